@@ -0,0 +1,629 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../src/definitions.h"
+#include "../src/scene.h"
+#include "../src/utility.h"
+#include "../src/parser.h"
+#include "../src/render.h"
+#include "../src/memory_report.h"
+#include "../src/obj_import.h"
+#include "scene_generator.h"
+
+#ifndef RAYTRACER_EXAMPLES_DIR
+#define RAYTRACER_EXAMPLES_DIR "Examples"
+#endif
+
+/*
+    Microbenchmarks for the renderer's hot paths. Every benchmark is run once to warm up and then
+    'repetitions' times; the JSON report holds the median and 95th percentile of those runs.
+
+    Usage:
+    SimpleRayTracerBench [--repetitions N] [--filter text] [--output results.json] [--examples dir]
+    SimpleRayTracerBench --generate-scene out.txt [--spheres N] [--triangles M] [--instanced] [--lights K] [--glass L] [--shapes N] [--shapes-as-faces] [--imsize W H] [--seed S]
+
+    Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+*/
+
+struct BenchmarkResult
+{
+    std::string name;
+    std::vector<std::pair<std::string, double>> parameters;
+    double items; // Work per run, e.g. rays traced
+    std::vector<double> seconds;
+    std::vector<std::pair<std::string, size_t>> memory; // Bytes by category, for benchmarks that track memory
+};
+
+struct BenchmarkSettings
+{
+    unsigned int repetitions = 10;
+    std::string filter;
+};
+
+/*
+    Value below which the given fraction of sorted samples fall, interpolated between neighbours
+*/
+double percentile(std::vector<double> samples, double fraction)
+{
+    std::sort(samples.begin(), samples.end());
+    double position = fraction * (samples.size() - 1);
+    size_t lower = static_cast<size_t>(position);
+    size_t upper = std::min(lower + 1, samples.size() - 1);
+    return samples[lower] + (samples[upper] - samples[lower]) * (position - lower);
+}
+
+/**
+ * @brief Times body() once per repetition after one warm up run
+ * @param results Receives the timings
+ * @param settings Repetitions and name filter
+ * @param name Benchmark name
+ * @param parameters Scale of the benchmark, reported alongside the timings
+ * @param items Work done by one call of body
+ * @param body The code to time
+**/
+void run_benchmark(std::vector<BenchmarkResult>& results, BenchmarkSettings& settings, std::string name,
+    std::vector<std::pair<std::string, double>> parameters, double items, std::function<void()> body)
+{
+    if (!settings.filter.empty() && name.find(settings.filter) == std::string::npos) {
+        return;
+    }
+    BenchmarkResult result = { .name = name, .parameters = parameters, .items = items, .seconds = {}, .memory = {} };
+    body();
+    for (unsigned int i = 0; i < settings.repetitions; i++) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        result.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::cerr << name;
+    for (auto& [key, value] : parameters) {
+        std::cerr << " " << key << "=" << value;
+    }
+    std::cerr << ": median " << percentile(result.seconds, 0.5) * 1e3 << " ms" << std::endl;
+    results.push_back(result);
+}
+
+void write_json(std::ostream& out, std::vector<BenchmarkResult>& results, BenchmarkSettings& settings)
+{
+    out << "{\n  \"repetitions\": " << settings.repetitions << ",\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        BenchmarkResult& result = results[i];
+        double median = percentile(result.seconds, 0.5);
+        out << (i > 0 ? "," : "") << "\n    {\"name\": \"" << result.name << "\", \"parameters\": {";
+        for (size_t k = 0; k < result.parameters.size(); k++) {
+            out << (k > 0 ? ", " : "") << "\"" << result.parameters[k].first << "\": " << result.parameters[k].second;
+        }
+        out << "}, \"items\": " << result.items
+            << ", \"median_s\": " << median
+            << ", \"p95_s\": " << percentile(result.seconds, 0.95)
+            << ", \"min_s\": " << *std::min_element(result.seconds.begin(), result.seconds.end())
+            << ", \"items_per_s\": " << (median > 0 ? result.items / median : 0.0);
+        if (!result.memory.empty()) {
+            out << ", \"memory_bytes\": {";
+            for (size_t k = 0; k < result.memory.size(); k++) {
+                out << (k > 0 ? ", " : "") << "\"" << result.memory[k].first << "\": " << result.memory[k].second;
+            }
+            out << "}";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}" << std::endl;
+}
+
+/*
+    Parses a generated scene into the parser and builds its state with 'accel'
+*/
+void load_generated_scene(SceneGeneratorOptions options, SceneParser& parser, AccelType accel = ACCEL_AUTO)
+{
+    std::istringstream scene(generate_scene(options));
+    std::string line;
+    while (std::getline(scene, line)) {
+        parser.parse_line(line);
+    }
+    parser.state.settings.accel = accel;
+    parser.state.settings.threads = 1; // Renders are timed on one thread
+    build_scene(parser.state);
+}
+
+/*
+    Parses a scene file into the parser, from the file's directory so its texture paths resolve, and builds its state.
+    Returns false, with the error printed to stderr, for scenes that cannot be loaded (e.g. textures not fetched from Git LFS).
+*/
+bool load_scene_file(std::filesystem::path path, SceneParser& parser)
+{
+    std::filesystem::path working_directory = std::filesystem::current_path();
+    bool loaded = false;
+    try
+    {
+        std::filesystem::current_path(path.parent_path());
+        loaded = parser.parse_file(path.filename().string()) && parser.width > 0 && parser.height > 0;
+        if (loaded) {
+            parser.state.settings.threads = 1;
+            build_scene(parser.state);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Skipping '" << path.string() << "': " << e.what() << std::endl;
+    }
+    std::filesystem::current_path(working_directory);
+    return loaded;
+}
+
+/*
+    Unit rays from the camera at the origin spread over its 60 degree view of -z
+*/
+std::vector<Vector3> camera_rays(size_t count, unsigned int seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> spread(-0.55f, 0.55f);
+    std::vector<Vector3> rays(count);
+    for (Vector3& ray : rays) {
+        ray = Vector3({ spread(random), spread(random) * 0.75f, -1.0f }).norm();
+    }
+    return rays;
+}
+
+/*
+    Closest hit along the ray, as chosen for primary rays in create_view_window_and_ray_trace
+*/
+bool closest_hit(SceneState& scene, Vector3 origin, Vector3 ray, SceneObjectInfo*& object_info, Intersection& hit)
+{
+    float min_distance = std::numeric_limits<float>::max();
+    object_info = nullptr;
+    for (auto& object_intersections : TraceRay(scene, origin, ray)) {
+        for (auto& intersection : object_intersections.intersections) {
+            if (intersection.distance > 0.0f && intersection.distance < min_distance) {
+                min_distance = intersection.distance;
+                object_info = object_intersections.object_info;
+                hit = intersection;
+            }
+        }
+    }
+    return object_info != nullptr;
+}
+
+int generate_scene_file(int argc, char* argv[])
+{
+    SceneGeneratorOptions options;
+    std::string path = argv[2];
+    for (int i = 3; i < argc; i++) {
+        std::string option{argv[i]};
+        try
+        {
+            if (option == "--spheres" && i + 1 < argc) {
+                options.spheres = std::stoi(argv[++i]);
+            } else if (option == "--triangles" && i + 1 < argc) {
+                options.triangles = std::stoi(argv[++i]);
+            } else if (option == "--instanced") {
+                options.instanced = true;
+            } else if (option == "--lights" && i + 1 < argc) {
+                options.lights = std::stoi(argv[++i]);
+            } else if (option == "--glass" && i + 1 < argc) {
+                options.glass_layers = std::stoi(argv[++i]);
+            } else if (option == "--shapes" && i + 1 < argc) {
+                options.shapes = std::stoi(argv[++i]);
+            } else if (option == "--shapes-as-faces") {
+                options.shapes_as_faces = true;
+            } else if (option == "--imsize" && i + 2 < argc) {
+                options.width = std::stoi(argv[++i]);
+                options.height = std::stoi(argv[++i]);
+            } else if (option == "--seed" && i + 1 < argc) {
+                options.seed = std::stoi(argv[++i]);
+            } else {
+                throw std::invalid_argument("Unknown option.");
+            }
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            std::cout << "ERROR: Invalid option '" << option << "'. Please verify." << std::endl;
+            return 1;
+        }
+    }
+    std::ofstream output(path);
+    if (!output.is_open()) {
+        std::cout << "ERROR: Unable to write '" << path << "'. Please verify path." << std::endl;
+        return 1;
+    }
+    output << generate_scene(options);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2 && std::string(argv[1]) == "--generate-scene") {
+        return generate_scene_file(argc, argv);
+    }
+
+    BenchmarkSettings settings;
+    std::string output_path;
+    std::filesystem::path examples_dir = RAYTRACER_EXAMPLES_DIR;
+    for (int i = 1; i < argc; i++) {
+        std::string option{argv[i]};
+        if (option == "--repetitions" && i + 1 < argc) {
+            settings.repetitions = std::max(1, std::stoi(argv[++i]));
+        } else if (option == "--filter" && i + 1 < argc) {
+            settings.filter = argv[++i];
+        } else if (option == "--output" && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (option == "--examples" && i + 1 < argc) {
+            examples_dir = argv[++i];
+        } else {
+            std::cout << "ERROR: Invalid option '" << option << "'. Please verify." << std::endl;
+            return 1;
+        }
+    }
+
+    std::filesystem::path scratch = std::filesystem::temp_directory_path() / "simple_raytracer_bench";
+    std::filesystem::create_directories(scratch);
+    std::vector<BenchmarkResult> results;
+    const size_t ray_count = 4096;
+    std::vector<Vector3> rays = camera_rays(ray_count, 7);
+    Vector3 origin = { 0.0f, 0.0f, 0.0f };
+
+    /*
+        Parsing: scene file commands, and OBJ import
+    */
+    for (unsigned int triangles : { 2000u, 20000u }) {
+        SceneGeneratorOptions options = { .spheres = 100, .triangles = triangles };
+        std::string text = generate_scene(options);
+        double lines = static_cast<double>(std::count(text.begin(), text.end(), '\n'));
+        run_benchmark(results, settings, "parse_scene", { { "triangles", triangles }, { "lines", lines } }, lines, [&]() {
+            SceneParser parser;
+            std::istringstream scene(text);
+            std::string line;
+            while (std::getline(scene, line)) {
+                parser.parse_line(line);
+            }
+        });
+    }
+    for (unsigned int cells : { 100u, 300u }) {
+        std::string path = (scratch / ("grid_" + std::to_string(cells) + ".obj")).string();
+        {
+            std::ofstream obj(path);
+            for (unsigned int i = 0; i <= cells; i++) {
+                for (unsigned int j = 0; j <= cells; j++) {
+                    obj << "v " << j << " " << (i * j) % 7 << " " << i << "\n";
+                }
+            }
+            for (unsigned int i = 0; i < cells; i++) {
+                for (unsigned int j = 0; j < cells; j++) {
+                    unsigned int a = i * (cells + 1) + j + 1;
+                    obj << "f " << a << " " << a + 1 << " " << a + cells + 2 << " " << a + cells + 1 << "\n";
+                }
+            }
+        }
+        double triangles = 2.0 * cells * cells;
+        run_benchmark(results, settings, "import_obj", { { "triangles", triangles } }, triangles, [&]() {
+            TextureCache cache;
+            SceneArena arena;
+            std::cout.setstate(std::ios::failbit); // Silence the import report
+            import_obj(path, std::thread::hardware_concurrency(), false, arena, cache);
+            std::cout.clear();
+        });
+    }
+
+    /*
+        Intersection: TraceRay testing every sphere and scene face, and the two level BVH over a mesh instance
+    */
+    for (unsigned int spheres : { 1u, 16u, 256u, 1024u }) {
+        SceneParser parser;
+        load_generated_scene({ .spheres = spheres }, parser, ACCEL_BRUTE);
+        run_benchmark(results, settings, "trace_spheres", { { "spheres", spheres } }, ray_count, [&]() {
+            for (Vector3& ray : rays) {
+                TraceRay(parser.state, origin, ray);
+            }
+        });
+    }
+    for (unsigned int triangles : { 32u, 512u, 2048u }) {
+        SceneParser parser;
+        load_generated_scene({ .triangles = triangles }, parser, ACCEL_BRUTE);
+        double faces = static_cast<double>(parser.state.scene_mesh.triangles.size());
+        run_benchmark(results, settings, "trace_faces", { { "triangles", faces } }, ray_count, [&]() {
+            for (Vector3& ray : rays) {
+                TraceRay(parser.state, origin, ray);
+            }
+        });
+        run_benchmark(results, settings, "triangle_intersection", { { "triangles", faces } }, ray_count * faces, [&]() {
+            Intersection hit;
+            for (Vector3& ray : rays) {
+                WatertightRay face_ray(origin, ray);
+                for (uint32_t i = 0; i < parser.state.scene_mesh.triangles.size(); i++) {
+                    intersect_face(&parser.state.scene_mesh, i, face_ray, hit);
+                }
+            }
+        });
+    }
+    for (unsigned int triangles : { 2048u, 32768u, 524288u }) {
+        SceneParser parser;
+        load_generated_scene({ .triangles = triangles, .instanced = true }, parser);
+        double mesh_triangles = static_cast<double>(parser.state.meshes["field"]->triangles.size());
+        run_benchmark(results, settings, "trace_mesh_bvh", { { "triangles", mesh_triangles } }, ray_count, [&]() {
+            for (Vector3& ray : rays) {
+                TraceRay(parser.state, origin, ray);
+            }
+        });
+    }
+
+    /*
+        Accelerators: build time and TraceRay time of each one on evenly spread spheres and on a height field
+    */
+    std::vector<Vector3> accel_rays(rays.begin(), rays.begin() + ray_count / 8); // Brute force is slow on these scenes
+    for (SceneGeneratorOptions options : { SceneGeneratorOptions{ .spheres = 4096 }, SceneGeneratorOptions{ .triangles = 8192 } }) {
+        SceneParser parser;
+        load_generated_scene(options, parser);
+        double primitives = static_cast<double>(parser.state.primitives.size());
+        for (int type = ACCEL_BRUTE; type < ACCEL_TYPE_COUNT; type++) {
+            std::vector<std::pair<std::string, double>> parameters = { { "accel", type }, { "spheres", options.spheres }, { "primitives", primitives } };
+            run_benchmark(results, settings, "accel_build", parameters, primitives, [&]() {
+                build_accelerator(parser.state, static_cast<AccelType>(type));
+            });
+            build_accelerator(parser.state, static_cast<AccelType>(type));
+            run_benchmark(results, settings, "accel_trace", parameters, static_cast<double>(accel_rays.size()), [&]() {
+                for (Vector3& ray : accel_rays) {
+                    TraceRay(parser.state, origin, ray);
+                }
+            });
+        }
+    }
+
+    /*
+        Shapes: TraceRay on boxes over a floor, as analytic 'box' and 'plane' commands and as faces
+    */
+    for (bool faces : { false, true }) {
+        SceneParser parser;
+        load_generated_scene({ .shapes = 2048, .shapes_as_faces = faces }, parser, ACCEL_BVH);
+        run_benchmark(results, settings, "shapes_trace", { { "faces", faces }, { "primitives", static_cast<double>(parser.state.primitives.size()) } },
+            static_cast<double>(accel_rays.size()), [&]() {
+            for (Vector3& ray : accel_rays) {
+                TraceRay(parser.state, origin, ray);
+            }
+        });
+    }
+
+    /*
+        Shading: ShadeRay on precomputed primary hits, scaling lights and nested glass
+    */
+    auto shade_benchmark = [&](std::string name, std::pair<std::string, double> parameter, SceneGeneratorOptions options) {
+        SceneParser parser;
+        load_generated_scene(options, parser);
+        std::vector<std::pair<SceneObjectInfo*, Intersection>> hits;
+        for (Vector3& ray : rays) {
+            SceneObjectInfo* object_info;
+            Intersection hit;
+            if (closest_hit(parser.state, origin, ray, object_info, hit)) {
+                hits.push_back({ object_info, hit });
+            }
+        }
+        run_benchmark(results, settings, name, { parameter }, static_cast<double>(hits.size()), [&]() {
+            size_t k = 0;
+            for (Vector3& ray : rays) {
+                if (k == hits.size()) break;
+                auto& [object_info, hit] = hits[k++];
+                ShadeRay(parser.state, ray, object_info, hit, parser.state.background_refraction_index, object_info->material.refraction_index,
+                    { object_info }, RayState::ENTERING, parser.state.settings.recursion_depth, parser.background_color);
+            }
+        });
+    };
+    for (unsigned int lights : { 1u, 4u, 16u }) {
+        shade_benchmark("shade_lights", { "lights", lights }, { .spheres = 64, .lights = lights });
+    }
+    for (unsigned int layers : { 1u, 4u, 8u }) {
+        shade_benchmark("shade_glass", { "glass_layers", layers }, { .spheres = 16, .glass_layers = layers });
+    }
+
+    /*
+        Shading kernels: each Examples scene rendered small with the kernels specialized per material, then with the generic kernel
+    */
+    std::vector<std::filesystem::path> example_scenes;
+    if (std::filesystem::is_directory(examples_dir)) {
+        for (auto& entry : std::filesystem::recursive_directory_iterator(examples_dir)) {
+            if (entry.path().extension() == ".txt") {
+                example_scenes.push_back(entry.path());
+            }
+        }
+    }
+    std::sort(example_scenes.begin(), example_scenes.end());
+    for (std::filesystem::path& scene_path : example_scenes) {
+        std::string name = "shade_kernels/" + scene_path.stem().string();
+        if (!settings.filter.empty() && name.find(settings.filter) == std::string::npos) {
+            continue;
+        }
+        SceneParser parser;
+        if (!load_scene_file(scene_path, parser)) {
+            continue;
+        }
+        float height = 96.0f;
+        float width = std::round(height * parser.width / parser.height);
+        for (bool generic : { false, true }) {
+            parser.state.settings.generic_shading = generic;
+            assign_shade_kernels(parser.state);
+            run_benchmark(results, settings, name, { { "generic", generic }, { "width", width }, { "height", height } }, width * height, [&]() {
+                create_view_window_and_ray_trace(parser.state, parser.view_origin, parser.view_direction.norm(), parser.view_up.norm(),
+                    parser.fov_h, height, width, parser.background_color);
+            });
+        }
+    }
+
+    /*
+        Primary visibility: renders of triangle heavy scenes with camera rays ray traced, then rasterized
+    */
+    auto primary_benchmark = [&](std::string name, SceneParser& parser) {
+        double pixels = static_cast<double>(parser.width) * parser.height;
+        for (PrimaryVisibilityMode mode : { PRIMARY_RAYTRACE, PRIMARY_RASTER }) {
+            parser.state.settings.primary_visibility = mode;
+            run_benchmark(results, settings, name, { { "raster", mode == PRIMARY_RASTER }, { "width", parser.width }, { "height", parser.height } }, pixels, [&]() {
+                create_view_window_and_ray_trace(parser.state, parser.view_origin, parser.view_direction.norm(), parser.view_up.norm(),
+                    parser.fov_h, parser.height, parser.width, parser.background_color);
+            });
+        }
+    };
+    for (unsigned int triangles : { 2048u, 32768u }) {
+        std::string name = "primary_visibility/faces_" + std::to_string(triangles);
+        if (settings.filter.empty() || name.find(settings.filter) != std::string::npos) {
+            SceneParser parser;
+            load_generated_scene({ .spheres = 16, .triangles = triangles, .width = 320, .height = 240 }, parser);
+            primary_benchmark(name, parser);
+        }
+    }
+    {
+        SceneParser parser;
+        if ((settings.filter.empty() || std::string("primary_visibility/house").find(settings.filter) != std::string::npos)
+            && load_scene_file(examples_dir / "showcases" / "house.txt", parser)) {
+            primary_benchmark("primary_visibility/house", parser);
+        }
+    }
+
+    /*
+        Tile culling: renders of sparse spheres, a sparse scene of shapes over an infinite plane and a dense
+        one, with every tile traced (culling=0) and with tiles culled against their camera ray frustum (culling=1)
+    */
+    auto culling_benchmark = [&](std::string name, SceneParser& parser) {
+        double pixels = static_cast<double>(parser.width) * parser.height;
+        for (TileCullingMode culling : { TILE_CULLING_OFF, TILE_CULLING_ON }) {
+            parser.state.settings.tile_culling = culling;
+            run_benchmark(results, settings, name, { { "culling", culling }, { "width", parser.width }, { "height", parser.height } }, pixels, [&]() {
+                create_view_window_and_ray_trace(parser.state, parser.view_origin, parser.view_direction.norm(), parser.view_up.norm(),
+                    parser.fov_h, parser.height, parser.width, parser.background_color);
+            });
+        }
+    };
+    for (auto [scene, options] : { std::pair<std::string, SceneGeneratorOptions>{ "spheres", { .spheres = 64, .width = 320, .height = 240 } },
+        std::pair<std::string, SceneGeneratorOptions>{ "shapes", { .shapes = 32, .width = 320, .height = 240 } },
+        std::pair<std::string, SceneGeneratorOptions>{ "dense", { .spheres = 256, .triangles = 1024, .width = 320, .height = 240 } } }) {
+        std::string name = "tile_culling/" + scene;
+        if (settings.filter.empty() || name.find(settings.filter) != std::string::npos) {
+            SceneParser parser;
+            load_generated_scene(options, parser);
+            culling_benchmark(name, parser);
+        }
+    }
+
+    /*
+        Memory: a render of each scene, reporting the scene's footprint by category and the peaks of the
+        render's framebuffers and temporary buffers, so memory regressions show up next to the timings
+    */
+    auto memory_benchmark = [&](std::string name, SceneParser& parser) {
+        size_t count = results.size();
+        memory_ledger.reset_peaks();
+        run_benchmark(results, settings, name, { { "width", parser.width }, { "height", parser.height } }, static_cast<double>(parser.width) * parser.height, [&]() {
+            Framebuffer radiance = create_view_window_and_ray_trace(parser.state, parser.view_origin, parser.view_direction.norm(), parser.view_up.norm(),
+                parser.fov_h, parser.height, parser.width, parser.background_color);
+            tone_map_to_image(radiance, TONEMAP_CLAMP, false);
+        });
+        if (results.size() > count) {
+            MemoryFootprint footprint = measure_memory(parser.state);
+            for (int category = 0; category < MEMORY_CATEGORY_COUNT; category++) {
+                results.back().memory.push_back({ memory_category_names[category], footprint.bytes[category] });
+            }
+            results.back().memory.push_back({ "total", footprint.total() });
+            results.back().memory.push_back({ "peak_rss", footprint.peak_rss });
+        }
+    };
+    if (settings.filter.empty() || std::string("memory_footprint/faces_32768").find(settings.filter) != std::string::npos) {
+        SceneParser parser;
+        load_generated_scene({ .spheres = 16, .triangles = 32768, .width = 320, .height = 240 }, parser);
+        memory_benchmark("memory_footprint/faces_32768", parser);
+    }
+    if (settings.filter.empty() || std::string("memory_footprint/instanced").find(settings.filter) != std::string::npos) {
+        SceneParser parser;
+        load_generated_scene({ .spheres = 32, .triangles = 32768, .instanced = true, .lights = 2, .width = 320, .height = 240 }, parser);
+        memory_benchmark("memory_footprint/instanced", parser);
+    }
+    {
+        SceneParser parser;
+        if ((settings.filter.empty() || std::string("memory_footprint/house").find(settings.filter) != std::string::npos)
+            && load_scene_file(examples_dir / "showcases" / "house.txt", parser)) {
+            memory_benchmark("memory_footprint/house", parser);
+        }
+    }
+
+    /*
+        Textures: indexing a file with read_texture, and sampling through the tile cache
+    */
+    for (unsigned int size : { 256u, 1024u }) {
+        std::string p3_path = (scratch / ("texture_" + std::to_string(size) + ".ppm")).string();
+        std::string p6_path = (scratch / ("texture_" + std::to_string(size) + "_binary.ppm")).string();
+        {
+            std::ofstream p3(p3_path);
+            std::ofstream p6(p6_path, std::ios::binary);
+            p3 << "P3\n" << size << " " << size << "\n255\n";
+            p6 << "P6\n" << size << " " << size << "\n255\n";
+            for (unsigned int i = 0; i < size * size * 3; i++) {
+                p3 << (i * 37) % 256 << ((i % 12 == 11) ? "\n" : " ");
+                p6.put(static_cast<char>((i * 37) % 256));
+            }
+        }
+        double texels = static_cast<double>(size) * size;
+        run_benchmark(results, settings, "read_texture", { { "size", size } }, texels, [&]() {
+            TextureCache cache;
+            SceneArena arena;
+            read_texture(p3_path, arena, cache);
+        });
+
+        TextureCache cache;
+        SceneArena arena;
+        Texture* texture = read_texture(p6_path, arena, cache);
+        std::mt19937 random(3);
+        std::vector<std::pair<size_t, size_t>> coordinates(1 << 16);
+        for (auto& [x, y] : coordinates) {
+            x = random() % size;
+            y = random() % size;
+        }
+        for (TextureCompression compression : { TEXTURE_COMPRESSION_NONE, TEXTURE_COMPRESSION_BC1 }) {
+            cache.release(texture);
+            cache.set_compression(compression);
+            run_benchmark(results, settings, "texture_sample", { { "size", size }, { "compression", static_cast<double>(compression) } }, static_cast<double>(coordinates.size()), [&]() {
+                byte texel[3];
+                for (auto& [x, y] : coordinates) {
+                    texture->fetch(x, y, texel);
+                }
+            });
+        }
+    }
+
+    /*
+        Output: writing a P3 image, and an end to end render of a mixed scene
+    */
+    for (unsigned int width : { 320u, 1280u }) {
+        unsigned int height = width * 3 / 4;
+        Mat3D image(height, width, 3, 0);
+        for (unsigned int i = 0; i < height; i++) {
+            for (unsigned int j = 0; j < width; j++) {
+                image(i, j, 0) = (i + j) % 256;
+                image(i, j, 1) = (i * 3) % 256;
+                image(i, j, 2) = (j * 5) % 256;
+            }
+        }
+        std::string path = (scratch / "image.ppm").string();
+        double pixels = static_cast<double>(width) * height;
+        run_benchmark(results, settings, "image_output", { { "width", width }, { "height", height } }, pixels, [&]() {
+            write_ppm(path, image, height, width);
+        });
+    }
+    {
+        SceneParser parser;
+        load_generated_scene({ .spheres = 32, .triangles = 2048, .instanced = true, .lights = 2, .glass_layers = 2 }, parser);
+        double pixels = static_cast<double>(parser.width) * parser.height;
+        run_benchmark(results, settings, "render", { { "width", parser.width }, { "height", parser.height } }, pixels, [&]() {
+            create_view_window_and_ray_trace(parser.state, parser.view_origin, parser.view_direction.norm(), parser.view_up.norm(),
+                parser.fov_h, parser.height, parser.width, parser.background_color);
+        });
+    }
+    std::filesystem::remove_all(scratch);
+
+    if (output_path.empty()) {
+        write_json(std::cout, results, settings);
+    } else {
+        std::ofstream output(output_path);
+        write_json(output, results, settings);
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <string>
+
+/*
+    Options for a procedurally generated stress scene. The camera sits at the origin looking down -z,
+    and all geometry is placed inside its view.
+*/
+struct SceneGeneratorOptions
+{
+    unsigned int spheres = 0; // Randomly placed opaque spheres
+    unsigned int triangles = 0; // Approximate triangle count of a tessellated height field
+    bool instanced = false; // Put the height field in a 'beginmesh' block placed with 'instance' instead of scene faces
+    unsigned int lights = 1; // Point lights spread on a ring above the camera
+    unsigned int glass_layers = 0; // Nested transparent spheres in the middle of the view
+    unsigned int shapes = 0; // Random boxes (every other one turned about y), cylinders and disks over an infinite floor 'plane'
+    bool shapes_as_faces = false; // Write the boxes as 12 faces each and the floor as two large ones, for comparison
+    unsigned int width = 64;
+    unsigned int height = 48;
+    unsigned int seed = 1;
+};
+
+/**
+ * @brief Writes a scene file for the given options
+ * @returns The scene file's text
+ * @param options What the scene contains
+**/
+std::string generate_scene(SceneGeneratorOptions options)
+{
+    std::mt19937 random(options.seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::ostringstream scene;
+    unsigned int vertex_count = 0; // 'v' lines so far, for face indices
+
+    scene << "eye 0 0 0\n";
+    scene << "viewdir 0 0 -1\n";
+    scene << "updir 0 1 0\n";
+    scene << "hfov 60\n";
+    scene << "imsize " << options.width << " " << options.height << "\n";
+    scene << "bkgcolor 0.1 0.1 0.1 1\n";
+
+    for (unsigned int i = 0; i < options.lights; i++) {
+        float angle = 2.0f * static_cast<float>(M_PI) * i / std::max(1u, options.lights);
+        scene << "light " << 4.0f * std::cos(angle) << " 4 " << -6.0f + 4.0f * std::sin(angle) << " 1 "
+            << 1.0f / options.lights << " " << 1.0f / options.lights << " " << 1.0f / options.lights << "\n";
+    }
+
+    for (unsigned int i = 0; i < options.spheres; i++) {
+        scene << "mtlcolor " << unit(random) << " " << unit(random) << " " << unit(random) << " 1 1 1 0.1 0.7 0.2 20\n";
+        scene << "sphere " << -4.0f + 8.0f * unit(random) << " " << -3.0f + 6.0f * unit(random) << " "
+            << -6.0f - 8.0f * unit(random) << " " << 0.1f + 0.3f * unit(random) << "\n";
+    }
+
+    for (unsigned int i = 0; i < options.glass_layers; i++) {
+        float radius = 1.5f * (options.glass_layers - i) / options.glass_layers;
+        scene << "mtlcolor 0.9 0.9 1 1 1 1 0.05 0.2 0.5 60 0.2 " << 1.3f + 0.1f * (i % 3) << "\n";
+        scene << "sphere 0 0 -6 " << radius << "\n";
+    }
+
+    if (options.triangles > 0) {
+        // Height field of quads, two triangles each, with per vertex normals
+        unsigned int cells = std::max(1u, static_cast<unsigned int>(std::sqrt(options.triangles / 2.0)));
+        for (unsigned int i = 0; i <= cells; i++) {
+            for (unsigned int j = 0; j <= cells; j++) {
+                float x = -5.0f + 10.0f * j / cells;
+                float z = -4.0f - 10.0f * i / cells;
+                float y = -2.0f + 0.3f * std::sin(x * 2.0f) * std::cos(z * 2.0f);
+                scene << "v " << x << " " << y << " " << z << "\n";
+                scene << "vn " << -0.6f * std::cos(x * 2.0f) * std::cos(z * 2.0f) << " 1 "
+                    << 0.6f * std::sin(x * 2.0f) * std::sin(z * 2.0f) << "\n";
+            }
+        }
+        scene << "mtlcolor 0.4 0.8 0.4 1 1 1 0.1 0.8 0.1 10\n";
+        if (options.instanced) {
+            scene << "beginmesh field\n";
+        }
+        for (unsigned int i = 0; i < cells; i++) {
+            for (unsigned int j = 0; j < cells; j++) {
+                unsigned int a = i * (cells + 1) + j + 1;
+                unsigned int b = a + 1;
+                unsigned int c = a + cells + 1;
+                unsigned int e = c + 1;
+                scene << "f " << a << "//" << a << " " << c << "//" << c << " " << b << "//" << b << "\n";
+                scene << "f " << b << "//" << b << " " << c << "//" << c << " " << e << "//" << e << "\n";
+            }
+        }
+        if (options.instanced) {
+            scene << "endmesh\n";
+            scene << "instance field 1 0 0 0 0 1 0 0 0 0 1 0\n";
+        }
+        vertex_count += (cells + 1) * (cells + 1);
+    }
+
+    if (options.shapes > 0) {
+        scene << "mtlcolor 0.6 0.6 0.6 1 1 1 0.1 0.8 0.1 10\n";
+        if (options.shapes_as_faces) {
+            scene << "v -40 -3 20\nv 40 -3 20\nv 40 -3 -60\nv -40 -3 -60\n";
+            scene << "f " << vertex_count + 1 << " " << vertex_count + 2 << " " << vertex_count + 3 << "\n";
+            scene << "f " << vertex_count + 1 << " " << vertex_count + 3 << " " << vertex_count + 4 << "\n";
+            vertex_count += 4;
+        } else {
+            scene << "plane 0 -3 0 0 1 0\n";
+        }
+    }
+    for (unsigned int i = 0; i < options.shapes; i++) {
+        scene << "mtlcolor " << unit(random) << " " << unit(random) << " " << unit(random) << " 1 1 1 0.1 0.7 0.2 20\n";
+        float x = -4.0f + 8.0f * unit(random), y = -3.0f + 6.0f * unit(random), z = -6.0f - 8.0f * unit(random);
+        float size = 0.1f + 0.3f * unit(random);
+        float angle = i % 4 == 1 ? 90.0f * unit(random) : 0.0f;
+        if (i % 4 == 2) {
+            scene << "cylinder " << x << " " << y - size << " " << z << " " << x + 0.5f * size << " " << y + size << " " << z << " " << 0.5f * size << "\n";
+        } else if (i % 4 == 3) {
+            scene << "disk " << x << " " << y << " " << z << " " << unit(random) - 0.5f << " 1 " << unit(random) - 0.5f << " " << size << "\n";
+        } else if (options.shapes_as_faces) {
+            // Corners (+-1, +-1, +-1) of the box turned about y, wound anticlockwise seen from outside
+            float c = std::cos(angle * static_cast<float>(M_PI) / 180.0f), s = std::sin(angle * static_cast<float>(M_PI) / 180.0f);
+            for (int corner = 0; corner < 8; corner++) {
+                float cx = (corner & 1) ? size : -size, cy = (corner & 2) ? size : -size, cz = (corner & 4) ? size : -size;
+                scene << "v " << x + c * cx + s * cz << " " << y + cy << " " << z - s * cx + c * cz << "\n";
+            }
+            const int quads[6][4] = { { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 2, 3, 1 }, { 4, 5, 7, 6 } };
+            for (const int* quad : quads) {
+                scene << "f " << vertex_count + quad[0] + 1 << " " << vertex_count + quad[1] + 1 << " " << vertex_count + quad[2] + 1 << "\n";
+                scene << "f " << vertex_count + quad[0] + 1 << " " << vertex_count + quad[2] + 1 << " " << vertex_count + quad[3] + 1 << "\n";
+            }
+            vertex_count += 8;
+        } else {
+            scene << "box " << x - size << " " << y - size << " " << z - size << " " << x + size << " " << y + size << " " << z + size;
+            if (angle != 0.0f) {
+                scene << " 0 1 0 " << angle;
+            }
+            scene << "\n";
+        }
+    }
+
+    return scene.str();
+}
@@ -0,0 +1,588 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "definitions.h"
+#include "bvh.h"
+#include "stats.h"
+
+/*
+    Spatial indexes over the top level primitives of the scene (spheres, shapes, scene faces and mesh instances),
+    selected with '--accel'. TraceRay asks the accelerator for the primitives a ray may hit and only tests those.
+    ACCEL_AUTO picks one from the scene's statistics with choose_accelerator().
+*/
+enum AccelType { ACCEL_AUTO, ACCEL_BRUTE, ACCEL_GRID, ACCEL_KDTREE, ACCEL_BVH, ACCEL_TYPE_COUNT };
+
+inline const char* accel_names[ACCEL_TYPE_COUNT] = { "auto", "brute", "grid", "kd", "bvh" };
+
+class Accelerator
+{
+public:
+    virtual ~Accelerator() = default;
+
+    virtual AccelType type() = 0;
+
+    /*
+        Indexes the given primitive bounds. Primitive indices are positions in this list.
+    */
+    virtual void build(std::vector<AABB>& bounds) = 0;
+
+    /*
+        Appends, in ascending order and without repeats, every primitive whose bounds the ray may cross in front
+        of its origin. Keeping the order of the primitive list makes the result independent of the accelerator.
+    */
+    virtual void candidates(Vector3 origin, Vector3 ray, std::vector<uint32_t>& out) = 0;
+
+    /*
+        Bytes held by the index
+    */
+    virtual size_t memory_usage() = 0;
+};
+
+/*
+    Writable component of a vector, axis 0, 1 or 2 for x, y or z
+*/
+inline float& coordinate(Vector3& v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+/*
+    Component-wise reciprocal of a ray direction, for slab tests
+*/
+inline Vector3 inverse_direction(Vector3 ray)
+{
+    return { 1.0f / ray.x, 1.0f / ray.y, 1.0f / ray.z };
+}
+
+inline void sort_candidates(std::vector<uint32_t>& out, size_t first)
+{
+    std::sort(out.begin() + first, out.end());
+    out.erase(std::unique(out.begin() + first, out.end()), out.end());
+}
+
+/*
+    Tests every primitive, as the renderer did before it had a top level index. Cheapest for a handful of primitives.
+*/
+class BruteForceAccelerator : public Accelerator
+{
+private:
+    uint32_t m_count = 0;
+
+public:
+    AccelType type() override
+    {
+        return ACCEL_BRUTE;
+    }
+
+    void build(std::vector<AABB>& bounds) override
+    {
+        m_count = static_cast<uint32_t>(bounds.size());
+    }
+
+    void candidates(Vector3, Vector3, std::vector<uint32_t>& out) override
+    {
+        for (uint32_t i = 0; i < m_count; i++) {
+            out.push_back(i);
+        }
+    }
+
+    size_t memory_usage() override
+    {
+        return sizeof(*this);
+    }
+};
+
+/*
+    Cells per axis for a uniform grid of about 'density' cells per primitive over the box. Axes along which the
+    box is flat get a single cell, so a planar scene is divided in 2D rather than squeezed into thin slabs.
+*/
+inline void grid_resolution(AABB box, size_t primitives, float density, int max_resolution, int resolution[3])
+{
+    Vector3 extent = box.max - box.min;
+    float largest = std::max(extent.x, std::max(extent.y, extent.z));
+    float volume = 1.0f;
+    int dimensions = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] > largest * 1e-3f) {
+            volume *= extent[axis];
+            dimensions++;
+        }
+    }
+    float cells_per_unit = dimensions == 0 ? 0.0f : std::pow(density * primitives / volume, 1.0f / dimensions);
+    for (int axis = 0; axis < 3; axis++) {
+        bool flat = !(extent[axis] > largest * 1e-3f);
+        int cells = flat ? 1 : static_cast<int>(std::round(extent[axis] * cells_per_unit));
+        resolution[axis] = std::clamp(cells, 1, max_resolution);
+    }
+}
+
+/*
+    Uniform grid with the primitives of each cell stored contiguously. Rays walk the cells they cross with a 3D DDA
+    (Amanatides and Woo). Suits many primitives of similar size spread evenly through the scene.
+*/
+class GridAccelerator : public Accelerator
+{
+private:
+    static constexpr float density = 3.0f; // Cells per primitive
+    static const int max_resolution = 256;
+
+    AABB m_bounds;
+    Vector3 m_cell_size;
+    Vector3 m_inverse_cell_size;
+    int m_resolution[3] = { 1, 1, 1 };
+    std::vector<uint32_t> m_cell_start; // Cell c holds m_cell_items[m_cell_start[c]] up to m_cell_start[c + 1]
+    std::vector<uint32_t> m_cell_items;
+
+    int cell_index(int x, int y, int z)
+    {
+        return (z * m_resolution[1] + y) * m_resolution[0] + x;
+    }
+
+    int cell_coordinate(float position, int axis)
+    {
+        int cell = static_cast<int>((position - m_bounds.min[axis]) * m_inverse_cell_size[axis]);
+        return std::clamp(cell, 0, m_resolution[axis] - 1);
+    }
+
+public:
+    AccelType type() override
+    {
+        return ACCEL_GRID;
+    }
+
+    void build(std::vector<AABB>& bounds) override
+    {
+        m_bounds = AABB();
+        for (AABB& box : bounds) {
+            m_bounds.extend(box);
+        }
+        m_cell_start.assign(2, 0);
+        m_cell_items.clear();
+        if (bounds.empty()) {
+            return;
+        }
+
+        grid_resolution(m_bounds, bounds.size(), density, max_resolution, m_resolution);
+        for (int axis = 0; axis < 3; axis++) {
+            float extent = m_bounds.max[axis] - m_bounds.min[axis];
+            coordinate(m_cell_size, axis) = extent / m_resolution[axis];
+            coordinate(m_inverse_cell_size, axis) = extent > 0.0f ? m_resolution[axis] / extent : 0.0f;
+        }
+
+        // Count the primitives overlapping each cell, then place them with a prefix sum
+        size_t cell_count = static_cast<size_t>(m_resolution[0]) * m_resolution[1] * m_resolution[2];
+        m_cell_start.assign(cell_count + 1, 0);
+        for (int pass = 0; pass < 2; pass++) {
+            for (uint32_t primitive = 0; primitive < bounds.size(); primitive++) {
+                int lower[3], upper[3];
+                for (int axis = 0; axis < 3; axis++) {
+                    lower[axis] = cell_coordinate(bounds[primitive].min[axis], axis);
+                    upper[axis] = cell_coordinate(bounds[primitive].max[axis], axis);
+                }
+                for (int z = lower[2]; z <= upper[2]; z++) {
+                    for (int y = lower[1]; y <= upper[1]; y++) {
+                        for (int x = lower[0]; x <= upper[0]; x++) {
+                            int cell = cell_index(x, y, z);
+                            if (pass == 0) {
+                                m_cell_start[cell + 1]++;
+                            } else {
+                                m_cell_items[m_cell_start[cell]++] = primitive;
+                            }
+                        }
+                    }
+                }
+            }
+            if (pass == 0) {
+                for (size_t cell = 0; cell < cell_count; cell++) {
+                    m_cell_start[cell + 1] += m_cell_start[cell];
+                }
+                m_cell_items.resize(m_cell_start[cell_count]);
+            } else {
+                // Filling advanced every start to the next cell's start
+                for (size_t cell = cell_count; cell > 0; cell--) {
+                    m_cell_start[cell] = m_cell_start[cell - 1];
+                }
+                m_cell_start[0] = 0;
+            }
+        }
+    }
+
+    void candidates(Vector3 origin, Vector3 ray, std::vector<uint32_t>& out) override
+    {
+        float t_near, t_far;
+        if (m_cell_items.empty() || !m_bounds.intersect(origin, inverse_direction(ray), t_near, t_far)) {
+            return;
+        }
+        size_t first = out.size();
+
+        // Cell the ray enters at, and the distance to the next cell boundary along each axis
+        Vector3 entry = origin + (ray * t_near);
+        int cell[3], step[3];
+        float t_next[3], t_delta[3];
+        for (int axis = 0; axis < 3; axis++) {
+            cell[axis] = cell_coordinate(entry[axis], axis);
+            float direction = ray[axis];
+            if (direction > 0.0f) {
+                step[axis] = 1;
+                t_delta[axis] = m_cell_size[axis] / direction;
+                t_next[axis] = (m_bounds.min[axis] + (cell[axis] + 1) * m_cell_size[axis] - origin[axis]) / direction;
+            } else if (direction < 0.0f) {
+                step[axis] = -1;
+                t_delta[axis] = -m_cell_size[axis] / direction;
+                t_next[axis] = (m_bounds.min[axis] + cell[axis] * m_cell_size[axis] - origin[axis]) / direction;
+            } else {
+                step[axis] = 0;
+                t_delta[axis] = std::numeric_limits<float>::max();
+                t_next[axis] = std::numeric_limits<float>::max();
+            }
+        }
+
+        while (true) {
+            STATS_COUNT(node_visits);
+            int index = cell_index(cell[0], cell[1], cell[2]);
+            out.insert(out.end(), m_cell_items.begin() + m_cell_start[index], m_cell_items.begin() + m_cell_start[index + 1]);
+
+            int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            if (t_next[axis] > t_far) {
+                break;
+            }
+            cell[axis] += step[axis];
+            if (cell[axis] < 0 || cell[axis] >= m_resolution[axis]) {
+                break;
+            }
+            t_next[axis] += t_delta[axis];
+        }
+        sort_candidates(out, first);
+    }
+
+    size_t memory_usage() override
+    {
+        return sizeof(*this) + m_cell_start.capacity() * sizeof(uint32_t) + m_cell_items.capacity() * sizeof(uint32_t);
+    }
+};
+
+struct KdNode
+{
+    float split;
+    uint32_t axis; // 0 to 2, or leaf_axis for leaves
+    uint32_t first; // Index of first item (leaf) or of the child below the split (interior). The child above is first + 1
+    uint32_t count; // Number of items in a leaf
+};
+
+/*
+    k-d tree with split planes chosen by a binned surface area heuristic. Primitives crossing a plane are referenced
+    from both sides, so empty space is cut away tightly; suits axis aligned architectural geometry.
+*/
+class KdTreeAccelerator : public Accelerator
+{
+private:
+    static const uint32_t leaf_axis = 3;
+    static const int bin_count = 32;
+    static constexpr int max_depth_limit = 48;
+    static constexpr float traversal_cost = 1.0f;
+    static constexpr float intersection_cost = 80.0f;
+    static constexpr float empty_bonus = 0.5f;
+
+    AABB m_bounds;
+    std::vector<KdNode> m_nodes;
+    std::vector<uint32_t> m_items;
+    int m_max_depth = 0;
+
+    void make_leaf(uint32_t node_index, std::vector<uint32_t>& primitives)
+    {
+        m_nodes[node_index] = { .split = 0.0f, .axis = leaf_axis, .first = static_cast<uint32_t>(m_items.size()), .count = static_cast<uint32_t>(primitives.size()) };
+        m_items.insert(m_items.end(), primitives.begin(), primitives.end());
+    }
+
+    void subdivide(uint32_t node_index, std::vector<uint32_t>& primitives, AABB node_bounds, std::vector<AABB>& bounds, int depth)
+    {
+        float count = static_cast<float>(primitives.size());
+        if (primitives.size() <= 1 || depth >= m_max_depth) {
+            make_leaf(node_index, primitives);
+            return;
+        }
+
+        // Cost of splitting at each bin boundary: primitives starting below the plane go below, those ending above go above
+        int best_axis = -1;
+        float best_split = 0.0f;
+        float best_cost = intersection_cost * count;
+        float inverse_area = 1.0f / node_bounds.surface_area();
+        Vector3 extent = node_bounds.max - node_bounds.min;
+        for (int axis = 0; axis < 3; axis++) {
+            float lower = node_bounds.min[axis];
+            if (!(extent[axis] > 0.0f)) {
+                continue;
+            }
+            uint32_t starts[bin_count] = { 0 };
+            uint32_t ends[bin_count] = { 0 };
+            float scale = bin_count / extent[axis];
+            for (uint32_t primitive : primitives) {
+                starts[std::clamp(static_cast<int>((bounds[primitive].min[axis] - lower) * scale), 0, bin_count - 1)]++;
+                ends[std::clamp(static_cast<int>((bounds[primitive].max[axis] - lower) * scale), 0, bin_count - 1)]++;
+            }
+            uint32_t below = 0;
+            uint32_t above = static_cast<uint32_t>(primitives.size());
+            for (int i = 1; i < bin_count; i++) {
+                below += starts[i - 1];
+                above -= ends[i - 1];
+                float split = lower + i / scale;
+                AABB below_box = node_bounds;
+                AABB above_box = node_bounds;
+                coordinate(below_box.max, axis) = split;
+                coordinate(above_box.min, axis) = split;
+                float bonus = (below == 0 || above == 0) ? empty_bonus : 0.0f;
+                float cost = traversal_cost + intersection_cost * (1.0f - bonus) * inverse_area
+                    * (below_box.surface_area() * below + above_box.surface_area() * above);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = split;
+                }
+            }
+        }
+
+        if (best_axis == -1) {
+            make_leaf(node_index, primitives);
+            return;
+        }
+
+        std::vector<uint32_t> below, above;
+        for (uint32_t primitive : primitives) {
+            if (bounds[primitive].min[best_axis] <= best_split) below.push_back(primitive);
+            if (bounds[primitive].max[best_axis] >= best_split) above.push_back(primitive);
+        }
+        if (below.size() == primitives.size() && above.size() == primitives.size()) {
+            make_leaf(node_index, primitives);
+            return;
+        }
+        std::vector<uint32_t>().swap(primitives);
+
+        uint32_t below_index = static_cast<uint32_t>(m_nodes.size());
+        m_nodes[node_index] = { .split = best_split, .axis = static_cast<uint32_t>(best_axis), .first = below_index, .count = 0 };
+        m_nodes.push_back({});
+        m_nodes.push_back({});
+        AABB below_bounds = node_bounds;
+        AABB above_bounds = node_bounds;
+        coordinate(below_bounds.max, best_axis) = best_split;
+        coordinate(above_bounds.min, best_axis) = best_split;
+        subdivide(below_index, below, below_bounds, bounds, depth + 1);
+        subdivide(below_index + 1, above, above_bounds, bounds, depth + 1);
+    }
+
+public:
+    AccelType type() override
+    {
+        return ACCEL_KDTREE;
+    }
+
+    void build(std::vector<AABB>& bounds) override
+    {
+        m_bounds = AABB();
+        m_nodes.clear();
+        m_items.clear();
+        if (bounds.empty()) {
+            return;
+        }
+        std::vector<uint32_t> primitives(bounds.size());
+        for (uint32_t i = 0; i < bounds.size(); i++) {
+            primitives[i] = i;
+            m_bounds.extend(bounds[i]);
+        }
+        // Depth limit suggested by Pharr, Jakob and Humphreys
+        m_max_depth = std::min(max_depth_limit, static_cast<int>(std::round(8.0f + 1.3f * std::log2(static_cast<float>(bounds.size())))));
+        m_nodes.push_back({});
+        subdivide(0, primitives, m_bounds, bounds, 0);
+        m_nodes.shrink_to_fit();
+        m_items.shrink_to_fit();
+    }
+
+    void candidates(Vector3 origin, Vector3 ray, std::vector<uint32_t>& out) override
+    {
+        Vector3 inverse_ray = inverse_direction(ray);
+        float t_near, t_far;
+        if (m_nodes.empty() || !m_bounds.intersect(origin, inverse_ray, t_near, t_far)) {
+            return;
+        }
+        size_t first = out.size();
+        float origin_axis[3] = { origin.x, origin.y, origin.z };
+        float ray_axis[3] = { ray.x, ray.y, ray.z };
+        float inverse_axis[3] = { inverse_ray.x, inverse_ray.y, inverse_ray.z };
+
+        struct Pending { uint32_t node; float t_near; float t_far; };
+        Pending stack[max_depth_limit + 2];
+        int stack_size = 0;
+        stack[stack_size++] = { 0, t_near, t_far };
+        while (stack_size > 0) {
+            Pending pending = stack[--stack_size];
+            uint32_t node_index = pending.node;
+            t_near = pending.t_near;
+            t_far = pending.t_far;
+            while (true) {
+                STATS_COUNT(node_visits);
+                KdNode& node = m_nodes[node_index];
+                if (node.axis == leaf_axis) {
+                    out.insert(out.end(), m_items.begin() + node.first, m_items.begin() + node.first + node.count);
+                    break;
+                }
+
+                // Visit the child on the origin's side first. NaN (ray in the plane) visits both.
+                float t_split = (node.split - origin_axis[node.axis]) * inverse_axis[node.axis];
+                bool below_first = origin_axis[node.axis] < node.split || (origin_axis[node.axis] == node.split && ray_axis[node.axis] <= 0.0f);
+                uint32_t near_child = below_first ? node.first : node.first + 1;
+                uint32_t far_child = below_first ? node.first + 1 : node.first;
+                if (t_split > t_far || t_split <= 0.0f) {
+                    node_index = near_child;
+                } else if (t_split < t_near) {
+                    node_index = far_child;
+                } else {
+                    bool split_is_nan = t_split != t_split;
+                    stack[stack_size++] = { far_child, split_is_nan ? t_near : t_split, t_far };
+                    node_index = near_child;
+                    t_far = split_is_nan ? t_far : t_split;
+                }
+            }
+        }
+        sort_candidates(out, first);
+    }
+
+    size_t memory_usage() override
+    {
+        return sizeof(*this) + m_nodes.capacity() * sizeof(KdNode) + m_items.capacity() * sizeof(uint32_t);
+    }
+};
+
+/*
+    The binned SAH BVH also used for mesh triangles. Adapts to primitives of very different sizes, e.g. mesh instances.
+*/
+class BVHAccelerator : public Accelerator
+{
+private:
+    BVH m_bvh;
+
+public:
+    AccelType type() override
+    {
+        return ACCEL_BVH;
+    }
+
+    void build(std::vector<AABB>& bounds) override
+    {
+        m_bvh.build(bounds);
+    }
+
+    void candidates(Vector3 origin, Vector3 ray, std::vector<uint32_t>& out) override
+    {
+        size_t first = out.size();
+        m_bvh.traverse(origin, ray, [&](uint32_t index) {
+            out.push_back(index);
+        });
+        std::sort(out.begin() + first, out.end());
+    }
+
+    size_t memory_usage() override
+    {
+        return sizeof(*this) + m_bvh.nodes.capacity() * sizeof(BVHNode) + m_bvh.indices.capacity() * sizeof(uint32_t);
+    }
+};
+
+inline Accelerator* create_accelerator(AccelType type)
+{
+    switch (type)
+    {
+    case ACCEL_GRID:
+        return new GridAccelerator();
+    case ACCEL_KDTREE:
+        return new KdTreeAccelerator();
+    case ACCEL_BVH:
+        return new BVHAccelerator();
+    default:
+        return new BruteForceAccelerator();
+    }
+}
+
+/*
+    Scene statistics choose_accelerator() decides on
+*/
+struct AccelSceneStats
+{
+    size_t primitives = 0;
+    size_t spheres = 0;
+    size_t faces = 0;
+    size_t instances = 0;
+    size_t shapes = 0; // Disks, boxes and cylinders
+    float axis_aligned_faces = 0.0f; // Fraction of faces whose normal is within about a degree of an axis
+    float size_spread = 1.0f; // 90th percentile over median of the primitives' bounding box diagonals
+    float occupancy = 0.0f; // Fraction of cells holding a primitive center, in a grid of about one cell per primitive
+};
+
+/**
+ * @brief Measures how primitive sizes and positions are distributed. Counts and axis_aligned_faces are left to the caller.
+ * @returns Statistics with size_spread and occupancy filled in
+ * @param bounds Bounds of every primitive
+**/
+inline AccelSceneStats measure_primitive_distribution(std::vector<AABB>& bounds)
+{
+    AccelSceneStats stats;
+    stats.primitives = bounds.size();
+    if (bounds.empty()) {
+        return stats;
+    }
+
+    std::vector<float> diagonals;
+    AABB scene_bounds;
+    for (AABB& box : bounds) {
+        Vector3 extent = box.max - box.min;
+        diagonals.push_back(std::sqrt(extent.square().sum()));
+        scene_bounds.extend(box);
+    }
+    std::sort(diagonals.begin(), diagonals.end());
+    float median = diagonals[diagonals.size() / 2];
+    float high = diagonals[(diagonals.size() * 9) / 10];
+    stats.size_spread = median > 0.0f ? high / median : std::numeric_limits<float>::max();
+
+    int resolution[3];
+    grid_resolution(scene_bounds, bounds.size(), 1.0f, 128, resolution);
+    std::vector<bool> occupied(static_cast<size_t>(resolution[0]) * resolution[1] * resolution[2], false);
+    size_t occupied_cells = 0;
+    for (AABB& box : bounds) {
+        size_t cell = 0;
+        for (int axis = 2; axis >= 0; axis--) {
+            float extent = scene_bounds.max[axis] - scene_bounds.min[axis];
+            int coordinate = extent > 0.0f ? static_cast<int>((box.center()[axis] - scene_bounds.min[axis]) / extent * resolution[axis]) : 0;
+            cell = cell * resolution[axis] + std::clamp(coordinate, 0, resolution[axis] - 1);
+        }
+        if (!occupied[cell]) {
+            occupied[cell] = true;
+            occupied_cells++;
+        }
+    }
+    stats.occupancy = static_cast<float>(occupied_cells) / occupied.size();
+    return stats;
+}
+
+/**
+ * @brief Picks the accelerator expected to trace the scene fastest
+ * @returns ACCEL_BRUTE, ACCEL_GRID, ACCEL_KDTREE or ACCEL_BVH
+ * @param stats Scene statistics
+**/
+inline AccelType choose_accelerator(AccelSceneStats& stats)
+{
+    // Walking any index costs more than testing a handful of primitives
+    if (stats.primitives <= 16) {
+        return ACCEL_BRUTE;
+    }
+    // Walls and floors: planes aligned with the axes cut empty space away exactly
+    if (stats.faces * 2 > stats.primitives && stats.axis_aligned_faces >= 0.5f) {
+        return ACCEL_KDTREE;
+    }
+    // Similar sizes spread evenly (random uniform centers occupy about 63% of the cells). A few large
+    // primitives, such as a mesh instance among spheres, do not move the 90th percentile of the sizes.
+    if (stats.size_spread <= 4.0f && stats.occupancy >= 0.25f) {
+        return ACCEL_GRID;
+    }
+    // Clustered primitives or mixed sizes, e.g. many instances of different scales
+    return ACCEL_BVH;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+    Owns every object of one scene (spheres, shapes, object infos, meshes, instances and textures). Objects are
+    placed one after another in large blocks of a monotonic buffer resource, in the order the scene file
+    creates them, and are never freed one by one: release() runs their destructors in reverse order and
+    returns all blocks at once. Objects that own further memory (a mesh's arrays, a texture's cached tiles)
+    free it in their destructors. Not thread safe; the parser is the only writer.
+*/
+class SceneArena
+{
+private:
+    struct Destructor
+    {
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    std::pmr::monotonic_buffer_resource m_resource;
+    std::vector<Destructor> m_destructors;
+    size_t m_bytes = 0;
+    size_t m_objects = 0;
+
+public:
+    static const size_t initial_block_size = 64 * 1024;
+
+    SceneArena() : m_resource(initial_block_size) {}
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+
+    ~SceneArena()
+    {
+        release();
+    }
+
+    /*
+        Constructs a T in the arena. It lives until the next release().
+    */
+    template <typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        void* memory = m_resource.allocate(sizeof(T), alignof(T));
+        T* object = new (memory) T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            m_destructors.push_back({ [](void* pointer) { static_cast<T*>(pointer)->~T(); }, object });
+        }
+        m_bytes += sizeof(T);
+        m_objects++;
+        return object;
+    }
+
+    /*
+        Destroys every object, last created first, and frees the arena's blocks
+    */
+    void release()
+    {
+        for (auto destructor = m_destructors.rbegin(); destructor != m_destructors.rend(); destructor++) {
+            destructor->destroy(destructor->object);
+        }
+        m_destructors.clear();
+        m_destructors.shrink_to_fit();
+        m_resource.release();
+        m_bytes = 0;
+        m_objects = 0;
+    }
+
+    /*
+        Bytes of the objects created since the last release, excluding alignment padding and unused block space
+    */
+    size_t bytes()
+    {
+        return m_bytes;
+    }
+
+    size_t objects()
+    {
+        return m_objects;
+    }
+};
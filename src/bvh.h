@@ -0,0 +1,259 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "definitions.h"
+#include "stats.h"
+
+/*
+    Axis aligned bounding box
+*/
+struct AABB
+{
+    Vector3 min = {
+        .x = std::numeric_limits<float>::max(),
+        .y = std::numeric_limits<float>::max(),
+        .z = std::numeric_limits<float>::max()
+    };
+    Vector3 max = {
+        .x = -std::numeric_limits<float>::max(),
+        .y = -std::numeric_limits<float>::max(),
+        .z = -std::numeric_limits<float>::max()
+    };
+
+    void extend(Vector3 point)
+    {
+        min = { std::min(min.x, point.x), std::min(min.y, point.y), std::min(min.z, point.z) };
+        max = { std::max(max.x, point.x), std::max(max.y, point.y), std::max(max.z, point.z) };
+    }
+
+    void extend(AABB other)
+    {
+        extend(other.min);
+        extend(other.max);
+    }
+
+    bool empty()
+    {
+        return min.x > max.x;
+    }
+
+    Vector3 center()
+    {
+        return (min + max) * 0.5f;
+    }
+
+    float surface_area()
+    {
+        if (empty()) {
+            return 0.0f;
+        }
+        Vector3 extent = max - min;
+        return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
+    /*
+        Slab test. Returns true if the ray overlaps the box anywhere in front of its origin.
+        inverse_ray is the component-wise reciprocal of the ray direction.
+    */
+    bool intersect(Vector3 origin, Vector3 inverse_ray)
+    {
+        float t_near, t_far;
+        return intersect(origin, inverse_ray, t_near, t_far);
+    }
+
+    /*
+        Slab test that also clips the ray to the box: t_near (at least 0) and t_far receive the distances
+        at which the ray enters and leaves it.
+    */
+    bool intersect(Vector3 origin, Vector3 inverse_ray, float& t_near, float& t_far)
+    {
+        t_near = 0.0f;
+        t_far = std::numeric_limits<float>::max();
+        for (int axis = 0; axis < 3; axis++) {
+            float t0 = (min[axis] - origin[axis]) * inverse_ray[axis];
+            float t1 = (max[axis] - origin[axis]) * inverse_ray[axis];
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            // NaN (0 * inf) means the ray runs along a slab face; treat it as overlapping
+            t_near = t0 > t_near ? t0 : t_near;
+            t_far = t1 < t_far ? t1 : t_far;
+            if (t_near > t_far) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct BVHNode
+{
+    AABB bounds;
+    uint32_t first; // Index of first primitive (leaf) or of left child (interior). Right child is first + 1
+    uint32_t count; // Number of primitives, 0 for interior nodes
+};
+
+/*
+    Bounding volume hierarchy over an arbitrary list of primitive bounds, built with binned SAH.
+    The tree only stores primitive indices, so the same class serves as the per-mesh bottom level
+    and as the top level over mesh instances.
+*/
+class BVH
+{
+private:
+    static const uint32_t max_leaf_size = 4;
+    static const int bin_count = 12;
+    static const int max_depth = 60; // Keeps the traversal stack bounded
+
+    void subdivide(uint32_t node_index, std::vector<AABB>& bounds, std::vector<Vector3>& centers, int depth)
+    {
+        BVHNode& node = nodes[node_index];
+        if (node.count <= max_leaf_size || depth >= max_depth) {
+            return;
+        }
+
+        AABB center_bounds;
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+            center_bounds.extend(centers[indices[i]]);
+        }
+
+        // Find the cheapest split plane among evenly spaced bins on every axis
+        int best_axis = -1;
+        float best_split = 0.0f;
+        float best_cost = node.bounds.surface_area() * node.count;
+        for (int axis = 0; axis < 3; axis++) {
+            float lower = center_bounds.min[axis];
+            float upper = center_bounds.max[axis];
+            if (lower == upper) {
+                continue;
+            }
+            AABB bin_bounds[bin_count];
+            uint32_t bin_counts[bin_count] = { 0 };
+            float scale = bin_count / (upper - lower);
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                int bin = std::min(bin_count - 1, static_cast<int>((centers[indices[i]][axis] - lower) * scale));
+                bin_counts[bin]++;
+                bin_bounds[bin].extend(bounds[indices[i]]);
+            }
+
+            // Sweep from both ends to get the cost of splitting after each bin
+            float left_area[bin_count - 1], right_area[bin_count - 1];
+            uint32_t left_count[bin_count - 1], right_count[bin_count - 1];
+            AABB left_box, right_box;
+            uint32_t left_sum = 0, right_sum = 0;
+            for (int i = 0; i < bin_count - 1; i++) {
+                left_sum += bin_counts[i];
+                left_count[i] = left_sum;
+                left_box.extend(bin_bounds[i]);
+                left_area[i] = left_box.surface_area();
+                right_sum += bin_counts[bin_count - 1 - i];
+                right_count[bin_count - 2 - i] = right_sum;
+                right_box.extend(bin_bounds[bin_count - 1 - i]);
+                right_area[bin_count - 2 - i] = right_box.surface_area();
+            }
+            for (int i = 0; i < bin_count - 1; i++) {
+                float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = lower + (i + 1) / scale;
+                }
+            }
+        }
+
+        if (best_axis == -1) {
+            return; // Splitting is not cheaper than testing every primitive
+        }
+
+        // Partition primitive indices in place
+        uint32_t i = node.first;
+        uint32_t j = node.first + node.count - 1;
+        while (i <= j && j != std::numeric_limits<uint32_t>::max()) {
+            if (centers[indices[i]][best_axis] < best_split) {
+                i++;
+            } else {
+                std::swap(indices[i], indices[j]);
+                j--;
+            }
+        }
+        uint32_t left_count = i - node.first;
+        if (left_count == 0 || left_count == node.count) {
+            return;
+        }
+
+        uint32_t left_index = static_cast<uint32_t>(nodes.size());
+        BVHNode left = { .bounds = AABB(), .first = node.first, .count = left_count };
+        BVHNode right = { .bounds = AABB(), .first = i, .count = node.count - left_count };
+        for (uint32_t k = left.first; k < left.first + left.count; k++) left.bounds.extend(bounds[indices[k]]);
+        for (uint32_t k = right.first; k < right.first + right.count; k++) right.bounds.extend(bounds[indices[k]]);
+        nodes.push_back(left);
+        nodes.push_back(right);
+
+        // "node" may dangle after push_back
+        nodes[node_index].first = left_index;
+        nodes[node_index].count = 0;
+        subdivide(left_index, bounds, centers, depth + 1);
+        subdivide(left_index + 1, bounds, centers, depth + 1);
+    }
+
+public:
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> indices;
+
+    void build(std::vector<AABB>& bounds)
+    {
+        nodes.clear();
+        indices.resize(bounds.size());
+        if (bounds.empty()) {
+            return;
+        }
+
+        std::vector<Vector3> centers(bounds.size());
+        BVHNode root = { .bounds = AABB(), .first = 0, .count = static_cast<uint32_t>(bounds.size()) };
+        for (uint32_t i = 0; i < bounds.size(); i++) {
+            indices[i] = i;
+            centers[i] = bounds[i].center();
+            root.bounds.extend(bounds[i]);
+        }
+        nodes.reserve(bounds.size() * 2);
+        nodes.push_back(root);
+        subdivide(0, bounds, centers, 0);
+        nodes.shrink_to_fit();
+    }
+
+    AABB bounds()
+    {
+        return nodes.empty() ? AABB() : nodes[0].bounds;
+    }
+
+    /*
+        Calls visit(primitive_index) for every primitive in a leaf whose box the ray passes through.
+    */
+    template <typename Visitor>
+    void traverse(Vector3 origin, Vector3 ray, Visitor&& visit)
+    {
+        if (nodes.empty()) {
+            return;
+        }
+        Vector3 inverse_ray = { 1.0f / ray.x, 1.0f / ray.y, 1.0f / ray.z };
+        uint32_t stack[max_depth + 2];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            BVHNode& node = nodes[stack[--stack_size]];
+            STATS_COUNT(node_visits);
+            if (!node.bounds.intersect(origin, inverse_ray)) {
+                continue;
+            }
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    visit(indices[i]);
+                }
+            } else {
+                stack[stack_size++] = node.first;
+                stack[stack_size++] = node.first + 1;
+            }
+        }
+    }
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "definitions.h"
+
+/*
+    Packs a unit vector into two 16-bit values using the octahedral mapping:
+    the sphere is projected onto an octahedron, and the octahedron unfolded into a square.
+    Maximum angular error is about 0.003 degrees.
+*/
+inline uint32_t encode_octahedral(Vector3 normal)
+{
+    float l1 = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    if (l1 == 0.0f) {
+        return 0;
+    }
+    float x = normal.x / l1;
+    float y = normal.y / l1;
+    if (normal.z < 0.0f) {
+        // Fold the lower hemisphere over the diagonals
+        float folded_x = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float folded_y = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+    uint32_t qx = static_cast<uint32_t>(std::lround((std::clamp(x, -1.0f, 1.0f) * 0.5f + 0.5f) * 65535.0f));
+    uint32_t qy = static_cast<uint32_t>(std::lround((std::clamp(y, -1.0f, 1.0f) * 0.5f + 0.5f) * 65535.0f));
+    return (qy << 16) | qx;
+}
+
+inline Vector3 decode_octahedral(uint32_t packed)
+{
+    float x = (packed & 0xFFFF) / 65535.0f * 2.0f - 1.0f;
+    float y = (packed >> 16) / 65535.0f * 2.0f - 1.0f;
+    Vector3 normal = { x, y, 1.0f - std::fabs(x) - std::fabs(y) };
+    if (normal.z < 0.0f) {
+        normal.x = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        normal.y = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return normal.norm();
+}
+
+/*
+    IEEE 754 binary16 conversion, rounding to nearest even. Values beyond the half range become infinity.
+*/
+inline uint16_t float_to_half(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+
+    if (((bits >> 23) & 0xFF) == 0xFF) {
+        return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0)); // Inf or NaN
+    }
+    if (exponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7C00);
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+        // Subnormal half
+        mantissa |= 0x800000;
+        uint32_t shift = static_cast<uint32_t>(14 - exponent);
+        uint32_t half_mantissa = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half_mantissa & 1))) {
+            half_mantissa++;
+        }
+        return static_cast<uint16_t>(sign | half_mantissa);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        half++; // May carry into the exponent, which is still correct
+    }
+    return static_cast<uint16_t>(half);
+}
+
+inline float half_to_float(uint16_t half)
+{
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+    uint32_t bits;
+
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // Renormalize subnormal
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3FF;
+            bits = sign | (exponent << 23) | (mantissa << 13);
+        }
+    } else if (exponent == 31) {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline uint32_t encode_half2(Point point)
+{
+    return (static_cast<uint32_t>(float_to_half(point.y)) << 16) | float_to_half(point.x);
+}
+
+inline Point decode_half2(uint32_t packed)
+{
+    return {
+        .x = half_to_float(static_cast<uint16_t>(packed & 0xFFFF)),
+        .y = half_to_float(static_cast<uint16_t>(packed >> 16))
+    };
+}
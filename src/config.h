@@ -1,4 +1,6 @@
 #pragma once
+#include <chrono> // Before the macros below, which clash with its literal suffixes
+#include <map>
 #include <string>
 #include <vector>
 
@@ -9,6 +11,9 @@
 #define num_commands 8
 #define num_obj_types 6
 #define M_PI 3.14159265358979323846
+#define TEXTURE_TILE_SIZE 64 // Texels per side of a lazily decoded texture tile
+#define TEXTURE_CACHE_DEFAULT_MB 256 // Default memory budget for resident texture tiles
+#define RENDER_TILE_SIZE 16 // Pixels per side of the image tiles handed to render threads
 
 // Type definitions
 typedef unsigned char byte;
@@ -24,15 +29,26 @@ enum ArgValues {
     mtlcolor,
     texture,
     sphere,
+    plane,
+    disk,
+    box,
+    cylinder,
     light,
+    spherelight,
+    rectlight,
     v,
     vn,
     vt,
-    f
+    f,
+    beginmesh,
+    endmesh,
+    instance,
+    mesh,
+    include
 };
 
 // Map to associate the strings with the enum values
-std::map<std::string, ArgValues> argsStringValues = {
+inline std::map<std::string, ArgValues> argsStringValues = {
     {"eye" , eye},
     {"viewdir", viewdir},
     {"updir", updir}, 
@@ -42,9 +58,20 @@ std::map<std::string, ArgValues> argsStringValues = {
     {"mtlcolor", mtlcolor}, 
     {"texture", texture},
     {"sphere", sphere}, 
+    {"plane", plane},
+    {"disk", disk},
+    {"box", box},
+    {"cylinder", cylinder},
     {"light", light}, 
+    {"spherelight", spherelight},
+    {"rectlight", rectlight},
     {"v", v}, 
     {"vn", vn}, 
     {"vt", vt}, 
-    {"f", f}
+    {"f", f},
+    {"beginmesh", beginmesh},
+    {"endmesh", endmesh},
+    {"instance", instance},
+    {"mesh", mesh},
+    {"include", include}
 };
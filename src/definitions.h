@@ -3,8 +3,12 @@
 #include <numeric>
 #include <algorithm>
 #include <string>
+#include <vector>
 #include <stdexcept>
 #include "config.h"
+#include "texture_cache.h"
+
+struct Mesh;
 
 enum RayState {
     ENTERING,
@@ -138,6 +142,10 @@ struct Vector3
     }
 };
 
+/*
+    Linear RGB radiance, also used for material colours. Operators do not clamp, so light adds up
+    without losing energy; values are brought into the displayable range once, by tone_map_to_image.
+*/
 struct Color 
 {
     float r, g, b;
@@ -145,36 +153,36 @@ struct Color
     Color operator * (Color other) 
     {
         Color result = *this;
-        result.r = std::clamp(other.r * result.r, 0.0f, 1.0f);
-        result.g = std::clamp(other.g * result.g, 0.0f, 1.0f);
-        result.b = std::clamp(other.b * result.b, 0.0f, 1.0f);
+        result.r *= other.r;
+        result.g *= other.g;
+        result.b *= other.b;
         return result;
     }
 
     Color operator * (float other) 
     {
         Color result = *this;
-        result.r = std::clamp(other * result.r, 0.0f, 1.0f);
-        result.g = std::clamp(other * result.g, 0.0f, 1.0f);
-        result.b = std::clamp(other * result.b, 0.0f, 1.0f);
+        result.r *= other;
+        result.g *= other;
+        result.b *= other;
         return result;
     }
 
     Color operator + (Color other) 
     {
         Color result = *this;
-        result.r = std::clamp(other.r + result.r, 0.0f, 1.0f);
-        result.g = std::clamp(other.g + result.g, 0.0f, 1.0f);
-        result.b = std::clamp(other.b + result.b, 0.0f, 1.0f);
+        result.r += other.r;
+        result.g += other.g;
+        result.b += other.b;
         return result;
     }
 
     Color operator + (float other) 
     {
         Color result = *this;
-        result.r = std::clamp(other + result.r, 0.0f, 1.0f);
-        result.g = std::clamp(other + result.g, 0.0f, 1.0f);
-        result.b = std::clamp(other + result.b, 0.0f, 1.0f);
+        result.r += other;
+        result.g += other;
+        result.b += other;
         return result;
     }
 
@@ -223,17 +231,20 @@ public:
     size_t get(size_t i, size_t j, size_t k) {
         return m_data[i][j][k];
     }
-};
 
-struct Texture {
-    public:
-    float height, width;
-    Texture(float width, float height) {
-        this->width = width;
-        this->height = height;
-        image = new Mat3D(width, height, 3);
+    /*
+        Bytes of the nested vectors: every pixel is its own vector of L size_t values
+    */
+    size_t memory_usage() {
+        size_t bytes = m_data.capacity() * sizeof(std::vector<std::vector<size_t>>);
+        for (auto& row : m_data) {
+            bytes += row.capacity() * sizeof(std::vector<size_t>);
+            for (auto& pixel : row) {
+                bytes += pixel.capacity() * sizeof(size_t);
+            }
+        }
+        return bytes;
     }
-    Mat3D* image;
 };
 
 /*
@@ -253,6 +264,15 @@ struct Material
     float ka, kd, ks, n, opacity, refraction_index;
 };
 
+struct SceneObjectInfo;
+struct Intersection;
+struct SceneState;
+
+/*
+    A ShadeRay implementation specialized for one material feature set, see shade_kernel in render.h
+*/
+typedef Color (*ShadeKernel)(SceneState&, Vector3, SceneObjectInfo*, Intersection, float, float, std::vector<SceneObjectInfo*>, RayState, float, Color);
+
 struct SceneObjectInfo 
 {
     unsigned int id;
@@ -260,6 +280,7 @@ struct SceneObjectInfo
     Material material;
     Texture* texture = nullptr;
     bool has_texture; // Overrides material if present
+    ShadeKernel shade_kernel = nullptr; // Chosen by build_scene, the generic kernel if not set
 };
 
 struct Sphere
@@ -269,23 +290,21 @@ struct Sphere
     SceneObjectInfo* object_info;
 };
 
-struct Face 
-{
-    Vector3 surface_normal;
-    Vector3 vertex[3];
-    bool smooth_shading;
-    Vector3 vertex_normal[3];
-    Vector3 barycentric_cords;
-    Point texture_coords[3];
-    SceneObjectInfo* object_info;
-};
+/*
+    Point and directional lights ('light', told apart by w) or area lights with a size, which cast soft shadows
+*/
+enum LightShape { LIGHT_POINT, LIGHT_SPHERE, LIGHT_RECTANGLE };
 
 struct Light
 {
-    Vector3 position; // For positional lights
+    Vector3 position; // For positional lights. The centre of area lights
     Vector3 direction; // For directional lights
     float w;
     Color color;
+    LightShape shape = LIGHT_POINT;
+    float radius = 0.0f; // Sphere lights
+    Vector3 edge_u = { 0.0f, 0.0f, 0.0f }; // Rectangle lights: the rectangle spans position +- edge_u / 2 +- edge_v / 2
+    Vector3 edge_v = { 0.0f, 0.0f, 0.0f };
 };
 
 struct Intersection
@@ -293,6 +312,10 @@ struct Intersection
     float distance;
     Vector3 point;
     Vector3 normal;
+    Vector3 barycentric_cords = { 0.0f, 0.0f, 0.0f }; // Triangle hits only
+    Mesh* mesh = nullptr; // Triangle hits only
+    uint32_t triangle = 0; // Triangle hits only
+    Point texture_coords = { 0.0f, 0.0f }; // Shape hits only
 };
 
 struct ObjectIntersections 
@@ -300,12 +323,3 @@ struct ObjectIntersections
     SceneObjectInfo* object_info;
     std::vector<Intersection> intersections;
 };
-
-struct Globals {
-    std::map<std::string, std::vector<SceneObjectInfo*>> scene_object_infos;
-    std::map<int, Face*> faces;
-    std::map<int, Sphere*> spheres;
-    std::vector<Light> scene_lights;
-    std::map<std::string, std::vector<std::string>> commands;
-    std::map<std::string, float> other;
-};
\ No newline at end of file
@@ -0,0 +1,163 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/*
+    Approximations used by ShadeRay in '--precision fast'. The exact path keeps the <cmath> calls.
+
+    Maximum errors over the inputs shading passes in, measured against the double precision <cmath>
+    functions by the 'fast_math' test (tests/fast_math.cpp), which fails if they are exceeded:
+        fast_acos      absolute error <= FAST_ACOS_MAX_ERROR radians on [-1, 1]
+        fast_atan2     absolute error <= FAST_ATAN2_MAX_ERROR radians
+        fast_pow       relative error <= FAST_POW_MAX_RELATIVE_ERROR for x in (0, 1], y in [0, 1000];
+                       integer exponents up to 64 use repeated squaring and are within a few ulps
+        pow2, pow5     exact up to float rounding of the products
+    Total internal reflection is tested on cosines, so it has no approximation error at all.
+*/
+constexpr float FAST_ACOS_MAX_ERROR = 5e-7f;
+constexpr float FAST_ATAN2_MAX_ERROR = 3e-6f;
+constexpr float FAST_POW_MAX_RELATIVE_ERROR = 3e-5f;
+
+inline float pow2(float x)
+{
+    return x * x;
+}
+
+inline float pow5(float x)
+{
+    float x2 = x * x;
+    return x2 * x2 * x;
+}
+
+/*
+    x^n by repeated squaring
+*/
+inline float pow_int(float x, unsigned int n)
+{
+    float result = 1.0f;
+    while (n > 0) {
+        if (n & 1) {
+            result *= x;
+        }
+        x *= x;
+        n >>= 1;
+    }
+    return result;
+}
+
+/*
+    Abramowitz and Stegun 4.4.46, with acos(-x) = pi - acos(x) for negative inputs
+*/
+inline float fast_acos(float x)
+{
+    float a = std::fabs(x);
+    float p = -0.0012624911f;
+    p = p * a + 0.0066700901f;
+    p = p * a - 0.0170881256f;
+    p = p * a + 0.0308918810f;
+    p = p * a - 0.0501743046f;
+    p = p * a + 0.0889789874f;
+    p = p * a - 0.2145988016f;
+    p = p * a + 1.5707963050f;
+    float result = std::sqrt(std::fmax(0.0f, 1.0f - a)) * p;
+    return x < 0.0f ? static_cast<float>(M_PI) - result : result;
+}
+
+/*
+    Odd minimax polynomial for atan on [0, 1], extended to all quadrants by symmetry
+*/
+inline float fast_atan2(float y, float x)
+{
+    float ax = std::fabs(x);
+    float ay = std::fabs(y);
+    float big = std::fmax(ax, ay);
+    if (big == 0.0f) {
+        return 0.0f;
+    }
+    float z = std::fmin(ax, ay) / big;
+    float z2 = z * z;
+    float p = -0.01172120f;
+    p = p * z2 + 0.05265332f;
+    p = p * z2 - 0.11643287f;
+    p = p * z2 + 0.19354346f;
+    p = p * z2 - 0.33262347f;
+    p = p * z2 + 0.99997726f;
+    float angle = z * p;
+    if (ay > ax) angle = static_cast<float>(M_PI_2) - angle;
+    if (x < 0.0f) angle = static_cast<float>(M_PI) - angle;
+    return y < 0.0f ? -angle : angle;
+}
+
+/*
+    log2 of a positive, finite x. The mantissa is moved into [sqrt(0.5), sqrt(2)) and
+    log2(m) = 2 atanh(t) / ln 2 with t = (m - 1) / (m + 1) is summed to t^7.
+*/
+inline float fast_log2(float x)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    int exponent = static_cast<int>((bits >> 23) & 0xFF) - 127;
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float m;
+    std::memcpy(&m, &bits, sizeof(m));
+    if (m > static_cast<float>(M_SQRT2)) {
+        m *= 0.5f;
+        exponent++;
+    }
+    float t = (m - 1.0f) / (m + 1.0f);
+    float t2 = t * t;
+    float series = t * (1.0f + t2 * (1.0f / 3.0f + t2 * (1.0f / 5.0f + t2 * (1.0f / 7.0f))));
+    return static_cast<float>(exponent) + series * static_cast<float>(2.0 / M_LN2);
+}
+
+/*
+    2^x, with the fraction in [-0.5, 0.5] evaluated by its Taylor series to degree 6
+*/
+inline float fast_exp2(float x)
+{
+    if (x < -126.0f) {
+        return 0.0f;
+    }
+    if (x > 127.0f) {
+        return INFINITY;
+    }
+    float whole = std::nearbyint(x);
+    float f = (x - whole) * static_cast<float>(M_LN2);
+    float p = 1.0f + f * (1.0f + f * (1.0f / 2.0f + f * (1.0f / 6.0f + f * (1.0f / 24.0f + f * (1.0f / 120.0f + f * (1.0f / 720.0f))))));
+    uint32_t bits = static_cast<uint32_t>(static_cast<int>(whole) + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+/*
+    x^y for x >= 0, as used by the specular term. Integer exponents (the usual Phong shininess) take pow_int.
+*/
+inline float fast_pow(float x, float y)
+{
+    if (y >= 0.0f && y <= 64.0f && y == std::floor(y)) {
+        return pow_int(x, static_cast<unsigned int>(y));
+    }
+    if (x <= 0.0f) {
+        return y == 0.0f ? 1.0f : 0.0f;
+    }
+    return fast_exp2(y * fast_log2(x));
+}
+
+/**
+ * @brief Whether light crossing into a medium is totally internally reflected, tested on cosines
+ * instead of comparing acos(cos_angle_incidence) against the critical angle asin(ratio)
+ * @returns True if the angle of incidence is above the critical angle and below 90 degrees
+ * @param cos_angle_incidence Cosine of the angle between the normal and the incoming ray
+ * @param index_ratio Transmission refraction index over incidence refraction index
+**/
+inline bool total_internal_reflection_from_cosine(float cos_angle_incidence, float index_ratio)
+{
+    // No critical angle exists when the ratio is at least 1 (asin is undefined or 90 degrees)
+    if (!(index_ratio < 1.0f) || !(cos_angle_incidence > 0.0f)) {
+        return false;
+    }
+    float cos_critical_angle = std::sqrt(1.0f - pow2(std::fmax(0.0f, index_ratio)));
+    return cos_angle_incidence < cos_critical_angle;
+}
@@ -0,0 +1,352 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "definitions.h"
+#include "memory.h"
+#include "utility.h"
+
+/*
+    How linear radiance is brought into the displayable 0 to 1 range for '--tonemap'
+*/
+enum ToneMap { TONEMAP_CLAMP, TONEMAP_REINHARD, TONEMAP_ACES };
+
+/*
+    Linear radiance of every pixel as 32-bit floats, row-major RGB. Shading stores unclamped values;
+    they are tone mapped to 8-bit values once, when the image is written.
+*/
+struct Framebuffer
+{
+    int width;
+    int height;
+    std::vector<float> rgb;
+
+    Framebuffer(int height, int width) :
+        width(width), height(height), rgb(static_cast<size_t>(width) * static_cast<size_t>(height) * 3, 0.0f)
+    {}
+
+    void set(int i, int j, Color color)
+    {
+        float* pixel = &rgb[(static_cast<size_t>(i) * width + j) * 3];
+        pixel[0] = color.r;
+        pixel[1] = color.g;
+        pixel[2] = color.b;
+    }
+
+    Color get(int i, int j)
+    {
+        float* pixel = &rgb[(static_cast<size_t>(i) * width + j) * 3];
+        return { pixel[0], pixel[1], pixel[2] };
+    }
+};
+
+/*
+    Linear to sRGB transfer function for a value in 0 to 1
+*/
+inline float encode_srgb(float linear)
+{
+    return linear <= 0.0031308f ? 12.92f * linear : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+/**
+ * @brief Brings linear radiance into the displayable 0 to 1 range. Each channel is tone mapped
+ * independently over the flat float array, so the loop compiles to packed SIMD.
+ * @returns The mapped values, in the same layout
+ * @param rgb Linear radiance
+ * @param tone_map TONEMAP_CLAMP cuts values to 0 to 1, TONEMAP_REINHARD applies c / (1 + c) and
+ * TONEMAP_ACES the Narkowicz fit of the ACES filmic curve
+ * @param srgb Also apply the sRGB transfer function after tone mapping
+**/
+inline std::vector<float> tone_map_values(std::vector<float>& rgb, ToneMap tone_map, bool srgb)
+{
+    std::vector<float> mapped(rgb.size());
+    for (size_t k = 0; k < mapped.size(); k++) {
+        float c = rgb[k];
+        c = c > 0.0f ? c : 0.0f; // Also turns NaN into black
+        switch (tone_map)
+        {
+        case TONEMAP_REINHARD:
+            c = c / (1.0f + c);
+            break;
+        case TONEMAP_ACES:
+            c = (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f);
+            break;
+        default:
+            break;
+        }
+        mapped[k] = c < 1.0f ? c : 1.0f;
+    }
+    if (srgb) {
+        for (float& c : mapped) {
+            c = encode_srgb(c);
+        }
+    }
+    return mapped;
+}
+
+/*
+    8-bit value of a tone mapped channel
+*/
+inline int pixel_value(float mapped)
+{
+    return static_cast<int>(map(mapped, 0, 1.0, MIN_PIXEL_VALUE, MAX_PIXEL_VALUE));
+}
+
+/**
+ * @brief Maps the framebuffer's linear radiance to an 8-bit image
+ * @returns The displayable image
+ * @param framebuffer Linear radiance
+ * @param tone_map How radiance is brought into range, see tone_map_values
+ * @param srgb Also apply the sRGB transfer function after tone mapping
+**/
+inline Mat3D tone_map_to_image(Framebuffer& framebuffer, ToneMap tone_map, bool srgb)
+{
+    std::vector<float> mapped = tone_map_values(framebuffer.rgb, tone_map, srgb);
+    Mat3D image(framebuffer.height, framebuffer.width, 3, 0);
+    for (int i = 0; i < framebuffer.height; i++) {
+        for (int j = 0; j < framebuffer.width; j++) {
+            for (int k = 0; k < 3; k++) {
+                image(i, j, k) = pixel_value(mapped[(static_cast<size_t>(i) * framebuffer.width + j) * 3 + k]);
+            }
+        }
+    }
+    TrackedMemory output_memory(MEMORY_FRAMEBUFFERS, framebuffer.rgb.capacity() * sizeof(float) + image.memory_usage());
+    TrackedMemory mapped_memory(MEMORY_TEMPORARY, mapped.capacity() * sizeof(float));
+    return image;
+}
+
+/**
+ * @brief Writes the framebuffer's linear radiance, untouched, as a colour PFM (rows bottom to top as PFM requires)
+ * @returns False if the file could not be written
+ * @param path Output file
+ * @param framebuffer Linear radiance
+**/
+inline bool write_pfm(std::string path, Framebuffer& framebuffer)
+{
+    // Negative scale marks little endian floats
+    std::ofstream stream(path, std::ios::binary);
+    stream << "PF\n" << framebuffer.width << " " << framebuffer.height << "\n-1.0\n";
+    for (int i = framebuffer.height - 1; i >= 0; i--) {
+        stream.write(reinterpret_cast<const char*>(&framebuffer.rgb[static_cast<size_t>(i) * framebuffer.width * 3]), framebuffer.width * 3 * sizeof(float));
+    }
+    return !stream.fail();
+}
+
+/*
+    Writes an image band by band, top to bottom, as it is rendered: the tone mapped 'P3' PPM and optionally
+    the linear radiance as PFM. The files are byte for byte those of write_ppm and write_pfm for the whole
+    image. PFM stores rows bottom to top, so each band is written at its final offset in the file.
+*/
+class StreamingImageWriter
+{
+private:
+    std::ofstream m_ppm;
+    std::ofstream m_pfm;
+    std::streamoff m_pfm_data_offset = 0;
+    int m_width = 0;
+    int m_height = 0;
+    int m_next_row = 0;
+    ToneMap m_tone_map = TONEMAP_CLAMP;
+    bool m_srgb = false;
+
+public:
+    /**
+     * @brief Creates the output files and writes their headers
+     * @returns False if a file could not be created
+     * @param ppm_path Tone mapped image
+     * @param pfm_path Linear radiance, or empty for none
+     * @param height Image height in pixels
+     * @param width Image width in pixels
+     * @param tone_map How radiance is brought into range, see tone_map_values
+     * @param srgb Also apply the sRGB transfer function after tone mapping
+    **/
+    bool open(std::string ppm_path, std::string pfm_path, int height, int width, ToneMap tone_map, bool srgb)
+    {
+        m_width = width;
+        m_height = height;
+        m_tone_map = tone_map;
+        m_srgb = srgb;
+        m_ppm.open(ppm_path);
+        m_ppm << "P3 \n" << width << " " << height << " \n" << "255 \n";
+        if (!pfm_path.empty()) {
+            m_pfm.open(pfm_path, std::ios::binary);
+            m_pfm << "PF\n" << width << " " << height << "\n-1.0\n";
+            m_pfm_data_offset = m_pfm.tellp();
+        }
+        return !m_ppm.fail() && !m_pfm.fail();
+    }
+
+    /**
+     * @brief Appends the next rows of the image
+     * @returns False if the band is out of order or could not be written
+     * @param first_row Image row of the band's first row
+     * @param band Linear radiance of the rows
+    **/
+    bool write_band(int first_row, Framebuffer& band)
+    {
+        if (first_row != m_next_row || band.width != m_width || first_row + band.height > m_height) {
+            return false;
+        }
+        std::vector<float> mapped = tone_map_values(band.rgb, m_tone_map, m_srgb);
+        TrackedMemory mapped_memory(MEMORY_TEMPORARY, mapped.capacity() * sizeof(float));
+        for (size_t k = 0; k < mapped.size(); k += 3) {
+            m_ppm << pixel_value(mapped[k]) << " " << pixel_value(mapped[k + 1]) << " " << pixel_value(mapped[k + 2]) << " \n";
+        }
+        if (m_pfm.is_open()) {
+            std::streamoff row_bytes = static_cast<std::streamoff>(m_width) * 3 * sizeof(float);
+            for (int i = 0; i < band.height; i++) {
+                m_pfm.seekp(m_pfm_data_offset + (m_height - 1 - (first_row + i)) * row_bytes);
+                m_pfm.write(reinterpret_cast<const char*>(&band.rgb[static_cast<size_t>(i) * m_width * 3]), row_bytes);
+            }
+        }
+        m_next_row += band.height;
+        return !m_ppm.fail() && !m_pfm.fail();
+    }
+
+    /**
+     * @brief Flushes and closes the files
+     * @returns False if the image is incomplete or could not be written
+    **/
+    bool close()
+    {
+        m_ppm.close();
+        if (m_pfm.is_open()) {
+            m_pfm.close();
+        }
+        return m_next_row == m_height && !m_ppm.fail() && !m_pfm.fail();
+    }
+};
+
+/*
+    A rectangle of the image rendered on its own with '--region' or '--tile-index', as linear radiance.
+    The file is the line "RTPART", the whole image's "width height", the rectangle's "x0 y0 x1 y1"
+    (x1 and y1 exclusive), each on its own line, then the rectangle's pixels as 32-bit little endian
+    float RGB, rows top to bottom.
+*/
+struct PartialImage
+{
+    std::string path;
+    int image_width = 0;
+    int image_height = 0;
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+    std::streamoff data_offset = 0; // Of the first pixel
+};
+
+/**
+ * @brief Writes a rendered rectangle of the image with its placement
+ * @returns False if the file could not be written
+ * @param path Output file
+ * @param region Linear radiance of the rectangle
+ * @param image_width Width of the whole image
+ * @param image_height Height of the whole image
+ * @param x0 Column of the rectangle's left edge
+ * @param y0 Row of the rectangle's top edge
+**/
+inline bool write_partial_image(std::string path, Framebuffer& region, int image_width, int image_height, int x0, int y0)
+{
+    std::ofstream stream(path, std::ios::binary);
+    stream << "RTPART\n" << image_width << " " << image_height << "\n"
+        << x0 << " " << y0 << " " << x0 + region.width << " " << y0 + region.height << "\n";
+    stream.write(reinterpret_cast<const char*>(region.rgb.data()), region.rgb.size() * sizeof(float));
+    return !stream.fail();
+}
+
+/**
+ * @brief Reads the placement of a partial image
+ * @returns The partial image's header
+ * @param path Partial image file
+**/
+inline PartialImage read_partial_image_header(std::string path)
+{
+    PartialImage part;
+    part.path = path;
+    std::ifstream stream(path, std::ios::binary);
+    std::string magic;
+    stream >> magic >> part.image_width >> part.image_height >> part.x0 >> part.y0 >> part.x1 >> part.y1;
+    stream.get(); // The newline ending the header
+    if (stream.fail() || magic != "RTPART") {
+        throw std::invalid_argument("ERROR: '" + path + "' is not a partial image. Please verify.");
+    }
+    if (part.x0 < 0 || part.y0 < 0 || part.x1 > part.image_width || part.y1 > part.image_height || part.x0 >= part.x1 || part.y0 >= part.y1) {
+        throw std::invalid_argument("ERROR: Partial image '" + path + "' lies outside its image. Please verify.");
+    }
+    part.data_offset = stream.tellg();
+    stream.seekg(0, std::ios::end);
+    std::streamoff pixels = static_cast<std::streamoff>(part.x1 - part.x0) * (part.y1 - part.y0);
+    if (stream.tellg() - part.data_offset < pixels * 3 * static_cast<std::streamoff>(sizeof(float))) {
+        throw std::invalid_argument("ERROR: Partial image '" + path + "' is truncated. Please verify.");
+    }
+    return part;
+}
+
+/**
+ * @brief Assembles partial images that together cover an image exactly once into the final image files.
+ * The image is written row by row, so only one row of it is held in memory.
+ * @param paths Partial image files, in any order
+ * @param ppm_path Tone mapped image
+ * @param pfm_path Linear radiance, or empty for none
+ * @param tone_map How radiance is brought into range, see tone_map_values
+ * @param srgb Also apply the sRGB transfer function after tone mapping
+**/
+inline void merge_partial_images(std::vector<std::string> paths, std::string ppm_path, std::string pfm_path, ToneMap tone_map, bool srgb)
+{
+    if (paths.empty()) {
+        throw std::invalid_argument("ERROR: No partial images to merge. Please verify.");
+    }
+    std::vector<PartialImage> parts;
+    int64_t covered = 0;
+    for (std::string& path : paths) {
+        PartialImage part = read_partial_image_header(path);
+        if (!parts.empty() && (part.image_width != parts[0].image_width || part.image_height != parts[0].image_height)) {
+            throw std::invalid_argument("ERROR: Partial image '" + path + "' belongs to an image of another size. Please verify.");
+        }
+        for (PartialImage& other : parts) {
+            if (part.x0 < other.x1 && other.x0 < part.x1 && part.y0 < other.y1 && other.y0 < part.y1) {
+                throw std::invalid_argument("ERROR: Partial images '" + other.path + "' and '" + path + "' overlap. Please verify.");
+            }
+        }
+        covered += static_cast<int64_t>(part.x1 - part.x0) * (part.y1 - part.y0);
+        parts.push_back(part);
+    }
+    int width = parts[0].image_width;
+    int height = parts[0].image_height;
+    if (covered != static_cast<int64_t>(width) * height) {
+        throw std::invalid_argument("ERROR: Partial images leave " + std::to_string(static_cast<int64_t>(width) * height - covered) + " pixels uncovered. Please verify.");
+    }
+
+    StreamingImageWriter writer;
+    if (!writer.open(ppm_path, pfm_path, height, width, tone_map, srgb)) {
+        throw std::invalid_argument("ERROR: Unable to create '" + ppm_path + "'. Please verify path.");
+    }
+    std::vector<std::ifstream> streams;
+    for (PartialImage& part : parts) {
+        streams.emplace_back(part.path, std::ios::binary);
+    }
+    Framebuffer row(1, width);
+    for (int i = 0; i < height; i++) {
+        for (size_t p = 0; p < parts.size(); p++) {
+            PartialImage& part = parts[p];
+            if (i < part.y0 || i >= part.y1) {
+                continue;
+            }
+            std::streamoff row_bytes = static_cast<std::streamoff>(part.x1 - part.x0) * 3 * sizeof(float);
+            streams[p].seekg(part.data_offset + (i - part.y0) * row_bytes);
+            streams[p].read(reinterpret_cast<char*>(&row.rgb[static_cast<size_t>(part.x0) * 3]), row_bytes);
+            if (streams[p].fail()) {
+                throw std::invalid_argument("ERROR: Unable to read partial image '" + part.path + "'. Please verify.");
+            }
+        }
+        if (!writer.write_band(i, row)) {
+            throw std::invalid_argument("ERROR: Unable to write '" + ppm_path + "'. Please verify path.");
+        }
+    }
+    if (!writer.close()) {
+        throw std::invalid_argument("ERROR: Unable to write '" + ppm_path + "'. Please verify path.");
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "definitions.h"
+#include "stats.h"
+#include "utility.h"
+
+/*
+    What a pixel's cost is measured in for '--heatmap'
+*/
+enum HeatmapMetric { HEATMAP_OFF, HEATMAP_CYCLES, HEATMAP_TESTS, HEATMAP_RAYS };
+
+/*
+    Monotonic counter for the metric on the calling thread. The difference between two readings
+    taken around a pixel is that pixel's cost. Cycles fall back to nanoseconds off x86.
+    Tests and rays come from the '--stats' counters, so they need RAYTRACER_STATS.
+*/
+inline uint64_t read_cost_counter(HeatmapMetric metric)
+{
+    switch (metric)
+    {
+    case HEATMAP_CYCLES:
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+#if RAYTRACER_STATS
+    case HEATMAP_TESTS:
+    {
+        RenderCounters& counters = thread_counters();
+        uint64_t tests = 0;
+        for (int i = 0; i < PRIMITIVE_KIND_COUNT; i++) tests += counters.intersection_tests[i];
+        return tests;
+    }
+    case HEATMAP_RAYS:
+    {
+        RenderCounters& counters = thread_counters();
+        uint64_t rays = 0;
+        for (int i = 0; i < RAY_KIND_COUNT; i++) rays += counters.rays[i];
+        return rays;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+/*
+    Blue (cheap) through cyan, green and yellow to red (expensive) for t in 0 to 1
+*/
+inline Color heat_color(float t)
+{
+    Color stops[5] = {
+        { 0.0f, 0.0f, 1.0f },
+        { 0.0f, 1.0f, 1.0f },
+        { 0.0f, 1.0f, 0.0f },
+        { 1.0f, 1.0f, 0.0f },
+        { 1.0f, 0.0f, 0.0f }
+    };
+    t = std::clamp<float>(t, 0.0, 1.0) * 4.0f;
+    int stop = std::min(3, static_cast<int>(t));
+    float blend = t - stop;
+    return stops[stop] * (1.0f - blend) + stops[stop + 1] * blend;
+}
+
+/**
+ * @brief Writes a per-pixel cost buffer as a false colour image (path + "_heatmap.ppm") and
+ * as raw 32-bit floats in a greyscale PFM (path + "_heatmap.pfm", rows bottom to top as PFM requires).
+ * Colours are scaled to the 99th percentile so a few outliers do not flatten the rest of the image.
+ * @returns False if either file could not be written
+ * @param path Output path without extension
+ * @param costs Row-major cost of each pixel
+ * @param height Image height in pixels
+ * @param width Image width in pixels
+**/
+inline bool write_heatmap(std::string path, std::vector<float>& costs, int height, int width)
+{
+    std::vector<float> sorted = costs;
+    std::sort(sorted.begin(), sorted.end());
+    float scale = sorted.empty() ? 0.0f : sorted[static_cast<size_t>(0.99 * (sorted.size() - 1))];
+    if (scale <= 0.0f) {
+        scale = 1.0f;
+    }
+
+    Mat3D image(height, width, 3, 0);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            Color color = heat_color(costs[i * width + j] / scale);
+            image(i, j, 0) = static_cast<int>(map(color.r, 0, 1.0, MIN_PIXEL_VALUE, MAX_PIXEL_VALUE));
+            image(i, j, 1) = static_cast<int>(map(color.g, 0, 1.0, MIN_PIXEL_VALUE, MAX_PIXEL_VALUE));
+            image(i, j, 2) = static_cast<int>(map(color.b, 0, 1.0, MIN_PIXEL_VALUE, MAX_PIXEL_VALUE));
+        }
+    }
+    if (!write_ppm(path + "_heatmap.ppm", image, height, width)) {
+        return false;
+    }
+
+    // Negative scale marks little endian floats
+    std::ofstream raw_stream(path + "_heatmap.pfm", std::ios::binary);
+    raw_stream << "Pf\n" << width << " " << height << "\n-1.0\n";
+    for (int i = height - 1; i >= 0; i--) {
+        raw_stream.write(reinterpret_cast<const char*>(&costs[i * width]), width * sizeof(float));
+    }
+    return !raw_stream.fail();
+}
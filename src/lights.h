@@ -0,0 +1,118 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include "definitions.h"
+#include "stats.h"
+
+/*
+    How shadows of area lights are sampled ('--soft-shadows'): ADAPTIVE starts with a 2x2 stratified set
+    of shadow rays and only traces the full set where those disagree (the penumbra), FIXED always traces
+    the full set.
+*/
+enum SoftShadowMode { SOFT_SHADOWS_ADAPTIVE, SOFT_SHADOWS_FIXED };
+
+const int SHADOW_SAMPLES_DEFAULT = 16;
+const int SHADOW_SAMPLES_INITIAL_GRID = 2;
+
+/*
+    Integer hash (PCG output permutation), used to jitter samples the same way whichever thread shades a point
+*/
+inline uint32_t hash_uint(uint32_t value)
+{
+    uint32_t state = value * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+inline uint32_t hash_float(uint32_t seed, float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return hash_uint(seed ^ bits);
+}
+
+/*
+    A number in [0, 1) from a hash
+*/
+inline float hash_to_unit(uint32_t hash)
+{
+    return static_cast<float>(hash >> 8) * (1.0f / 16777216.0f);
+}
+
+/**
+ * @brief Seed for the shadow samples of one light at one shading point
+ * @returns The seed
+ * @param point Shading point
+ * @param light Light sampled
+**/
+inline uint32_t shadow_sample_seed(Vector3 point, Light& light)
+{
+    uint32_t seed = hash_float(0x9e3779b9u, point.x);
+    seed = hash_float(seed, point.y);
+    seed = hash_float(seed, point.z);
+    seed = hash_float(seed, light.position.x);
+    seed = hash_float(seed, light.position.y);
+    return hash_float(seed, light.position.z);
+}
+
+/**
+ * @brief A point on an area light for stratified sample (s, t) of the unit square. Sphere lights are sampled
+ * over the disk they present to the shading point, by the concentric disk mapping so strata stay compact.
+ * @returns The point on the light
+ * @param light A sphere or rectangle light
+ * @param point Shading point
+ * @param s First sample coordinate, 0 to 1
+ * @param t Second sample coordinate, 0 to 1
+**/
+inline Vector3 sample_area_light(Light& light, Vector3 point, float s, float t)
+{
+    if (light.shape == LIGHT_RECTANGLE) {
+        return light.position + (light.edge_u * (s - 0.5f)) + (light.edge_v * (t - 0.5f));
+    }
+
+    // Orthonormal basis of the disk perpendicular to the direction to the light's centre
+    Vector3 w = (light.position - point).norm();
+    Vector3 helper = std::fabs(w.x) > 0.9f ? Vector3({ 0.0f, 1.0f, 0.0f }) : Vector3({ 1.0f, 0.0f, 0.0f });
+    Vector3 u = w.cross(helper).norm();
+    Vector3 v = w.cross(u);
+
+    float a = 2.0f * s - 1.0f;
+    float b = 2.0f * t - 1.0f;
+    float r, phi;
+    if (a == 0.0f && b == 0.0f) {
+        r = 0.0f;
+        phi = 0.0f;
+    } else if (std::fabs(a) > std::fabs(b)) {
+        r = a;
+        phi = static_cast<float>(M_PI / 4.0) * (b / a);
+    } else {
+        r = b;
+        phi = static_cast<float>(M_PI / 2.0) - static_cast<float>(M_PI / 4.0) * (a / b);
+    }
+    return light.position + (u * (light.radius * r * std::cos(phi))) + (v * (light.radius * r * std::sin(phi)));
+}
+
+/**
+ * @brief Prints shadow rays per pixel, and what always tracing the full set of samples for area lights
+ * would have cost. Needs RAYTRACER_STATS.
+ * @param out Stream to print to
+ * @param counters Counters of the render, e.g. render_stats.merged()
+ * @param pixels Pixels rendered
+ * @param samples Full set of shadow rays per area light evaluation
+**/
+inline void print_shadow_report(std::ostream& out, const RenderCounters& counters, uint64_t pixels, int samples)
+{
+    uint64_t rays = counters.rays[RAY_SHADOW];
+    uint64_t fixed_rays = rays - counters.area_light_rays + counters.area_light_evaluations * static_cast<uint64_t>(samples);
+    double per_pixel = static_cast<double>(rays) / std::max<uint64_t>(1, pixels);
+    double fixed_per_pixel = static_cast<double>(fixed_rays) / std::max<uint64_t>(1, pixels);
+    out << "Shadow rays: " << per_pixel << " per pixel (" << rays << " in total), against " << fixed_per_pixel
+        << " per pixel with " << samples << " fixed samples per area light";
+    if (counters.area_light_evaluations > 0) {
+        out << ". Area lights: " << static_cast<double>(counters.area_light_rays) / counters.area_light_evaluations << " rays per shading point, "
+            << 100.0 * counters.refined_area_light_evaluations / counters.area_light_evaluations << "% of shading points refined in penumbrae";
+    }
+    out << std::endl;
+}
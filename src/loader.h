@@ -0,0 +1,196 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "trace.h"
+
+/*
+    Runs startup work, such as indexing texture files, on background threads while the main thread keeps
+    parsing the scene, building the acceleration structure and rendering. Workers are started as jobs
+    arrive, up to the configured count, and wait for more work until the loader is destroyed.
+*/
+class BackgroundLoader
+{
+private:
+    std::mutex m_lock;
+    std::condition_variable m_work_available;
+    std::condition_variable m_jobs_done;
+    std::deque<std::packaged_task<void()>> m_queue;
+    std::vector<std::thread> m_workers;
+    std::vector<std::string> m_errors;
+    unsigned int m_max_workers = 1;
+    unsigned int m_idle_workers = 0;
+    size_t m_unfinished_jobs = 0; // Queued or running
+    bool m_stopping = false;
+
+    void work(unsigned int index)
+    {
+        set_trace_thread_name("loader " + std::to_string(index));
+        std::unique_lock<std::mutex> guard(m_lock);
+        while (true) {
+            m_idle_workers++;
+            m_work_available.wait(guard, [&]() { return m_stopping || !m_queue.empty(); });
+            m_idle_workers--;
+            if (m_queue.empty()) {
+                return;
+            }
+            std::packaged_task<void()> job = std::move(m_queue.front());
+            m_queue.pop_front();
+            guard.unlock();
+            job();
+            guard.lock();
+            if (--m_unfinished_jobs == 0) {
+                m_jobs_done.notify_all();
+            }
+        }
+    }
+
+public:
+    BackgroundLoader() = default;
+    BackgroundLoader(const BackgroundLoader&) = delete;
+    BackgroundLoader& operator=(const BackgroundLoader&) = delete;
+
+    /*
+        Finishes the queued jobs, then stops the workers
+    */
+    ~BackgroundLoader()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_stopping = true;
+        }
+        m_work_available.notify_all();
+        for (std::thread& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    void set_max_workers(unsigned int max_workers)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_max_workers = std::max(1u, max_workers);
+    }
+
+    /**
+     * @brief Queues a job. An exception thrown by the job is recorded as an error, see take_errors.
+     * @returns Ready once the job has run
+     * @param job Work to run on a background thread
+    **/
+    std::shared_future<void> submit(std::function<void()> job)
+    {
+        std::packaged_task<void()> task([this, job]() {
+            try
+            {
+                job();
+            }
+            catch(const std::exception& e)
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                m_errors.push_back(e.what());
+            }
+        });
+        std::shared_future<void> done = task.get_future().share();
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_queue.push_back(std::move(task));
+            m_unfinished_jobs++;
+            if (m_idle_workers < m_queue.size() && m_workers.size() < m_max_workers) {
+                m_workers.emplace_back(&BackgroundLoader::work, this, static_cast<unsigned int>(m_workers.size()) + 1);
+            }
+        }
+        m_work_available.notify_one();
+        return done;
+    }
+
+    /*
+        Messages of the jobs that failed since the last call
+    */
+    std::vector<std::string> take_errors()
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        return std::move(m_errors);
+    }
+
+    /*
+        Blocks until every submitted job has run
+    */
+    void wait_until_idle()
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        m_jobs_done.wait(guard, [&]() { return m_unfinished_jobs == 0; });
+    }
+
+    /*
+        Waits for every submitted job and prints the errors of those that failed. Returns true if any did.
+    */
+    bool report_errors(std::ostream& out)
+    {
+        wait_until_idle();
+        std::vector<std::string> errors = take_errors();
+        for (std::string& error : errors) {
+            out << error << std::endl;
+        }
+        return !errors.empty();
+    }
+};
+
+/*
+    How long startup took and how much of it overlapped, for '--startup-report'. Times are seconds since
+    the program started.
+*/
+struct StartupTimeline
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double parsed = 0.0; // Scene file read, textures possibly still indexing
+    double built = 0.0; // Acceleration structure built, rendering starts
+    std::atomic<bool> first_pixel_done = false;
+    std::atomic<double> first_pixel = 0.0;
+    std::atomic<double> last_texture_indexed = 0.0;
+    std::atomic<int> textures_indexing = 0; // Background indexing jobs not yet finished
+    int textures_indexing_at_render = 0;
+    std::atomic<int64_t> texture_wait_nanoseconds = 0; // Render threads blocked on textures still indexing
+
+    double now()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void texture_indexed()
+    {
+        double finished = now();
+        double latest = last_texture_indexed.load();
+        while (latest < finished && !last_texture_indexed.compare_exchange_weak(latest, finished)) {}
+        textures_indexing--;
+    }
+
+    /*
+        Called after every pixel; only the first call records anything
+    */
+    inline void pixel_done()
+    {
+        if (!first_pixel_done.load(std::memory_order_relaxed) && !first_pixel_done.exchange(true)) {
+            first_pixel = now();
+        }
+    }
+
+    void print(std::ostream& out)
+    {
+        out << "Startup: scene parsed at " << parsed << " s, acceleration structure built at " << built
+            << " s, first pixel at " << first_pixel.load() << " s. Textures indexed in the background until "
+            << last_texture_indexed.load() << " s (" << textures_indexing_at_render << " still indexing when rendering began); "
+            << "render threads waited for them " << texture_wait_nanoseconds.load() * 1.0e-9 << " s in total" << std::endl;
+    }
+};
+
+inline StartupTimeline startup_timeline;
@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/*
+    What the bytes of '--mem-report' are spent on
+*/
+enum MemoryCategory {
+    MEMORY_GEOMETRY, // Vertices, triangles, spheres, shapes and instance transforms
+    MEMORY_METADATA, // Object infos, primitive lists and the maps that index them
+    MEMORY_MATERIALS, // Materials of objects and meshes, per triangle material indices and lights
+    MEMORY_TEXTURES, // Texture indices, in-memory texels and decoded tiles in the cache
+    MEMORY_ACCELERATION, // Top level accelerator and mesh BVHs
+    MEMORY_FRAMEBUFFERS, // Radiance, output images and heatmap costs
+    MEMORY_TEMPORARY, // Buffers that only live during a render or while writing the image
+    MEMORY_CATEGORY_COUNT
+};
+
+inline const char* memory_category_names[MEMORY_CATEGORY_COUNT] = {
+    "geometry", "per-primitive metadata", "materials", "textures", "acceleration structures", "framebuffers", "temporary buffers"
+};
+
+/*
+    Framebuffers and temporary buffers are not part of the scene, so the code that allocates them
+    records them here while they are alive. The peak is what a render needed at most at once.
+*/
+struct MemoryLedger
+{
+    std::atomic<size_t> current[MEMORY_CATEGORY_COUNT] = {};
+    std::atomic<size_t> peak[MEMORY_CATEGORY_COUNT] = {};
+
+    void add(MemoryCategory category, size_t bytes)
+    {
+        size_t now = current[category].fetch_add(bytes) + bytes;
+        size_t highest = peak[category].load();
+        while (now > highest && !peak[category].compare_exchange_weak(highest, now)) {}
+    }
+
+    void remove(MemoryCategory category, size_t bytes)
+    {
+        current[category].fetch_sub(bytes);
+    }
+
+    /*
+        Starts measuring peaks again from what is alive now
+    */
+    void reset_peaks()
+    {
+        for (int category = 0; category < MEMORY_CATEGORY_COUNT; category++) {
+            peak[category] = current[category].load();
+        }
+    }
+};
+
+inline MemoryLedger memory_ledger;
+
+/*
+    Records a buffer in the memory ledger for the lifetime of the guard
+*/
+class TrackedMemory
+{
+private:
+    MemoryCategory m_category;
+    size_t m_bytes;
+
+public:
+    TrackedMemory(MemoryCategory category, size_t bytes) : m_category(category), m_bytes(bytes)
+    {
+        memory_ledger.add(m_category, m_bytes);
+    }
+
+    TrackedMemory(const TrackedMemory&) = delete;
+    TrackedMemory& operator=(const TrackedMemory&) = delete;
+
+    ~TrackedMemory()
+    {
+        memory_ledger.remove(m_category, m_bytes);
+    }
+};
+
+/*
+    Largest resident set of the process so far, in bytes. 0 where the platform does not report it.
+*/
+inline size_t peak_rss_bytes()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
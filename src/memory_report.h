@@ -0,0 +1,181 @@
+#pragma once
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <utility>
+#include "definitions.h"
+#include "accel.h"
+#include "memory.h"
+#include "mesh.h"
+#include "scene.h"
+#include "texture_cache.h"
+
+/*
+    Bytes of the loaded scene by category, with the peaks of the transient buffers of the renders so far
+*/
+struct MemoryFootprint
+{
+    size_t bytes[MEMORY_CATEGORY_COUNT] = {};
+    size_t texture_cache_peak = 0; // Most decoded texture tiles resident at once
+    size_t peak_rss = 0; // Of the whole process, 0 if unknown
+
+    size_t total()
+    {
+        size_t sum = 0;
+        for (size_t category_bytes : bytes) {
+            sum += category_bytes;
+        }
+        return sum;
+    }
+};
+
+// Colour and three links of a std::map node, besides its value
+const size_t MAP_NODE_BYTES = 4 * sizeof(void*);
+
+/*
+    Heap bytes of a string, 0 while it fits in the string object itself
+*/
+inline size_t string_heap_bytes(const std::string& text)
+{
+    const char* inline_begin = reinterpret_cast<const char*>(&text);
+    bool inline_storage = text.data() >= inline_begin && text.data() < inline_begin + sizeof(std::string);
+    return inline_storage ? 0 : text.capacity() + 1;
+}
+
+/*
+    Adds the arrays of a mesh's vertices, triangles, materials and BVH to the footprint
+*/
+inline void measure_mesh_memory(Mesh& mesh, MemoryFootprint& footprint)
+{
+    footprint.bytes[MEMORY_GEOMETRY] += mesh.positions.capacity() * sizeof(Vector3)
+        + mesh.normals.capacity() * sizeof(Vector3)
+        + mesh.texture_coords.capacity() * sizeof(Point)
+        + mesh.packed_normals.capacity() * sizeof(uint32_t)
+        + mesh.packed_texture_coords.capacity() * sizeof(uint32_t)
+        + mesh.triangles.capacity() * sizeof(MeshTriangle)
+        + mesh.intersection_data.capacity() * sizeof(TriangleIntersectionData)
+        + mesh.smooth_shading.capacity() / 8
+        + mesh.vertex_lookup.size() * (sizeof(std::pair<const std::tuple<uint32_t, uint32_t, uint32_t>, uint32_t>) + 2 * sizeof(void*))
+        + mesh.vertex_lookup.bucket_count() * sizeof(void*);
+    footprint.bytes[MEMORY_MATERIALS] += mesh.materials.capacity() * sizeof(MeshMaterial) + mesh.triangle_materials.capacity() * sizeof(uint16_t);
+    for (MeshMaterial& material : mesh.materials) {
+        footprint.bytes[MEMORY_MATERIALS] += string_heap_bytes(material.name);
+    }
+    footprint.bytes[MEMORY_ACCELERATION] += mesh.bvh.nodes.capacity() * sizeof(BVHNode) + mesh.bvh.indices.capacity() * sizeof(uint32_t);
+}
+
+/*
+    Adds an object info to the footprint: its material under materials, the rest under metadata
+*/
+inline void measure_object_info_memory(SceneObjectInfo* object_info, MemoryFootprint& footprint)
+{
+    footprint.bytes[MEMORY_METADATA] += sizeof(SceneObjectInfo) - sizeof(Material) + string_heap_bytes(object_info->type);
+    footprint.bytes[MEMORY_MATERIALS] += sizeof(Material);
+}
+
+/**
+ * @brief Measures what a scene costs in memory, for '--mem-report' and the memory benchmarks.
+ * Framebuffers and temporary buffers are the peaks recorded in memory_ledger by the renders so far.
+ * @returns Bytes by category
+ * @param scene State of the scene
+**/
+inline MemoryFootprint measure_memory(SceneState& scene)
+{
+    MemoryFootprint footprint;
+
+    measure_mesh_memory(scene.scene_mesh, footprint);
+    for (auto& [name, mesh] : scene.meshes) {
+        footprint.bytes[MEMORY_GEOMETRY] += sizeof(Mesh);
+        measure_mesh_memory(*mesh, footprint);
+        footprint.bytes[MEMORY_METADATA] += MAP_NODE_BYTES + sizeof(std::pair<const std::string, Mesh*>) + string_heap_bytes(name);
+    }
+
+    footprint.bytes[MEMORY_GEOMETRY] += scene.spheres.size() * sizeof(Sphere);
+    footprint.bytes[MEMORY_METADATA] += scene.spheres.size() * (MAP_NODE_BYTES + sizeof(std::pair<const int, Sphere*>));
+    footprint.bytes[MEMORY_GEOMETRY] += scene.shapes.size() * sizeof(Shape);
+    footprint.bytes[MEMORY_METADATA] += scene.shapes.size() * (MAP_NODE_BYTES + sizeof(std::pair<const int, Shape*>));
+
+    footprint.bytes[MEMORY_METADATA] += scene.instances.capacity() * sizeof(Instance*);
+    for (Instance* instance : scene.instances) {
+        footprint.bytes[MEMORY_GEOMETRY] += sizeof(Instance);
+        footprint.bytes[MEMORY_METADATA] += instance->material_infos.capacity() * sizeof(SceneObjectInfo*);
+        for (SceneObjectInfo* material_info : instance->material_infos) {
+            measure_object_info_memory(material_info, footprint);
+        }
+    }
+
+    for (auto& [type, object_infos] : scene.scene_object_infos) {
+        footprint.bytes[MEMORY_METADATA] += MAP_NODE_BYTES + sizeof(std::pair<const std::string, std::vector<SceneObjectInfo*>>)
+            + string_heap_bytes(type) + object_infos.capacity() * sizeof(SceneObjectInfo*);
+        for (SceneObjectInfo* object_info : object_infos) {
+            measure_object_info_memory(object_info, footprint);
+        }
+    }
+    footprint.bytes[MEMORY_METADATA] += scene.primitives.capacity() * sizeof(ScenePrimitive);
+    for (auto& [command, arguments] : scene.commands) {
+        footprint.bytes[MEMORY_METADATA] += MAP_NODE_BYTES + sizeof(std::pair<const std::string, std::vector<std::string>>)
+            + string_heap_bytes(command) + arguments.capacity() * sizeof(std::string);
+        for (std::string& argument : arguments) {
+            footprint.bytes[MEMORY_METADATA] += string_heap_bytes(argument);
+        }
+    }
+    footprint.bytes[MEMORY_MATERIALS] += scene.scene_lights.capacity() * sizeof(Light);
+
+    // Textures of 'texture' commands and of imported .mtl files
+    std::set<Texture*> textures(scene.textures.begin(), scene.textures.end());
+    for (auto& [name, mesh] : scene.meshes) {
+        for (MeshMaterial& material : mesh->materials) {
+            if (material.texture != nullptr) {
+                textures.insert(material.texture);
+            }
+        }
+    }
+    footprint.bytes[MEMORY_METADATA] += scene.textures.capacity() * sizeof(Texture*);
+    for (Texture* texture : textures) {
+        footprint.bytes[MEMORY_TEXTURES] += sizeof(Texture) + string_heap_bytes(texture->path)
+            + texture->tile_offsets.capacity() * sizeof(std::streamoff)
+            + texture->slots.capacity() * sizeof(TextureSlot)
+            + texture->texels.capacity();
+    }
+    TextureCacheStats cache = scene.texture_cache.stats();
+    footprint.bytes[MEMORY_TEXTURES] += cache.bytes_resident;
+    footprint.texture_cache_peak = cache.peak_bytes_resident;
+
+    if (scene.accelerator != nullptr) {
+        footprint.bytes[MEMORY_ACCELERATION] += scene.accelerator->memory_usage();
+    }
+
+    footprint.bytes[MEMORY_FRAMEBUFFERS] = memory_ledger.peak[MEMORY_FRAMEBUFFERS];
+    footprint.bytes[MEMORY_TEMPORARY] = memory_ledger.peak[MEMORY_TEMPORARY];
+    footprint.peak_rss = peak_rss_bytes();
+    return footprint;
+}
+
+/**
+ * @brief Prints the bytes of each category, their share of the accounted total and the process's peak RSS for '--mem-report'
+ * @param out Stream to print to
+ * @param footprint From measure_memory()
+**/
+inline void print_memory_report(std::ostream& out, MemoryFootprint& footprint)
+{
+    size_t total = footprint.total();
+    out << "Memory: " << total << " B accounted for";
+    if (footprint.peak_rss > 0) {
+        out << ", peak RSS " << footprint.peak_rss << " B";
+    }
+    out << std::endl;
+    for (int category = 0; category < MEMORY_CATEGORY_COUNT; category++) {
+        out << "  " << std::left << std::setw(24) << memory_category_names[category] << std::right << std::setw(12) << footprint.bytes[category]
+            << " B  " << std::fixed << std::setprecision(1) << std::setw(5) << 100.0 * footprint.bytes[category] / std::max<size_t>(1, total) << "%"
+            << std::defaultfloat << std::setprecision(6);
+        if (category == MEMORY_TEXTURES && footprint.texture_cache_peak > 0) {
+            out << " (decoded tiles peaked at " << footprint.texture_cache_peak << " B)";
+        }
+        if (category == MEMORY_FRAMEBUFFERS || category == MEMORY_TEMPORARY) {
+            out << " (peak)";
+        }
+        out << std::endl;
+    }
+}
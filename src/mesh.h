@@ -0,0 +1,521 @@
+#pragma once
+#include <map>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "definitions.h"
+#include "bvh.h"
+#include "stats.h"
+#include "trace.h"
+#include "compression.h"
+
+/*
+    Row-major 4x4 affine transform. Points are column vectors: p' = M * p
+*/
+struct Mat4
+{
+    float m[4][4];
+
+    static Mat4 identity()
+    {
+        Mat4 result = {};
+        for (int i = 0; i < 4; i++) {
+            result.m[i][i] = 1.0f;
+        }
+        return result;
+    }
+
+    Vector3 transform_point(Vector3 p)
+    {
+        return {
+            .x = m[0][0]*p.x + m[0][1]*p.y + m[0][2]*p.z + m[0][3],
+            .y = m[1][0]*p.x + m[1][1]*p.y + m[1][2]*p.z + m[1][3],
+            .z = m[2][0]*p.x + m[2][1]*p.y + m[2][2]*p.z + m[2][3]
+        };
+    }
+
+    Vector3 transform_vector(Vector3 v)
+    {
+        return {
+            .x = m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z,
+            .y = m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z,
+            .z = m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z
+        };
+    }
+
+    /*
+        Multiplies by the transpose. Called on the world-to-object matrix, this maps
+        object space normals to world space (the inverse transpose of object-to-world).
+    */
+    Vector3 transform_normal(Vector3 n)
+    {
+        return {
+            .x = m[0][0]*n.x + m[1][0]*n.y + m[2][0]*n.z,
+            .y = m[0][1]*n.x + m[1][1]*n.y + m[2][1]*n.z,
+            .z = m[0][2]*n.x + m[1][2]*n.y + m[2][2]*n.z
+        };
+    }
+
+    /*
+        General inverse by Gauss-Jordan elimination with partial pivoting
+    */
+    Mat4 inverse()
+    {
+        Mat4 a = *this;
+        Mat4 result = identity();
+        for (int column = 0; column < 4; column++) {
+            int pivot = column;
+            for (int row = column + 1; row < 4; row++) {
+                if (std::fabs(a.m[row][column]) > std::fabs(a.m[pivot][column])) {
+                    pivot = row;
+                }
+            }
+            if (a.m[pivot][column] == 0.0f) {
+                throw std::invalid_argument("ERROR: Transform is not invertible. Please verify.");
+            }
+            std::swap(a.m[column], a.m[pivot]);
+            std::swap(result.m[column], result.m[pivot]);
+
+            float scale = 1.0f / a.m[column][column];
+            for (int k = 0; k < 4; k++) {
+                a.m[column][k] *= scale;
+                result.m[column][k] *= scale;
+            }
+            for (int row = 0; row < 4; row++) {
+                if (row == column) {
+                    continue;
+                }
+                float factor = a.m[row][column];
+                for (int k = 0; k < 4; k++) {
+                    a.m[row][k] -= factor * a.m[column][k];
+                    result.m[row][k] -= factor * result.m[column][k];
+                }
+            }
+        }
+        return result;
+    }
+};
+
+/*
+    Hash for (position, texture coord, normal) index triples
+*/
+struct VertexKeyHash
+{
+    size_t operator()(const std::tuple<uint32_t, uint32_t, uint32_t>& key) const
+    {
+        uint64_t h = std::get<0>(key);
+        h = h * 0x9E3779B97F4A7C15ull ^ std::get<1>(key);
+        h = h * 0x9E3779B97F4A7C15ull ^ std::get<2>(key);
+        return static_cast<size_t>(h ^ (h >> 29));
+    }
+};
+
+/*
+    A named material carried by the mesh itself, e.g. from a Wavefront .mtl file
+*/
+struct MeshMaterial
+{
+    std::string name;
+    Material material;
+    Texture* texture = nullptr;
+};
+
+/*
+    Three indices into a mesh's vertex arrays. A vertex is a unique (position, normal, texture coordinate) combination.
+*/
+struct MeshTriangle
+{
+    uint32_t vertex[3];
+};
+
+/*
+    What the ray-triangle test needs of a triangle, computed once when the mesh is finalized instead of per ray
+*/
+struct TriangleIntersectionData
+{
+    Vector3 p[3]; // Vertex positions, gathered so the test reads one contiguous block
+    Vector3 normal; // Unit geometric normal, along (p1 - p0) x (p2 - p0)
+};
+
+/*
+    Component k (0, 1 or 2 for x, y or z) of a vector
+*/
+inline float component(Vector3& v, int k)
+{
+    return k == 0 ? v.x : (k == 1 ? v.y : v.z);
+}
+
+/*
+    Per ray setup of the watertight triangle test. The axis along which the direction is largest
+    becomes z, and a shear maps the direction onto +z, so triangles are tested in 2D.
+*/
+struct WatertightRay
+{
+    Vector3 origin;
+    Vector3 direction;
+    int kx, ky, kz;
+    float shear_x, shear_y, shear_z;
+
+    WatertightRay(Vector3 origin, Vector3 direction) : origin(origin), direction(direction)
+    {
+        float ax = std::fabs(direction.x);
+        float ay = std::fabs(direction.y);
+        float az = std::fabs(direction.z);
+        kz = (ax > ay) ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        // Keep the triangle's winding when the ray points down the axis
+        if (component(direction, kz) < 0.0f) {
+            std::swap(kx, ky);
+        }
+        shear_x = component(direction, kx) / component(direction, kz);
+        shear_y = component(direction, ky) / component(direction, kz);
+        shear_z = 1.0f / component(direction, kz);
+    }
+};
+
+/*
+    Indexed triangle storage. Vertex attributes are shared between every triangle that references them.
+    With compressed attributes, normals are stored octahedral encoded in 2x16 bits and texture
+    coordinates as two half floats, and are decoded when a hit is shaded.
+
+    Used for the scene's own faces, and for meshes defined once between 'beginmesh' and 'endmesh'.
+    Triangles of an instanced mesh carry no SceneObjectInfo; material and identity come from each instance.
+*/
+struct Mesh
+{
+    std::string name;
+    bool compressed = false;
+    std::vector<Vector3> positions;
+    std::vector<Vector3> normals; // Uncompressed only
+    std::vector<Point> texture_coords; // Uncompressed only
+    std::vector<uint32_t> packed_normals; // Compressed only
+    std::vector<uint32_t> packed_texture_coords; // Compressed only
+    std::vector<MeshTriangle> triangles;
+    std::vector<TriangleIntersectionData> intersection_data; // Per triangle, filled by finalize()
+    std::vector<bool> smooth_shading; // Per triangle
+    std::vector<MeshMaterial> materials;
+    std::vector<uint16_t> triangle_materials; // Per triangle index into materials, or no_material. Empty if the mesh has none
+    BVH bvh; // Bottom level acceleration structure
+
+    static constexpr uint16_t no_material = 0xFFFF;
+
+    // Parse time only: maps (position, texture coord, normal) indices of the scene file to a vertex
+    std::unordered_map<std::tuple<uint32_t, uint32_t, uint32_t>, uint32_t, VertexKeyHash> vertex_lookup;
+
+    /*
+        Returns the index of the vertex made of these attributes, adding it if it is new.
+        key identifies the attributes by their indices in the scene file.
+    */
+    uint32_t add_vertex(std::tuple<uint32_t, uint32_t, uint32_t> key, Vector3 position, Vector3 normal, Point texture_coord)
+    {
+        auto found = vertex_lookup.find(key);
+        if (found != vertex_lookup.end()) {
+            return found->second;
+        }
+        uint32_t index = append_vertex(position, normal, texture_coord);
+        vertex_lookup[key] = index;
+        return index;
+    }
+
+    /*
+        Adds a vertex that is not shared through the scene file indices, returning its index
+    */
+    uint32_t append_vertex(Vector3 position, Vector3 normal, Point texture_coord)
+    {
+        uint32_t index = static_cast<uint32_t>(positions.size());
+        positions.push_back(position);
+        Vector3 unit_normal = (normal.x == 0.0f && normal.y == 0.0f && normal.z == 0.0f) ? normal : normal.norm();
+        if (compressed) {
+            packed_normals.push_back(encode_octahedral(unit_normal));
+            packed_texture_coords.push_back(encode_half2(texture_coord));
+        } else {
+            normals.push_back(unit_normal);
+            texture_coords.push_back(texture_coord);
+        }
+        return index;
+    }
+
+    void add_triangle(uint32_t a, uint32_t b, uint32_t c, bool smooth)
+    {
+        triangles.push_back({ { a, b, c } });
+        smooth_shading.push_back(smooth);
+    }
+
+    Vector3 vertex_normal(uint32_t vertex)
+    {
+        return compressed ? decode_octahedral(packed_normals[vertex]) : normals[vertex];
+    }
+
+    Point texture_coord(uint32_t vertex)
+    {
+        return compressed ? decode_half2(packed_texture_coords[vertex]) : texture_coords[vertex];
+    }
+
+    Vector3 surface_normal(uint32_t triangle)
+    {
+        MeshTriangle& tri = triangles[triangle];
+        Vector3 e1 = positions[tri.vertex[1]] - positions[tri.vertex[0]];
+        Vector3 e2 = positions[tri.vertex[2]] - positions[tri.vertex[0]];
+        return e1.cross(e2).norm();
+    }
+
+    /*
+        Drops parse time bookkeeping and precomputes intersection data. Call once all triangles have been added.
+    */
+    void finalize()
+    {
+        vertex_lookup = {};
+        intersection_data.resize(triangles.size());
+        for (size_t i = 0; i < triangles.size(); i++) {
+            Vector3 p0 = positions[triangles[i].vertex[0]];
+            Vector3 p1 = positions[triangles[i].vertex[1]];
+            Vector3 p2 = positions[triangles[i].vertex[2]];
+            intersection_data[i] = { { p0, p1, p2 }, (p1 - p0).cross(p2 - p0).norm() };
+        }
+        positions.shrink_to_fit();
+        normals.shrink_to_fit();
+        texture_coords.shrink_to_fit();
+        packed_normals.shrink_to_fit();
+        packed_texture_coords.shrink_to_fit();
+        triangles.shrink_to_fit();
+        intersection_data.shrink_to_fit();
+        triangle_materials.shrink_to_fit();
+    }
+
+    /*
+        finalize(), then build the bottom level BVH
+    */
+    void build()
+    {
+        STATS_PHASE(PHASE_BUILD);
+        TraceSpan span("mesh_bvh_build", "build", name);
+        finalize();
+        std::vector<AABB> bounds(triangles.size());
+        for (size_t i = 0; i < triangles.size(); i++) {
+            for (int k = 0; k < 3; k++) {
+                bounds[i].extend(positions[triangles[i].vertex[k]]);
+            }
+        }
+        bvh.build(bounds);
+    }
+
+    size_t memory_usage()
+    {
+        return sizeof(Mesh)
+            + positions.capacity() * sizeof(Vector3)
+            + normals.capacity() * sizeof(Vector3)
+            + texture_coords.capacity() * sizeof(Point)
+            + packed_normals.capacity() * sizeof(uint32_t)
+            + packed_texture_coords.capacity() * sizeof(uint32_t)
+            + triangles.capacity() * sizeof(MeshTriangle)
+            + intersection_data.capacity() * sizeof(TriangleIntersectionData)
+            + smooth_shading.capacity() / 8
+            + triangle_materials.capacity() * sizeof(uint16_t)
+            + materials.capacity() * sizeof(MeshMaterial)
+            + bvh.nodes.capacity() * sizeof(BVHNode)
+            + bvh.indices.capacity() * sizeof(uint32_t);
+    }
+};
+
+/*
+    Prints what a mesh costs per triangle, next to what the same triangles cost when every face
+    kept its own copies of 3 vertices, 3 vertex normals, 3 texture coordinates, a surface normal,
+    a barycentric scratch vector, flags and an object pointer.
+*/
+inline void print_mesh_memory_report(std::ostream& out, Mesh& mesh)
+{
+    const size_t per_face_copy_bytes = 8 * sizeof(Vector3) + 3 * sizeof(Point) + sizeof(float) + sizeof(void*);
+    size_t triangle_count = std::max<size_t>(1, mesh.triangles.size());
+    size_t bvh_bytes = mesh.bvh.nodes.capacity() * sizeof(BVHNode) + mesh.bvh.indices.capacity() * sizeof(uint32_t);
+    size_t total = mesh.memory_usage();
+
+    out << "Mesh '" << mesh.name << "': " << mesh.triangles.size() << " triangles, " << mesh.positions.size() << " vertices"
+        << (mesh.compressed ? " (compressed attributes)" : "") << std::endl;
+    out << "  positions " << mesh.positions.capacity() * sizeof(Vector3)
+        << " B, normals " << mesh.normals.capacity() * sizeof(Vector3) + mesh.packed_normals.capacity() * sizeof(uint32_t)
+        << " B, texture coords " << mesh.texture_coords.capacity() * sizeof(Point) + mesh.packed_texture_coords.capacity() * sizeof(uint32_t)
+        << " B, indices " << mesh.triangles.capacity() * sizeof(MeshTriangle) + mesh.smooth_shading.capacity() / 8 + mesh.triangle_materials.capacity() * sizeof(uint16_t)
+        << " B, intersection data " << mesh.intersection_data.capacity() * sizeof(TriangleIntersectionData)
+        << " B, bvh " << bvh_bytes << " B" << std::endl;
+    out << "  " << static_cast<double>(total - bvh_bytes) / triangle_count << " bytes/triangle indexed (+"
+        << static_cast<double>(bvh_bytes) / triangle_count << " bvh), "
+        << per_face_copy_bytes << " bytes/triangle as per-face copies" << std::endl;
+}
+
+/*
+    A placement of a mesh in the scene. Only the transform and material are stored per instance.
+*/
+struct Instance
+{
+    Mesh* mesh;
+    Mat4 object_to_world;
+    Mat4 world_to_object;
+    AABB bounds; // World space
+    SceneObjectInfo* object_info; // Material override, or fallback for triangles without a mesh material
+    std::vector<SceneObjectInfo*> material_infos; // Per mesh material when the mesh's own materials are used. Share object_info's id
+
+    /*
+        Object info a hit on the given triangle is shaded with
+    */
+    SceneObjectInfo* object_info_for(uint32_t triangle)
+    {
+        if (material_infos.empty() || mesh->triangle_materials.empty()) {
+            return object_info;
+        }
+        uint16_t material = mesh->triangle_materials[triangle];
+        return material == Mesh::no_material ? object_info : material_infos[material];
+    }
+
+    void compute_bounds()
+    {
+        AABB local = mesh->bvh.bounds();
+        bounds = AABB();
+        if (local.empty()) {
+            return;
+        }
+        for (int corner = 0; corner < 8; corner++) {
+            Vector3 p = {
+                .x = (corner & 1) ? local.max.x : local.min.x,
+                .y = (corner & 2) ? local.max.y : local.min.y,
+                .z = (corner & 4) ? local.max.z : local.min.z
+            };
+            bounds.extend(object_to_world.transform_point(p));
+        }
+    }
+};
+
+/**
+ * @brief Reads a row-major 3x4 or 4x4 transform from command arguments.
+ * @returns The transform. The bottom row is 0 0 0 1 when only 12 values are given.
+ * @param arguments Command arguments
+ * @param first Index of the first matrix value within arguments
+**/
+inline Mat4 parse_transform(std::vector<std::string>& arguments, size_t first)
+{
+    size_t count = arguments.size() - first;
+    if (count != 12 && count != 16) {
+        throw std::invalid_argument("ERROR: Transform requires 12 or 16 values. Please verify.");
+    }
+    Mat4 transform = Mat4::identity();
+    for (size_t i = 0; i < count; i++) {
+        transform.m[i / 4][i % 4] = std::stof(arguments[first + i]);
+    }
+    return transform;
+}
+
+/**
+ * @brief Intersects a ray with a single triangle, using the data precomputed by Mesh::finalize().
+ * Watertight: a ray through an edge or vertex shared by several triangles hits at least one of them.
+ * @returns True if the ray hits the triangle, edges included, in front of its origin. info then holds the hit.
+ * @param mesh Mesh holding the triangle
+ * @param triangle Index of the triangle within the mesh
+ * @param ray Ray set up for the test. Need not be normalized; distance is measured in multiples of it.
+ * @param info Receives distance, point, shading normal and barycentric coordinates
+**/
+inline bool intersect_face(Mesh* mesh, uint32_t triangle, WatertightRay& ray, Intersection& info)
+{
+    STATS_COUNT(intersection_tests[PRIMITIVE_TRIANGLE]);
+    TriangleIntersectionData& face = mesh->intersection_data[triangle];
+
+    /*
+        Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection" (JCGT 2013).
+        The vertices are moved into the ray's frame, where the ray starts at the origin and runs along +z.
+        The 2D edge functions U, V and W of the sheared triangle are then its unnormalized barycentric
+        coordinates for p0, p1 and p2, and the ray hits the triangle when they all have the same sign.
+        Edges evaluate to exactly 0 in both triangles that share them, so a point on an edge cannot be
+        missed by both; exact zeros are recomputed in double precision to break ties consistently.
+    */
+    Vector3 a = face.p[0] - ray.origin;
+    Vector3 b = face.p[1] - ray.origin;
+    Vector3 c = face.p[2] - ray.origin;
+    float az = component(a, ray.kz);
+    float bz = component(b, ray.kz);
+    float cz = component(c, ray.kz);
+    float ax = component(a, ray.kx) - ray.shear_x * az;
+    float ay = component(a, ray.ky) - ray.shear_y * az;
+    float bx = component(b, ray.kx) - ray.shear_x * bz;
+    float by = component(b, ray.ky) - ray.shear_y * bz;
+    float cx = component(c, ray.kx) - ray.shear_x * cz;
+    float cy = component(c, ray.ky) - ray.shear_y * cz;
+
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+    if (u == 0.0f || v == 0.0f || w == 0.0f) {
+        u = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+        v = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+        w = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+    }
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) {
+        return false;
+    }
+    float det = u + v + w;
+    if (det == 0.0f) {
+        return false; // Ray in the triangle's plane, or degenerate triangle
+    }
+
+    // Scaled distance, rejected before dividing when the hit is behind the ray's origin
+    float scaled_distance = ray.shear_z * (u * az + v * bz + w * cz);
+    if ((det > 0.0f) ? scaled_distance <= 0.0f : scaled_distance >= 0.0f) {
+        return false;
+    }
+    float inverse_det = 1.0f / det;
+    float distance = scaled_distance * inverse_det;
+    float bary_a = u * inverse_det;
+    float bary_b = v * inverse_det;
+    float bary_g = w * inverse_det;
+    MeshTriangle& face_object = mesh->triangles[triangle];
+
+    info.barycentric_cords = {
+        .x = bary_a,
+        .y = bary_b,
+        .z = bary_g
+    };
+
+    // Vertex normals are stored normalized, and decoded here when compressed
+    if (mesh->smooth_shading[triangle]) {
+        info.normal = (
+            (mesh->vertex_normal(face_object.vertex[0]) * bary_a) +
+            (mesh->vertex_normal(face_object.vertex[1]) * bary_b) +
+            (mesh->vertex_normal(face_object.vertex[2]) * bary_g)
+        ).norm();
+    } else {
+        info.normal = face.normal;
+    }
+
+    info.distance = distance;
+    info.point = ray.origin + (ray.direction * distance);
+    info.mesh = mesh;
+    info.triangle = triangle;
+    return true;
+}
+
+/**
+ * @brief Intersects a ray with every triangle of an instanced mesh, via the mesh's bottom level BVH.
+ * The ray is moved into object space rather than transforming the mesh.
+ * @param instance Mesh instance to test
+ * @param view_origin origin of the ray (world space)
+ * @param ray Outgoing ray (world space)
+ * @param intersections Receives every hit, with points and normals in world space
+**/
+inline void intersect_instance(Instance* instance, Vector3 view_origin, Vector3 ray, std::vector<Intersection>& intersections)
+{
+    STATS_COUNT(intersection_tests[PRIMITIVE_INSTANCE]);
+    Vector3 local_origin = instance->world_to_object.transform_point(view_origin);
+    Vector3 local_ray = instance->world_to_object.transform_vector(ray);
+    Mesh* mesh = instance->mesh;
+    WatertightRay local_setup(local_origin, local_ray);
+
+    mesh->bvh.traverse(local_origin, local_ray, [&](uint32_t index) {
+        Intersection info;
+        if (intersect_face(mesh, index, local_setup, info)) {
+            // The ray was not renormalized, so distance is still measured along the world ray
+            info.point = view_origin + (ray * info.distance);
+            info.normal = instance->world_to_object.transform_normal(info.normal).norm();
+            intersections.push_back(info);
+        }
+    });
+}
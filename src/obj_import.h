@@ -0,0 +1,485 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "definitions.h"
+#include "mesh.h"
+#include "utility.h"
+#include "trace.h"
+
+/*
+    Read-only view of a whole file. Memory-mapped where available, otherwise read into memory.
+*/
+class MappedFile
+{
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    std::string m_buffer;
+    bool m_mapped = false;
+
+public:
+    MappedFile(const std::string& path)
+    {
+#ifndef _WIN32
+        int descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor >= 0) {
+            struct stat info;
+            if (fstat(descriptor, &info) == 0 && info.st_size > 0) {
+                void* mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+                if (mapping != MAP_FAILED) {
+                    madvise(mapping, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+                    m_data = static_cast<const char*>(mapping);
+                    m_size = static_cast<size_t>(info.st_size);
+                    m_mapped = true;
+                }
+            }
+            close(descriptor);
+            if (m_mapped) {
+                return;
+            }
+        }
+#endif
+        std::ifstream input_file(path, std::ios::binary);
+        if (!input_file.is_open()) {
+            throw std::invalid_argument("ERROR: Unable to open '" + path + "'. Please verify path.");
+        }
+        m_buffer.assign(std::istreambuf_iterator<char>(input_file), std::istreambuf_iterator<char>());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (m_mapped) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() { return m_data; }
+    size_t size() { return m_size; }
+};
+
+/*
+    One corner of an OBJ face. Indices are 1-based and global, 0 if absent. Negative (relative)
+    indices are stored resolved against the chunk they were read in and flagged in "relative",
+    since the number of elements in earlier chunks is not known until every chunk is parsed.
+*/
+struct ObjCorner
+{
+    int64_t index[3]; // position, texture coordinate, normal
+    uint8_t relative = 0; // Bit k set when index[k] is a 0-based offset from the start of the chunk
+};
+
+/*
+    Everything read from one line-aligned slice of an OBJ file
+*/
+struct ObjChunk
+{
+    std::vector<Vector3> positions;
+    std::vector<Point> texture_coords;
+    std::vector<Vector3> normals;
+    std::vector<ObjCorner> corners;
+    std::vector<uint32_t> face_sizes; // Corners per face, in file order
+    std::vector<std::pair<size_t, std::string>> material_changes; // ('usemtl' before face index, material name)
+    std::vector<std::string> material_libraries;
+    std::string error;
+};
+
+/*
+    Skips spaces and tabs, not newlines
+*/
+inline const char* obj_skip_blank(const char* cursor, const char* end)
+{
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) cursor++;
+    return cursor;
+}
+
+inline const char* obj_read_float(const char* cursor, const char* end, float& value)
+{
+    cursor = obj_skip_blank(cursor, end);
+    if (cursor < end && *cursor == '+') cursor++;
+    auto [next, error] = std::from_chars(cursor, end, value);
+    if (error != std::errc()) {
+        throw std::invalid_argument("expected a number");
+    }
+    return next;
+}
+
+inline std::string obj_read_rest_of_line(const char* cursor, const char* end)
+{
+    cursor = obj_skip_blank(cursor, end);
+    const char* line_end = cursor;
+    while (line_end < end && *line_end != '\n') line_end++;
+    while (line_end > cursor && isspace(static_cast<unsigned char>(line_end[-1]))) line_end--;
+    return std::string(cursor, line_end);
+}
+
+/**
+ * @brief Parses the lines in [begin, end) of an OBJ file. begin and end must fall on line starts.
+ * @param begin First byte of the chunk
+ * @param end One past the last byte of the chunk
+ * @param chunk Receives the chunk's elements. chunk.error is set instead of throwing.
+**/
+inline void parse_obj_chunk(const char* begin, const char* end, ObjChunk& chunk)
+{
+    const char* cursor = begin;
+    try
+    {
+        while (cursor < end) {
+            cursor = obj_skip_blank(cursor, end);
+            const char* keyword = cursor;
+            while (cursor < end && !isspace(static_cast<unsigned char>(*cursor))) cursor++;
+            std::string_view command(keyword, cursor - keyword);
+
+            if (command == "v") {
+                Vector3 position;
+                cursor = obj_read_float(cursor, end, position.x);
+                cursor = obj_read_float(cursor, end, position.y);
+                cursor = obj_read_float(cursor, end, position.z);
+                chunk.positions.push_back(position);
+            } else if (command == "vn") {
+                Vector3 normal;
+                cursor = obj_read_float(cursor, end, normal.x);
+                cursor = obj_read_float(cursor, end, normal.y);
+                cursor = obj_read_float(cursor, end, normal.z);
+                chunk.normals.push_back(normal);
+            } else if (command == "vt") {
+                Point coord;
+                cursor = obj_read_float(cursor, end, coord.x);
+                cursor = obj_read_float(cursor, end, coord.y);
+                chunk.texture_coords.push_back(coord);
+            } else if (command == "f") {
+                uint32_t corner_count = 0;
+                int64_t counts[3] = {
+                    static_cast<int64_t>(chunk.positions.size()),
+                    static_cast<int64_t>(chunk.texture_coords.size()),
+                    static_cast<int64_t>(chunk.normals.size())
+                };
+                while (true) {
+                    cursor = obj_skip_blank(cursor, end);
+                    if (cursor >= end || *cursor == '\n' || *cursor == '#') {
+                        break;
+                    }
+                    // v, v/t, v//n or v/t/n
+                    ObjCorner corner = { { 0, 0, 0 }, 0 };
+                    for (int k = 0; k < 3; k++) {
+                        if (k > 0) {
+                            if (cursor >= end || *cursor != '/') break;
+                            cursor++;
+                            if (cursor < end && *cursor == '/') continue; // Empty texture coordinate
+                        }
+                        int64_t index = 0;
+                        auto [next, error] = std::from_chars(cursor, end, index);
+                        if (error != std::errc() || index == 0) {
+                            throw std::invalid_argument("invalid face index");
+                        }
+                        cursor = next;
+                        if (index < 0) {
+                            corner.index[k] = counts[k] + index;
+                            corner.relative |= (1 << k);
+                        } else {
+                            corner.index[k] = index;
+                        }
+                    }
+                    chunk.corners.push_back(corner);
+                    corner_count++;
+                }
+                if (corner_count < 3) {
+                    throw std::invalid_argument("face with fewer than 3 vertices");
+                }
+                chunk.face_sizes.push_back(corner_count);
+            } else if (command == "usemtl") {
+                chunk.material_changes.push_back({ chunk.face_sizes.size(), obj_read_rest_of_line(cursor, end) });
+            } else if (command == "mtllib") {
+                chunk.material_libraries.push_back(obj_read_rest_of_line(cursor, end));
+            }
+            // Anything else (comments, 'o', 'g', 's', ...) is ignored
+
+            while (cursor < end && *cursor != '\n') cursor++;
+            cursor++;
+        }
+    }
+    catch(const std::exception& e)
+    {
+        const char* line_start = cursor;
+        while (line_start > begin && line_start[-1] != '\n') line_start--;
+        const char* line_end = cursor;
+        while (line_end < end && *line_end != '\n') line_end++;
+        chunk.error = std::string(e.what()) + " in line '" + std::string(line_start, line_end) + "'";
+    }
+}
+
+/**
+ * @brief Reads a Wavefront .mtl file. Kd/Ks become the diffuse/specular colors, the largest Ka
+ * component the ambient weight, Ns the specular falloff, d (or 1 - Tr) the opacity and Ni the
+ * refraction index. map_Kd is loaded as the texture when it is a PPM file.
+ * @param path Path of the .mtl file
+ * @param materials Receives each material
+ * @param arena Owns the textures
+ * @param cache Keeps the textures' decoded tiles
+ * @param loader Optional. Indexes the textures in the background, see read_texture
+**/
+inline void read_mtl(std::string path, std::vector<MeshMaterial>& materials, SceneArena& arena, TextureCache& cache, BackgroundLoader* loader = nullptr)
+{
+    std::ifstream input_file(path);
+    if (!input_file.is_open()) {
+        std::cerr << "WARNING: Unable to open material library '" << path << "'. Using current material." << std::endl;
+        return;
+    }
+    std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+    std::string line;
+    MeshMaterial* current = nullptr;
+    while (std::getline(input_file, line)) {
+        std::istringstream ss(line);
+        std::string command;
+        if (!(ss >> command) || command[0] == '#') {
+            continue;
+        }
+        if (command == "newmtl") {
+            MeshMaterial material;
+            ss >> material.name;
+            material.material = {
+                .diffuse = { 0.8f, 0.8f, 0.8f },
+                .specular = { 0.0f, 0.0f, 0.0f },
+                .ka = 0.1f, .kd = 1.0f, .ks = 0.0f, .n = 10.0f,
+                .opacity = 1.0f, .refraction_index = 1.0f
+            };
+            materials.push_back(material);
+            current = &materials.back();
+            continue;
+        }
+        if (current == nullptr) {
+            continue;
+        }
+        Material& material = current->material;
+        if (command == "Kd") {
+            ss >> material.diffuse.r >> material.diffuse.g >> material.diffuse.b;
+        } else if (command == "Ks") {
+            ss >> material.specular.r >> material.specular.g >> material.specular.b;
+            material.ks = (material.specular.r + material.specular.g + material.specular.b) > 0.0f ? 1.0f : 0.0f;
+        } else if (command == "Ka") {
+            Color ambient;
+            ss >> ambient.r >> ambient.g >> ambient.b;
+            material.ka = std::max({ ambient.r, ambient.g, ambient.b });
+        } else if (command == "Ns") {
+            ss >> material.n;
+        } else if (command == "d") {
+            ss >> material.opacity;
+        } else if (command == "Tr") {
+            float transparency = 0.0f;
+            ss >> transparency;
+            material.opacity = 1.0f - transparency;
+        } else if (command == "Ni") {
+            ss >> material.refraction_index;
+        } else if (command == "map_Kd") {
+            std::string texture_path;
+            std::getline(ss >> std::ws, texture_path);
+            if (texture_path.size() >= 4 && texture_path.substr(texture_path.size() - 4) == ".ppm") {
+                current->texture = read_texture(directory + texture_path, arena, cache, loader);
+            } else {
+                std::cerr << "WARNING: Only PPM textures are supported, ignoring '" << texture_path << "'." << std::endl;
+            }
+        }
+        material.opacity = std::clamp<float>(material.opacity, 0.0, 1.0);
+    }
+}
+
+/**
+ * @brief Imports a Wavefront .obj file (and the .mtl files it references) into indexed mesh storage.
+ * The file is memory-mapped and split into line-aligned chunks that are parsed in parallel, then merged
+ * in file order so negative (relative) indices and 'usemtl' spans resolve exactly as in a serial read.
+ * Polygons with more than 3 vertices are fan triangulated.
+ * @returns A new mesh with its bottom level BVH built
+ * @param path Path of the .obj file
+ * @param thread_count Number of parser threads
+ * @param compressed Store vertex attributes compressed (see Mesh)
+ * @param arena Owns the mesh and its textures
+ * @param cache Keeps the decoded tiles of the textures of the .mtl files
+ * @param loader Optional. Indexes the textures of the .mtl files in the background, see read_texture
+**/
+inline Mesh* import_obj(std::string path, unsigned int thread_count, bool compressed, SceneArena& arena, TextureCache& cache, BackgroundLoader* loader = nullptr)
+{
+    TraceSpan span("import_obj", "load", path);
+    auto start = std::chrono::steady_clock::now();
+    MappedFile file(path);
+    const char* data = file.data();
+    size_t size = file.size();
+
+    /*
+        Split into roughly equal chunks, moving each boundary forward to the next line start
+    */
+    thread_count = std::max(1u, thread_count);
+    size_t chunk_count = std::max<size_t>(1, std::min<size_t>(thread_count * 4, size / (1 << 20)));
+    std::vector<size_t> boundaries(chunk_count + 1, size);
+    boundaries[0] = 0;
+    for (size_t i = 1; i < chunk_count; i++) {
+        size_t boundary = std::max(boundaries[i - 1], size * i / chunk_count);
+        while (boundary < size && boundary > 0 && data[boundary - 1] != '\n') boundary++;
+        boundaries[i] = boundary;
+    }
+
+    std::vector<ObjChunk> chunks(chunk_count);
+    std::atomic<size_t> next_chunk = 0;
+    auto worker = [&]() {
+        TraceSpan parse_span("parse_obj_chunks", "load");
+        for (size_t i = next_chunk++; i < chunk_count; i = next_chunk++) {
+            parse_obj_chunk(data + boundaries[i], data + boundaries[i + 1], chunks[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < std::min<size_t>(thread_count, chunk_count); i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+
+    for (ObjChunk& chunk : chunks) {
+        if (!chunk.error.empty()) {
+            throw std::invalid_argument("ERROR: Invalid OBJ '" + path + "': " + chunk.error);
+        }
+    }
+
+    /*
+        Merge in file order. Attribute arrays are concatenated, then each face corner is resolved to
+        a global index and deduplicated into the mesh's vertices.
+    */
+    Mesh* mesh = arena.create<Mesh>();
+    mesh->name = path;
+    mesh->compressed = compressed;
+    std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+    std::vector<Vector3> positions;
+    std::vector<Point> texture_coords;
+    std::vector<Vector3> normals;
+    std::vector<int64_t> bases[3];
+    size_t face_total = 0;
+    for (ObjChunk& chunk : chunks) {
+        bases[0].push_back(static_cast<int64_t>(positions.size()));
+        bases[1].push_back(static_cast<int64_t>(texture_coords.size()));
+        bases[2].push_back(static_cast<int64_t>(normals.size()));
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        texture_coords.insert(texture_coords.end(), chunk.texture_coords.begin(), chunk.texture_coords.end());
+        normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+        for (std::string& library : chunk.material_libraries) {
+            read_mtl(directory + library, mesh->materials, arena, cache, loader);
+        }
+        for (uint32_t face_size : chunk.face_sizes) {
+            face_total += face_size - 2;
+        }
+        std::vector<Vector3>().swap(chunk.positions);
+        std::vector<Point>().swap(chunk.texture_coords);
+        std::vector<Vector3>().swap(chunk.normals);
+    }
+    int64_t sizes[3] = {
+        static_cast<int64_t>(positions.size()),
+        static_cast<int64_t>(texture_coords.size()),
+        static_cast<int64_t>(normals.size())
+    };
+
+    std::map<std::string, uint16_t> material_indices;
+    for (size_t i = 0; i < mesh->materials.size() && i < Mesh::no_material; i++) {
+        material_indices[mesh->materials[i].name] = static_cast<uint16_t>(i);
+    }
+
+    mesh->triangles.reserve(face_total);
+    mesh->vertex_lookup.reserve(positions.size());
+    if (!mesh->materials.empty()) {
+        mesh->triangle_materials.reserve(face_total);
+    }
+
+    uint16_t current_material = Mesh::no_material;
+    for (size_t c = 0; c < chunk_count; c++) {
+        ObjChunk& chunk = chunks[c];
+        size_t corner = 0;
+        size_t material_change = 0;
+        for (size_t face = 0; face < chunk.face_sizes.size(); face++) {
+            while (material_change < chunk.material_changes.size() && chunk.material_changes[material_change].first == face) {
+                auto found = material_indices.find(chunk.material_changes[material_change].second);
+                current_material = found != material_indices.end() ? found->second : Mesh::no_material;
+                material_change++;
+            }
+
+            uint32_t face_size = chunk.face_sizes[face];
+            uint32_t vertices[3] = { 0, 0, 0 };
+            bool smooth_shading = true;
+            for (uint32_t i = 0; i < face_size; i++) {
+                ObjCorner& source = chunk.corners[corner + i];
+                uint32_t resolved[3];
+                for (int k = 0; k < 3; k++) {
+                    int64_t index = (source.relative & (1 << k)) ? bases[k][c] + source.index[k] + 1 : source.index[k];
+                    if (index < 0 || index > sizes[k] || (k == 0 && index == 0)) {
+                        throw std::invalid_argument("ERROR: Face index out of range in OBJ '" + path + "'.");
+                    }
+                    resolved[k] = static_cast<uint32_t>(index);
+                }
+                smooth_shading = smooth_shading && resolved[2] > 0;
+
+                uint32_t vertex = mesh->add_vertex(
+                    { resolved[0], resolved[1], resolved[2] },
+                    positions[resolved[0] - 1],
+                    resolved[2] > 0 ? normals[resolved[2] - 1] : Vector3({ 0.0f, 0.0f, 0.0f }),
+                    resolved[1] > 0 ? texture_coords[resolved[1] - 1] : Point({ 0.0f, 0.0f })
+                );
+
+                // Fan triangulation around the first corner
+                if (i == 0) {
+                    vertices[0] = vertex;
+                } else if (i == 1) {
+                    vertices[2] = vertex;
+                } else {
+                    vertices[1] = vertices[2];
+                    vertices[2] = vertex;
+                    mesh->add_triangle(vertices[0], vertices[1], vertices[2], false);
+                    if (!mesh->materials.empty()) {
+                        mesh->triangle_materials.push_back(current_material);
+                    }
+                }
+            }
+            // Smooth shading needs a normal on every corner of the polygon
+            for (uint32_t i = 0; i < face_size - 2; i++) {
+                mesh->smooth_shading[mesh->triangles.size() - 1 - i] = smooth_shading;
+            }
+            corner += face_size;
+        }
+        // A usemtl after the chunk's last face applies to the next chunk's faces
+        for (; material_change < chunk.material_changes.size(); material_change++) {
+            auto found = material_indices.find(chunk.material_changes[material_change].second);
+            current_material = found != material_indices.end() ? found->second : Mesh::no_material;
+        }
+        std::vector<std::pair<size_t, std::string>>().swap(chunk.material_changes);
+        std::vector<ObjCorner>().swap(chunk.corners);
+    }
+
+    mesh->build();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Imported '" << path << "': " << mesh->triangles.size() << " triangles, " << mesh->positions.size()
+        << " vertices in " << seconds << " s (" << static_cast<size_t>(mesh->triangles.size() / std::max(seconds, 1e-9))
+        << " triangles/s, " << std::min<size_t>(thread_count, chunk_count) << " threads)" << std::endl;
+    return mesh;
+}
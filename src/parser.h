@@ -0,0 +1,725 @@
+#pragma once
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "definitions.h"
+#include "scene.h"
+#include "mesh.h"
+#include "obj_import.h"
+#include "scene_builder.h"
+#include "utility.h"
+
+
+/*
+    Valid Args for config file:
+
+    eye eyex eyey eyez                         (The location of the 'eye' within scene)
+    viewdir vdirx  vdiry  vdirz                (Defines the direction the 'eye' is looking)
+    updir upx  upy  upz                        (Roll of the camera)
+    hfov fovh                                  (Horizonal field of view)
+    imsize width  height                       (Output image dimentions)
+    bkgcolor r  g  b  η                        (Scene background color. Param η is optional) 
+    mtlcolor Od Od Od Os Os Os ka kd ks n α η  (Material color. Params α η are optional)
+    texture texture.ppm                        (Texture to apply to model)           
+    light x y z w r g b                        (Scene light. Directional or point)
+    spherelight x y z radius r g b             (Spherical area light, casts soft shadows)
+    rectlight x y z ux uy uz vx vy vz r g b    (Rectangular area light centred on x y z with edges u and v)
+    sphere cx  cy  cz  r                       (Sphere defined by center and radiusm)
+    plane x y z nx ny nz [size]                (Infinite plane through x y z with normal n. A texture repeats every 'size' units)
+    disk cx cy cz nx ny nz r                   (Disk with center c, normal n and radius r)
+    box x0 y0 z0 x1 y1 z1 [ax ay az degrees]   (Box between two corners, optionally rotated about its center around axis a)
+    cylinder x0 y0 z0 x1 y1 z1 r               (Closed cylinder between the centers of its caps, with radius r)
+    vn nx ny nz                                (Vertex normal)
+    vt tx ty                                   (texture coordinates)
+    #                                          (Single line comment)
+    f v1/vt1/vn1 v2/vt2/vn2 v3/vt2/vn          (smooth-shaded, textured triangle)
+    f v1//vn1 v2//vn2 v3//vn3                  (smooth-shaded, untextured triangle)
+    f v1/vt1 v2/vt2 v3/vt2                     (non-smooth-shaded, textured triangle)
+    beginmesh name                             (Faces up to 'endmesh' define a reusable mesh instead of scene faces)
+    endmesh                                    (Ends the current mesh definition)
+    instance name m00 m01 ... m23 [m30 .. m33] (Places a mesh with a row-major 3x4 or 4x4 transform and the current material)
+    mesh name file.obj                         (Imports a Wavefront .obj file as a reusable mesh for 'instance')
+    include file.obj [m00 ... m23 [m30 .. m33]] (Places a Wavefront .obj file with its .mtl materials and an optional transform)
+*/
+
+/*
+    Reads scene file commands one line at a time into its scene state, adding objects through
+    SceneBuilder. Keeps the state that carries over between commands (vertex lists, current material, camera).
+*/
+struct SceneParser : SceneBuilder
+{
+    // Storage
+    std::vector<Point> texture_coords;
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> normals;
+
+    Mesh* current_mesh = nullptr; // Set between 'beginmesh' and 'endmesh'
+
+    // Scene related variables
+    Vector3 view_origin;
+    int height = 0, width = 0;
+    Vector3 view_direction;
+    Vector3 view_up;
+    float fov_h;
+    Color background_color;
+
+    /*
+        Parses a single line of a scene file. Blank lines, comments and unknown commands are ignored.
+        Throws if a command's arguments are invalid.
+    */
+    void parse_line(std::string line)
+    {
+        std::vector<std::string> arguments;
+        std::istringstream ss(line);
+        std::string del;
+
+        // Strip line of whitespace
+        while(std::getline(ss, del, ' ')) {
+            // If not blank string or comment
+            if (!del.empty() || del.at(0) != '#') {
+                arguments.push_back(del);
+            }
+        }
+
+        if (arguments.size() == 0) {
+            return;
+        }
+
+        std::string command = arguments[0];
+        arguments.erase(arguments.begin());
+
+        // Hoist switch variables here
+        Vector3 sphere_center;
+        float sphere_radius = 0.0f;
+        Mat4 instance_transform;
+        Light light;
+        Material material;
+        Shape shape;
+
+        // If blank line or invalid command
+        if (argsStringValues.find(command) == argsStringValues.end() || (arguments.size() == 0 && argsStringValues[command] != ArgValues::endmesh)) {
+            return;
+        } else {
+            try
+            {
+                switch (argsStringValues[command])
+                {
+                case ArgValues::eye:
+                    /* 
+                        Extract view origin. Validate correctness.
+                    */
+                    state.commands[command] = arguments;
+
+                    try
+                    {
+                        view_origin = {
+                            .x = std::stof(arguments[0]),
+                            .y = std::stof(arguments[1]),
+                            .z = std::stof(arguments[2])
+                        };
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'eye' command. Please verify.");
+                    }
+                    break;
+                case ArgValues::viewdir:
+                    /*
+                        Extract view direction. Validate Correctness.
+                    */
+                    state.commands[command] = arguments;
+                    try
+                    {
+                        view_direction = {
+                            .x = std::stof(arguments[0]),
+                            .y = std::stof(arguments[1]),
+                            .z = std::stof(arguments[2])
+                        };
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'viewdir' command. Please verify.");
+                    }
+                    break;
+                case ArgValues::updir:
+                    /*
+                        Extract view up. Validate Correctness.
+                    */
+                    state.commands[command] = arguments;
+                    try
+                    {
+                        view_up = {
+                            .x = std::stof(arguments[0]),
+                            .y = std::stof(arguments[1]),
+                            .z = std::stof(arguments[2])
+                        };
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'updir' command. Please verify.");
+                    }
+                    break;
+                case ArgValues::hfov:
+                    /*
+                        Extract horizontal FOV. Validate Correctness.
+                    */
+                    state.commands[command] = arguments;
+                    try
+                    {
+                        fov_h = std::stof(arguments[0]);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'hfov' command. Please verify.");
+                    }
+                    break;
+                case ArgValues::imsize:
+                    /*
+                        Extract height and width. Validate Correctness.
+                    */ 
+                    state.commands[command] = arguments;
+
+                    try
+                    {
+                        height = std::stoi(arguments[1]);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid image dimensions. Please verify.");
+                    }
+
+                    try
+                    {
+                        width = std::stoi(arguments[0]);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid image dimensions. Please verify.");
+                    } 
+
+                    if (height <= 1 || width <= 1) {
+                        throw std::invalid_argument("ERROR: Invalid image dimensions. Please verify.");
+                    }
+
+                    break;
+                case ArgValues::bkgcolor:
+                    /*
+                        Extract background color. Validate Correctness.
+                    */
+                    state.commands[command] = arguments;
+                    try
+                    {
+                        background_color = {
+                            .r = std::stof(arguments[0]),
+                            .g = std::stof(arguments[1]),
+                            .b = std::stof(arguments[2])
+                        };
+
+                        if (arguments.size() > 3) {
+                            state.background_refraction_index = std::stof(arguments[3]);
+                        }
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'bkgcolor' command. Please verify.");
+                    }
+                    break;
+                case ArgValues::mtlcolor:
+                    try
+                    {
+                        material.diffuse = {
+                            .r = std::stof(arguments[0]),
+                            .g = std::stof(arguments[1]),
+                            .b = std::stof(arguments[2])
+                        };
+
+                        material.specular = { 
+                            .r = std::stof(arguments[3]),
+                            .g = std::stof(arguments[4]),
+                            .b = std::stof(arguments[5])
+                        };
+
+                        material.ka = std::stof(arguments[6]);
+                        material.kd = std::stof(arguments[7]);
+                        material.ks = std::stof(arguments[8]);
+                        material.n = std::stof(arguments[9]);
+
+                        if (arguments.size() == 12) {
+                            material.opacity = std::clamp<float>(std::stof(arguments[10]), 0.0, 1.0);
+                            material.refraction_index = std::stof(arguments[11]);
+                        } else {
+                            material.opacity = 1.0; // Fully opaque by default
+                            material.refraction_index = 1.0;
+                        }
+                        set_material(material);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::runtime_error("ERROR: Issue parsing 'material' from arguments. Please verify.");
+                    }
+                    break;
+                case ArgValues::texture:
+                    /*
+                        Because an object's color/texture is relative to previous command
+                        'texture' will overwrite 'mtcolor', and vice versa.
+                    */
+
+                    use_texture = true;
+                    try
+                    {
+                        set_texture(add_texture(arguments[0]));
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::runtime_error("ERROR: Issue reading 'texture' from ppm. Please verify.");
+                    }
+                    break;
+                case ArgValues::sphere:
+                    try
+                    {
+                        sphere_radius = std::stof(arguments[3]);
+                        sphere_center = {
+                            .x = std::stof(arguments[0]), 
+                            .y = std::stof(arguments[1]), 
+                            .z = std::stof(arguments[2])
+                        };
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'sphere' object. Please verify.");
+                    }
+
+                    try
+                    {
+                        add_sphere(sphere_center, sphere_radius);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'mtlcolor' command. Please verify.");
+                    }
+                    break;
+                case ArgValues::plane:
+                    /*
+                        Extract infinite plane: a point on it, its normal and optionally the size of one texture repeat
+                    */
+                    try {
+                        if (arguments.size() != 6 && arguments.size() != 7) {
+                            throw std::invalid_argument("'plane' requires x y z nx ny nz [size].");
+                        }
+                        shape = make_plane(
+                            { .x = std::stof(arguments[0]), .y = std::stof(arguments[1]), .z = std::stof(arguments[2]) },
+                            { .x = std::stof(arguments[3]), .y = std::stof(arguments[4]), .z = std::stof(arguments[5]) },
+                            arguments.size() == 7 ? std::stof(arguments[6]) : 1.0f);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'plane' object. Please verify.");
+                    }
+                    add_parsed_shape(shape);
+                    break;
+                case ArgValues::disk:
+                    /*
+                        Extract disk: center, normal and radius
+                    */
+                    try {
+                        if (arguments.size() != 7) {
+                            throw std::invalid_argument("'disk' requires cx cy cz nx ny nz r.");
+                        }
+                        shape = make_disk(
+                            { .x = std::stof(arguments[0]), .y = std::stof(arguments[1]), .z = std::stof(arguments[2]) },
+                            { .x = std::stof(arguments[3]), .y = std::stof(arguments[4]), .z = std::stof(arguments[5]) },
+                            std::stof(arguments[6]));
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'disk' object. Please verify.");
+                    }
+                    add_parsed_shape(shape);
+                    break;
+                case ArgValues::box:
+                    /*
+                        Extract box: its two corners, and optionally a rotation axis and angle in degrees
+                    */
+                    try {
+                        if (arguments.size() != 6 && arguments.size() != 10) {
+                            throw std::invalid_argument("'box' requires x0 y0 z0 x1 y1 z1 [ax ay az degrees].");
+                        }
+                        Vector3 rotation_axis = { 0.0f, 0.0f, 0.0f };
+                        float degrees = 0.0f;
+                        if (arguments.size() == 10) {
+                            rotation_axis = { .x = std::stof(arguments[6]), .y = std::stof(arguments[7]), .z = std::stof(arguments[8]) };
+                            degrees = std::stof(arguments[9]);
+                        }
+                        shape = make_box(
+                            { .x = std::stof(arguments[0]), .y = std::stof(arguments[1]), .z = std::stof(arguments[2]) },
+                            { .x = std::stof(arguments[3]), .y = std::stof(arguments[4]), .z = std::stof(arguments[5]) },
+                            rotation_axis, degrees);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'box' object. Please verify.");
+                    }
+                    add_parsed_shape(shape);
+                    break;
+                case ArgValues::cylinder:
+                    /*
+                        Extract cylinder: the centers of its caps and its radius
+                    */
+                    try {
+                        if (arguments.size() != 7) {
+                            throw std::invalid_argument("'cylinder' requires x0 y0 z0 x1 y1 z1 r.");
+                        }
+                        shape = make_cylinder(
+                            { .x = std::stof(arguments[0]), .y = std::stof(arguments[1]), .z = std::stof(arguments[2]) },
+                            { .x = std::stof(arguments[3]), .y = std::stof(arguments[4]), .z = std::stof(arguments[5]) },
+                            std::stof(arguments[6]));
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'cylinder' object. Please verify.");
+                    }
+                    add_parsed_shape(shape);
+                    break;
+                case ArgValues::light:
+                    /*
+                        Extract light. Validate Correctness.
+                    */
+                    try {
+                        light.w = std::stof(arguments[3]);
+                        if (light.w == 0) {
+                            light.direction = {
+                                .x = std::stof(arguments[0]),
+                                .y = std::stof(arguments[1]),
+                                .z = std::stof(arguments[2])
+                            };
+                        } else {
+                            light.position = {
+                                .x = std::stof(arguments[0]),
+                                .y = std::stof(arguments[1]),
+                                .z = std::stof(arguments[2])
+                            };
+                        }
+
+                        light.color = { 
+                            .r = std::stof(arguments[4]),
+                            .g = std::stof(arguments[5]),
+                            .b = std::stof(arguments[6])
+                        };
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'light' command. Please verify.");
+                    }
+
+                    add_light(light);
+                    break;
+                case ArgValues::spherelight:
+                    /*
+                        Extract spherical area light: center, radius and color
+                    */
+                    try {
+                        if (arguments.size() != 7) {
+                            throw std::invalid_argument("'spherelight' requires x y z radius r g b.");
+                        }
+                        light.shape = LIGHT_SPHERE;
+                        light.w = 1.0f;
+                        light.position = { .x = std::stof(arguments[0]), .y = std::stof(arguments[1]), .z = std::stof(arguments[2]) };
+                        light.radius = std::stof(arguments[3]);
+                        light.color = { .r = std::stof(arguments[4]), .g = std::stof(arguments[5]), .b = std::stof(arguments[6]) };
+                        add_light(light);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'spherelight' command. Please verify.");
+                    }
+                    break;
+                case ArgValues::rectlight:
+                    /*
+                        Extract rectangular area light: center, the two edge vectors and color
+                    */
+                    try {
+                        if (arguments.size() != 12) {
+                            throw std::invalid_argument("'rectlight' requires x y z ux uy uz vx vy vz r g b.");
+                        }
+                        light.shape = LIGHT_RECTANGLE;
+                        light.w = 1.0f;
+                        light.position = { .x = std::stof(arguments[0]), .y = std::stof(arguments[1]), .z = std::stof(arguments[2]) };
+                        light.edge_u = { .x = std::stof(arguments[3]), .y = std::stof(arguments[4]), .z = std::stof(arguments[5]) };
+                        light.edge_v = { .x = std::stof(arguments[6]), .y = std::stof(arguments[7]), .z = std::stof(arguments[8]) };
+                        light.color = { .r = std::stof(arguments[9]), .g = std::stof(arguments[10]), .b = std::stof(arguments[11]) };
+                        add_light(light);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'rectlight' command. Please verify.");
+                    }
+                    break;
+                case ArgValues::v:
+                    /*
+                        Extract Vertex. Validate Correctness.
+                    */
+                    try
+                    {
+                        vertices.push_back({
+                            .x = std::stof(arguments[0]),
+                            .y = std::stof(arguments[1]),
+                            .z = std::stof(arguments[2])
+                        });
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for vertex. Please verify.");
+                    }
+                    break;
+                case ArgValues::vn:
+                    /*
+                        Extract Vertex normal. Validate Correctness.
+                    */
+                    try
+                    {
+                        normals.push_back({
+                            .x = std::stof(arguments[0]),
+                            .y = std::stof(arguments[1]),
+                            .z = std::stof(arguments[2])
+                        });
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for vertex normal. Please verify.");
+                    }
+                    break;
+                case ArgValues::vt:
+                    /*
+                        Extract texture coordinate. Validate Correctness.
+                    */
+                    try
+                    {
+                        Point coord = {
+                            .x = std::stof(arguments[0]),
+                            .y = std::stof(arguments[1])
+                        };
+
+                        texture_coords.push_back(coord);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for texture coordinate. Please verify.");
+                    }
+                    break;
+                case ArgValues::f:
+                    /*
+                        Extract Face. Validate Correctness.
+                    */
+                    try
+                    {
+                        Mesh* target_mesh = current_mesh != nullptr ? current_mesh : &state.scene_mesh;
+                        uint32_t face_vertices[3];
+                        bool smooth_shading = false;
+                        for (int i = 0; i < 3; i++) {
+                            // Parse for vertex normals and/or texture coordinates. 0 means absent.
+                            unsigned int t = 0; // Texture coord
+                            unsigned int n = 0; // Normal
+                            unsigned int v = 0; // Vertex
+                            if (sscanf(arguments[i].c_str(), "%d/%d/%d", &v, &t, &n ) == 3) {
+                                // success reading a face in v/t/n format. For a smooth shaded, textured triangle.
+                                smooth_shading = true;
+
+                            } else if (sscanf(arguments[i].c_str(), "%d//%d", &v, &n ) == 2) {
+                                //success reading a face in v//n format. For a smooth shaded, untextured triangle.
+                                t = 0;
+                                smooth_shading = true;
+
+                            } else if (sscanf(arguments[i].c_str(), "%d/%d", &v, &t) == 2) {
+                                // success reading a face in v/t format. For a non-smooth shaded, textured triangle.
+                                n = 0;
+                                smooth_shading = false;
+
+                            } else if (sscanf(arguments[i].c_str(), "%d", &v) == 1) {
+                                // success reading a face in v format; proceed accordingly
+                                t = 0;
+                                n = 0;
+                                smooth_shading = false;
+                            } else {
+                                // error reading face data
+                                throw std::invalid_argument("ERROR: Invalid args for 'f' object. Please verify.");
+                            }
+
+                            // Triangles sharing a (v, vt, vn) combination share the vertex. Undefined indices read as zero.
+                            face_vertices[i] = target_mesh->add_vertex(
+                                { v, t, n },
+                                (v > 0 && v <= vertices.size()) ? vertices[v - 1] : Vector3({ 0.0f, 0.0f, 0.0f }),
+                                (n > 0 && n <= normals.size()) ? normals[n - 1] : Vector3({ 0.0f, 0.0f, 0.0f }),
+                                (t > 0 && t <= texture_coords.size()) ? texture_coords[t - 1] : Point({ 0.0f, 0.0f })
+                            );
+                        };
+
+                        // Faces of a mesh definition get their material from each instance
+                        if (current_mesh != nullptr) {
+                            current_mesh->add_triangle(face_vertices[0], face_vertices[1], face_vertices[2], smooth_shading);
+                            break;
+                        }
+
+                        add_face(face_vertices, smooth_shading);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'f' (face) object. Please verify.");
+                    }
+                    /* code */
+                    break;
+                case ArgValues::beginmesh:
+                    /*
+                        Start collecting faces into a named mesh. 'v', 'vn' and 'vt' keep their global numbering.
+                    */
+                    if (current_mesh != nullptr) {
+                        throw std::invalid_argument("ERROR: 'beginmesh' cannot be nested. Please verify.");
+                    }
+                    if (state.meshes.find(arguments[0]) != state.meshes.end()) {
+                        throw std::invalid_argument("ERROR: Mesh '" + arguments[0] + "' is already defined. Please verify.");
+                    }
+                    current_mesh = state.arena.create<Mesh>();
+                    current_mesh->name = arguments[0];
+                    current_mesh->compressed = state.compress_vertices;
+                    break;
+                case ArgValues::endmesh:
+                    if (current_mesh == nullptr) {
+                        throw std::invalid_argument("ERROR: 'endmesh' without 'beginmesh'. Please verify.");
+                    }
+                    current_mesh->build();
+                    state.meshes[current_mesh->name] = current_mesh;
+                    current_mesh = nullptr;
+                    break;
+                case ArgValues::instance:
+                    /*
+                        Extract mesh instance. Validate Correctness.
+                    */
+                    if (state.meshes.find(arguments[0]) == state.meshes.end()) {
+                        throw std::invalid_argument("ERROR: Unknown mesh '" + arguments[0] + "' for 'instance'. Please verify.");
+                    }
+                    if (arguments.size() != 13 && arguments.size() != 17) {
+                        throw std::invalid_argument("ERROR: 'instance' requires a 3x4 or 4x4 transform. Please verify.");
+                    }
+
+                    try
+                    {
+                        instance_transform = parse_transform(arguments, 1);
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'instance' command. Please verify.");
+                    }
+                    add_instance(state.meshes[arguments[0]], instance_transform);
+                    break;
+                case ArgValues::mesh:
+                    /*
+                        Import a Wavefront .obj file as a named mesh. Instances of it use the current material.
+                    */
+                    if (arguments.size() != 2) {
+                        throw std::invalid_argument("ERROR: 'mesh' requires a name and an .obj file. Please verify.");
+                    }
+                    if (state.meshes.find(arguments[0]) != state.meshes.end()) {
+                        throw std::invalid_argument("ERROR: Mesh '" + arguments[0] + "' is already defined. Please verify.");
+                    }
+                    state.meshes[arguments[0]] = import_obj(
+                        arguments[1], state.settings.threads, state.compress_vertices, state.arena, state.texture_cache,
+                        state.serial_startup ? nullptr : &state.loader
+                    );
+                    state.meshes[arguments[0]]->name = arguments[0];
+                    break;
+                case ArgValues::include:
+                    /*
+                        Place a Wavefront .obj file in the scene, shaded with the materials of its .mtl files.
+                        Faces without a material fall back to the current material.
+                        The file is imported once no matter how often it is included.
+                    */
+                    if (arguments.size() != 1 && arguments.size() != 13 && arguments.size() != 17) {
+                        throw std::invalid_argument("ERROR: 'include' requires an .obj file and an optional 3x4 or 4x4 transform. Please verify.");
+                    }
+                    if (state.meshes.find(arguments[0]) == state.meshes.end()) {
+                        state.meshes[arguments[0]] = import_obj(
+                            arguments[0], state.settings.threads, state.compress_vertices, state.arena, state.texture_cache,
+                            state.serial_startup ? nullptr : &state.loader
+                        );
+                    }
+
+                    try
+                    {
+                        instance_transform = arguments.size() > 1 ? parse_transform(arguments, 1) : Mat4::identity();
+                    }
+                    catch(const std::exception& e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                        throw std::invalid_argument("ERROR: Invalid args for 'include' command. Please verify.");
+                    }
+                    add_instance(state.meshes[arguments[0]], instance_transform, true);
+                    break;
+                default:
+                    break;
+                }
+            }
+            catch(const std::exception& e)
+            {
+                std::cerr << e.what() << std::endl;
+                throw std::invalid_argument("ERROR: Command '" + command + "' is undefined. Please verify input.");
+            }   
+        }
+    }
+
+    /**
+     * @brief Parses every line of a scene file
+     * @returns False if the file could not be opened
+     * @param path Path of the scene file
+    **/
+    bool parse_file(std::string path)
+    {
+        std::ifstream input_file(path);
+        if (!input_file.is_open()) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(input_file, line)) {
+            parse_line(line);
+        }
+        return true;
+    }
+
+    /*
+        Adds a shape whose arguments were valid. Like 'sphere', it fails without a material.
+    */
+    void add_parsed_shape(Shape shape)
+    {
+        try
+        {
+            add_shape(shape);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            throw std::invalid_argument("ERROR: Invalid args for 'mtlcolor' command. Please verify.");
+        }
+    }
+};
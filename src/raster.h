@@ -0,0 +1,414 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+#include "definitions.h"
+#include "scene.h"
+#include "settings.h"
+#include "mesh.h"
+
+/*
+    What rasterize_tile found for a pixel, when not the index of its visible primitive
+*/
+const int32_t RASTER_BACKGROUND = -1; // No primitive covers the pixel
+const int32_t RASTER_UNRESOLVED = -2; // Too close to an edge or another surface to be sure, or a mesh instance: ray trace
+
+/*
+    Pixels closer than this, in pixels, to a triangle edge or a sphere's outline are ray traced. Well
+    above the rounding of the edge functions, so the rasterizer never disagrees with the intersection tests.
+*/
+const float RASTER_EDGE_TOLERANCE = 1.0f / 64.0f;
+
+/*
+    A surface is only visible for certain when the next one along the ray is this much further away, relative
+*/
+const float RASTER_DEPTH_TOLERANCE = 1.0e-4f;
+
+/*
+    Per pixel coverage and depth functions of one primitive, set up once per frame. With camera rays
+    r(x, y) = a + x * delta_h + y * delta_v through pixel column x and row y, the planes through the camera
+    and each triangle edge give edge functions that are linear in x and y, so triangles are rasterized
+    in homogeneous form: no projection, and nothing to clip where they pass behind the camera.
+*/
+struct RasterPrimitive
+{
+    uint32_t primitive; // Index in SceneState::primitives
+    PrimitiveKind kind;
+    bool always_unresolved; // Seen edge on, a mesh instance or a shape other than a plane: every pixel it may cover is ray traced
+    float edge[3][3] = {}; // Triangles: value at pixel (x, y) is edge[k][0] + x * edge[k][1] + y * edge[k][2]
+    float edge_tolerance[3] = {};
+    float depth_numerator = 0.0f; // Triangles: ray distance is depth_numerator / (depth[0] + x * depth[1] + y * depth[2])
+    float depth[3] = {};
+    Vector3 center = { 0.0f, 0.0f, 0.0f }; // Spheres
+    float radius = 0.0f;
+};
+
+/*
+    Counts over every rasterized frame or band, for '--primary-report'
+*/
+struct PrimaryVisibilityStats
+{
+    std::atomic<uint64_t> resolved = 0; // Pixels whose ray was tested against one primitive
+    std::atomic<uint64_t> background = 0; // Pixels no primitive covers
+    std::atomic<uint64_t> unresolved = 0; // Pixels ray traced
+    uint64_t primitives = 0; // Set up, summed over frames
+    uint64_t bin_entries = 0;
+    double setup_seconds = 0.0;
+};
+
+inline PrimaryVisibilityStats primary_visibility_stats;
+
+class PrimaryVisibility
+{
+private:
+    Vector3 m_origin;
+    Vector3 m_a; // Camera ray through pixel (0, 0)
+    Vector3 m_delta_h;
+    Vector3 m_delta_v;
+    int m_first_row;
+    int m_first_column;
+    int m_height;
+    int m_width;
+    int m_tiles_x;
+    std::vector<RasterPrimitive> m_primitives;
+    std::vector<std::vector<uint32_t>> m_bins; // Per tile, positions in m_primitives
+
+    /*
+        Image coordinates (column, row) where the camera ray through a point crosses the view window.
+        Returns false for points that are not in front of the camera.
+    */
+    bool project(Vector3 point, float& x, float& y)
+    {
+        Vector3 q = point - m_origin;
+        float w = (m_delta_h.cross(m_delta_v)).dot(q);
+        float scale = (m_delta_h.cross(m_delta_v)).dot(m_a);
+        if (!(w / scale > 0.0f)) {
+            return false;
+        }
+        x = (m_delta_v.cross(m_a)).dot(q) / w;
+        y = (m_a.cross(m_delta_h)).dot(q) / w;
+        return std::isfinite(x) && std::isfinite(y);
+    }
+
+    /*
+        Adds a primitive to the bins of the tiles the box may cover on screen. Boxes that reach behind the
+        camera may cover any tile. Boxes entirely behind it are dropped.
+    */
+    void bin(uint32_t raster_index, AABB box)
+    {
+        float x0 = std::numeric_limits<float>::max(), y0 = x0, x1 = -x0, y1 = -x0;
+        bool whole_region = false;
+        int behind = 0;
+        for (int corner = 0; corner < 8; corner++) {
+            Vector3 point = {
+                (corner & 1) ? box.max.x : box.min.x,
+                (corner & 2) ? box.max.y : box.min.y,
+                (corner & 4) ? box.max.z : box.min.z
+            };
+            float x, y;
+            if (!project(point, x, y)) {
+                whole_region = true;
+                Vector3 q = point - m_origin;
+                behind += (m_delta_h.cross(m_delta_v)).dot(q) / (m_delta_h.cross(m_delta_v)).dot(m_a) < 0.0f;
+                continue;
+            }
+            x0 = std::min(x0, x);
+            y0 = std::min(y0, y);
+            x1 = std::max(x1, x);
+            y1 = std::max(y1, y);
+        }
+        if (behind == 8) {
+            return;
+        }
+        int column0 = 0, row0 = 0, column1 = m_width - 1, row1 = m_height - 1;
+        if (!whole_region) {
+            column0 = std::max(column0, static_cast<int>(std::floor(x0)) - 1 - m_first_column);
+            row0 = std::max(row0, static_cast<int>(std::floor(y0)) - 1 - m_first_row);
+            column1 = std::min(column1, static_cast<int>(std::ceil(x1)) + 1 - m_first_column);
+            row1 = std::min(row1, static_cast<int>(std::ceil(y1)) + 1 - m_first_row);
+        }
+        for (int tile_y = row0 / RENDER_TILE_SIZE; row0 <= row1 && tile_y <= row1 / RENDER_TILE_SIZE; tile_y++) {
+            for (int tile_x = column0 / RENDER_TILE_SIZE; column0 <= column1 && tile_x <= column1 / RENDER_TILE_SIZE; tile_x++) {
+                m_bins[tile_y * m_tiles_x + tile_x].push_back(raster_index);
+            }
+        }
+    }
+
+    /*
+        Coefficients of v.r(x, y) in pixel coordinates
+    */
+    void linear(Vector3 v, float out[3])
+    {
+        out[0] = v.dot(m_a);
+        out[1] = v.dot(m_delta_h);
+        out[2] = v.dot(m_delta_v);
+    }
+
+public:
+    /*
+        Bytes of the set up primitives and the tile bins
+    */
+    size_t memory_usage()
+    {
+        size_t bytes = m_primitives.capacity() * sizeof(RasterPrimitive) + m_bins.capacity() * sizeof(std::vector<uint32_t>);
+        for (std::vector<uint32_t>& bin : m_bins) {
+            bytes += bin.capacity() * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+    /**
+     * @brief Sets up every face, sphere, shape and mesh instance of the scene for the camera and sorts them into
+     * the bins of the render tiles they may cover
+     * @param scene Built scene to rasterize
+     * @param origin Camera position
+     * @param upper_left View window point of pixel (0, 0)
+     * @param delta_h View window offset from one column to the next
+     * @param delta_v View window offset from one row to the next
+     * @param image_height Rows of the whole image
+     * @param image_width Columns of the whole image
+     * @param first_row Image row of the rendered rectangle's top edge
+     * @param first_column Image column of the rendered rectangle's left edge
+     * @param height Rows of the rendered rectangle
+     * @param width Columns of the rendered rectangle
+     * @param bounds World space bounds of SceneState::primitives but the infinite planes, from scene_primitive_bounds
+    **/
+    void build(SceneState& scene, Vector3 origin, Vector3 upper_left, Vector3 delta_h, Vector3 delta_v, int image_height, int image_width,
+        int first_row, int first_column, int height, int width, std::vector<AABB>& bounds)
+    {
+        auto start = std::chrono::steady_clock::now();
+        m_origin = origin;
+        m_a = upper_left - origin;
+        m_delta_h = delta_h;
+        m_delta_v = delta_v;
+        m_first_row = first_row;
+        m_first_column = first_column;
+        m_height = height;
+        m_width = width;
+        m_tiles_x = (width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+        int tiles_y = (height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+        m_bins.assign(static_cast<size_t>(m_tiles_x) * tiles_y, {});
+        m_primitives.clear();
+        m_primitives.reserve(scene.primitives.size());
+
+        for (uint32_t p = 0; p < scene.primitives.size(); p++) {
+            ScenePrimitive& primitive = scene.primitives[p];
+            RasterPrimitive raster = { .primitive = p, .kind = primitive.kind, .always_unresolved = primitive.kind == PRIMITIVE_INSTANCE };
+            if (primitive.kind == PRIMITIVE_SHAPE && primitive.shape->kind == SHAPE_PLANE) {
+                /*
+                    Infinite planes are triangles without edges: every pixel is inside, and the depth is that of the plane
+                */
+                raster.kind = PRIMITIVE_TRIANGLE;
+                for (int k = 0; k < 3; k++) {
+                    raster.edge[k][0] = 1.0f;
+                    raster.edge[k][1] = raster.edge[k][2] = 0.0f;
+                    raster.edge_tolerance[k] = 0.0f;
+                }
+                Vector3 normal = primitive.shape->axes[2];
+                Vector3 p0 = primitive.shape->center - origin;
+                raster.depth_numerator = normal.dot(p0);
+                linear(normal, raster.depth);
+                raster.always_unresolved = !(std::fabs(raster.depth_numerator) > 1.0e-4f * std::sqrt(p0.square().sum()));
+            } else if (primitive.kind == PRIMITIVE_SHAPE) {
+                raster.always_unresolved = true;
+            } else if (primitive.kind == PRIMITIVE_SPHERE) {
+                raster.center = primitive.sphere->center;
+                raster.radius = primitive.sphere->radius;
+            } else if (primitive.kind == PRIMITIVE_TRIANGLE) {
+                TriangleIntersectionData& face = scene.scene_mesh.intersection_data[primitive.index];
+                Vector3 p0 = face.p[0] - origin;
+                Vector3 p1 = face.p[1] - origin;
+                Vector3 p2 = face.p[2] - origin;
+                Vector3 corners[3] = { p0, p1, p2 };
+                for (int k = 0; k < 3; k++) {
+                    // Positive on the same side of every edge plane when the triangle winds anticlockwise as seen from the camera
+                    linear(corners[k].cross(corners[(k + 1) % 3]), raster.edge[k]);
+                    float magnitude = std::fabs(raster.edge[k][0]) + std::fabs(raster.edge[k][1]) * image_width + std::fabs(raster.edge[k][2]) * image_height;
+                    raster.edge_tolerance[k] = RASTER_EDGE_TOLERANCE * (std::fabs(raster.edge[k][1]) + std::fabs(raster.edge[k][2])) + 1.0e-5f * magnitude;
+                }
+                Vector3 normal = (face.p[1] - face.p[0]).cross(face.p[2] - face.p[0]);
+                raster.depth_numerator = normal.dot(p0);
+                linear(normal, raster.depth);
+                // Planes through or nearly through the camera are seen edge on, and their depth is unreliable
+                float scale = std::sqrt(normal.square().sum()) * std::sqrt(p0.square().sum());
+                raster.always_unresolved = !(std::fabs(raster.depth_numerator) > 1.0e-4f * scale);
+            }
+            m_primitives.push_back(raster);
+            if (p < bounds.size()) {
+                bin(static_cast<uint32_t>(m_primitives.size() - 1), bounds[p]);
+            } else {
+                for (std::vector<uint32_t>& tile : m_bins) {
+                    tile.push_back(static_cast<uint32_t>(m_primitives.size() - 1)); // Infinite planes may cover any tile
+                }
+            }
+        }
+        uint64_t entries = 0;
+        for (auto& tile : m_bins) {
+            entries += tile.size();
+        }
+        primary_visibility_stats.primitives += m_primitives.size();
+        primary_visibility_stats.bin_entries += entries;
+        primary_visibility_stats.setup_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * @brief Rasterizes the primitives binned to one tile and decides each pixel's visible primitive
+     * @param tile_i Row of the tile's top left pixel in the rendered rectangle
+     * @param tile_j Column of the tile's top left pixel in the rendered rectangle
+     * @param visible Receives RENDER_TILE_SIZE x RENDER_TILE_SIZE values, row-major: the index in
+     * SceneState::primitives of the visible primitive, RASTER_BACKGROUND or RASTER_UNRESOLVED
+    **/
+    void rasterize_tile(int tile_i, int tile_j, int32_t* visible)
+    {
+        const int pixels = RENDER_TILE_SIZE * RENDER_TILE_SIZE;
+        float nearest[pixels]; // Ray distance of the nearest covering primitive, in multiples of r(x, y)
+        float rival[pixels]; // Nearest distance of any other primitive that covers or may cover the pixel
+        bool unresolved[pixels];
+        std::fill(visible, visible + pixels, RASTER_BACKGROUND);
+        std::fill(nearest, nearest + pixels, std::numeric_limits<float>::infinity());
+        std::fill(rival, rival + pixels, std::numeric_limits<float>::infinity());
+        std::fill(unresolved, unresolved + pixels, false);
+
+        int rows = std::min(RENDER_TILE_SIZE, m_height - tile_i);
+        int columns = std::min(RENDER_TILE_SIZE, m_width - tile_j);
+        float x0 = static_cast<float>(m_first_column + tile_j);
+        float y0 = static_cast<float>(m_first_row + tile_i);
+
+        /*
+            Keeps the nearest surface per pixel and the distance of the runner up
+        */
+        auto cover = [&](int pixel, float distance, int32_t primitive) {
+            if (distance < nearest[pixel]) {
+                rival[pixel] = std::min(rival[pixel], nearest[pixel]);
+                nearest[pixel] = distance;
+                visible[pixel] = primitive;
+            } else {
+                rival[pixel] = std::min(rival[pixel], distance);
+            }
+        };
+
+        for (uint32_t raster_index : m_bins[(tile_i / RENDER_TILE_SIZE) * m_tiles_x + tile_j / RENDER_TILE_SIZE]) {
+            RasterPrimitive& primitive = m_primitives[raster_index];
+            if (primitive.always_unresolved) {
+                /*
+                    Only the pixels the primitive's bounds may cover were binned, at tile granularity; ray trace the whole tile
+                */
+                std::fill(unresolved, unresolved + pixels, true);
+                continue;
+            }
+            for (int i = 0; i < rows; i++) {
+                float y = y0 + i;
+                if (primitive.kind == PRIMITIVE_TRIANGLE) {
+                    /*
+                        Edge functions and depth denominators of a row, in loops the compiler vectorizes
+                    */
+                    float e0[RENDER_TILE_SIZE], e1[RENDER_TILE_SIZE], e2[RENDER_TILE_SIZE], denominator[RENDER_TILE_SIZE];
+                    float row0 = primitive.edge[0][0] + y * primitive.edge[0][2];
+                    float row1 = primitive.edge[1][0] + y * primitive.edge[1][2];
+                    float row2 = primitive.edge[2][0] + y * primitive.edge[2][2];
+                    float row_depth = primitive.depth[0] + y * primitive.depth[2];
+                    for (int j = 0; j < RENDER_TILE_SIZE; j++) {
+                        float x = x0 + j;
+                        e0[j] = row0 + x * primitive.edge[0][1];
+                        e1[j] = row1 + x * primitive.edge[1][1];
+                        e2[j] = row2 + x * primitive.edge[2][1];
+                        denominator[j] = row_depth + x * primitive.depth[1];
+                    }
+                    for (int j = 0; j < columns; j++) {
+                        float t0 = primitive.edge_tolerance[0], t1 = primitive.edge_tolerance[1], t2 = primitive.edge_tolerance[2];
+                        bool some_positive = e0[j] > t0 || e1[j] > t1 || e2[j] > t2;
+                        bool some_negative = e0[j] < -t0 || e1[j] < -t1 || e2[j] < -t2;
+                        if (some_positive && some_negative) {
+                            continue; // The ray's line passes outside an edge
+                        }
+                        float distance = primitive.depth_numerator / denominator[j];
+                        if (!(distance > 0.0f)) {
+                            continue; // Behind the camera, and edge on planes were ruled out
+                        }
+                        bool inside = (e0[j] > t0 && e1[j] > t1 && e2[j] > t2) || (e0[j] < -t0 && e1[j] < -t1 && e2[j] < -t2);
+                        int pixel = i * RENDER_TILE_SIZE + j;
+                        if (inside) {
+                            cover(pixel, distance, static_cast<int32_t>(primitive.primitive));
+                        } else {
+                            rival[pixel] = std::min(rival[pixel], distance); // On an edge: may or may not be hit
+                        }
+                    }
+                } else {
+                    /*
+                        Spheres: the nearest root in front of the camera of |r t - (center - origin)|^2 = radius^2
+                    */
+                    Vector3 to_origin = m_origin - primitive.center;
+                    float c = to_origin.dot(to_origin) - primitive.radius * primitive.radius;
+                    for (int j = 0; j < columns; j++) {
+                        Vector3 ray = m_a + (m_delta_h * (x0 + j)) + (m_delta_v * y);
+                        float a = ray.dot(ray);
+                        float b = 2.0f * ray.dot(to_origin);
+                        float discriminant = b * b - 4.0f * a * c;
+                        float tolerance = 1.0e-4f * (b * b + std::fabs(4.0f * a * c));
+                        int pixel = i * RENDER_TILE_SIZE + j;
+                        if (discriminant < -tolerance) {
+                            continue;
+                        }
+                        if (discriminant <= tolerance) {
+                            // Grazing the outline: may be hit anywhere from here to the tangent point
+                            float closest = (-b - std::sqrt(std::max(discriminant, 0.0f) + tolerance)) / (2.0f * a);
+                            if (-b > 0.0f || c <= 0.0f) {
+                                rival[pixel] = std::min(rival[pixel], std::max(closest, 0.0f));
+                            }
+                            continue;
+                        }
+                        float root = std::sqrt(discriminant);
+                        float near_distance = (-b - root) / (2.0f * a);
+                        float far_distance = (-b + root) / (2.0f * a);
+                        float scale = std::max(std::fabs(near_distance), std::fabs(far_distance));
+                        if (std::fabs(near_distance) <= 1.0e-4f * scale || std::fabs(far_distance) <= 1.0e-4f * scale) {
+                            unresolved[pixel] = true; // The camera is on the surface
+                        } else if (near_distance > 0.0f) {
+                            cover(pixel, near_distance, static_cast<int32_t>(primitive.primitive));
+                        } else if (far_distance > 0.0f) {
+                            cover(pixel, far_distance, static_cast<int32_t>(primitive.primitive)); // The camera is inside
+                        }
+                    }
+                }
+            }
+        }
+
+        uint64_t resolved = 0, background = 0;
+        for (int pixel = 0; pixel < pixels; pixel++) {
+            if (unresolved[pixel]) {
+                visible[pixel] = RASTER_UNRESOLVED;
+            } else if (visible[pixel] == RASTER_BACKGROUND) {
+                if (rival[pixel] != std::numeric_limits<float>::infinity()) {
+                    visible[pixel] = RASTER_UNRESOLVED;
+                }
+            } else if (!(rival[pixel] > nearest[pixel] * (1.0f + RASTER_DEPTH_TOLERANCE))) {
+                visible[pixel] = RASTER_UNRESOLVED;
+            }
+            if (pixel / RENDER_TILE_SIZE < rows && pixel % RENDER_TILE_SIZE < columns) {
+                resolved += visible[pixel] >= 0;
+                background += visible[pixel] == RASTER_BACKGROUND;
+            }
+        }
+        primary_visibility_stats.resolved += resolved;
+        primary_visibility_stats.background += background;
+        primary_visibility_stats.unresolved += static_cast<uint64_t>(rows) * columns - resolved - background;
+    }
+};
+
+/*
+    Prints how camera rays were resolved by '--primary raster'
+*/
+inline void print_primary_visibility_report(std::ostream& out)
+{
+    PrimaryVisibilityStats& stats = primary_visibility_stats;
+    uint64_t pixels = std::max<uint64_t>(1, stats.resolved + stats.background + stats.unresolved);
+    out << "Primary visibility: " << stats.primitives << " primitives set up and binned into " << stats.bin_entries
+        << " tile entries in " << stats.setup_seconds * 1e3 << " ms. Pixels: " << 100.0 * stats.resolved / pixels
+        << "% tested against their visible primitive only, " << 100.0 * stats.background / pixels << "% background, "
+        << 100.0 * stats.unresolved / pixels << "% ray traced" << std::endl;
+}
@@ -0,0 +1,205 @@
+#pragma once
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "definitions.h"
+#include "scene.h"
+#include "scene_builder.h"
+#include "settings.h"
+#include "parser.h"
+#include "render.h"
+#include "framebuffer.h"
+#include "memory_report.h"
+
+/*
+    Renderer API for programs that embed it (CMake target simple_raytracer_core). Build a Scene from
+    memory with the SceneBuilder methods or from scene file text, place a Camera, and render() gives
+    the linear radiance of every pixel:
+
+        Scene scene;
+        scene.set_background({ 0.1f, 0.1f, 0.1f });
+        scene.set_material(material);
+        scene.add_sphere({ 0.0f, 0.0f, -5.0f }, 1.0f);
+        scene.add_light(light);
+        Framebuffer image(camera.height, camera.width);
+        render(scene, camera, settings, image);
+
+    Each Scene owns its objects, its texture cache and the settings of its render, so several may exist at
+    once and different scenes may render at the same time on different threads. A scene renders one image
+    at a time. Any number of translation units may include this header. The render statistics and reports
+    ('--stats', '--primary-report', '--tile-culling-report', '--startup-report') add up every render in the
+    process.
+*/
+
+/*
+    Where the image is seen from, as the 'eye', 'viewdir', 'updir', 'hfov' and 'imsize' commands give it
+*/
+struct Camera
+{
+    Vector3 eye = { 0.0f, 0.0f, 0.0f };
+    Vector3 view_direction = { 0.0f, 0.0f, -1.0f };
+    Vector3 up = { 0.0f, 1.0f, 0.0f };
+    float fov_h = 60.0f; // Horizontal field of view in degrees
+    int width = 0;
+    int height = 0;
+};
+
+/*
+    A scene to render. Objects are added with the SceneBuilder methods, scene file lines with
+    parse_line, parse_text or parse_file. Its objects are freed with it.
+*/
+class Scene : public SceneParser
+{
+    public:
+    /**
+     * @param compress_vertices Store the vertices of its faces and meshes compressed ('--compress-vertices')
+     * @param serial_startup Index textures and meshes while parsing instead of in the background ('--serial-startup')
+    **/
+    Scene(bool compress_vertices = false, bool serial_startup = false)
+    {
+        state.compress_vertices = compress_vertices;
+        state.serial_startup = serial_startup;
+        state.scene_mesh.compressed = compress_vertices;
+    }
+
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+
+    /**
+     * @brief Color of rays that hit nothing, and the refraction index of the space between objects
+     * @param color Background color
+     * @param refraction_index Refraction index outside of every object, 0 for none
+    **/
+    void set_background(Color color, float refraction_index = 0.0f)
+    {
+        background_color = color;
+        state.background_refraction_index = refraction_index;
+    }
+
+    /*
+        Parses scene file commands, one per line
+    */
+    void parse_text(std::string text)
+    {
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            parse_line(line);
+        }
+    }
+
+    /*
+        The camera of the parsed 'eye', 'viewdir', 'updir', 'hfov' and 'imsize' commands
+    */
+    Camera camera()
+    {
+        return { view_origin, view_direction, view_up, fov_h, width, height };
+    }
+
+    /*
+        True if objects were added, or the settings need another accelerator or other shading kernels,
+        since the scene was last built
+    */
+    bool needs_build(RenderSettings& settings)
+    {
+        return changed || settings.accel != built_accel || settings.generic_shading != built_generic_shading;
+    }
+
+    /*
+        Renders this scene with these settings from now on. build() and the render functions call it; call
+        it before parsing to load textures and meshes with the settings' threads and texture cache.
+    */
+    void apply(RenderSettings& settings)
+    {
+        state.settings = settings;
+        state.loader.set_max_workers(static_cast<unsigned int>(settings.threads));
+        state.texture_cache.set_budget(static_cast<size_t>(settings.texture_cache_mb * 1024.0f * 1024.0f));
+        state.texture_cache.set_compression(settings.texture_compression);
+    }
+
+    /*
+        Builds the scene for these settings. render() does this when needed; call it first to time or
+        report on the build.
+    */
+    void build(RenderSettings& settings)
+    {
+        apply(settings);
+        build_scene(state);
+        changed = false;
+        built_accel = settings.accel;
+        built_generic_shading = settings.generic_shading;
+    }
+
+    private:
+    AccelType built_accel = ACCEL_AUTO;
+    bool built_generic_shading = false;
+};
+
+/*
+    Applies the settings and builds the scene if needed. Throws if the camera has no image.
+*/
+inline void prepare_render(Scene& scene, Camera& camera, RenderSettings& settings)
+{
+    if (camera.width <= 1 || camera.height <= 1) {
+        throw std::invalid_argument("ERROR: Invalid image dimensions. Please verify.");
+    }
+    if (scene.needs_build(settings)) {
+        scene.build(settings);
+    } else {
+        scene.apply(settings);
+    }
+}
+
+/**
+ * @brief Ray traces the scene
+ * @param scene Scene to render
+ * @param camera Where it is seen from
+ * @param settings Render options
+ * @param framebuffer Receives the linear radiance of every pixel, camera.height by camera.width
+ * @param pixel_costs Optional. Receives the row-major cost of each pixel, measured in settings.heatmap
+**/
+inline void render(Scene& scene, Camera& camera, RenderSettings& settings, Framebuffer& framebuffer, std::vector<float>* pixel_costs = nullptr)
+{
+    prepare_render(scene, camera, settings);
+    Camera view = camera;
+    framebuffer = create_view_window_and_ray_trace(scene.state, view.eye, view.view_direction.norm(), view.up.norm(), view.fov_h,
+        view.height, view.width, scene.background_color, pixel_costs);
+}
+
+/**
+ * @brief Ray traces a rectangle of the image. Its pixels are those of the same rectangle of a whole image render.
+ * @param scene Scene to render
+ * @param camera Where it is seen from
+ * @param settings Render options
+ * @param region Columns region[0] to region[2] - 1 and rows region[1] to region[3] - 1
+ * @param framebuffer Receives the linear radiance of the rectangle's pixels
+**/
+inline void render_region(Scene& scene, Camera& camera, RenderSettings& settings, int region[4], Framebuffer& framebuffer)
+{
+    prepare_render(scene, camera, settings);
+    if (region[0] < 0 || region[1] < 0 || region[2] > camera.width || region[3] > camera.height || region[0] >= region[2] || region[1] >= region[3]) {
+        throw std::invalid_argument("ERROR: '--region' must be a non-empty rectangle inside the image. Please verify.");
+    }
+    Camera view = camera;
+    framebuffer = create_view_window_and_ray_trace_region(scene.state, view.eye, view.view_direction.norm(), view.up.norm(), view.fov_h,
+        view.height, view.width, scene.background_color, region);
+}
+
+/**
+ * @brief Ray traces the image in bands of rows, each written to the output files as soon as it is done
+ * @returns False if an output file could not be written
+ * @param scene Scene to render
+ * @param camera Where it is seen from
+ * @param settings Render options
+ * @param band_rows Rows per band, rounded up to whole tiles
+ * @param writer Opened output files
+**/
+inline bool render_streaming(Scene& scene, Camera& camera, RenderSettings& settings, int band_rows, StreamingImageWriter& writer)
+{
+    prepare_render(scene, camera, settings);
+    Camera view = camera;
+    return stream_view_window_and_ray_trace(scene.state, view.eye, view.view_direction.norm(), view.up.norm(), view.fov_h,
+        view.height, view.width, scene.background_color, band_rows, writer);
+}
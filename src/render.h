@@ -0,0 +1,1405 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "definitions.h"
+#include "accel.h"
+#include "fast_math.h"
+#include "framebuffer.h"
+#include "scene.h"
+#include "mesh.h"
+#include "stats.h"
+#include "heatmap.h"
+#include "lights.h"
+#include "memory.h"
+#include "raster.h"
+#include "tile_culling.h"
+#include "trace.h"
+#include "utility.h"
+
+/*
+    Where each pixel of the image lies in world space. Camera rays run from 'origin' through these points.
+*/
+struct ViewWindow
+{
+    Vector3 origin;
+    Vector3 upper_left; // Pixel (0, 0)
+    Vector3 delta_h; // From one column to the next
+    Vector3 delta_v; // From one row to the next
+    int width;
+    int height;
+
+    Vector3 pixel_position(int i, int j)
+    {
+        return upper_left + (delta_h * static_cast<float>(j)) + (delta_v * static_cast<float>(i));
+    }
+};
+
+/*
+    Function hoisting
+*/
+inline Framebuffer create_view_window_and_ray_trace(
+    SceneState& scene,
+    Vector3 view_origin, 
+    Vector3 view_direction, 
+    Vector3 view_up, 
+    float fov_h, 
+    float res_h, 
+    float res_w, 
+    Color background_color,
+    std::vector<float>* pixel_costs = nullptr
+);
+inline std::vector<ObjectIntersections> TraceRay(
+    SceneState& scene,
+    Vector3 view_origin, 
+    Vector3 ray
+);
+inline Color ShadeRay(
+    SceneState& scene,
+    Vector3 incidence_ray, 
+    SceneObjectInfo* incidence_object_info, 
+    Intersection incidence_object_intersection, 
+    float incidence_refraction_index, 
+    float transmission_refraction_index, 
+    std::vector<SceneObjectInfo*> incident_object_stack,
+    RayState ray_state,
+    float recursion_depth,
+    Color background_color
+);
+inline void assign_shade_kernels(SceneState& scene);
+inline void intersect_primitive(SceneState& scene, uint32_t candidate, Vector3 view_origin, Vector3 ray, WatertightRay& face_ray, std::vector<ObjectIntersections>& ray_trace_results);
+
+/*
+    Lists the top level primitives in the order TraceRay has always reported them in: by object type
+    name (boxes, cylinders, disks, faces, instances, spheres), then in parse order. Infinite planes
+    follow the others, outside the range the accelerator indexes.
+*/
+inline void collect_scene_primitives(SceneState& scene)
+{
+    scene.primitives.clear();
+    std::vector<ScenePrimitive> unbounded;
+    for (auto& [type, object_infos] : scene.scene_object_infos) {
+        for (uint32_t i = 0; i < object_infos.size(); i++) {
+            if (type == "sphere") {
+                scene.primitives.push_back({ PRIMITIVE_SPHERE, i, scene.spheres[object_infos[i]->id], object_infos[i] });
+            } else if (is_shape_type(type)) {
+                Shape* shape = scene.shapes[object_infos[i]->id];
+                (shape_bounded(*shape) ? scene.primitives : unbounded).push_back({ PRIMITIVE_SHAPE, i, nullptr, object_infos[i], shape });
+            } else if (type == "face") {
+                // Scene faces are stored in the scene mesh in the same order as their object infos
+                scene.primitives.push_back({ PRIMITIVE_TRIANGLE, i, nullptr, object_infos[i] });
+            } else if (type == "instance") {
+                scene.primitives.push_back({ PRIMITIVE_INSTANCE, i, nullptr, nullptr });
+            }
+        }
+    }
+    scene.bounded_primitives = static_cast<uint32_t>(scene.primitives.size());
+    scene.primitives.insert(scene.primitives.end(), unbounded.begin(), unbounded.end());
+}
+
+/*
+    World space bounds of every top level primitive but the infinite planes, in the order of SceneState::primitives.
+    They are slightly enlarged, so that rounding in an accelerator's slab tests cannot cull a ray grazing an edge.
+*/
+inline std::vector<AABB> scene_primitive_bounds(SceneState& scene)
+{
+    std::vector<AABB> bounds;
+    bounds.reserve(scene.bounded_primitives);
+    for (uint32_t p = 0; p < scene.bounded_primitives; p++) {
+        ScenePrimitive& primitive = scene.primitives[p];
+        AABB box;
+        if (primitive.kind == PRIMITIVE_SHAPE) {
+            box = shape_bounds(*primitive.shape);
+        } else if (primitive.kind == PRIMITIVE_SPHERE) {
+            Vector3 radius = { primitive.sphere->radius, primitive.sphere->radius, primitive.sphere->radius };
+            box.extend(primitive.sphere->center - radius);
+            box.extend(primitive.sphere->center + radius);
+        } else if (primitive.kind == PRIMITIVE_TRIANGLE) {
+            for (Vector3 vertex : scene.scene_mesh.intersection_data[primitive.index].p) {
+                box.extend(vertex);
+            }
+        } else {
+            box = scene.instances[primitive.index]->bounds;
+        }
+        Vector3 size = box.max - box.min;
+        float magnitude = std::max({ std::fabs(box.min.x), std::fabs(box.min.y), std::fabs(box.min.z), std::fabs(box.max.x), std::fabs(box.max.y), std::fabs(box.max.z) });
+        float margin = 1e-5f * (magnitude + size.x + size.y + size.z) + 1e-6f;
+        Vector3 padding = { margin, margin, margin };
+        box.min = box.min - padding;
+        box.max = box.max + padding;
+        bounds.push_back(box);
+    }
+    return bounds;
+}
+
+/*
+    Statistics of the scene's primitives that the accelerator is chosen from
+*/
+inline AccelSceneStats measure_scene(SceneState& scene, std::vector<AABB>& bounds)
+{
+    AccelSceneStats stats = measure_primitive_distribution(bounds);
+    size_t axis_aligned = 0;
+    for (uint32_t p = 0; p < scene.bounded_primitives; p++) {
+        ScenePrimitive& primitive = scene.primitives[p];
+        if (primitive.kind == PRIMITIVE_SPHERE) {
+            stats.spheres++;
+        } else if (primitive.kind == PRIMITIVE_SHAPE) {
+            stats.shapes++;
+        } else if (primitive.kind == PRIMITIVE_INSTANCE) {
+            stats.instances++;
+        } else {
+            stats.faces++;
+            Vector3 normal = scene.scene_mesh.intersection_data[primitive.index].normal;
+            if (std::max({ std::fabs(normal.x), std::fabs(normal.y), std::fabs(normal.z) }) > 0.9998f) {
+                axis_aligned++;
+            }
+        }
+    }
+    stats.axis_aligned_faces = stats.faces > 0 ? static_cast<float>(axis_aligned) / stats.faces : 0.0f;
+    return stats;
+}
+
+/**
+ * @brief Replaces the scene's accelerator with a newly built one
+ * @returns The type that was built; ACCEL_AUTO is resolved by choose_accelerator()
+ * @param scene Scene whose primitives it indexes
+ * @param type Accelerator to build
+**/
+inline AccelType build_accelerator(SceneState& scene, AccelType type)
+{
+    std::vector<AABB> bounds = scene_primitive_bounds(scene);
+    if (type == ACCEL_AUTO) {
+        AccelSceneStats stats = measure_scene(scene, bounds);
+        type = choose_accelerator(stats);
+    }
+    delete scene.accelerator;
+    scene.accelerator = create_accelerator(type);
+    scene.accelerator->build(bounds);
+    return type;
+}
+
+/*
+    Prepares the parsed scene for tracing: compacts the scene mesh, builds the accelerator over the
+    top level primitives (settings.accel selects it) and picks each material's shading kernel.
+*/
+inline void build_scene(SceneState& scene)
+{
+    STATS_PHASE(PHASE_BUILD);
+    TraceSpan span("accel_build", "build");
+    scene.scene_mesh.finalize();
+    collect_scene_primitives(scene);
+    build_accelerator(scene, scene.settings.accel);
+    assign_shade_kernels(scene);
+}
+
+/**
+ * @brief Builds every accelerator on the scene and prints its build time, memory and query time for '--accel-report'.
+ * Queries are full TraceRay calls: half are rays from the camera towards random points of the scene, half start
+ * at random points of the scene in random directions like secondary rays. The scene's own accelerator is kept.
+ * @param scene Built scene to measure
+ * @param out Stream to print to
+ * @param view_origin Position of the camera
+**/
+inline void print_accel_report(SceneState& scene, std::ostream& out, Vector3 view_origin)
+{
+    const int probe_count = 4096;
+    std::vector<AABB> bounds = scene_primitive_bounds(scene);
+    AccelSceneStats stats = measure_scene(scene, bounds);
+    AccelType chosen = scene.accelerator->type();
+    AABB scene_bounds;
+    for (AABB& box : bounds) {
+        scene_bounds.extend(box);
+    }
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    auto random_point = [&]() {
+        Vector3 extent = scene_bounds.max - scene_bounds.min;
+        return scene_bounds.min + Vector3({ extent.x * unit(random), extent.y * unit(random), extent.z * unit(random) });
+    };
+    std::vector<std::pair<Vector3, Vector3>> probes;
+    for (int i = 0; i < probe_count && !bounds.empty(); i++) {
+        if (i % 2 == 0) {
+            probes.push_back({ view_origin, (random_point() - view_origin).norm() });
+        } else {
+            Vector3 direction = { unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f };
+            probes.push_back({ random_point(), direction.norm() });
+        }
+    }
+
+    out << "Accelerator: " << accel_names[chosen] << (scene.settings.accel == ACCEL_AUTO ? " (auto)" : "") << " over "
+        << stats.primitives << " primitives (" << stats.spheres << " spheres, " << stats.faces << " faces, " << stats.instances
+        << " instances, " << stats.shapes << " shapes; " << scene.primitives.size() - scene.bounded_primitives
+        << " infinite planes outside it); axis aligned faces " << stats.axis_aligned_faces * 100.0f << "%, size spread " << stats.size_spread
+        << ", occupancy " << stats.occupancy * 100.0f << "%" << std::endl;
+    for (int type = ACCEL_BRUTE; type < ACCEL_TYPE_COUNT; type++) {
+        auto build_start = std::chrono::steady_clock::now();
+        build_accelerator(scene, static_cast<AccelType>(type));
+        double build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+
+        size_t candidate_count = 0;
+        std::vector<uint32_t> candidates;
+        for (auto& [origin, direction] : probes) {
+            candidates.clear();
+            scene.accelerator->candidates(origin, direction, candidates);
+            candidate_count += candidates.size();
+        }
+        auto query_start = std::chrono::steady_clock::now();
+        for (auto& [origin, direction] : probes) {
+            TraceRay(scene, origin, direction);
+        }
+        double query_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - query_start).count();
+
+        double rays = std::max<double>(1.0, probes.size());
+        out << "  " << std::left << std::setw(6) << accel_names[type] << std::right << std::fixed << std::setprecision(3)
+            << " build " << std::setw(10) << build_seconds * 1e3 << " ms, memory " << std::setw(10) << scene.accelerator->memory_usage()
+            << " B, query " << std::setw(10) << query_seconds / rays * 1e6 << " us/ray, " << std::setprecision(1)
+            << std::setw(8) << candidate_count / rays << " candidates/ray" << (type == chosen ? "  <- used" : "") << std::endl;
+        out.unsetf(std::ios::fixed);
+        out << std::setprecision(6);
+    }
+    build_accelerator(scene, chosen);
+}
+
+/**
+ * @brief Define the viewing window: where the camera is and where each pixel lies in world space
+ * @returns The window's top left pixel and the offsets between neighbouring pixels
+ * @param view_origin The position of the camera
+ * @param view_direction The forward direction the camera
+ * @param view_up The up direction of camera. Determines tilt and roll.
+ * @param fov_h Horizontal feild of view
+ * @param res_h Height of view window
+ * @param res_w Width of view window
+**/
+inline ViewWindow define_view_window(Vector3 view_origin, Vector3 view_direction, Vector3 view_up, float fov_h, float res_h, float res_w)
+{
+    /* 
+        Define the horizontal edge of the view window. Orthogonal to v and view_direction. 
+        TODO:: calculation fails when view_up and view direction are co-linear. 
+    */
+    Vector3 u = (view_direction).cross(view_up).norm();
+
+    /*
+        Define the virtical edge of the view window. 
+        Can be also defined by projecting the camera "view up" vector onto the viewing window plane.
+        However, its more computationally efficient to calculate "u" first via above method, and then "v".
+    */
+    Vector3 v = u.cross(view_direction);
+    
+    /*
+        Find the width and the height of the viewing window in world coordinate units
+    */
+    float aspect_ratio = res_w / res_h;
+    float w = 2.0f*d* tan((0.5*fov_h) * M_PI / 180.0f);
+    float h = w / aspect_ratio;
+
+    /* 
+        Define the (x, y, z) locations of each corner of the viewing window
+    */
+    Vector3 n = view_direction;
+    Vector3 ul = view_origin + n*d - u*(w/2.0f) + v*(h/2.0f);
+    Vector3 ur = view_origin + n*d + u*(w/2.0f) + v*(h/2.0f);
+    Vector3 ll = view_origin + n*d - u*(w/2.0f) - v*(h/2.0f);
+
+    /*
+        Now we define a mappings between pixels in the image to points in the viewing window
+        Starts with the top left point, then iterates through each adding horizontal and vertical offsets
+        in order to find their respective world space locations.
+    */
+    ViewWindow window;
+    window.origin = view_origin;
+    window.upper_left = ul;
+    window.delta_h = (ur - ul) / (res_w - 1.0f); 
+    window.delta_v = (ll - ul) / (res_h - 1.0f);
+    window.width = static_cast<int>(res_w);
+    window.height = static_cast<int>(res_h);
+    return window;
+}
+
+/**
+ * @brief Ray trace a rectangle of the image. Camera rays are formed per pixel as the rectangle is traced.
+ * @param scene Built scene to trace
+ * @param window The viewing window, from define_view_window
+ * @param first_row Image row of the rectangle's top edge
+ * @param first_column Image column of the rectangle's left edge
+ * @param band Receives the linear radiance of the band.height x band.width pixels from (first_row, first_column)
+ * @param background_color Default base color used when no ray intersections are found
+ * @param pixel_costs Optional. Receives the row-major cost of each pixel of the band, measured in the metric set by settings.heatmap
+**/
+inline void ray_trace_region(SceneState& scene, ViewWindow& window, int first_row, int first_column, Framebuffer& band, Color background_color, std::vector<float>* pixel_costs)
+{
+    STATS_PHASE(PHASE_TRACE);
+    TraceSpan span("render", "render", trace_recorder.enabled() ? std::to_string(first_column) + "," + std::to_string(first_row) + " " + std::to_string(band.width) + "x" + std::to_string(band.height) : "");
+
+    /*
+        For each pixel in the view port (image), define a ray from the view origin to the world location correspondind to that pixel.
+        Then for each ray, cycle through scene objects. Detect which objects the ray intersects, returning the one closest to the camera.
+
+        The band is split into RENDER_TILE_SIZE square tiles that worker threads take in turn. Pixels are independent,
+        so the image does not depend on the number of threads or on how it is split into rectangles.
+    */
+    HeatmapMetric cost_metric = HEATMAP_OFF;
+    if (pixel_costs != nullptr) {
+        cost_metric = scene.settings.heatmap;
+        pixel_costs->assign(static_cast<size_t>(band.height) * static_cast<size_t>(band.width), 0.0f);
+    }
+
+    int height = band.height;
+    int width = band.width;
+    int tiles_x = (width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    int tiles_y = (height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+
+    /*
+        With '--primary raster', each tile is rasterized before its pixels are traced, into a visibility
+        buffer that names the one primitive each camera ray needs to be tested against
+    */
+    bool raster = scene.settings.primary_visibility == PRIMARY_RASTER;
+    bool culling = scene.settings.tile_culling == TILE_CULLING_ON;
+    PrimaryVisibility primary_visibility;
+    TileCulling tile_culling;
+    if (raster || culling) {
+        std::vector<AABB> bounds = scene_primitive_bounds(scene);
+        if (raster) {
+            TraceSpan raster_span("raster_setup", "render");
+            primary_visibility.build(scene, window.origin, window.upper_left, window.delta_h, window.delta_v, window.height, window.width,
+                first_row, first_column, height, width, bounds);
+        }
+        if (culling) {
+            TraceSpan culling_span("tile_culling_setup", "render");
+            tile_culling.build(scene, window.origin, window.upper_left, window.delta_h, window.delta_v, first_row, first_column, height, width, bounds);
+        }
+    }
+
+    // For '--mem-report': the band and heatmap costs, the raster bins, the tiles' candidates and each thread's visibility buffer
+    unsigned int thread_count = std::max(1, scene.settings.threads);
+    TrackedMemory band_memory(MEMORY_FRAMEBUFFERS, band.rgb.capacity() * sizeof(float) + (pixel_costs != nullptr ? pixel_costs->capacity() * sizeof(float) : 0));
+    TrackedMemory scratch_memory(MEMORY_TEMPORARY, primary_visibility.memory_usage() + tile_culling.memory_usage()
+        + thread_count * sizeof(int32_t) * RENDER_TILE_SIZE * RENDER_TILE_SIZE);
+
+    std::atomic<int> next_tile = 0;
+    auto render_tiles = [&]() {
+        int32_t tile_visibility[RENDER_TILE_SIZE * RENDER_TILE_SIZE];
+        std::fill(tile_visibility, tile_visibility + RENDER_TILE_SIZE * RENDER_TILE_SIZE, RASTER_UNRESOLVED);
+        for (int tile = next_tile++; tile < tiles_x * tiles_y; tile = next_tile++) {
+            int tile_i = (tile / tiles_x) * RENDER_TILE_SIZE;
+            int tile_j = (tile % tiles_x) * RENDER_TILE_SIZE;
+            TraceSpan tile_span("tile", "render", trace_recorder.enabled() ? std::to_string(first_column + tile_j) + "," + std::to_string(first_row + tile_i) : "");
+
+            /*
+                Tiles whose camera rays reach no primitive show only the background. Tiles that reach a few
+                test those for every ray instead of asking the accelerator.
+            */
+            const uint32_t* tile_candidates = nullptr;
+            uint32_t tile_candidate_count = culling ? tile_culling.tile_candidates(tile_i, tile_j, tile_candidates) : TILE_CULLING_MAX_CANDIDATES + 1;
+            if (tile_candidate_count == 0) {
+                int rows = std::min(tile_i + RENDER_TILE_SIZE, height) - tile_i;
+                int columns = std::min(tile_j + RENDER_TILE_SIZE, width) - tile_j;
+                for (int i = tile_i; i < tile_i + rows; i++) {
+                    for (int j = tile_j; j < tile_j + columns; j++) {
+                        band.set(i, j, background_color);
+                        startup_timeline.pixel_done();
+                    }
+                }
+                if (raster) {
+                    primary_visibility_stats.background += static_cast<uint64_t>(rows) * columns;
+                }
+                continue;
+            }
+            auto trace_camera_ray = [&](Vector3 view_origin, Vector3 ray) {
+                if (tile_candidate_count > TILE_CULLING_MAX_CANDIDATES) {
+                    return TraceRay(scene, view_origin, ray);
+                }
+                std::vector<ObjectIntersections> ray_trace_results;
+                WatertightRay face_ray(view_origin, ray);
+                for (uint32_t k = 0; k < tile_candidate_count; k++) {
+                    intersect_primitive(scene, tile_candidates[k], view_origin, ray, face_ray, ray_trace_results);
+                }
+                return ray_trace_results;
+            };
+
+            if (raster) {
+                primary_visibility.rasterize_tile(tile_i, tile_j, tile_visibility);
+            }
+            for (int i = tile_i; i < std::min(tile_i + RENDER_TILE_SIZE, height); i++) {
+                for (int j = tile_j; j < std::min(tile_j + RENDER_TILE_SIZE, width); j++) {
+                    uint64_t cost_start = pixel_costs != nullptr ? read_cost_counter(cost_metric) : 0;
+                    Vector3 pixel_position = window.pixel_position(first_row + i, first_column + j);
+                    Vector3 view_origin = window.origin;
+                    Color pixel_color = background_color;
+                    float min_distance = std::numeric_limits<float>::max();
+                    /*
+                        Form a ray pointing from view origin through a given point on the view window.
+                        Then, ray-trace through scene finding intersecting objects
+                    */
+                    Vector3 ray = (pixel_position - view_origin).norm();
+                    STATS_COUNT(rays[RAY_PRIMARY]);
+                    Intersection min_intersection;
+                    SceneObjectInfo* intersected_object = nullptr; 
+                    auto find_closest = [&](std::vector<ObjectIntersections>& ray_trace_results) {
+                        for (auto & object_intersections : ray_trace_results) 
+                        {    
+                            for (auto & intersection : object_intersections.intersections) 
+                            {   
+                                if (intersection.distance > 0.0f && intersection.distance < min_distance) {
+                                    min_distance = intersection.distance;
+                                    intersected_object = object_intersections.object_info;
+                                    min_intersection = intersection;
+                                }
+                            }
+                        }
+                    };
+
+                    int32_t visible = tile_visibility[(i - tile_i) * RENDER_TILE_SIZE + (j - tile_j)];
+                    if (visible >= 0) {
+                        // Only the primitive rasterized at this pixel can be the closest
+                        std::vector<ObjectIntersections> ray_trace_results;
+                        WatertightRay face_ray(view_origin, ray);
+                        intersect_primitive(scene, static_cast<uint32_t>(visible), view_origin, ray, face_ray, ray_trace_results);
+                        find_closest(ray_trace_results);
+                    }
+                    if (visible == RASTER_UNRESOLVED || (visible >= 0 && intersected_object == nullptr)) {
+                        std::vector<ObjectIntersections> ray_trace_results = trace_camera_ray(view_origin, ray);
+                        find_closest(ray_trace_results);
+                    }
+
+            
+                    if (intersected_object != nullptr) {
+                        std::vector<SceneObjectInfo*> incident_object_stack = { intersected_object };
+                        pixel_color = ShadeRay(
+                            scene,
+                            ray, 
+                            intersected_object, 
+                            min_intersection, 
+                            scene.background_refraction_index,
+                            intersected_object->material.refraction_index,
+                            incident_object_stack,
+                            RayState::ENTERING,
+                            scene.settings.recursion_depth,
+                            background_color    
+                        );    
+                    }
+            
+                    band.set(i, j, pixel_color);
+                    startup_timeline.pixel_done();
+                    if (pixel_costs != nullptr) {
+                        (*pixel_costs)[i * static_cast<size_t>(width) + j] = static_cast<float>(read_cost_counter(cost_metric) - cost_start);
+                    }
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < thread_count; t++) {
+        workers.emplace_back([&, t]() {
+            set_trace_thread_name("render worker " + std::to_string(t));
+            render_tiles();
+        });
+    }
+    render_tiles();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+}
+
+/**
+ * @brief  Define the viewing window and begin ray tracing to determine color value of each pixel
+ * @returns The linear radiance of each pixel
+ * @param scene Built scene to trace
+ * @param view_origin The position of the camera
+ * @param view_direction The forward direction the camera
+ * @param view_up The up direction of camera. Determines tilt and roll.
+ * @param fov_h Horizontal feild of view
+ * @param res_h Height of view window
+ * @param res_w Width of view window
+ * @param background_color Default base color used when no ray intersections are found
+ * @param pixel_costs Optional. Receives the row-major cost of each pixel, measured in the metric set by settings.heatmap
+**/
+inline Framebuffer create_view_window_and_ray_trace(SceneState& scene, Vector3 view_origin, Vector3 view_direction, Vector3 view_up, float fov_h, float res_h, float res_w, Color background_color, std::vector<float>* pixel_costs) 
+{
+    ViewWindow window = define_view_window(view_origin, view_direction, view_up, fov_h, res_h, res_w);
+    Framebuffer framebuffer(window.height, window.width);
+    ray_trace_region(scene, window, 0, 0, framebuffer, background_color, pixel_costs);
+    return framebuffer;
+}
+
+/**
+ * @brief Define the viewing window and ray trace only a rectangle of the image, for example one process's
+ * share of a render spread over several processes. The pixels are those of the same rectangle of a whole
+ * image render.
+ * @returns The linear radiance of the rectangle's pixels
+ * @param scene Built scene to trace
+ * @param view_origin The position of the camera
+ * @param view_direction The forward direction the camera
+ * @param view_up The up direction of camera. Determines tilt and roll.
+ * @param fov_h Horizontal feild of view
+ * @param res_h Height of view window
+ * @param res_w Width of view window
+ * @param background_color Default base color used when no ray intersections are found
+ * @param region Columns region[0] to region[2] - 1 and rows region[1] to region[3] - 1
+**/
+inline Framebuffer create_view_window_and_ray_trace_region(SceneState& scene, Vector3 view_origin, Vector3 view_direction, Vector3 view_up, float fov_h, float res_h, float res_w, Color background_color, int region[4])
+{
+    ViewWindow window = define_view_window(view_origin, view_direction, view_up, fov_h, res_h, res_w);
+    Framebuffer framebuffer(region[3] - region[1], region[2] - region[0]);
+    ray_trace_region(scene, window, region[1], region[0], framebuffer, background_color, nullptr);
+    return framebuffer;
+}
+
+/**
+ * @brief Splits the image into 'count' bands of whole tile rows of about equal height, for '--tile-index'
+ * @returns False if there are fewer tile rows than bands
+ * @param index Band, from 0 to count - 1
+ * @param count Number of bands
+ * @param height Image height in pixels
+ * @param width Image width in pixels
+ * @param region Receives the band as columns region[0] to region[2] - 1 and rows region[1] to region[3] - 1
+**/
+inline bool tile_index_region(int index, int count, int height, int width, int region[4])
+{
+    int tile_rows = (height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    if (count > tile_rows) {
+        return false;
+    }
+    region[0] = 0;
+    region[1] = static_cast<int>(static_cast<int64_t>(tile_rows) * index / count) * RENDER_TILE_SIZE;
+    region[2] = width;
+    region[3] = std::min(height, static_cast<int>(static_cast<int64_t>(tile_rows) * (index + 1) / count) * RENDER_TILE_SIZE);
+    return true;
+}
+
+/**
+ * @brief Ray trace the image in bands of rows and append each band to the output files as soon as it is
+ * done, so memory is bounded by the band rather than the image. Writes the same files as tracing the whole
+ * image with create_view_window_and_ray_trace and writing it with tone_map_to_image, write_ppm and write_pfm.
+ * @returns False if an output file could not be written
+ * @param scene Built scene to trace
+ * @param view_origin The position of the camera
+ * @param view_direction The forward direction the camera
+ * @param view_up The up direction of camera. Determines tilt and roll.
+ * @param fov_h Horizontal feild of view
+ * @param res_h Height of view window
+ * @param res_w Width of view window
+ * @param background_color Default base color used when no ray intersections are found
+ * @param band_rows Rows per band, rounded up to whole tiles
+ * @param writer Opened output files
+**/
+inline bool stream_view_window_and_ray_trace(SceneState& scene, Vector3 view_origin, Vector3 view_direction, Vector3 view_up, float fov_h, float res_h, float res_w, Color background_color, int band_rows, StreamingImageWriter& writer)
+{
+    ViewWindow window = define_view_window(view_origin, view_direction, view_up, fov_h, res_h, res_w);
+    band_rows = std::max(1, (band_rows + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE) * RENDER_TILE_SIZE;
+    for (int first_row = 0; first_row < window.height; first_row += band_rows) {
+        Framebuffer band(std::min(band_rows, window.height - first_row), window.width);
+        ray_trace_region(scene, window, first_row, 0, band, background_color, nullptr);
+
+        STATS_PHASE(PHASE_OUTPUT);
+        TraceSpan span("write_band", "output");
+        if (!writer.write_band(first_row, band)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Parts of shading a kernel compiles in. Kernels only leave out work their material can never need,
+    so SHADE_ALL with GEOMETRY_ANY is the generic kernel, which shades every material.
+*/
+enum ShadeFeature : unsigned int { SHADE_TEXTURE = 1, SHADE_TRANSMISSION = 2, SHADE_REFLECTION = 4, SHADE_ALL = 7 };
+enum ShadeGeometry { GEOMETRY_ANY, GEOMETRY_SPHERE, GEOMETRY_TRIANGLE, GEOMETRY_SHAPE };
+
+/**
+ * @brief Occlusion test for one shadow ray: multiplies the mask by the transparency (1 - opacity) of every
+ * object the ray passes through on its way to the light. The shaded object itself is not considered.
+ * @param scene Scene the shadow ray is traced in
+ * @param shadow_mask Light reaching the point so far
+ * @param point Shading point
+ * @param ray Direction towards the light
+ * @param max_distance Distance to the light along 'ray', or infinity for directional lights
+ * @param incidence_object_info The shaded object
+**/
+inline void attenuate_shadow(SceneState& scene, Color& shadow_mask, Vector3 point, Vector3 ray, float max_distance, SceneObjectInfo* incidence_object_info)
+{
+    STATS_COUNT(rays[RAY_SHADOW]);
+    std::vector<ObjectIntersections> other_object_intersections = TraceRay(scene, point, ray);
+
+    for ( auto [object, intersections] : other_object_intersections) 
+    {    
+        /*
+            We do not consider self intersections
+        */
+        if (object->id == incidence_object_info->id) {
+            continue;
+        }
+        
+        /*
+            Find if object intersection is in-between object and light source
+        */ 
+        for (auto intersection : intersections) 
+        {
+            if (intersection.distance > scene.settings.epsilon && intersection.distance < max_distance) 
+            {
+                shadow_mask = shadow_mask * (1.0 - object->material.opacity);
+            }
+        }  
+    }
+}
+
+/**
+ * @brief Fraction of an area light that reaches a point, estimated from shadow rays to a jittered
+ * grid of points on the light (settings.shadow_samples of them, rounded to a square).
+ * In the adaptive mode a 2x2 grid is traced first; if all four rays agree, the point is taken to be
+ * fully lit or fully in shadow and the estimate is done. Only points where they differ, in penumbrae,
+ * get the full grid.
+ * @returns Light transmitted per channel, 0 to 1
+ * @param scene Scene the shadow rays are traced in
+ * @param light A sphere or rectangle light
+ * @param point Shading point
+ * @param incidence_object_info The shaded object
+**/
+inline Color area_light_visibility(SceneState& scene, Light& light, Vector3 point, SceneObjectInfo* incidence_object_info)
+{
+    int grid = std::max(1, static_cast<int>(std::lround(std::sqrt(scene.settings.shadow_samples))));
+    bool adaptive = scene.settings.soft_shadows == SOFT_SHADOWS_ADAPTIVE && grid > SHADOW_SAMPLES_INITIAL_GRID;
+    uint32_t seed = shadow_sample_seed(point, light);
+    STATS_COUNT(area_light_evaluations);
+
+    // Traces one jittered sample of each cell of a 'cells' x 'cells' grid, returning the summed transmission
+    Color first_mask;
+    bool samples_agree = true;
+    auto trace_grid = [&](int cells, uint32_t salt) {
+        Color sum = { 0.0f, 0.0f, 0.0f };
+        for (int cell = 0; cell < cells * cells; cell++) {
+            uint32_t hash = hash_uint(seed ^ salt ^ static_cast<uint32_t>(cell));
+            float s = (static_cast<float>(cell % cells) + hash_to_unit(hash)) / cells;
+            float t = (static_cast<float>(cell / cells) + hash_to_unit(hash_uint(hash))) / cells;
+            Vector3 to_sample = sample_area_light(light, point, s, t) - point;
+            float distance = std::sqrt(to_sample.square().sum());
+            Color mask = { 1.0f, 1.0f, 1.0f };
+            attenuate_shadow(scene, mask, point, to_sample / distance, distance, incidence_object_info);
+            if (cell == 0) {
+                first_mask = mask;
+            } else if (mask.r != first_mask.r || mask.g != first_mask.g || mask.b != first_mask.b) {
+                samples_agree = false;
+            }
+            sum = sum + mask;
+        }
+        STATS_ADD(area_light_rays, static_cast<uint64_t>(cells) * cells);
+        return sum;
+    };
+
+    Color sum = { 0.0f, 0.0f, 0.0f };
+    int samples = 0;
+    if (adaptive) {
+        sum = trace_grid(SHADOW_SAMPLES_INITIAL_GRID, 0x5bd1e995u);
+        samples = SHADOW_SAMPLES_INITIAL_GRID * SHADOW_SAMPLES_INITIAL_GRID;
+        if (samples_agree) {
+            return first_mask;
+        }
+        STATS_COUNT(refined_area_light_evaluations);
+    }
+    sum = sum + trace_grid(grid, 0x1b873593u);
+    samples += grid * grid;
+    return sum * (1.0f / samples);
+}
+
+/**
+ * @brief Shading kernel: determines pixel intensity returned by a ray and object it intersects. 
+ * Calulates contribution of shadows, transparency, reflections, specular/diffuse color, and so on
+ * to said pixel intesity. 
+ * @returns Linear RGB radiance, not clamped
+ * @param scene Scene the ray is traced in
+ * @param incidence_ray Incoming ray  
+ * @param incidence_object_info Information about object intersected by incident ray
+ * @param incidence_object_intersection The point of intersection between ray and object
+ * @param recursion_depth How deep we want to raytrace within scene
+ * @param incidence_refraction_index Reflectivity of incident object
+ * @param transmission_refraction_index Reflectivity of transmission object
+ * @param ray_state Default is "ENTERING." Used to track where ray is in relation to object material during recursive calls to ShadeRay
+ * @param background_color Base color utilized if no intersections are found during raytracing 
+ * @tparam Features ShadeFeature flags for the parts of shading compiled in
+ * @tparam Geometry Object type the kernel shades, or GEOMETRY_ANY to check it at runtime
+**/
+template <unsigned int Features, ShadeGeometry Geometry>
+Color shade_kernel(SceneState& scene, Vector3 incidence_ray, SceneObjectInfo* incidence_object_info, Intersection incidence_object_intersection, float incidence_refraction_index, float transmission_refraction_index, std::vector<SceneObjectInfo*> incident_object_stack, RayState ray_state, float recursion_depth, Color background_color)
+{
+    constexpr bool textured = (Features & SHADE_TEXTURE) != 0;
+    constexpr bool transmissive = (Features & SHADE_TRANSMISSION) != 0;
+    constexpr bool reflective = (Features & SHADE_REFLECTION) != 0;
+    STATS_COUNT(shade_calls[static_cast<int>(std::clamp<float>(recursion_depth, 0, RenderCounters::max_depth - 1))]);
+    Vector3 N = incidence_object_intersection.normal;
+    Vector3 I = (incidence_ray * -1.0);
+    Color tmp_specular = { 0.0, 0.0, 0.0 };
+    Color shadow_mask = { 1.0, 1.0, 1.0 };
+    Color diffuse;
+    Color tmp_reflection = { 0.0, 0.0, 0.0 };
+    Color tmp_transparency = { 0.0, 0.0, 0.0 };
+    Material material = incidence_object_info->material;
+    std::vector<bool> obstructions;
+    float cos_angle_incidence = N.dot(I);
+    RayState previous_ray_state = ray_state;
+    bool fast_math = scene.settings.fast_math; // '--precision fast', see fast_math.h
+    bool is_sphere = Geometry == GEOMETRY_ANY ? incidence_object_info->type == "sphere" : Geometry == GEOMETRY_SPHERE;
+    bool is_shape = Geometry == GEOMETRY_ANY ? is_shape_type(incidence_object_info->type) : Geometry == GEOMETRY_SHAPE;
+    
+    /*
+        At point of intersection, either retreive the base diffuse color or the corresponding texture value
+    */
+    if (textured && incidence_object_info->has_texture) 
+    {
+        if (is_sphere) 
+        {
+            // Find texture coorinates
+            float v = (fast_math ? fast_acos(N.z) : acos(N.z)) / M_PI;
+            float phi = fast_math ? fast_atan2(N.y, N.x) : atan2(N.y, N.x);
+            float u;
+            u = map(phi, -M_PI, M_PI, 0.0, 1.0);
+            
+            // Find texture pixel value that location
+            float width = static_cast<float>(incidence_object_info->texture->width);
+            float height = static_cast<float>(incidence_object_info->texture->height);
+            v = std::clamp<float>(v, 0.0, 1.0);
+            u = std::clamp<float>(u, 0.0, 1.0);
+
+            // TODO: Map using bi-linear interpolation 
+            int i = static_cast<int>(std::clamp<float>(round((height - 1.0) * v), 0.0, height - 1.0));
+            int j = static_cast<int>(std::clamp<float>(round((width - 1.0) * u), 0.0, width - 1.0));
+            byte texel[3];
+            incidence_object_info->texture->fetch(j, i, texel);
+            
+            // Update diffuse color 
+            diffuse = {
+                .r = static_cast<float>(map(texel[0], MIN_PIXEL_VALUE, MAX_PIXEL_VALUE, 0.0, 1.0)),
+                .g = static_cast<float>(map(texel[1], MIN_PIXEL_VALUE, MAX_PIXEL_VALUE, 0.0, 1.0)),
+                .b = static_cast<float>(map(texel[2], MIN_PIXEL_VALUE, MAX_PIXEL_VALUE, 0.0, 1.0))
+            };
+        } else if (is_shape) {
+            // Shapes map their texture as they are intersected
+            float u = incidence_object_intersection.texture_coords.x;
+            float v = incidence_object_intersection.texture_coords.y;
+            float width = static_cast<float>(incidence_object_info->texture->width);
+            float height = static_cast<float>(incidence_object_info->texture->height);
+            int i = static_cast<int>(std::clamp<float>(round((width - 1.0f) * u), 0.0, width - 1.0));
+            int j = static_cast<int>(std::clamp<float>(round((height - 1.0f) * v), 0.0, height - 1.0));
+            byte texel[3];
+            incidence_object_info->texture->fetch(i, j, texel);
+            diffuse = {
+                .r = static_cast<float>(map(texel[0], MIN_PIXEL_VALUE, MAX_PIXEL_VALUE, 0.0, 1.0)),
+                .g = static_cast<float>(map(texel[1], MIN_PIXEL_VALUE, MAX_PIXEL_VALUE, 0.0, 1.0)),
+                .b = static_cast<float>(map(texel[2], MIN_PIXEL_VALUE, MAX_PIXEL_VALUE, 0.0, 1.0))
+            };
+        } else {
+            Mesh* mesh = incidence_object_intersection.mesh;
+            MeshTriangle& face = mesh->triangles[incidence_object_intersection.triangle];
+            Vector3 barycentric_cords = incidence_object_intersection.barycentric_cords;
+            Point texture_coords[3] = {
+                mesh->texture_coord(face.vertex[0]),
+                mesh->texture_coord(face.vertex[1]),
+                mesh->texture_coord(face.vertex[2])
+            };
+
+            /* 
+                Get new texture coordinate as linear combination of the 3 texture coordinates,
+                using face' barycentric coordinates as weights
+            */
+            float u = 
+                (barycentric_cords.x * std::clamp<float>(texture_coords[0].x, 0.0, 1.0)) +
+                (barycentric_cords.y * std::clamp<float>(texture_coords[1].x, 0.0, 1.0)) +
+                (barycentric_cords.z * std::clamp<float>(texture_coords[2].x, 0.0, 1.0));
+            float v = 
+                (barycentric_cords.x * std::clamp<float>(texture_coords[0].y, 0.0, 1.0)) +
+                (barycentric_cords.y * std::clamp<float>(texture_coords[1].y, 0.0, 1.0)) +
+                (barycentric_cords.z * std::clamp<float>(texture_coords[2].y, 0.0, 1.0));
+
+
+            v = std::clamp<float>(v, 0.0, 1.0);
+            u = std::clamp<float>(u, 0.0, 1.0);
+        
+            // Find texture pixel value that location
+            float width = static_cast<float>(incidence_object_info->texture->width);
+            float height = static_cast<float>(incidence_object_info->texture->height);
+            
+            // TODO: Map using bi-linear interpolation 
+            int i = static_cast<int>(std::clamp<float>(round((width - 1.0f) * u), 0.0, width - 1.0));
+            int j = static_cast<int>(std::clamp<float>(round((height - 1.0f) * v), 0.0, height - 1.0));
+            byte texel[3];
+            incidence_object_info->texture->fetch(i, j, texel);
+            
+            // Update diffuse color 
+            diffuse = {
+                .r = static_cast<float>(map(texel[0], MIN_PIXEL_VALUE, MAX_PIXEL_VALUE, 0.0, 1.0)),
+                .g = static_cast<float>(map(texel[1], MIN_PIXEL_VALUE, MAX_PIXEL_VALUE, 0.0, 1.0)),
+                .b = static_cast<float>(map(texel[2], MIN_PIXEL_VALUE, MAX_PIXEL_VALUE, 0.0, 1.0)),
+            };
+        }
+    } 
+    else 
+    {
+        diffuse = material.diffuse;
+    }
+
+    // Shapes face the ray, whether it is inside a box or cylinder or behind a plane or disk
+    if (cos_angle_incidence < 0.0 && (is_sphere || is_shape)) {
+        N = (N * -1.0);
+        cos_angle_incidence = N.dot(I);
+    }
+
+    /*
+        Simulate shadows by tracing up from intersection point to light source.
+        If the object has transparency, then the object's opacity discounts the intensity of the shadow.
+    */
+    for (Light light : scene.scene_lights) 
+    {
+        Vector3 L, H;
+
+        /*
+            If directional light source. These are at infinite distance. All rays point in same direction.
+        */
+        if (light.w == 0) 
+        {
+            L = light.direction.norm() * -1.0f;
+
+
+            /*
+                Determine if shadow exists:
+                Ray-trace along the negative of light's direction for a directional light
+                For directional lights, if intersection distance is greater than 0, then a shadow will be cast.
+            */
+            Vector3 ray = light.direction * -1.0f;
+            attenuate_shadow(scene, shadow_mask, incidence_object_intersection.point, ray, std::numeric_limits<float>::infinity(), incidence_object_info);
+        }
+
+        /*
+            Area lights cast soft shadows: the fraction of the light that is visible is estimated with several shadow rays
+        */
+        else if (light.shape != LIGHT_POINT)
+        {
+            L = (light.position - incidence_object_intersection.point).norm();
+            shadow_mask = shadow_mask * area_light_visibility(scene, light, incidence_object_intersection.point, incidence_object_info);
+        }
+
+        /*
+            Otherwise its a point light source, which emit light in all directions at once. Points from objects surface to light. 
+        */
+        else 
+        {
+ 
+            L = (light.position - incidence_object_intersection.point).norm();
+            float distance_to_light = std::sqrt((incidence_object_intersection.point - light.position).square().sum());
+
+            /*
+                Determine if shadow exists:
+                Ray-trace from point of intersection to light source, detecting other scene objects are occluding light.
+            */
+            attenuate_shadow(scene, shadow_mask, incidence_object_intersection.point, L, distance_to_light, incidence_object_info);
+        }
+  
+        H = (L + I).norm(); // Halfway vector
+        Color diffuse_component = (diffuse * material.kd) * std::max(0.0f, N.dot(L));
+        float cos_angle_halfway = std::max(0.0f, N.dot(H));
+        Color specular_component = (material.specular * material.ks) * (fast_math ? fast_pow(cos_angle_halfway, material.n) : powf(cos_angle_halfway, material.n));
+        tmp_specular = tmp_specular + (light.color * shadow_mask * (
+            diffuse_component + 
+            specular_component
+        ));
+    }
+
+    /*
+        Opaque materials without reflections are done: ambient + diffuse + specular
+    */
+    if constexpr (!transmissive && !reflective) {
+        return (diffuse * material.ka) + tmp_specular;
+    }
+
+    float snells_ratio = (incidence_refraction_index / transmission_refraction_index);
+    bool total_internal_reflection = false;
+    float F_0 = 0.0f;
+    float schlick_weight; // (1 - cos)^5, shared by the transmission and reflection Fresnel terms
+    // Faces are not flipped to face the ray, so the cosine is negative on their back. Clamped, F stays in [0, 1].
+    float fresnel_cos_angle = std::max(0.0f, cos_angle_incidence);
+    if (fast_math) {
+        if (transmissive) {
+            total_internal_reflection = total_internal_reflection_from_cosine(cos_angle_incidence, transmission_refraction_index / incidence_refraction_index);
+            F_0 = pow2((transmission_refraction_index - incidence_refraction_index)/(transmission_refraction_index + incidence_refraction_index));
+        }
+        schlick_weight = pow5(1.0f - fresnel_cos_angle);
+    } else {
+        if (transmissive) {
+            float critical_angle = asinf(transmission_refraction_index / incidence_refraction_index); 
+            float incidence_angle = acosf(cos_angle_incidence);
+            total_internal_reflection = (critical_angle < incidence_angle) && (incidence_angle < (90.0 * M_PI / 180.0));
+            F_0 = powf((transmission_refraction_index - incidence_refraction_index)/(transmission_refraction_index + incidence_refraction_index), 2.0); 
+        }
+        schlick_weight = powf(1.0 - fresnel_cos_angle, 5.0);
+    }
+    float F = F_0 + (1.0 - F_0)*schlick_weight;
+    
+    /*
+        Determine contribution of pixel intensity from transparency effects:
+        Do this by recursively raytracing from the transmission ray "T" (Ray that enters new medium).
+
+        Assuming the material the ray enters is not fully opaque
+        or refracted back into the same medium it arrived from (total internal reflection), 
+        we then trace the ray through the scene (up to "recursion_depth" times).
+    */
+    if (transmissive && recursion_depth > 0 && !total_internal_reflection && incidence_object_info->material.opacity < 1.0 && incidence_object_info->material.refraction_index > 0) {
+        
+        // Transmission ray
+        Vector3 T = (N * -1.0) 
+                    * 
+                    sqrtf(
+                        fast_math ? 1.0f - pow2(snells_ratio)*(1.0f - pow2(cos_angle_incidence))
+                                  : 1.0 - ( powf(snells_ratio, 2.0)*(1.0-powf(cos_angle_incidence, 2.0)))
+                    ) 
+                    + 
+                    (
+                        ((N*cos_angle_incidence) - I)*snells_ratio
+                    );
+
+        Intersection min_intersection;
+        SceneObjectInfo* intersected_object = nullptr; 
+        float min_distance = std::numeric_limits<float>::max();
+        STATS_COUNT(rays[RAY_REFRACTION]);
+        for (auto & [object, intersections] : TraceRay(scene, incidence_object_intersection.point, T)) 
+        {   
+            for (auto & intersection : intersections) 
+            {  
+                // Make distance greater than some small number here, likely the same intersection point.
+                if (intersection.distance > scene.settings.epsilon && intersection.distance < min_distance) {
+                    
+                    // Prevents self-intersections at the surface of faces, resulting in artifacts at edges of connected faces
+                    if (incident_object_stack.size() > 0 && object->id != incident_object_stack.back()->id && incidence_object_info->type == "face") {
+                       goto SKIP_TRANS;
+                    } 
+
+                    min_distance = intersection.distance;
+                    
+                    // The case when transmission ray is exiting the same material
+                    min_intersection = intersection;
+                    intersected_object = object;  
+                }
+            }
+        }
+
+        // Recurse on transmitted ray
+        if (intersected_object != nullptr) {
+        
+            float new_incident_refraction_index;
+            float new_transmittion_refraction_index;
+            std::vector<SceneObjectInfo*> new_incident_object_stack = incident_object_stack;
+            RayState new_ray_state;
+
+            switch (previous_ray_state)
+            {
+            // Previous ray was entering an object...
+            case RayState::ENTERING:
+                //  ...and transmitted ray exits other side of sphere
+                if (intersected_object->id == incidence_object_info->id) { 
+                    new_ray_state = RayState::EXITING;
+                    new_incident_refraction_index = new_incident_object_stack.back()->material.refraction_index;
+                    new_incident_object_stack.pop_back();
+                    new_transmittion_refraction_index = new_incident_object_stack.size() > 0 ? new_incident_object_stack.back()->material.refraction_index : scene.background_refraction_index;
+                    if (new_incident_object_stack.size() > 0) new_incident_object_stack.pop_back();
+
+                // ...and transmitted ray enters into another internal material
+                } else { 
+                    new_ray_state = RayState::ENTERING;
+                    new_incident_refraction_index = transmission_refraction_index;
+                    new_transmittion_refraction_index = intersected_object->material.refraction_index;
+                    new_incident_object_stack.push_back(intersected_object);
+                }
+
+                break;
+            // Previous ray was exiting a material...
+            case RayState::EXITING:
+                if (new_incident_object_stack.size() > 0) {
+
+                    // .. and transmissions enter a new object before exiting current media
+                    if (!objectInStack(new_incident_object_stack, intersected_object)) { 
+                        new_ray_state = RayState::ENTERING;
+                        new_incident_refraction_index = transmission_refraction_index;
+                        new_transmittion_refraction_index = intersected_object->material.refraction_index;
+                        new_incident_object_stack.push_back(intersected_object);
+
+                    // .. and transmission ray is exiting from nested containing material
+                    } else { 
+                        new_ray_state = RayState::EXITING;
+                        new_incident_refraction_index = transmission_refraction_index;
+                        new_transmittion_refraction_index = new_incident_object_stack.back()->material.refraction_index;
+                        new_incident_object_stack.pop_back();
+                    }  
+                    
+                // .. and transmission ray enters new object (through background space)
+                } else { 
+                    new_ray_state = RayState::ENTERING;
+                    new_incident_refraction_index = scene.background_refraction_index;
+                    new_transmittion_refraction_index = intersected_object->material.refraction_index;
+                    new_incident_object_stack = { intersected_object }; // We are not appending to stack if entering new obj from background 
+                }
+                
+                break;
+            }
+        
+            tmp_transparency = ShadeRay(
+                scene,
+                T,
+                intersected_object, 
+                min_intersection, 
+                new_incident_refraction_index,
+                new_transmittion_refraction_index,
+                new_incident_object_stack,
+                new_ray_state,
+                recursion_depth-1,
+                background_color
+            // ) * (1.0-F)*(expf(-1.0 * incidence_object_info->material.opacity*min_intersection.distance)); // Attenuated transparency via Beer's Law
+            ) *(1.0-F)*(1.0 - incidence_object_info->material.opacity);
+        
+        // Use background color if no object was intersected
+        } else {
+            tmp_transparency = background_color * (1.0-F)*(1.0 - incidence_object_info->material.opacity);
+        }
+    }
+
+    SKIP_TRANS:
+
+    /*
+        Determine contribution of pixel intensity from reflections:
+        Simulate reflections using Schlick's approximation of Fresnel Reflectance.
+        
+        To do so, we recursively raytrace from the incidence ray "R" (Ray that is reflected off the surface of intersected object).
+        This ray will bounce around the scene (traced up to "recursion_depth" times). 
+        The RGB value returned by this traced ray is then multiplied by the Schlick approximation, "F",
+        of the material surface's Fresnal reflectance.
+    */
+    
+    float reflectance_ratio = (incidence_object_info->material.refraction_index - 1)/(incidence_object_info->material.refraction_index + 1);
+    F_0 = fast_math ? pow2(reflectance_ratio) : powf(reflectance_ratio, 2.0); 
+    F = F_0 + (1.0 - F_0)*schlick_weight;
+    if (reflective && recursion_depth > 0 && F != 0.0 && incidence_object_info->material.ks > 0.0) 
+    {
+        // Refraction ray
+        Vector3 R = N*(2.0*(cos_angle_incidence)) - I;
+        Intersection min_intersection;
+        SceneObjectInfo* intersected_object = nullptr; 
+        float min_distance = std::numeric_limits<float>::max();
+
+        STATS_COUNT(rays[RAY_REFLECTION]);
+        for (auto& [object, intersections] : TraceRay(scene, incidence_object_intersection.point, R)) 
+        {
+            for (auto & intersection : intersections) 
+            {
+                if (intersection.distance > scene.settings.epsilon && intersection.distance < min_distance) 
+                {
+                    min_distance = intersection.distance;
+                    intersected_object = object;
+                    min_intersection = intersection;
+                }
+            }
+        }
+
+        // Recurse on reflected ray
+        if (intersected_object != nullptr)
+        {
+            float new_incident_refraction_index;
+            float new_transmittion_refraction_index;
+            std::vector<SceneObjectInfo*> new_incident_object_stack = incident_object_stack;
+            RayState new_ray_state;
+
+            switch (previous_ray_state)
+            {
+            // Previous ray was entering an object...
+            case RayState::ENTERING:
+                if (new_incident_object_stack.size() > 0) {
+
+                    // .. and reflected ray enters new object before exiting parent media
+                    if (!objectInStack(new_incident_object_stack, intersected_object)) { 
+                        new_ray_state = RayState::ENTERING;
+                        new_incident_refraction_index = incidence_refraction_index;
+                        new_transmittion_refraction_index = intersected_object->material.refraction_index;
+                        new_incident_object_stack.push_back(incidence_object_info);
+
+                    // .. and reflected ray exits towards border of parent media
+                    } else { 
+                        new_ray_state = RayState::ENTERING;
+                        new_incident_refraction_index = incidence_refraction_index;
+                        new_transmittion_refraction_index = new_incident_object_stack.back()->material.refraction_index;
+                        new_incident_object_stack.pop_back();
+                    }
+
+                // .. and reflect ray enters object in background media
+                } else { 
+                    new_ray_state = RayState::ENTERING;
+                    new_incident_refraction_index = incidence_refraction_index;
+                    new_transmittion_refraction_index = intersected_object->material.refraction_index;
+                    new_incident_object_stack = { intersected_object };
+                }
+                
+                break;
+            
+            // Previous ray was exiting an object...
+            case RayState::EXITING: 
+                // .. and reflected ray intersects back onto same surface
+                if (intersected_object->id == incidence_object_info->id) {
+                    new_ray_state = RayState::EXITING;
+                    new_incident_refraction_index = incidence_refraction_index;
+                    new_transmittion_refraction_index = transmission_refraction_index;
+
+                // .. and reflected ray intersects a nested object
+                } else {
+                    new_ray_state = RayState::ENTERING;
+                    new_incident_refraction_index = incidence_refraction_index;
+                    new_transmittion_refraction_index = intersected_object->material.refraction_index;
+                    new_incident_object_stack.push_back(intersected_object);
+                }
+
+                break;
+            }
+
+            tmp_reflection = ShadeRay(
+                scene,
+                R,
+                intersected_object, 
+                min_intersection, 
+                new_incident_refraction_index,
+                new_transmittion_refraction_index,
+                new_incident_object_stack,
+                new_ray_state,
+                recursion_depth-1,
+                background_color
+            ) * F;
+            
+        // Use background color if no object was intersected
+        } else {
+            tmp_reflection = background_color * F;
+        }
+    }
+    
+    
+    /*
+        Ambient + diffuse + specular + reflection + transparency
+    */
+    return (diffuse * material.ka) + tmp_specular + tmp_transparency + tmp_reflection;
+}
+
+/*
+    Kernel for a material's feature set on one kind of geometry
+*/
+template <ShadeGeometry Geometry>
+ShadeKernel shade_kernel_for(unsigned int features)
+{
+    switch (features)
+    {
+    case 0: return shade_kernel<0, Geometry>;
+    case SHADE_TEXTURE: return shade_kernel<SHADE_TEXTURE, Geometry>;
+    case SHADE_TRANSMISSION: return shade_kernel<SHADE_TRANSMISSION, Geometry>;
+    case SHADE_TEXTURE | SHADE_TRANSMISSION: return shade_kernel<SHADE_TEXTURE | SHADE_TRANSMISSION, Geometry>;
+    case SHADE_REFLECTION: return shade_kernel<SHADE_REFLECTION, Geometry>;
+    case SHADE_TEXTURE | SHADE_REFLECTION: return shade_kernel<SHADE_TEXTURE | SHADE_REFLECTION, Geometry>;
+    case SHADE_TRANSMISSION | SHADE_REFLECTION: return shade_kernel<SHADE_TRANSMISSION | SHADE_REFLECTION, Geometry>;
+    default: return shade_kernel<SHADE_ALL, Geometry>;
+    }
+}
+
+/**
+ * @brief Picks the shading kernel for an object from its material, once at scene load
+ * @returns The specialized kernel, or the generic one when settings.generic_shading is set
+ * @param scene Scene whose settings choose the kernel
+ * @param object_info Object to shade
+**/
+inline ShadeKernel select_shade_kernel(SceneState& scene, SceneObjectInfo& object_info)
+{
+    if (scene.settings.generic_shading) {
+        return shade_kernel<SHADE_ALL, GEOMETRY_ANY>;
+    }
+    Material& material = object_info.material;
+    unsigned int features = 0;
+    if (object_info.has_texture) features |= SHADE_TEXTURE;
+    if (material.opacity < 1.0 && material.refraction_index > 0) features |= SHADE_TRANSMISSION;
+    if (material.ks > 0.0) features |= SHADE_REFLECTION;
+    if (object_info.type == "sphere") {
+        return shade_kernel_for<GEOMETRY_SPHERE>(features);
+    }
+    return is_shape_type(object_info.type) ? shade_kernel_for<GEOMETRY_SHAPE>(features) : shade_kernel_for<GEOMETRY_TRIANGLE>(features);
+}
+
+inline void assign_shade_kernels(SceneState& scene)
+{
+    for (auto& [type, object_infos] : scene.scene_object_infos) {
+        for (SceneObjectInfo* object_info : object_infos) {
+            object_info->shade_kernel = select_shade_kernel(scene, *object_info);
+        }
+    }
+    for (Instance* placed : scene.instances) {
+        for (SceneObjectInfo* material_info : placed->material_infos) {
+            material_info->shade_kernel = select_shade_kernel(scene, *material_info);
+        }
+    }
+}
+
+/**
+ * @brief Determines pixel intensity returned by a ray and object it intersects, with the kernel
+ * chosen for the object's material. Arguments are those of shade_kernel.
+ * @returns Linear RGB radiance, not clamped
+**/
+inline Color ShadeRay(SceneState& scene, Vector3 incidence_ray, SceneObjectInfo* incidence_object_info, Intersection incidence_object_intersection, float incidence_refraction_index, float transmission_refraction_index, std::vector<SceneObjectInfo*> incident_object_stack, RayState ray_state, float recursion_depth, Color background_color)
+{
+    ShadeKernel kernel = incidence_object_info->shade_kernel != nullptr ? incidence_object_info->shade_kernel : shade_kernel<SHADE_ALL, GEOMETRY_ANY>;
+    return kernel(scene, incidence_ray, incidence_object_info, incidence_object_intersection, incidence_refraction_index, transmission_refraction_index,
+        std::move(incident_object_stack), ray_state, recursion_depth, background_color);
+}
+
+/**
+ * @brief Intersects a ray with a sphere
+ * @returns Both points where the ray's line crosses the sphere, including those behind the origin, or none
+ * @param sphere_object Sphere to intersect
+ * @param view_origin origin of the ray
+ * @param ray Outgoing ray. Need not be normalized; distance is measured in multiples of it.
+**/
+inline std::vector<Intersection> intersect_sphere(Sphere* sphere_object, Vector3 view_origin, Vector3 ray)
+{
+    std::vector<Intersection> intersections;
+    STATS_COUNT(intersection_tests[PRIMITIVE_SPHERE]);
+    Vector3 dir = (view_origin - sphere_object->center);
+
+    /*
+        Determine ray intersection points (x, y, z) via equation of sphere:
+        (x–sphere.x)^2 + (y–sphere.y)^2 + (z–sphere.z)^2 == sum[(intersection - sphere_center)^2] == sphere.r^2
+        intersection = view_origin + (distance * ray)
+    */
+    float A = ray.square().sum(); // Not 1 for the unnormalized shadow rays of directional lights
+    float B = 2.0 * (ray * dir).sum();
+    float C = dir.square().sum() - pow(sphere_object->radius, 2.0);
+
+    /*
+        When the sign of the determinant is Positive, there are two solutions.
+        When the sign of the determinant is Negative, there are no solutions.
+        When the determinant is Zero, there there is one solution.
+    */
+    
+    float determinant = std::pow(B, 2.0) - (4.0 * A * C);
+    if (!std::signbit(determinant)) {
+        float distance1 = (-B + std::sqrt(determinant)) / (2.0 * A);
+        Vector3 intersection1 = view_origin + (ray * distance1);
+        intersections.push_back({
+            distance1,
+            intersection1,
+            ((intersection1 - sphere_object->center) / sphere_object->radius).norm()
+        });
+        
+        float distance2 = (-B - std::sqrt(determinant)) / (2.0 * A);
+        Vector3 intersection2 = view_origin + (ray * distance2);
+        intersections.push_back({
+            distance2,
+            intersection2,
+            ((intersection2 - sphere_object->center) / sphere_object->radius).norm()
+        });
+        
+    } else if (determinant == 0) {
+        float distance = -B / (2.0 * A);
+        Vector3 intersection = view_origin + (ray * distance);
+        intersections.push_back({
+            distance,
+            intersection,
+            ((intersection - sphere_object->center) / sphere_object->radius).norm()
+        });
+    }
+    return intersections;
+}
+
+/**
+ * @brief Intersects a ray with one top level primitive of the scene
+ * @param scene Scene the primitive belongs to
+ * @param candidate Index of the primitive in SceneState::primitives
+ * @param view_origin origin of the ray
+ * @param ray Outgoing ray
+ * @param face_ray The same ray, set up for triangle tests
+ * @param ray_trace_results Receives the primitive's intersections, if any, grouped by object info
+**/
+inline void intersect_primitive(SceneState& scene, uint32_t candidate, Vector3 view_origin, Vector3 ray, WatertightRay& face_ray, std::vector<ObjectIntersections>& ray_trace_results)
+{
+    ScenePrimitive& primitive = scene.primitives[candidate];
+    if (primitive.kind == PRIMITIVE_SPHERE) 
+    {
+        std::vector<Intersection> intersections = intersect_sphere(primitive.sphere, view_origin, ray);
+        if (!intersections.empty()) {
+            ray_trace_results.push_back({ .object_info = primitive.object_info, .intersections = intersections });
+        }
+    } 
+    else if (primitive.kind == PRIMITIVE_SHAPE) 
+    {
+        std::vector<Intersection> intersections = intersect_shape(primitive.shape, view_origin, ray);
+        if (!intersections.empty()) {
+            ray_trace_results.push_back({ .object_info = primitive.object_info, .intersections = intersections });
+        }
+    } 
+    else if (primitive.kind == PRIMITIVE_TRIANGLE) 
+    {
+        Intersection info; // Will only ever be one intersection per triangle (But other objects may differ)
+        if (intersect_face(&scene.scene_mesh, primitive.index, face_ray, info)) {
+            ray_trace_results.push_back({ .object_info = primitive.object_info, .intersections = { info } });
+        }
+    } 
+    else 
+    {
+        /*
+            Two level traversal: the accelerator finds instances whose world bounds the ray crosses,
+            then each instance's mesh BVH is walked in object space.
+        */
+        Instance* placed = scene.instances[primitive.index];
+        std::vector<Intersection> intersections;
+        intersect_instance(placed, view_origin, ray, intersections);
+        if (intersections.empty()) {
+            return;
+        }
+        if (placed->material_infos.empty()) {
+            ray_trace_results.push_back({ .object_info = placed->object_info, .intersections = intersections });
+            return;
+        }
+        // Group hits by the material they are shaded with
+        size_t first_result = ray_trace_results.size();
+        for (Intersection& intersection : intersections) {
+            SceneObjectInfo* object_info = placed->object_info_for(intersection.triangle);
+            size_t k = first_result;
+            while (k < ray_trace_results.size() && ray_trace_results[k].object_info != object_info) k++;
+            if (k == ray_trace_results.size()) {
+                ray_trace_results.push_back({ .object_info = object_info, .intersections = {} });
+            }
+            ray_trace_results[k].intersections.push_back(intersection);
+        }
+    }
+}
+
+/**
+ * @brief Traces ray into scene, finding intersections with any and all scene objects.
+ * Only the primitives the scene's accelerator returns are tested, and the infinite planes.
+ * @returns Returns a vector of intersection objects with points of intersection
+ * @param scene Scene to trace the ray in
+ * @param ray Outgoing ray
+ * @param view_origin origin of the ray
+**/
+inline std::vector<ObjectIntersections> TraceRay(SceneState& scene, Vector3 view_origin, Vector3 ray) 
+{
+    std::vector<ObjectIntersections> ray_trace_results;
+    thread_local std::vector<uint32_t> candidates; // Reused, so tracing does not allocate per ray
+    candidates.clear();
+    scene.accelerator->candidates(view_origin, ray, candidates);
+    for (uint32_t plane = scene.bounded_primitives; plane < scene.primitives.size(); plane++) {
+        candidates.push_back(plane);
+    }
+
+    WatertightRay face_ray(view_origin, ray);
+    for (uint32_t candidate : candidates) 
+    {
+        intersect_primitive(scene, candidate, view_origin, ray, face_ray, ray_trace_results);
+    }
+   
+    return ray_trace_results;
+}
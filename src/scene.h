@@ -0,0 +1,93 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "definitions.h"
+#include "accel.h"
+#include "arena.h"
+#include "bvh.h"
+#include "loader.h"
+#include "mesh.h"
+#include "settings.h"
+#include "shapes.h"
+#include "stats.h"
+#include "texture_cache.h"
+
+/*
+    A top level primitive of the scene, as indexed by the accelerator
+*/
+struct ScenePrimitive
+{
+    PrimitiveKind kind;
+    uint32_t index; // Triangle of the scene mesh, or position in SceneState::instances
+    Sphere* sphere; // Spheres only
+    SceneObjectInfo* object_info; // Null for instances, whose hits pick an object info per triangle
+    Shape* shape = nullptr; // Planes, disks, boxes and cylinders only
+};
+
+/*
+    Everything a scene holds: its objects, lights and textures, the accelerator over them and the settings
+    of its current render. Each Scene (raytracer.h) owns one, and the renderer's functions (render.h) are
+    given the one they work on.
+*/
+struct SceneState {
+    std::map<std::string, std::vector<SceneObjectInfo*>> scene_object_infos;
+    Mesh scene_mesh; // Triangles of top level 'f' commands, in the same order as scene_object_infos["face"]
+    std::map<int, Sphere*> spheres;
+    std::map<int, Shape*> shapes;
+    std::map<std::string, Mesh*> meshes;
+    std::vector<Instance*> instances;
+    std::vector<ScenePrimitive> primitives; // By object type name then in parse order, the order TraceRay reports them in; infinite planes last
+    uint32_t bounded_primitives = 0; // The accelerator indexes the primitives before this; every ray tests the infinite planes after them
+    Accelerator* accelerator = nullptr; // Over 'primitives', built by build_scene()
+    std::vector<Light> scene_lights;
+    std::vector<Texture*> textures; // From 'texture' commands
+    std::map<std::string, std::vector<std::string>> commands;
+
+    float background_refraction_index = 0.0f; // Outside of every object, 0 for none ('bkgcolor')
+    bool compress_vertices = false; // '--compress-vertices', for the scene mesh and meshes added later
+    bool serial_startup = false; // '--serial-startup', textures and meshes are indexed while parsing
+    RenderSettings settings; // Of the current render, set by Scene::apply
+
+    TextureCache texture_cache; // Decoded tiles of the textures, within settings.texture_cache_mb
+    BackgroundLoader loader; // Indexes 'P3' textures in the background, on up to settings.threads workers
+    SceneArena arena; // Owns the spheres, shapes, object infos, meshes, instances and textures above. Freed before the cache and loader they use
+
+    SceneState()
+    {
+        scene_mesh.name = "scene";
+    }
+
+    SceneState(const SceneState&) = delete;
+    SceneState& operator=(const SceneState&) = delete;
+
+    ~SceneState()
+    {
+        delete accelerator;
+    }
+
+    /*
+        Frees every scene object at once so another scene can be parsed. Vertex compression, serial startup
+        and the render settings are kept.
+    */
+    void clear()
+    {
+        delete accelerator;
+        accelerator = nullptr;
+        scene_object_infos.clear();
+        scene_mesh = Mesh();
+        scene_mesh.name = "scene";
+        scene_mesh.compressed = compress_vertices;
+        spheres.clear();
+        shapes.clear();
+        meshes.clear();
+        instances.clear();
+        primitives.clear();
+        bounded_primitives = 0;
+        scene_lights.clear();
+        textures.clear();
+        commands.clear();
+        background_refraction_index = 0.0f;
+        arena.release();
+    }
+};
@@ -0,0 +1,269 @@
+#pragma once
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "definitions.h"
+#include "scene.h"
+#include "mesh.h"
+#include "utility.h"
+
+/*
+    Adds objects to its scene state from values in memory. The scene file parser
+    (parser.h) is built on it, and programs embedding the renderer use it through Scene (raytracer.h).
+    As with 'mtlcolor' and 'texture' in scene files, spheres, shapes, faces and instances take the
+    material and texture set last.
+*/
+struct SceneBuilder
+{
+    SceneState state; // The objects added so far
+
+    // Counters for unique object id's
+    unsigned int obj_id_counter = 0;
+
+    // Will toggle between these two when adding objects
+    Texture* current_texture = nullptr;
+    Material current_material;
+    bool use_texture = false;
+    bool has_material = false;
+
+    // Set whenever objects are added, until the scene is built again
+    bool changed = true;
+
+    /*
+        Objects added from now on use this material and no texture
+    */
+    void set_material(Material material)
+    {
+        current_material = material;
+        has_material = true;
+        use_texture = false;
+    }
+
+    /*
+        Objects added from now on use this texture, shaded with the current material
+    */
+    void set_texture(Texture* texture)
+    {
+        current_texture = texture;
+        use_texture = true;
+    }
+
+    /**
+     * @brief Loads a PPM texture. Its tiles are decoded the first time they are sampled.
+     * @returns The texture, owned by the scene
+     * @param path Path of the '.ppm' file
+    **/
+    Texture* add_texture(std::string path)
+    {
+        Texture* texture = read_texture(path, state.arena, state.texture_cache, state.serial_startup ? nullptr : &state.loader);
+        state.textures.push_back(texture);
+        return texture;
+    }
+
+    /**
+     * @brief Adds a texture whose texels are already in memory
+     * @returns The texture, owned by the scene
+     * @param width Texels per row
+     * @param height Rows
+     * @param rgb Row-major 8-bit RGB texels, width * height * 3 bytes. Copied.
+    **/
+    Texture* add_texture(int width, int height, const byte* rgb)
+    {
+        if (width <= 0 || height <= 0 || rgb == nullptr) {
+            throw std::invalid_argument("ERROR: Invalid dimensions for texture in memory. Please verify.");
+        }
+        Texture* texture = state.arena.create<Texture>(width, height);
+        texture->path = "(memory)";
+        texture->texels.assign(rgb, rgb + static_cast<size_t>(width) * height * 3);
+        state.textures.push_back(texture);
+        return texture;
+    }
+
+    /**
+     * @brief Adds a sphere with the current material and texture
+     * @returns The sphere, owned by the scene
+     * @param center Center of the sphere
+     * @param radius Radius of the sphere
+    **/
+    Sphere* add_sphere(Vector3 center, float radius)
+    {
+        SceneObjectInfo* object_info = new_object_info("sphere");
+        Sphere* sphere = state.arena.create<Sphere>();
+        sphere->center = center;
+        sphere->radius = radius;
+        sphere->object_info = object_info;
+        state.scene_object_infos["sphere"].push_back(object_info);
+        state.spheres[object_info->id] = sphere;
+        changed = true;
+        return sphere;
+    }
+
+    /**
+     * @brief Adds a plane, disk, box or cylinder with the current material and texture
+     * @returns The shape, owned by the scene
+     * @param shape From make_plane, make_disk, make_box or make_cylinder
+    **/
+    Shape* add_shape(Shape shape)
+    {
+        SceneObjectInfo* object_info = new_object_info(shape_kind_names[shape.kind]);
+        Shape* added = state.arena.create<Shape>(shape);
+        added->object_info = object_info;
+        state.scene_object_infos[object_info->type].push_back(object_info);
+        state.shapes[object_info->id] = added;
+        changed = true;
+        return added;
+    }
+
+    /*
+        Adds a point, directional, sphere or rectangle light. Throws if an area light has no area.
+    */
+    void add_light(Light light)
+    {
+        if (light.shape == LIGHT_SPHERE && light.radius <= 0.0f) {
+            throw std::invalid_argument("Radius of 'spherelight' must be positive.");
+        }
+        if (light.shape == LIGHT_RECTANGLE && light.edge_u.cross(light.edge_v).square().sum() == 0.0f) {
+            throw std::invalid_argument("Edges of 'rectlight' must span a rectangle.");
+        }
+        state.scene_lights.push_back(light);
+        changed = true;
+    }
+
+    /**
+     * @brief Adds a face of the scene mesh, made of vertices of the scene mesh, with the current material and texture
+     * @param vertices Indices returned by state.scene_mesh.add_vertex or append_vertex
+     * @param smooth_shading Interpolate the vertex normals
+    **/
+    void add_face(uint32_t vertices[3], bool smooth_shading)
+    {
+        SceneObjectInfo* object_info = new_object_info("face");
+        state.scene_mesh.add_triangle(vertices[0], vertices[1], vertices[2], smooth_shading);
+        state.scene_object_infos["face"].push_back(object_info);
+        changed = true;
+    }
+
+    /**
+     * @brief Adds a triangle with the current material and texture
+     * @param positions Corners of the triangle, counter-clockwise seen from the front
+     * @param normals Optional vertex normals. Smooth shaded when given.
+     * @param texture_coords Optional texture coordinates
+    **/
+    void add_face(const Vector3 positions[3], const Vector3* normals = nullptr, const Point* texture_coords = nullptr)
+    {
+        uint32_t vertices[3];
+        for (int i = 0; i < 3; i++) {
+            vertices[i] = state.scene_mesh.append_vertex(
+                positions[i],
+                normals != nullptr ? normals[i] : Vector3({ 0.0f, 0.0f, 0.0f }),
+                texture_coords != nullptr ? texture_coords[i] : Point({ 0.0f, 0.0f })
+            );
+        }
+        add_face(vertices, normals != nullptr);
+    }
+
+    /**
+     * @brief Adds a reusable mesh from vertex and index arrays, to place with add_instance
+     * @returns The mesh, owned by the scene
+     * @param name Name of the mesh, unique in the scene
+     * @param positions Vertex positions
+     * @param triangles Three vertex indices per triangle
+     * @param normals Optional, one per vertex. Smooth shaded when given.
+     * @param texture_coords Optional, one per vertex
+    **/
+    Mesh* add_mesh(std::string name, const std::vector<Vector3>& positions, const std::vector<uint32_t>& triangles,
+        const std::vector<Vector3>& normals = {}, const std::vector<Point>& texture_coords = {})
+    {
+        if (state.meshes.find(name) != state.meshes.end()) {
+            throw std::invalid_argument("ERROR: Mesh '" + name + "' is already defined. Please verify.");
+        }
+        if (triangles.empty() || triangles.size() % 3 != 0 || (!normals.empty() && normals.size() != positions.size())
+                || (!texture_coords.empty() && texture_coords.size() != positions.size())) {
+            throw std::invalid_argument("ERROR: Invalid vertex or index arrays for mesh '" + name + "'. Please verify.");
+        }
+        Mesh* mesh = state.arena.create<Mesh>();
+        mesh->name = name;
+        mesh->compressed = state.compress_vertices;
+        for (size_t i = 0; i < positions.size(); i++) {
+            mesh->append_vertex(
+                positions[i],
+                normals.empty() ? Vector3({ 0.0f, 0.0f, 0.0f }) : normals[i],
+                texture_coords.empty() ? Point({ 0.0f, 0.0f }) : texture_coords[i]
+            );
+        }
+        for (size_t i = 0; i < triangles.size(); i += 3) {
+            if (triangles[i] >= positions.size() || triangles[i + 1] >= positions.size() || triangles[i + 2] >= positions.size()) {
+                throw std::invalid_argument("ERROR: Index out of range in mesh '" + name + "'. Please verify.");
+            }
+            mesh->add_triangle(triangles[i], triangles[i + 1], triangles[i + 2], !normals.empty());
+        }
+        mesh->build();
+        state.meshes[name] = mesh;
+        return mesh;
+    }
+
+    /**
+     * @brief Places a mesh in the scene with the current material and texture
+     * @returns The instance, owned by the scene
+     * @param mesh Mesh from add_mesh, a 'beginmesh' block or a 'mesh' or 'include' command
+     * @param object_to_world Transform of the mesh
+     * @param mesh_materials Shade faces with the mesh's own materials (from its .mtl files). Only faces
+     * without one use the current material, which is then required.
+    **/
+    Instance* add_instance(Mesh* mesh, Mat4 object_to_world, bool mesh_materials = false)
+    {
+        bool needs_material = !mesh_materials || mesh->triangle_materials.empty() || std::find(
+            mesh->triangle_materials.begin(), mesh->triangle_materials.end(), Mesh::no_material
+        ) != mesh->triangle_materials.end();
+        if (mesh_materials && needs_material && !has_material) {
+            throw std::invalid_argument("ERROR: Faces without a material in '" + mesh->name + "'. Must define a 'mtlcolor'. Please verify.");
+        }
+
+        Instance* instance = state.arena.create<Instance>();
+        instance->mesh = mesh;
+        instance->object_to_world = object_to_world;
+        instance->world_to_object = object_to_world.inverse();
+        instance->compute_bounds();
+        instance->object_info = new_object_info("instance", needs_material);
+        if (mesh_materials) {
+            // Hits on each mesh material are reported as separate objects sharing the instance's id
+            for (MeshMaterial& mesh_material : mesh->materials) {
+                SceneObjectInfo* material_info = state.arena.create<SceneObjectInfo>();
+                material_info->id = instance->object_info->id;
+                material_info->type = "instance";
+                material_info->material = mesh_material.material;
+                material_info->texture = mesh_material.texture;
+                material_info->has_texture = mesh_material.texture != nullptr;
+                instance->material_infos.push_back(material_info);
+            }
+        }
+        state.instances.push_back(instance);
+        state.scene_object_infos["instance"].push_back(instance->object_info);
+        changed = true;
+        return instance;
+    }
+
+    /**
+     * @brief Gives the next object its id, the current material and the current texture
+     * @returns The object's info, owned by the scene
+     * @param type "sphere", "face", "instance" or a shape's kind name
+     * @param needs_material Throw if there is no current material (or texture, after 'texture')
+    **/
+    SceneObjectInfo* new_object_info(std::string type, bool needs_material = true)
+    {
+        if (needs_material && !has_material) {
+            throw std::invalid_argument(use_texture ? "ERROR: Must define a 'mtlcolor' and 'texture'. Please verify." : "ERROR: Must define a 'mtlcolor'. Please verify.");
+        }
+        if (needs_material && use_texture && current_texture == nullptr) {
+            throw std::invalid_argument("ERROR: Must define a 'mtlcolor' and 'texture'. Please verify.");
+        }
+        SceneObjectInfo* object_info = state.arena.create<SceneObjectInfo>();
+        obj_id_counter++;
+        object_info->id = obj_id_counter;
+        object_info->type = type;
+        object_info->material = current_material;
+        object_info->texture = use_texture && has_material ? current_texture : nullptr;
+        object_info->has_texture = object_info->texture != nullptr;
+        return object_info;
+    }
+};
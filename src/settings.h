@@ -0,0 +1,45 @@
+#pragma once
+#include <algorithm>
+#include <thread>
+#include "definitions.h"
+#include "accel.h"
+#include "heatmap.h"
+#include "lights.h"
+#include "texture_compression.h"
+
+/*
+    How camera rays find the first surface they hit ('--primary'): RAYTRACE asks TraceRay, and so the
+    accelerator, for every pixel. RASTER first rasterizes the scene's faces and spheres into a per pixel
+    primitive ID and depth buffer, one render tile at a time, and then tests each pixel's ray against
+    its one visible primitive only. Reflection, refraction and shadow rays are ray traced either way.
+*/
+enum PrimaryVisibilityMode { PRIMARY_RAYTRACE, PRIMARY_RASTER };
+
+/*
+    Tile frustum culling ('--tile-culling'): before a render tile is traced, the bounds of the scene's
+    primitives are tested against the frustum of its camera rays. Tiles whose frustum reaches no primitive
+    are filled with the background without tracing a ray. Tiles that reach only a few are traced against
+    those alone instead of asking the accelerator for every pixel.
+*/
+enum TileCullingMode { TILE_CULLING_OFF, TILE_CULLING_ON };
+
+/*
+    Options of a render. The command line options of the same names set them. Scene::build and the
+    render functions in raytracer.h copy them into the scene's state, where the renderer reads them.
+*/
+struct RenderSettings
+{
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int recursion_depth = 4;
+    float epsilon = 1.0e-3f;
+    AccelType accel = ACCEL_AUTO; // '--accel'
+    PrimaryVisibilityMode primary_visibility = PRIMARY_RAYTRACE; // '--primary'
+    TileCullingMode tile_culling = TILE_CULLING_ON; // '--tile-culling'
+    SoftShadowMode soft_shadows = SOFT_SHADOWS_ADAPTIVE; // '--soft-shadows'
+    int shadow_samples = SHADOW_SAMPLES_DEFAULT; // '--shadow-samples'
+    bool fast_math = false; // '--precision fast'
+    bool generic_shading = false; // '--shading generic'
+    HeatmapMetric heatmap = HEATMAP_OFF; // '--heatmap', what the pixel costs a render returns are measured in
+    float texture_cache_mb = TEXTURE_CACHE_DEFAULT_MB; // '--texture-cache-mb'
+    TextureCompression texture_compression = TEXTURE_COMPRESSION_NONE; // '--texture-compression'
+};
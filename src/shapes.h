@@ -0,0 +1,352 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "definitions.h"
+#include "bvh.h"
+#include "stats.h"
+
+/*
+    Analytic primitives of the 'plane', 'disk', 'box' and 'cylinder' commands. Each is intersected in its
+    own frame: 'center' and the orthonormal axes u, v and w, where w is the normal of planes and disks and
+    the axis of cylinders. Hits carry texture coordinates, so shapes are textured the same way faces are.
+*/
+enum ShapeKind { SHAPE_PLANE, SHAPE_DISK, SHAPE_BOX, SHAPE_CYLINDER, SHAPE_KIND_COUNT };
+
+// Also the object info type of each kind
+inline const char* shape_kind_names[SHAPE_KIND_COUNT] = { "plane", "disk", "box", "cylinder" };
+
+struct Shape
+{
+    ShapeKind kind = SHAPE_PLANE;
+    Vector3 center = { 0.0f, 0.0f, 0.0f };
+    Vector3 axes[3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } }; // u, v, w
+    /*
+        Box: half extents along u, v and w. Disk: radius in x. Cylinder: radius in x and half height in z.
+        Plane: world units per texture repeat in x.
+    */
+    Vector3 size = { 1.0f, 1.0f, 1.0f };
+    SceneObjectInfo* object_info = nullptr;
+};
+
+/*
+    True for the object info types of shapes
+*/
+inline bool is_shape_type(const std::string& type)
+{
+    return std::find(shape_kind_names, shape_kind_names + SHAPE_KIND_COUNT, type) != shape_kind_names + SHAPE_KIND_COUNT;
+}
+
+/*
+    Completes a unit w into a right handed orthonormal frame
+*/
+inline void orthonormal_frame(Vector3 w, Vector3 axes[3])
+{
+    Vector3 helper = std::fabs(w.x) < 0.9f ? Vector3({ 1.0f, 0.0f, 0.0f }) : Vector3({ 0.0f, 1.0f, 0.0f });
+    axes[0] = w.cross(helper).norm();
+    axes[1] = w.cross(axes[0]);
+    axes[2] = w;
+}
+
+/**
+ * @brief An infinite plane
+ * @returns The shape, to pass to SceneBuilder::add_shape
+ * @param point Any point of the plane
+ * @param normal Its normal. Need not be normalized.
+ * @param texture_size World units per repeat of a texture, which tiles the plane
+**/
+inline Shape make_plane(Vector3 point, Vector3 normal, float texture_size = 1.0f)
+{
+    if (normal.square().sum() == 0.0f) {
+        throw std::invalid_argument("Normal of 'plane' must not be zero.");
+    }
+    if (!(texture_size > 0.0f)) {
+        throw std::invalid_argument("Texture size of 'plane' must be positive.");
+    }
+    Shape shape;
+    shape.kind = SHAPE_PLANE;
+    shape.center = point;
+    orthonormal_frame(normal.norm(), shape.axes);
+    shape.size = { texture_size, texture_size, 0.0f };
+    return shape;
+}
+
+/**
+ * @brief A flat disk, textured with the image stretched over its square
+ * @returns The shape, to pass to SceneBuilder::add_shape
+ * @param center Center of the disk
+ * @param normal Its normal. Need not be normalized.
+ * @param radius Its radius
+**/
+inline Shape make_disk(Vector3 center, Vector3 normal, float radius)
+{
+    if (normal.square().sum() == 0.0f) {
+        throw std::invalid_argument("Normal of 'disk' must not be zero.");
+    }
+    if (!(radius > 0.0f)) {
+        throw std::invalid_argument("Radius of 'disk' must be positive.");
+    }
+    Shape shape;
+    shape.kind = SHAPE_DISK;
+    shape.center = center;
+    orthonormal_frame(normal.norm(), shape.axes);
+    shape.size = { radius, radius, 0.0f };
+    return shape;
+}
+
+/**
+ * @brief A box, axis aligned or rotated about its center. Each face shows the whole texture.
+ * @returns The shape, to pass to SceneBuilder::add_shape
+ * @param corner_min Corner with the smallest coordinates before rotation
+ * @param corner_max Opposite corner
+ * @param rotation_axis Axis to rotate the box about, through its center. Need not be normalized.
+ * @param degrees Angle of the rotation, anticlockwise looking down the axis. 0 for an axis aligned box.
+**/
+inline Shape make_box(Vector3 corner_min, Vector3 corner_max, Vector3 rotation_axis = { 0.0f, 0.0f, 0.0f }, float degrees = 0.0f)
+{
+    Vector3 extent = corner_max - corner_min;
+    if (!(extent.x > 0.0f && extent.y > 0.0f && extent.z > 0.0f)) {
+        throw std::invalid_argument("Corners of 'box' must span a volume, smallest coordinates first.");
+    }
+    if (degrees != 0.0f && rotation_axis.square().sum() == 0.0f) {
+        throw std::invalid_argument("Rotation axis of 'box' must not be zero.");
+    }
+    Shape shape;
+    shape.kind = SHAPE_BOX;
+    shape.center = (corner_min + corner_max) * 0.5f;
+    shape.size = extent * 0.5f;
+    if (degrees != 0.0f) {
+        // Rodrigues' rotation of each axis
+        Vector3 k = rotation_axis.norm();
+        float angle = degrees * static_cast<float>(M_PI) / 180.0f;
+        float c = std::cos(angle), s = std::sin(angle);
+        for (Vector3& axis : shape.axes) {
+            axis = axis * c + k.cross(axis) * s + k * (k.dot(axis) * (1.0f - c));
+        }
+    }
+    return shape;
+}
+
+/**
+ * @brief A closed cylinder. The side is textured around its circumference, the caps like disks.
+ * @returns The shape, to pass to SceneBuilder::add_shape
+ * @param base Center of one cap
+ * @param top Center of the other
+ * @param radius Its radius
+**/
+inline Shape make_cylinder(Vector3 base, Vector3 top, float radius)
+{
+    Vector3 axis = top - base;
+    if (axis.square().sum() == 0.0f) {
+        throw std::invalid_argument("Caps of 'cylinder' must not coincide.");
+    }
+    if (!(radius > 0.0f)) {
+        throw std::invalid_argument("Radius of 'cylinder' must be positive.");
+    }
+    Shape shape;
+    shape.kind = SHAPE_CYLINDER;
+    shape.center = (base + top) * 0.5f;
+    orthonormal_frame(axis.norm(), shape.axes);
+    shape.size = { radius, radius, axis.mag() * 0.5f };
+    return shape;
+}
+
+/*
+    Infinite planes have no bounds, so they are left out of the accelerator
+*/
+inline bool shape_bounded(Shape& shape)
+{
+    return shape.kind != SHAPE_PLANE;
+}
+
+/*
+    World space bounds of a bounded shape
+*/
+inline AABB shape_bounds(Shape& shape)
+{
+    float extent[3];
+    for (int i = 0; i < 3; i++) {
+        float u = std::fabs(shape.axes[0][i]), v = std::fabs(shape.axes[1][i]), w = std::fabs(shape.axes[2][i]);
+        // Half the extent of a circle of radius r with normal w along an axis is r * sqrt(1 - w^2)
+        float across = std::sqrt(std::max(0.0f, 1.0f - w * w));
+        switch (shape.kind)
+        {
+        case SHAPE_BOX:
+            extent[i] = u * shape.size.x + v * shape.size.y + w * shape.size.z;
+            break;
+        case SHAPE_CYLINDER:
+            extent[i] = w * shape.size.z + across * shape.size.x;
+            break;
+        default:
+            extent[i] = across * shape.size.x;
+            break;
+        }
+    }
+    Vector3 half = { extent[0], extent[1], extent[2] };
+    AABB box;
+    box.extend(shape.center - half);
+    box.extend(shape.center + half);
+    return box;
+}
+
+/**
+ * @brief Intersects a ray with a shape
+ * @returns Every point where the ray's line crosses the shape, including those behind the origin, or none:
+ * one for planes and disks, where the line enters and leaves for boxes and cylinders
+ * @param shape Shape to intersect
+ * @param view_origin origin of the ray
+ * @param ray Outgoing ray. Need not be normalized; distance is measured in multiples of it.
+**/
+inline std::vector<Intersection> intersect_shape(Shape* shape, Vector3 view_origin, Vector3 ray)
+{
+    std::vector<Intersection> intersections;
+    STATS_COUNT(intersection_tests[PRIMITIVE_SHAPE]);
+
+    // The ray in the shape's frame
+    Vector3 offset = view_origin - shape->center;
+    float o[3] = { offset.dot(shape->axes[0]), offset.dot(shape->axes[1]), offset.dot(shape->axes[2]) };
+    float r[3] = { ray.dot(shape->axes[0]), ray.dot(shape->axes[1]), ray.dot(shape->axes[2]) };
+    Vector3 size = shape->size;
+
+    // Adds the hit at distance t, with its normal and texture coordinates in the shape's frame
+    auto add_hit = [&](float t, float nu, float nv, float nw, float u, float v) {
+        Vector3 normal = shape->axes[0] * nu + shape->axes[1] * nv + shape->axes[2] * nw;
+        intersections.push_back({
+            .distance = t,
+            .point = view_origin + (ray * t),
+            .normal = normal,
+            .barycentric_cords = { 0.0f, 0.0f, 0.0f },
+            .texture_coords = { std::clamp(u, 0.0f, 1.0f), std::clamp(v, 0.0f, 1.0f) }
+        });
+    };
+
+    switch (shape->kind)
+    {
+    case SHAPE_PLANE:
+    case SHAPE_DISK:
+    {
+        if (r[2] == 0.0f) {
+            break;
+        }
+        float t = -o[2] / r[2];
+        float x = o[0] + t * r[0];
+        float y = o[1] + t * r[1];
+        if (shape->kind == SHAPE_PLANE) {
+            add_hit(t, 0.0f, 0.0f, 1.0f, x / size.x - std::floor(x / size.x), y / size.y - std::floor(y / size.y));
+        } else if (x * x + y * y <= size.x * size.x) {
+            add_hit(t, 0.0f, 0.0f, 1.0f, 0.5f + x / (2.0f * size.x), 0.5f - y / (2.0f * size.x));
+        }
+        break;
+    }
+    case SHAPE_BOX:
+    {
+        /*
+            Slab test, remembering the axis the line enters and leaves through
+        */
+        float half[3] = { size.x, size.y, size.z };
+        float t_near = -std::numeric_limits<float>::max(), t_far = std::numeric_limits<float>::max();
+        int near_axis = 0, far_axis = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (r[axis] == 0.0f) {
+                if (std::fabs(o[axis]) > half[axis]) {
+                    return intersections;
+                }
+                continue;
+            }
+            float t0 = (-half[axis] - o[axis]) / r[axis];
+            float t1 = (half[axis] - o[axis]) / r[axis];
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            if (t0 > t_near) {
+                t_near = t0;
+                near_axis = axis;
+            }
+            if (t1 < t_far) {
+                t_far = t1;
+                far_axis = axis;
+            }
+        }
+        if (t_near > t_far || t_near == -std::numeric_limits<float>::max()) {
+            break;
+        }
+        // Normals point against the ray where it enters and along it where it leaves
+        for (int side = 0; side < 2; side++) {
+            float t = side == 0 ? t_near : t_far;
+            int axis = side == 0 ? near_axis : far_axis;
+            float sign = (r[axis] > 0.0f) == (side == 1) ? 1.0f : -1.0f;
+            float normal[3] = { 0.0f, 0.0f, 0.0f };
+            normal[axis] = sign;
+            // The face's texture spans its other two axes
+            int a = (axis + 1) % 3, b = (axis + 2) % 3;
+            float u = 0.5f + (o[a] + t * r[a]) / (2.0f * half[a]);
+            float v = 0.5f - (o[b] + t * r[b]) / (2.0f * half[b]);
+            add_hit(t, normal[0], normal[1], normal[2], u, v);
+        }
+        break;
+    }
+    case SHAPE_CYLINDER:
+    {
+        /*
+            Crossings of the side within the caps' planes and of the caps within the radius. A line
+            enters and leaves a convex solid once, so the first and last crossing are its hits.
+        */
+        float radius = size.x, half_height = size.z;
+        float distances[4];
+        int sides[4]; // 0 for the side, -1 or 1 for a cap
+        int count = 0;
+        float a = r[0] * r[0] + r[1] * r[1];
+        if (a > 0.0f) {
+            float b = 2.0f * (o[0] * r[0] + o[1] * r[1]);
+            float c = o[0] * o[0] + o[1] * o[1] - radius * radius;
+            float determinant = b * b - 4.0f * a * c;
+            if (determinant >= 0.0f) {
+                for (float root : { (-b - std::sqrt(determinant)) / (2.0f * a), (-b + std::sqrt(determinant)) / (2.0f * a) }) {
+                    if (std::fabs(o[2] + root * r[2]) <= half_height) {
+                        distances[count] = root;
+                        sides[count++] = 0;
+                    }
+                }
+            }
+        }
+        if (r[2] != 0.0f) {
+            for (int cap : { -1, 1 }) {
+                float t = (cap * half_height - o[2]) / r[2];
+                float x = o[0] + t * r[0], y = o[1] + t * r[1];
+                if (x * x + y * y <= radius * radius) {
+                    distances[count] = t;
+                    sides[count++] = cap;
+                }
+            }
+        }
+        if (count == 0) {
+            break;
+        }
+        int first = 0, last = 0;
+        for (int k = 1; k < count; k++) {
+            first = distances[k] < distances[first] ? k : first;
+            last = distances[k] > distances[last] ? k : last;
+        }
+        for (int k : { first, last }) {
+            float t = distances[k];
+            float x = o[0] + t * r[0], y = o[1] + t * r[1], z = o[2] + t * r[2];
+            if (sides[k] == 0) {
+                float u = 0.5f + std::atan2(y, x) / (2.0f * static_cast<float>(M_PI));
+                add_hit(t, x / radius, y / radius, 0.0f, u, 0.5f - z / (2.0f * half_height));
+            } else {
+                add_hit(t, 0.0f, 0.0f, static_cast<float>(sides[k]), 0.5f + x / (2.0f * radius), 0.5f - y / (2.0f * radius));
+            }
+            if (first == last) {
+                break; // Grazing a rim
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return intersections;
+}
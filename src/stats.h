@@ -0,0 +1,178 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/*
+    Render statistics for '--stats'. Counters live in a per-thread block that is only written by
+    its own thread and merged when the report is written, so counting is a plain increment.
+    Build with RAYTRACER_STATS=0 to compile every counter and timer out. Defaults to off when
+    NDEBUG is defined (release builds), on otherwise.
+*/
+#ifndef RAYTRACER_STATS
+#ifdef NDEBUG
+#define RAYTRACER_STATS 0
+#else
+#define RAYTRACER_STATS 1
+#endif
+#endif
+
+enum RayKind { RAY_PRIMARY, RAY_SHADOW, RAY_REFLECTION, RAY_REFRACTION, RAY_KIND_COUNT };
+enum PrimitiveKind { PRIMITIVE_SPHERE, PRIMITIVE_TRIANGLE, PRIMITIVE_INSTANCE, PRIMITIVE_SHAPE, PRIMITIVE_KIND_COUNT };
+enum RenderPhase { PHASE_PARSE, PHASE_TEXTURE_LOAD, PHASE_BUILD, PHASE_TRACE, PHASE_OUTPUT, PHASE_COUNT };
+
+inline const char* ray_kind_names[RAY_KIND_COUNT] = { "primary", "shadow", "reflection", "refraction" };
+inline const char* primitive_kind_names[PRIMITIVE_KIND_COUNT] = { "sphere", "triangle", "instance", "shape" };
+inline const char* render_phase_names[PHASE_COUNT] = { "parse", "texture_load", "build", "trace", "output" };
+
+/*
+    One thread's counters
+*/
+struct RenderCounters
+{
+    static const int max_depth = 32;
+
+    uint64_t rays[RAY_KIND_COUNT] = { 0 };
+    uint64_t intersection_tests[PRIMITIVE_KIND_COUNT] = { 0 };
+    uint64_t node_visits = 0; // BVH and k-d tree nodes popped and grid cells walked, top and bottom level
+    uint64_t shade_calls[max_depth] = { 0 }; // Indexed by remaining recursion depth
+    uint64_t texture_samples = 0;
+    uint64_t area_light_evaluations = 0; // Shading points lit by an area light, for '--shadow-report'
+    uint64_t area_light_rays = 0; // Shadow rays traced for them
+    uint64_t refined_area_light_evaluations = 0; // Those whose first samples disagreed
+
+    void merge(const RenderCounters& other)
+    {
+        for (int i = 0; i < RAY_KIND_COUNT; i++) rays[i] += other.rays[i];
+        for (int i = 0; i < PRIMITIVE_KIND_COUNT; i++) intersection_tests[i] += other.intersection_tests[i];
+        node_visits += other.node_visits;
+        for (int i = 0; i < max_depth; i++) shade_calls[i] += other.shade_calls[i];
+        texture_samples += other.texture_samples;
+        area_light_evaluations += other.area_light_evaluations;
+        area_light_rays += other.area_light_rays;
+        refined_area_light_evaluations += other.refined_area_light_evaluations;
+    }
+};
+
+class RenderStats
+{
+private:
+    std::mutex m_lock;
+    std::vector<std::unique_ptr<RenderCounters>> m_thread_counters; // Kept alive after their thread exits
+    double m_phase_seconds[PHASE_COUNT] = { 0 };
+
+public:
+    /*
+        Registers a new counter block for the calling thread
+    */
+    RenderCounters* register_thread()
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_thread_counters.push_back(std::make_unique<RenderCounters>());
+        return m_thread_counters.back().get();
+    }
+
+    void add_phase_time(RenderPhase phase, double seconds)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_phase_seconds[phase] += seconds;
+    }
+
+    /*
+        Sum of every thread's counters. Only exact once rendering threads have finished.
+    */
+    RenderCounters merged()
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        RenderCounters total;
+        for (auto& counters : m_thread_counters) {
+            total.merge(*counters);
+        }
+        return total;
+    }
+
+    /**
+     * @brief Writes the merged counters and phase times as JSON
+     * @param out Destination stream
+     * @param recursion_depth Configured maximum recursion depth, to turn remaining depth into depth
+    **/
+    void write_json(std::ostream& out, int recursion_depth)
+    {
+        RenderCounters total = merged();
+        size_t thread_count;
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            thread_count = m_thread_counters.size();
+        }
+
+        out << "{\n  \"threads\": " << thread_count << ",\n  \"rays\": {";
+        uint64_t ray_total = 0;
+        for (int i = 0; i < RAY_KIND_COUNT; i++) {
+            out << "\"" << ray_kind_names[i] << "\": " << total.rays[i] << ", ";
+            ray_total += total.rays[i];
+        }
+        out << "\"total\": " << ray_total << "},\n  \"intersection_tests\": {";
+        for (int i = 0; i < PRIMITIVE_KIND_COUNT; i++) {
+            out << (i > 0 ? ", " : "") << "\"" << primitive_kind_names[i] << "\": " << total.intersection_tests[i];
+        }
+        out << "},\n  \"bvh_node_visits\": " << total.node_visits << ",\n  \"shade_calls_by_depth\": [";
+        for (int depth = 0; depth <= recursion_depth && depth < RenderCounters::max_depth; depth++) {
+            int remaining = std::min(recursion_depth - depth, RenderCounters::max_depth - 1);
+            out << (depth > 0 ? ", " : "") << total.shade_calls[remaining];
+        }
+        out << "],\n  \"texture_samples\": " << total.texture_samples << ",\n  \"area_lights\": {\"evaluations\": "
+            << total.area_light_evaluations << ", \"rays\": " << total.area_light_rays << ", \"refined\": "
+            << total.refined_area_light_evaluations << "},\n  \"phase_seconds\": {";
+        std::lock_guard<std::mutex> guard(m_lock);
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            out << (i > 0 ? ", " : "") << "\"" << render_phase_names[i] << "\": " << m_phase_seconds[i];
+        }
+        out << "}\n}" << std::endl;
+    }
+};
+
+inline RenderStats render_stats;
+
+#if RAYTRACER_STATS
+
+/*
+    The calling thread's counters, registered on first use
+*/
+inline RenderCounters& thread_counters()
+{
+    thread_local RenderCounters* counters = render_stats.register_thread();
+    return *counters;
+}
+
+/*
+    Adds the lifetime of the object to a phase's wall time
+*/
+class PhaseTimer
+{
+private:
+    RenderPhase m_phase;
+    std::chrono::steady_clock::time_point m_start;
+
+public:
+    PhaseTimer(RenderPhase phase) : m_phase(phase), m_start(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer()
+    {
+        render_stats.add_phase_time(m_phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count());
+    }
+};
+
+#define STATS_COUNT(counter) (thread_counters().counter++)
+#define STATS_ADD(counter, amount) (thread_counters().counter += (amount))
+#define STATS_PHASE(phase) PhaseTimer phase_timer_##phase(phase)
+
+#else
+
+#define STATS_COUNT(counter) ((void)0)
+#define STATS_ADD(counter, amount) ((void)0)
+#define STATS_PHASE(phase) ((void)0)
+
+#endif
@@ -0,0 +1,384 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "loader.h"
+#include "stats.h"
+#include "texture_compression.h"
+
+struct Texture;
+class TextureCache;
+
+/*
+    A decoded block of 8-bit RGB texels. Tiles are TEXTURE_TILE_SIZE x TEXTURE_TILE_SIZE,
+    except along the right and bottom edges of images whose size is not a multiple of it.
+    Compressed tiles keep BC1 blocks instead of texels, row-major, (width + 3) / 4 per row.
+*/
+struct TextureTile {
+    unsigned int width, height;
+    std::vector<byte> texels;
+    std::vector<BC1Block> blocks;
+};
+
+/*
+    What compressing a tile lost against its decoded source
+*/
+struct TileCompressionError {
+    double squared_error = 0.0; // Summed over every channel of every texel
+    int max_error = 0; // Largest difference of a single channel
+};
+
+/**
+ * @brief Transcodes a decoded tile to BC1 blocks. Partial blocks along the tile's right and bottom edges repeat its last column and row.
+ * @returns The compressed tile, without texels
+ * @param tile Decoded tile
+ * @param error Receives the error of the compressed texels against the tile's
+**/
+inline std::shared_ptr<TextureTile> compress_tile(const TextureTile& tile, TileCompressionError& error)
+{
+    std::shared_ptr<TextureTile> compressed = std::make_shared<TextureTile>();
+    compressed->width = tile.width;
+    compressed->height = tile.height;
+    unsigned int blocks_x = (tile.width + 3) / 4;
+    unsigned int blocks_y = (tile.height + 3) / 4;
+    compressed->blocks.resize(blocks_x * blocks_y);
+
+    byte block_texels[16][3];
+    for (unsigned int block_y = 0; block_y < blocks_y; block_y++) {
+        for (unsigned int block_x = 0; block_x < blocks_x; block_x++) {
+            for (unsigned int t = 0; t < 16; t++) {
+                unsigned int x = std::min(block_x * 4 + t % 4, tile.width - 1);
+                unsigned int y = std::min(block_y * 4 + t / 4, tile.height - 1);
+                std::copy_n(&tile.texels[(y * tile.width + x) * 3], 3, block_texels[t]);
+            }
+            BC1Block& block = compressed->blocks[block_y * blocks_x + block_x];
+            block = encode_bc1_block(block_texels);
+
+            byte decoded[3];
+            for (unsigned int t = 0; t < 16; t++) {
+                if (block_x * 4 + t % 4 >= tile.width || block_y * 4 + t / 4 >= tile.height) {
+                    continue;
+                }
+                decode_bc1_texel(block, t, decoded);
+                for (int k = 0; k < 3; k++) {
+                    int difference = std::abs(decoded[k] - block_texels[t][k]);
+                    error.squared_error += difference * difference;
+                    error.max_error = std::max(error.max_error, difference);
+                }
+            }
+        }
+    }
+    return compressed;
+}
+
+/*
+    Per-tile residency bookkeeping. Only touched while holding the texture cache lock.
+*/
+struct TextureSlot {
+    std::shared_ptr<const TextureTile> tile;
+    std::list<std::pair<Texture*, size_t>>::iterator lru_position;
+};
+
+/*
+    Whether a texture's tile offsets can be used yet. 'P3' files are indexed on the background loader
+    while the scene is still being parsed and rendered.
+*/
+enum TextureIndexState { TEXTURE_INDEXED, TEXTURE_INDEXING, TEXTURE_INDEX_FAILED };
+
+/*
+    A PPM texture whose texels are decoded lazily, one tile at a time, the first time they are sampled.
+    Loading a texture only reads the header and records where every tile row starts in the file,
+    so textures that are never hit by a ray cost a few bytes per image row.
+*/
+struct Texture {
+    public:
+    float height, width;
+    std::string path;
+    bool binary = false; // 'P6' (raw bytes) instead of 'P3' (ascii)
+    unsigned int tiles_x, tiles_y;
+    std::streamoff data_offset = 0; // 'P6' only: start of the raster
+    std::vector<std::streamoff> tile_offsets; // 'P3' only: file offset of each (row, tile column) run of texels
+    std::streamoff file_size = 0;
+    std::vector<TextureSlot> slots;
+    TextureCache* cache = nullptr; // Keeps the decoded tiles: the texture cache of its scene
+    std::vector<byte> texels; // Textures given in memory (SceneBuilder::add_texture): every texel, row-major RGB. Not cached
+    std::atomic<int> index_state = TEXTURE_INDEXED;
+    std::shared_future<void> indexing; // Valid while the background loader owns the texture's index
+
+    Texture(float width, float height) {
+        this->width = width;
+        this->height = height;
+        tiles_x = (static_cast<unsigned int>(width) + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        tiles_y = (static_cast<unsigned int>(height) + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        slots.resize(tiles_x * tiles_y);
+    }
+
+    /*
+        Drops the texture's resident tiles from the cache
+    */
+    ~Texture();
+
+    /*
+        Copies the RGB texel at column x, row y into rgb, decoding its tile first if it is not resident.
+        Waits if the file is still being indexed, and gives black if indexing failed.
+    */
+    void fetch(size_t x, size_t y, byte rgb[3]);
+
+    /*
+        Blocks until background indexing has finished. Returns false if it failed.
+    */
+    bool wait_until_indexed()
+    {
+        if (index_state.load(std::memory_order_acquire) == TEXTURE_INDEXING) {
+            auto start = std::chrono::steady_clock::now();
+            indexing.wait();
+            startup_timeline.texture_wait_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+        return index_state.load(std::memory_order_acquire) == TEXTURE_INDEXED;
+    }
+
+    /*
+        Reads and decodes a single tile from disk. Does not touch the cache. Runs on render threads, so it
+        never throws: texel values were checked when the file was indexed, and texels that can no longer
+        be read because the file changed since are left black.
+    */
+    std::shared_ptr<TextureTile> decode_tile(size_t tile_index)
+    {
+        size_t tile_x = tile_index % tiles_x;
+        size_t tile_y = tile_index / tiles_x;
+        size_t x0 = tile_x * TEXTURE_TILE_SIZE;
+        size_t y0 = tile_y * TEXTURE_TILE_SIZE;
+        size_t image_width = static_cast<size_t>(width);
+        size_t image_height = static_cast<size_t>(height);
+
+        std::shared_ptr<TextureTile> tile = std::make_shared<TextureTile>();
+        tile->width = static_cast<unsigned int>(std::min<size_t>(TEXTURE_TILE_SIZE, image_width - x0));
+        tile->height = static_cast<unsigned int>(std::min<size_t>(TEXTURE_TILE_SIZE, image_height - y0));
+        tile->texels.resize(tile->width * tile->height * 3);
+
+        std::ifstream input_file(path, std::ios::binary);
+        if (!input_file.is_open()) {
+            return tile;
+        }
+
+        size_t run_bytes = tile->width * 3;
+        std::string run;
+        for (size_t row = 0; row < tile->height; row++) {
+            byte* destination = &tile->texels[row * run_bytes];
+
+            if (binary) {
+                input_file.seekg(data_offset + static_cast<std::streamoff>(((y0 + row) * image_width + x0) * 3));
+                input_file.read(reinterpret_cast<char*>(destination), run_bytes);
+                input_file.clear();
+                continue;
+            }
+
+            // The run ends where the next tile column (or the next row) begins
+            size_t offset_index = (y0 + row) * tiles_x + tile_x;
+            std::streamoff begin = tile_offsets[offset_index];
+            std::streamoff end = offset_index + 1 < tile_offsets.size() ? tile_offsets[offset_index + 1] : file_size;
+            run.resize(static_cast<size_t>(end - begin));
+            input_file.seekg(begin);
+            input_file.read(run.data(), run.size());
+            run.resize(static_cast<size_t>(input_file.gcount()));
+            input_file.clear();
+
+            size_t value_index = 0;
+            const char* cursor = run.c_str();
+            while (value_index < run_bytes && *cursor != '\0') {
+                if (*cursor == '#') {
+                    while (*cursor != '\0' && *cursor != '\n') cursor++;
+                    continue;
+                }
+                if (isspace(static_cast<unsigned char>(*cursor))) {
+                    cursor++;
+                    continue;
+                }
+                char* token_end;
+                long value = std::strtol(cursor, &token_end, 10);
+                if (token_end == cursor || value < MIN_PIXEL_VALUE || value > MAX_PIXEL_VALUE) {
+                    break;
+                }
+                destination[value_index++] = static_cast<byte>(value);
+                cursor = token_end;
+            }
+        }
+
+        return tile;
+    }
+};
+
+struct TextureCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t bytes_resident = 0;
+    size_t peak_bytes_resident = 0;
+    size_t budget_bytes = 0;
+    // '--texture-compression': tiles transcoded so far, and what that lost against the decoded texels
+    uint64_t compressed_tiles = 0;
+    size_t uncompressed_bytes = 0; // Of the compressed tiles' texels, one per channel
+    size_t compressed_bytes = 0; // Of their blocks
+    double squared_error = 0.0; // Summed over every channel
+    int max_error = 0;
+};
+
+/*
+    Least-recently-used cache of decoded texture tiles, shared by every texture of a scene (SceneState::texture_cache).
+    When the resident tiles exceed the memory budget, the coldest tiles are dropped and will be
+    decoded again from disk if they are sampled later.
+*/
+class TextureCache {
+private:
+    std::mutex m_lock;
+    std::list<std::pair<Texture*, size_t>> m_lru; // Front is most recently used
+    TextureCacheStats m_stats;
+    std::atomic<int> m_compression = TEXTURE_COMPRESSION_NONE;
+
+    static size_t tile_bytes(const TextureTile& tile) {
+        return tile.texels.size() + tile.blocks.size() * sizeof(BC1Block) + sizeof(TextureTile);
+    }
+
+    void evict_until_fits(size_t incoming_bytes) {
+        while (!m_lru.empty() && m_stats.bytes_resident + incoming_bytes > m_stats.budget_bytes) {
+            auto [texture, tile_index] = m_lru.back();
+            TextureSlot& slot = texture->slots[tile_index];
+            m_stats.bytes_resident -= tile_bytes(*slot.tile);
+            m_stats.evictions++;
+            slot.tile.reset();
+            m_lru.pop_back();
+        }
+    }
+
+public:
+    TextureCache(size_t budget_bytes = static_cast<size_t>(TEXTURE_CACHE_DEFAULT_MB) * 1024 * 1024) {
+        m_stats.budget_bytes = budget_bytes;
+    }
+
+    void set_budget(size_t budget_bytes) {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stats.budget_bytes = budget_bytes;
+        evict_until_fits(0);
+    }
+
+    /*
+        How tiles decoded from now on are kept. Resident tiles stay as they are.
+    */
+    void set_compression(TextureCompression compression) {
+        m_compression = compression;
+    }
+
+    /*
+        Returns the requested tile, decoding it on a miss. The returned pointer stays valid
+        even if the tile is evicted while the caller is still reading from it.
+    */
+    std::shared_ptr<const TextureTile> acquire(Texture* texture, size_t tile_index) {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            TextureSlot& slot = texture->slots[tile_index];
+            if (slot.tile) {
+                m_stats.hits++;
+                m_lru.splice(m_lru.begin(), m_lru, slot.lru_position);
+                return slot.tile;
+            }
+            m_stats.misses++;
+        }
+
+        // Decode without holding the lock so other threads can keep sampling resident tiles
+        std::shared_ptr<const TextureTile> tile = texture->decode_tile(tile_index);
+        TileCompressionError error;
+        if (m_compression == TEXTURE_COMPRESSION_BC1) {
+            tile = compress_tile(*tile, error);
+        }
+
+        std::lock_guard<std::mutex> guard(m_lock);
+        TextureSlot& slot = texture->slots[tile_index];
+        if (slot.tile) {
+            return slot.tile; // Another thread decoded it first
+        }
+        if (!tile->blocks.empty()) {
+            m_stats.compressed_tiles++;
+            m_stats.uncompressed_bytes += tile->width * tile->height * 3;
+            m_stats.compressed_bytes += tile->blocks.size() * sizeof(BC1Block);
+            m_stats.squared_error += error.squared_error;
+            m_stats.max_error = std::max(m_stats.max_error, error.max_error);
+        }
+        size_t bytes = tile_bytes(*tile);
+        evict_until_fits(bytes);
+        slot.tile = tile;
+        m_lru.emplace_front(texture, tile_index);
+        slot.lru_position = m_lru.begin();
+        m_stats.bytes_resident += bytes;
+        m_stats.peak_bytes_resident = std::max(m_stats.peak_bytes_resident, m_stats.bytes_resident);
+        return tile;
+    }
+
+    /*
+        Drops every resident tile of a texture that is about to be destroyed
+    */
+    void release(Texture* texture) {
+        std::lock_guard<std::mutex> guard(m_lock);
+        for (TextureSlot& slot : texture->slots) {
+            if (slot.tile) {
+                m_stats.bytes_resident -= tile_bytes(*slot.tile);
+                m_lru.erase(slot.lru_position);
+                slot.tile.reset();
+            }
+        }
+    }
+
+    TextureCacheStats stats() {
+        std::lock_guard<std::mutex> guard(m_lock);
+        return m_stats;
+    }
+};
+
+inline void Texture::fetch(size_t x, size_t y, byte rgb[3])
+{
+    STATS_COUNT(texture_samples);
+    if (!texels.empty()) {
+        const byte* texel = &texels[(y * static_cast<size_t>(width) + x) * 3];
+        rgb[0] = texel[0];
+        rgb[1] = texel[1];
+        rgb[2] = texel[2];
+        return;
+    }
+    if (index_state.load(std::memory_order_acquire) != TEXTURE_INDEXED && !wait_until_indexed()) {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+        return;
+    }
+    size_t tile_index = (y / TEXTURE_TILE_SIZE) * tiles_x + (x / TEXTURE_TILE_SIZE);
+    std::shared_ptr<const TextureTile> tile = cache->acquire(this, tile_index);
+    if (!tile->blocks.empty()) {
+        size_t tile_x = x % TEXTURE_TILE_SIZE;
+        size_t tile_y = y % TEXTURE_TILE_SIZE;
+        const BC1Block& block = tile->blocks[(tile_y / 4) * ((tile->width + 3) / 4) + tile_x / 4];
+        decode_bc1_texel(block, static_cast<int>((tile_y % 4) * 4 + tile_x % 4), rgb);
+        return;
+    }
+    const byte* texel = &tile->texels[((y % TEXTURE_TILE_SIZE) * tile->width + (x % TEXTURE_TILE_SIZE)) * 3];
+    rgb[0] = texel[0];
+    rgb[1] = texel[1];
+    rgb[2] = texel[2];
+}
+
+inline Texture::~Texture()
+{
+    if (indexing.valid()) {
+        indexing.wait();
+    }
+    if (cache != nullptr) {
+        cache->release(this);
+    }
+}
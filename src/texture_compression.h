@@ -0,0 +1,202 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "config.h"
+
+/*
+    How texture tiles are kept in the cache ('--texture-compression')
+*/
+enum TextureCompression { TEXTURE_COMPRESSION_NONE, TEXTURE_COMPRESSION_BC1 };
+
+/*
+    A BC1 (DXT1) block: 4x4 RGB texels in 8 bytes instead of 48. Two RGB565 endpoint colours and a 2-bit
+    index per texel, row-major from bit 0, choosing color0, color1, or the colours a third and two thirds
+    of the way from color0 to color1. Blocks with color0 <= color1 have their midpoint and black instead.
+*/
+struct BC1Block
+{
+    uint16_t color0;
+    uint16_t color1;
+    uint32_t indices;
+};
+
+inline uint16_t pack_rgb565(const float rgb[3])
+{
+    int r = static_cast<int>(std::lround(std::clamp(rgb[0], 0.0f, 255.0f) * 31.0f / 255.0f));
+    int g = static_cast<int>(std::lround(std::clamp(rgb[1], 0.0f, 255.0f) * 63.0f / 255.0f));
+    int b = static_cast<int>(std::lround(std::clamp(rgb[2], 0.0f, 255.0f) * 31.0f / 255.0f));
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+/*
+    Expands to 8 bits per channel by replicating the high bits into the low ones, as GPUs do
+*/
+inline void unpack_rgb565(uint16_t color, int rgb[3])
+{
+    int r = (color >> 11) & 31;
+    int g = (color >> 5) & 63;
+    int b = color & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+/*
+    The four colours a block's indices choose from
+*/
+inline void bc1_palette(const BC1Block& block, int palette[4][3])
+{
+    unpack_rgb565(block.color0, palette[0]);
+    unpack_rgb565(block.color1, palette[1]);
+    for (int k = 0; k < 3; k++) {
+        if (block.color0 > block.color1) {
+            palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+            palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+        } else {
+            palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+            palette[3][k] = 0;
+        }
+    }
+}
+
+/**
+ * @brief Decodes one texel of a block
+ * @param block The block
+ * @param texel Position in the block, row * 4 + column
+ * @param rgb Receives the texel
+**/
+inline void decode_bc1_texel(const BC1Block& block, int texel, byte rgb[3])
+{
+    int palette[4][3];
+    bc1_palette(block, palette);
+    int index = (block.indices >> (2 * texel)) & 3;
+    rgb[0] = static_cast<byte>(palette[index][0]);
+    rgb[1] = static_cast<byte>(palette[index][1]);
+    rgb[2] = static_cast<byte>(palette[index][2]);
+}
+
+/*
+    Chooses the nearest palette colour for every texel. Returns the summed squared error.
+*/
+inline int assign_bc1_indices(BC1Block& block, const byte texels[16][3])
+{
+    int palette[4][3];
+    bc1_palette(block, palette);
+    int colours = block.color0 > block.color1 ? 4 : 3; // Black is never chosen, so blocks keep their shade
+    block.indices = 0;
+    int total_error = 0;
+    for (int t = 0; t < 16; t++) {
+        int best = 0, best_error = 0;
+        for (int index = 0; index < colours; index++) {
+            int error = 0;
+            for (int k = 0; k < 3; k++) {
+                int difference = texels[t][k] - palette[index][k];
+                error += difference * difference;
+            }
+            if (index == 0 || error < best_error) {
+                best = index;
+                best_error = error;
+            }
+        }
+        block.indices |= static_cast<uint32_t>(best) << (2 * t);
+        total_error += best_error;
+    }
+    return total_error;
+}
+
+/*
+    Quantizes a pair of endpoints into a block in four colour mode where they differ, and assigns indices
+*/
+inline int make_bc1_block(const float first[3], const float second[3], const byte texels[16][3], BC1Block& block)
+{
+    block.color0 = pack_rgb565(first);
+    block.color1 = pack_rgb565(second);
+    if (block.color0 < block.color1) {
+        std::swap(block.color0, block.color1);
+    }
+    return assign_bc1_indices(block, texels);
+}
+
+/**
+ * @brief Encodes 4x4 texels: endpoints at the extremes of the texels along their principal axis, then one
+ * least squares refit of the endpoints to the chosen indices, kept if it lowers the error
+ * @returns The block
+ * @param texels The texels, row-major. Partial blocks at image edges repeat their last row and column.
+**/
+inline BC1Block encode_bc1_block(const byte texels[16][3])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int t = 0; t < 16; t++) {
+        for (int k = 0; k < 3; k++) {
+            mean[k] += texels[t][k] / 16.0f;
+        }
+    }
+    float covariance[3][3] = {};
+    for (int t = 0; t < 16; t++) {
+        float centred[3] = { texels[t][0] - mean[0], texels[t][1] - mean[1], texels[t][2] - mean[2] };
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) {
+                covariance[a][b] += centred[a] * centred[b];
+            }
+        }
+    }
+
+    // Principal axis by power iteration, starting from the luminance direction
+    float axis[3] = { 0.3f, 0.6f, 0.1f };
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[3];
+        for (int a = 0; a < 3; a++) {
+            next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+        }
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f) {
+            break;
+        }
+        for (int a = 0; a < 3; a++) {
+            axis[a] = next[a] / length;
+        }
+    }
+
+    float low = 0.0f, high = 0.0f;
+    for (int t = 0; t < 16; t++) {
+        float projection = (texels[t][0] - mean[0]) * axis[0] + (texels[t][1] - mean[1]) * axis[1] + (texels[t][2] - mean[2]) * axis[2];
+        low = std::min(low, projection);
+        high = std::max(high, projection);
+    }
+    float first[3], second[3];
+    for (int k = 0; k < 3; k++) {
+        first[k] = mean[k] + axis[k] * high;
+        second[k] = mean[k] + axis[k] * low;
+    }
+    BC1Block block;
+    int error = make_bc1_block(first, second, texels, block);
+    if (error == 0 || block.color0 == block.color1) {
+        return block;
+    }
+
+    // Least squares endpoints for the chosen indices: texel = alpha * color0 + beta * color1
+    const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = {}, bx[3] = {};
+    for (int t = 0; t < 16; t++) {
+        float alpha = weights[(block.indices >> (2 * t)) & 3];
+        float beta = 1.0f - alpha;
+        aa += alpha * alpha;
+        bb += beta * beta;
+        ab += alpha * beta;
+        for (int k = 0; k < 3; k++) {
+            ax[k] += alpha * texels[t][k];
+            bx[k] += beta * texels[t][k];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f) {
+        return block;
+    }
+    for (int k = 0; k < 3; k++) {
+        first[k] = (ax[k] * bb - bx[k] * ab) / determinant;
+        second[k] = (bx[k] * aa - ax[k] * ab) / determinant;
+    }
+    BC1Block refit;
+    return make_bc1_block(first, second, texels, refit) < error ? refit : block;
+}
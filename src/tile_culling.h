@@ -0,0 +1,274 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+#include "definitions.h"
+#include "scene.h"
+#include "settings.h"
+
+/*
+    Tiles reaching more primitives than this ask the accelerator as before. Walking an index costs more
+    than testing a handful of primitives, the same reason 'auto' picks 'brute' for small scenes.
+*/
+const uint32_t TILE_CULLING_MAX_CANDIDATES = 16;
+
+/*
+    Counts over every culled frame or band, for '--tile-culling-report'
+*/
+struct TileCullingStats
+{
+    std::atomic<uint64_t> tiles = 0; // Tiles tested
+    std::atomic<uint64_t> empty = 0; // Filled with the background without tracing
+    std::atomic<uint64_t> reduced = 0; // Traced against their own candidates
+    std::atomic<uint64_t> reduced_candidates = 0; // Summed over the reduced tiles
+    double setup_seconds = 0.0;
+};
+
+inline TileCullingStats tile_culling_stats;
+
+class TileCulling
+{
+private:
+    static const int frustum_planes = 5; // Four sides and the camera's plane
+    Vector3 m_origin;
+    Vector3 m_a; // Camera ray through pixel (0, 0)
+    Vector3 m_delta_h;
+    Vector3 m_delta_v;
+    int m_first_row;
+    int m_first_column;
+    int m_height;
+    int m_width;
+    int m_tiles_x;
+    std::vector<uint32_t> m_counts; // Per tile, candidates found, TILE_CULLING_MAX_CANDIDATES + 1 once there are too many
+    std::vector<uint32_t> m_candidates; // Per tile, TILE_CULLING_MAX_CANDIDATES slots of primitive indices in ascending order
+
+    /*
+        The camera rays through a tile's corners, and the inward normals of the planes through the camera and
+        its edges and of the plane of the camera itself. The tile is widened by half a pixel on every side so
+        that rounding in the camera rays never leaves the frustum.
+    */
+    void tile_frustum(int tile, Vector3 corners[4], Vector3 planes[frustum_planes])
+    {
+        int row0 = (tile / m_tiles_x) * RENDER_TILE_SIZE, column0 = (tile % m_tiles_x) * RENDER_TILE_SIZE;
+        float y0 = m_first_row + row0 - 0.5f, x0 = m_first_column + column0 - 0.5f;
+        float y1 = m_first_row + std::min(row0 + RENDER_TILE_SIZE, m_height) - 0.5f;
+        float x1 = m_first_column + std::min(column0 + RENDER_TILE_SIZE, m_width) - 0.5f;
+        corners[0] = m_a + (m_delta_h * x0) + (m_delta_v * y0);
+        corners[1] = m_a + (m_delta_h * x1) + (m_delta_v * y0);
+        corners[2] = m_a + (m_delta_h * x1) + (m_delta_v * y1);
+        corners[3] = m_a + (m_delta_h * x0) + (m_delta_v * y1);
+        Vector3 middle = m_a + (m_delta_h * (0.5f * (x0 + x1))) + (m_delta_v * (0.5f * (y0 + y1)));
+        for (int k = 0; k < 4; k++) {
+            planes[k] = corners[k].cross(corners[(k + 1) % 4]);
+            if (planes[k].dot(middle) < 0.0f) {
+                planes[k] = planes[k] * -1.0f;
+            }
+        }
+        planes[4] = m_delta_h.cross(m_delta_v);
+        if (planes[4].dot(m_a) < 0.0f) {
+            planes[4] = planes[4] * -1.0f;
+        }
+    }
+
+    /*
+        False if the box is entirely outside one of the frustum's planes
+    */
+    bool box_in_frustum(AABB& box, Vector3 planes[frustum_planes])
+    {
+        for (int k = 0; k < frustum_planes; k++) {
+            // The corner furthest along the plane's normal
+            Vector3 corner = {
+                planes[k].x > 0.0f ? box.max.x : box.min.x,
+                planes[k].y > 0.0f ? box.max.y : box.min.y,
+                planes[k].z > 0.0f ? box.max.z : box.min.z
+            };
+            if (planes[k].dot(corner - m_origin) < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+        True if a camera ray of the tile may cross the infinite plane in front of the camera: one of the rays
+        through the frustum's corners points towards the plane's side of the camera
+    */
+    bool plane_in_frustum(Shape& plane, Vector3 corners[4])
+    {
+        float side = plane.axes[2].dot(plane.center - m_origin);
+        if (side == 0.0f) {
+            return true;
+        }
+        for (int k = 0; k < 4; k++) {
+            float toward = plane.axes[2].dot(corners[k]);
+            if (toward != 0.0f && (toward > 0.0f) == (side > 0.0f)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void add(int tile, uint32_t primitive)
+    {
+        uint32_t& count = m_counts[tile];
+        if (count < TILE_CULLING_MAX_CANDIDATES) {
+            m_candidates[static_cast<size_t>(tile) * TILE_CULLING_MAX_CANDIDATES + count] = primitive;
+        }
+        count = std::min(count + 1, TILE_CULLING_MAX_CANDIDATES + 1);
+    }
+
+    /*
+        Image coordinates (column, row) where the camera ray through a point crosses the view window.
+        Returns false for points that are not in front of the camera.
+    */
+    bool project(Vector3 point, float& x, float& y)
+    {
+        Vector3 q = point - m_origin;
+        float w = (m_delta_h.cross(m_delta_v)).dot(q);
+        float scale = (m_delta_h.cross(m_delta_v)).dot(m_a);
+        if (!(w / scale > 0.0f)) {
+            return false;
+        }
+        x = (m_delta_v.cross(m_a)).dot(q) / w;
+        y = (m_a.cross(m_delta_h)).dot(q) / w;
+        return std::isfinite(x) && std::isfinite(y);
+    }
+
+public:
+    /*
+        Bytes of the per tile candidate lists
+    */
+    size_t memory_usage()
+    {
+        return (m_counts.capacity() + m_candidates.capacity()) * sizeof(uint32_t);
+    }
+
+    /**
+     * @brief Finds the primitives each render tile's camera rays may reach. Boxes are sorted into the tiles their
+     * projection may cover, as PrimaryVisibility bins them, and then tested against the frustum of each of those tiles.
+     * @param scene Built scene to cull
+     * @param origin Camera position
+     * @param upper_left View window point of pixel (0, 0)
+     * @param delta_h View window offset from one column to the next
+     * @param delta_v View window offset from one row to the next
+     * @param first_row Image row of the rendered rectangle's top edge
+     * @param first_column Image column of the rendered rectangle's left edge
+     * @param height Rows of the rendered rectangle
+     * @param width Columns of the rendered rectangle
+     * @param bounds World space bounds of SceneState::primitives but the infinite planes, from scene_primitive_bounds
+    **/
+    void build(SceneState& scene, Vector3 origin, Vector3 upper_left, Vector3 delta_h, Vector3 delta_v, int first_row, int first_column, int height, int width,
+        std::vector<AABB>& bounds)
+    {
+        auto start = std::chrono::steady_clock::now();
+        m_origin = origin;
+        m_a = upper_left - origin;
+        m_delta_h = delta_h;
+        m_delta_v = delta_v;
+        m_first_row = first_row;
+        m_first_column = first_column;
+        m_height = height;
+        m_width = width;
+        m_tiles_x = (width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+        int tiles_y = (height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+        int tiles = m_tiles_x * tiles_y;
+        m_counts.assign(tiles, 0);
+        m_candidates.assign(static_cast<size_t>(tiles) * TILE_CULLING_MAX_CANDIDATES, 0);
+        Vector3 extent = m_a + m_delta_h + m_delta_v;
+        if (!std::isfinite(extent.x + extent.y + extent.z)) {
+            // A one pixel wide or high image has no view window offsets: every tile asks the accelerator
+            m_counts.assign(tiles, TILE_CULLING_MAX_CANDIDATES + 1);
+            return;
+        }
+        std::vector<Vector3> corners(static_cast<size_t>(tiles) * 4), planes(static_cast<size_t>(tiles) * frustum_planes);
+        for (int tile = 0; tile < tiles; tile++) {
+            tile_frustum(tile, &corners[static_cast<size_t>(tile) * 4], &planes[static_cast<size_t>(tile) * frustum_planes]);
+        }
+
+        // Bounded primitives come first, so every tile's candidates stay in the ascending order TraceRay tests them in
+        for (uint32_t p = 0; p < bounds.size(); p++) {
+            float x0 = std::numeric_limits<float>::max(), y0 = x0, x1 = -x0, y1 = -x0;
+            bool whole_region = false;
+            for (int corner = 0; corner < 8 && !whole_region; corner++) {
+                Vector3 point = {
+                    (corner & 1) ? bounds[p].max.x : bounds[p].min.x,
+                    (corner & 2) ? bounds[p].max.y : bounds[p].min.y,
+                    (corner & 4) ? bounds[p].max.z : bounds[p].min.z
+                };
+                float x, y;
+                if (!project(point, x, y)) {
+                    whole_region = true; // Reaches behind the camera, or is entirely behind it: left to the frustum test of every tile
+                    continue;
+                }
+                x0 = std::min(x0, x);
+                y0 = std::min(y0, y);
+                x1 = std::max(x1, x);
+                y1 = std::max(y1, y);
+            }
+            int column0 = 0, row0 = 0, column1 = width - 1, row1 = height - 1;
+            if (!whole_region) {
+                column0 = std::max(column0, static_cast<int>(std::floor(x0)) - 1 - first_column);
+                row0 = std::max(row0, static_cast<int>(std::floor(y0)) - 1 - first_row);
+                column1 = std::min(column1, static_cast<int>(std::ceil(x1)) + 1 - first_column);
+                row1 = std::min(row1, static_cast<int>(std::ceil(y1)) + 1 - first_row);
+            }
+            for (int tile_y = row0 / RENDER_TILE_SIZE; row0 <= row1 && tile_y <= row1 / RENDER_TILE_SIZE; tile_y++) {
+                for (int tile_x = column0 / RENDER_TILE_SIZE; column0 <= column1 && tile_x <= column1 / RENDER_TILE_SIZE; tile_x++) {
+                    int tile = tile_y * m_tiles_x + tile_x;
+                    if (m_counts[tile] <= TILE_CULLING_MAX_CANDIDATES && box_in_frustum(bounds[p], &planes[static_cast<size_t>(tile) * frustum_planes])) {
+                        add(tile, p);
+                    }
+                }
+            }
+        }
+        for (uint32_t p = static_cast<uint32_t>(bounds.size()); p < scene.primitives.size(); p++) {
+            for (int tile = 0; tile < tiles; tile++) {
+                if (m_counts[tile] <= TILE_CULLING_MAX_CANDIDATES && plane_in_frustum(*scene.primitives[p].shape, &corners[static_cast<size_t>(tile) * 4])) {
+                    add(tile, p);
+                }
+            }
+        }
+        tile_culling_stats.setup_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * @brief The primitives a tile's camera rays may reach
+     * @returns Their number, 0 for a tile that shows only the background, or TILE_CULLING_MAX_CANDIDATES + 1
+     * if there are too many to list, when the accelerator should be asked
+     * @param tile_i Band row of the tile's top edge
+     * @param tile_j Band column of the tile's left edge
+     * @param candidates Receives the tile's candidates in ascending order, when listed
+    **/
+    uint32_t tile_candidates(int tile_i, int tile_j, const uint32_t*& candidates)
+    {
+        int tile = (tile_i / RENDER_TILE_SIZE) * m_tiles_x + tile_j / RENDER_TILE_SIZE;
+        candidates = &m_candidates[static_cast<size_t>(tile) * TILE_CULLING_MAX_CANDIDATES];
+        uint32_t count = m_counts[tile];
+        tile_culling_stats.tiles++;
+        if (count == 0) {
+            tile_culling_stats.empty++;
+        } else if (count <= TILE_CULLING_MAX_CANDIDATES) {
+            tile_culling_stats.reduced++;
+            tile_culling_stats.reduced_candidates += count;
+        }
+        return count;
+    }
+};
+
+/*
+    Prints how many tiles tile culling skipped or traced against their own candidates
+*/
+inline void print_tile_culling_report(std::ostream& out)
+{
+    TileCullingStats& stats = tile_culling_stats;
+    uint64_t tiles = std::max<uint64_t>(1, stats.tiles);
+    out << "Tile culling: " << stats.empty << " of " << stats.tiles << " tiles skipped as background, " << stats.reduced
+        << " (" << 100.0 * stats.reduced / tiles << "%) traced against " << static_cast<double>(stats.reduced_candidates) / std::max<uint64_t>(1, stats.reduced)
+        << " candidates on average, " << stats.tiles - stats.empty - stats.reduced << " through the accelerator. Set up in "
+        << stats.setup_seconds * 1e3 << " ms" << std::endl;
+}
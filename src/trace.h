@@ -0,0 +1,154 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+    A completed span on one thread
+*/
+struct TraceEvent
+{
+    const char* name;
+    const char* category;
+    std::string detail; // Shown as the event's "detail" argument, may be empty
+    double start_us;
+    double duration_us;
+};
+
+/*
+    Events recorded by a single thread. Only its own thread appends to it, so recording takes no lock.
+*/
+struct TraceBuffer
+{
+    unsigned int thread_id;
+    std::string thread_name;
+    std::vector<TraceEvent> events;
+};
+
+/*
+    Timeline recorder for '--trace', written in the Chrome trace event format
+    (load in chrome://tracing or ui.perfetto.dev). Recording is off until enable() is called.
+*/
+class TraceRecorder
+{
+private:
+    std::mutex m_lock; // Guards m_buffers, taken once per thread and when writing
+    std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+    std::chrono::steady_clock::time_point m_origin = std::chrono::steady_clock::now();
+    bool m_enabled = false;
+
+public:
+    void enable()
+    {
+        m_enabled = true;
+    }
+
+    bool enabled()
+    {
+        return m_enabled;
+    }
+
+    double now_us()
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_origin).count();
+    }
+
+    /*
+        Registers a new buffer for the calling thread
+    */
+    TraceBuffer* register_thread()
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_buffers.push_back(std::make_unique<TraceBuffer>());
+        TraceBuffer* buffer = m_buffers.back().get();
+        buffer->thread_id = static_cast<unsigned int>(m_buffers.size());
+        buffer->thread_name = "thread " + std::to_string(buffer->thread_id);
+        return buffer;
+    }
+
+    /**
+     * @brief Writes every thread's events. Call after worker threads have been joined.
+     * @param out Destination stream
+    **/
+    void write_json(std::ostream& out)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        bool first = true;
+        for (auto& buffer : m_buffers) {
+            out << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->thread_id
+                << ", \"args\": {\"name\": \"" << buffer->thread_name << "\"}}";
+            first = false;
+            for (TraceEvent& event : buffer->events) {
+                out << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+                    << buffer->thread_id << ", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us;
+                if (!event.detail.empty()) {
+                    out << ", \"args\": {\"detail\": \"";
+                    for (char c : event.detail) {
+                        if (c == '"' || c == '\\') out << '\\';
+                        out << c;
+                    }
+                    out << "\"}";
+                }
+                out << "}";
+            }
+        }
+        out << "\n]}" << std::endl;
+    }
+};
+
+inline TraceRecorder trace_recorder;
+
+/*
+    The calling thread's trace buffer, registered on first use
+*/
+inline TraceBuffer& thread_trace_buffer()
+{
+    thread_local TraceBuffer* buffer = trace_recorder.register_thread();
+    return *buffer;
+}
+
+/*
+    Names the calling thread in the timeline
+*/
+inline void set_trace_thread_name(std::string name)
+{
+    if (trace_recorder.enabled()) {
+        thread_trace_buffer().thread_name = name;
+    }
+}
+
+/*
+    Records the lifetime of the object as a span on the calling thread. Does nothing unless tracing is enabled.
+*/
+class TraceSpan
+{
+private:
+    const char* m_name;
+    const char* m_category;
+    std::string m_detail;
+    double m_start_us = 0.0;
+    bool m_active;
+
+public:
+    TraceSpan(const char* name, const char* category, std::string detail = "")
+        : m_name(name), m_category(category), m_active(trace_recorder.enabled())
+    {
+        if (m_active) {
+            m_detail = detail;
+            m_start_us = trace_recorder.now_us();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (m_active) {
+            double end_us = trace_recorder.now_us();
+            thread_trace_buffer().events.push_back({ m_name, m_category, std::move(m_detail), m_start_us, end_us - m_start_us });
+        }
+    }
+};
@@ -1,9 +1,13 @@
 #pragma once
 #include <iostream>
+#include <fstream>
 #include <string>
 #include "definitions.h"
+#include "arena.h"
+#include "stats.h"
+#include "trace.h"
 
-bool objectInStack(std::vector<SceneObjectInfo*> &object_stack, SceneObjectInfo* object) {
+inline bool objectInStack(std::vector<SceneObjectInfo*> &object_stack, SceneObjectInfo* object) {
     if (std::find(object_stack.begin(), object_stack.end(), object) != object_stack.end()) {
         return true;
     } else {
@@ -20,7 +24,7 @@ bool objectInStack(std::vector<SceneObjectInfo*> &object_stack, SceneObjectInfo*
     out_min Minimum value or output range
     out_max Maximum value or output range 
 */
-float map(float x, float in_min, float in_max, float out_min, float out_max) 
+inline float map(float x, float in_min, float in_max, float out_min, float out_max) 
 {
     return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
 }
@@ -31,7 +35,7 @@ float map(float x, float in_min, float in_max, float out_min, float out_max)
 
     path String to modify
 */
-void remove_extension(std::string &path)
+inline void remove_extension(std::string &path)
 {
     std::size_t dot = path.rfind(".");
     if (dot != std::string::npos)
@@ -40,10 +44,121 @@ void remove_extension(std::string &path)
     }
 }
 
+/**
+ * @brief Writes an image as an ascii 'P3' PPM file
+ * @returns False if the file could not be created
+ * @param path Output path
+ * @param image Pixel values in the range 0 to 255, indexed (row, column, channel)
+ * @param height Image height in pixels
+ * @param width Image width in pixels
+**/
+inline bool write_ppm(std::string path, Mat3D& image, int height, int width)
+{
+    std::ofstream image_stream(path);
+    if (image_stream.fail()) {
+        return false;
+    }
+
+    /*
+        Create the image header
+    */ 
+    image_stream << "P3 " << std::endl;
+    image_stream << width << " " << height << " " << std::endl;
+    image_stream << "255 " << std::endl;
+
+    /*
+        Now print image to file
+    */
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            image_stream << image(i, j, 0) << " " << image(i, j, 1) << " " << image(i, j, 2) << " \n";
+        }
+    }
+
+    image_stream.close();
+    return !image_stream.fail();
+}
+
+/**
+ * @brief Records the file offset of every TEXTURE_TILE_SIZE wide run of texels of a 'P3' texture, so that
+ * its tiles can be decoded on first sample. Throws if a texel value is not an integer from MIN_PIXEL_VALUE to
+ * MAX_PIXEL_VALUE or the file has fewer values than its size needs, so decoding tiles on render threads cannot fail.
+ * @param texture Texture whose header has been read
+ * @param body_start Offset of the separator that ends the header
+**/
+inline void index_texture_texels(Texture* texture, std::streamoff body_start)
+{
+    STATS_PHASE(PHASE_TEXTURE_LOAD);
+    TraceSpan span("index_texture", "load", texture->path);
+    std::ifstream input_file(texture->path, std::ios::binary);
+    if (!input_file.is_open()) {
+        throw std::invalid_argument("ERROR: Unable to open texture '" + texture->path + "'. Please verify path.");
+    }
+    input_file.seekg(body_start);
+
+    /*
+        Scan the file in large chunks, tracking the absolute offset of each token
+    */
+    const size_t chunk_size = 1 << 20;
+    std::vector<char> chunk(chunk_size);
+    std::streamoff chunk_offset = body_start;
+    size_t width = static_cast<size_t>(texture->width);
+    size_t row_values = width * 3;
+    size_t tile_values = std::min<size_t>(TEXTURE_TILE_SIZE, width) * 3;
+    size_t value_index = 0;
+    long value = 0;
+    bool in_token = false, in_comment = false;
+    texture->tile_offsets.reserve(static_cast<size_t>(texture->height) * texture->tiles_x);
+
+    while (input_file.read(chunk.data(), chunk_size) || input_file.gcount() > 0) {
+        std::streamsize count = input_file.gcount();
+        for (std::streamsize i = 0; i < count; i++) {
+            char c = chunk[i];
+            if (in_comment) {
+                in_comment = (c != '\n');
+                continue;
+            }
+            bool separator = isspace(static_cast<unsigned char>(c)) || c == '#';
+            if (!separator && !in_token) {
+                // Start of a new texel value
+                if ((value_index % row_values) % tile_values == 0) {
+                    texture->tile_offsets.push_back(chunk_offset + i);
+                }
+                value_index++;
+                value = 0;
+            }
+            if (!separator) {
+                // Digits only, checked as they arrive so a long token cannot overflow
+                value = isdigit(static_cast<unsigned char>(c)) ? value * 10 + (c - '0') : -1;
+                if (value < MIN_PIXEL_VALUE || value > MAX_PIXEL_VALUE) {
+                    throw std::invalid_argument("ERROR: Invalid texel in texture '" + texture->path + "'. Values must be between "
+                        + std::to_string(MIN_PIXEL_VALUE) + " and " + std::to_string(MAX_PIXEL_VALUE) + ".");
+                }
+            }
+            in_token = !separator;
+            in_comment = (c == '#');
+        }
+        chunk_offset += count;
+    }
+
+    if (value_index < row_values * static_cast<size_t>(texture->height)) {
+        throw std::invalid_argument("ERROR: Texture '" + texture->path + "' is truncated.");
+    }
+}
+
 /*
-    Note: Only support PPM with 'P3' image file format. Image height and width must be 512 and 512.
+    Note: Supports PPM with 'P3' (ascii) or 'P6' (binary) image file format.
     Range of values must be between 0 to 255.
 
+    Texels are not decoded here. The header is parsed and, for 'P3', the file offset of every
+    TEXTURE_TILE_SIZE wide run of texels is recorded so tiles can be decoded on first sample
+    (see Texture::decode_tile and TextureCache). The texture is created in 'arena', which owns it, and keeps
+    its decoded tiles in 'cache'.
+
+    Given a loader, a 'P3' file is indexed on it in the background and the texture is returned as soon as
+    its header has been read; sampling it waits for the index. Errors in the header are thrown here, errors
+    found while indexing are reported by the loader.
+
     Example PPM header/body:
 
     P3
@@ -56,84 +171,94 @@ void remove_extension(std::string &path)
     127 178 229  127 178 229 ...
     ...
 */
-Texture* read_texture(std::string path, Texture* texture) {
-    unsigned int current_line = 0;
-    unsigned int current_token = 0;
-    int height, width;
-    std::string line;
-    std::ifstream input_file(path);
-    std::vector<std::string> tokens;
-
-    if (input_file.is_open()) 
-    {
-        // Read in one line at a time
-        while (std::getline(input_file, line))
-        {
-            current_line++;
-            std::istringstream ss(line);
-            std::string del;
-
-            // Skip comments
-            if (line.at(0) == '#') {
-                continue;
-            }
+inline Texture* read_texture(std::string path, SceneArena& arena, TextureCache& cache, BackgroundLoader* loader = nullptr) {
+    STATS_PHASE(PHASE_TEXTURE_LOAD);
+    TraceSpan span("read_texture", "load", path);
+    std::ifstream input_file(path, std::ios::binary);
+    if (!input_file.is_open()) {
+        throw std::invalid_argument("ERROR: Unable to open texture '" + path + "'. Please verify path.");
+    }
 
-            // Strip line of whitespace
-            while(std::getline(ss, del, ' ')) {
-                
-                // If not blank string or comment
-                if (!del.empty()) {
-                    current_token++;
-                    if (current_token == 1) {
-                        if (del != "P3") {
-                            throw std::invalid_argument("Only supports PPM 'P3' file format.");
-                        }
-                    } 
-                    else if (current_token == 2) 
-                    {
-                        width = std::stoi(del);
-                    }
-                    else if (current_token == 3) 
-                    {
-                        height = std::stoi(del);
-                    }
-                    else if (current_token == 4) 
-                    {
-                        if (del != "255") {
-                            throw std::invalid_argument("PPM pixel value must be between 0 - 255 .");
-                        }
-                    }
-                    else 
-                    {
-                        tokens.push_back(del);
-                    }
+    /*
+        Read the four header tokens, skipping comments
+    */
+    std::streamoff offset = 0;
+    unsigned int header_token = 0;
+    bool binary = false;
+    int width = 0, height = 0;
+    bool in_comment = false;
+    std::string token;
+    char c;
+    while (header_token < 4 && input_file.get(c)) {
+        if (in_comment) {
+            in_comment = (c != '\n');
+            offset++;
+            continue;
+        }
+        bool separator = isspace(static_cast<unsigned char>(c)) || c == '#';
+        if (!separator) {
+            token.push_back(c);
+        } else if (!token.empty()) {
+            header_token++;
+            if (header_token == 1) {
+                if (token != "P3" && token != "P6") {
+                    throw std::invalid_argument("Only supports PPM 'P3' or 'P6' file format.");
                 }
+                binary = (token == "P6");
+            } else if (header_token == 2) {
+                width = std::stoi(token);
+            } else if (header_token == 3) {
+                height = std::stoi(token);
+            } else if (token != "255") {
+                throw std::invalid_argument("PPM pixel value must be between 0 - 255 .");
             }
+            token.clear();
+        }
+        if (header_token < 4) {
+            in_comment = (c == '#');
+            offset++;
         }
     }
 
-    texture = new Texture(width, height);
+    if (header_token < 4) {
+        throw std::invalid_argument("ERROR: Incomplete header in texture '" + path + "'.");
+    }
+    if (width <= 0 || height <= 0) {
+        throw std::invalid_argument("ERROR: Invalid dimensions for texture '" + path + "'.");
+    }
+    Texture* texture = arena.create<Texture>(width, height);
+    texture->path = path;
+    texture->cache = &cache;
+    texture->binary = binary;
+    input_file.seekg(0, std::ios::end);
+    texture->file_size = input_file.tellg();
 
-    // Now write to image
-    unsigned int token_index = 0;
-    int i, j, k;
-    try
-    {
-        
-        for (j = 0; j < height; j++ ) {
-            for (i = 0; i < width; i++ ) {
-                for (k = 0; k < 3; k++ ) {
-                    texture->image->set(i, j, k, std::stoi(tokens[token_index]));
-                    token_index += 1;
-                }
-            }
+    if (binary) {
+        // A single whitespace byte separates the header from the raster
+        texture->data_offset = offset + 1;
+        if (texture->file_size - texture->data_offset < static_cast<std::streamoff>(width) * height * 3) {
+            throw std::invalid_argument("ERROR: Texture '" + path + "' is truncated.");
         }
+    } else if (loader == nullptr) {
+        index_texture_texels(texture, offset);
+    } else {
+        texture->index_state = TEXTURE_INDEXING;
+        startup_timeline.textures_indexing++;
+        texture->indexing = loader->submit([texture, offset]() {
+            try
+            {
+                index_texture_texels(texture, offset);
+                texture->index_state = TEXTURE_INDEXED;
+            }
+            catch(const std::exception& e)
+            {
+                texture->index_state = TEXTURE_INDEX_FAILED;
+                startup_timeline.texture_indexed();
+                throw;
+            }
+            startup_timeline.texture_indexed();
+        });
     }
-    catch(const std::exception& e)
-    {
-        std::cerr << e.what() << '\n';
-        throw e;
-    }
-    
+
     return texture;
-}
\ No newline at end of file
+}
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "../src/definitions.h"
+#include "../src/scene.h"
+#include "../src/parser.h"
+#include "../src/render.h"
+#include "../bench/scene_generator.h"
+
+/*
+    Checks that every '--accel' index makes TraceRay report the same hits in front of the ray's origin as
+    testing every object, for rays from the camera, rays starting on surfaces and unnormalized rays.
+
+    Usage:
+    SimpleRayTracerAcceleratorTest
+*/
+
+typedef std::tuple<SceneObjectInfo*, uint32_t, float> Hit;
+
+/*
+    Hits in front of the origin, in a canonical order
+*/
+std::vector<Hit> front_hits(SceneState& scene, Vector3 origin, Vector3 ray)
+{
+    std::vector<Hit> hits;
+    for (auto& [object_info, intersections] : TraceRay(scene, origin, ray)) {
+        for (Intersection& intersection : intersections) {
+            if (intersection.distance > 0.0f) {
+                hits.push_back({ object_info, intersection.triangle, intersection.distance });
+            }
+        }
+    }
+    std::sort(hits.begin(), hits.end());
+    return hits;
+}
+
+int main()
+{
+    bool passed = true;
+    for (SceneGeneratorOptions options : { SceneGeneratorOptions{ .spheres = 300, .triangles = 2000 }, SceneGeneratorOptions{ .spheres = 100, .triangles = 2000, .instanced = true },
+        SceneGeneratorOptions{ .spheres = 50, .triangles = 500, .shapes = 200 } }) {
+        SceneParser parser;
+        std::istringstream scene(generate_scene(options));
+        std::string line;
+        while (std::getline(scene, line)) {
+            parser.parse_line(line);
+        }
+        parser.state.settings.accel = ACCEL_BRUTE;
+        build_scene(parser.state);
+
+        /*
+            Rays from the camera, and from the surfaces they hit towards a light and in random unnormalized directions.
+            Surfaces far down an infinite plane are left out: from thousands of units away the sphere quadratic
+            loses its precision and reports hits a sphere's bounds rightly rule out.
+        */
+        std::mt19937 random(5);
+        std::uniform_real_distribution<float> spread(-1.0f, 1.0f);
+        std::vector<std::pair<Vector3, Vector3>> rays;
+        for (int i = 0; i < 2000; i++) {
+            Vector3 ray = Vector3({ spread(random) * 0.6f, spread(random) * 0.45f, -1.0f }).norm();
+            rays.push_back({ parser.view_origin, ray });
+            std::vector<Hit> hits = front_hits(parser.state, parser.view_origin, ray);
+            if (!hits.empty() && std::get<2>(hits.front()) < 100.0f) {
+                Vector3 point = parser.view_origin + (ray * std::get<2>(hits.front()));
+                rays.push_back({ point, Vector3({ 4.0f, 4.0f, -6.0f }) - point });
+                rays.push_back({ point, Vector3({ spread(random), spread(random), spread(random) }) * 3.0f });
+            }
+        }
+        std::vector<std::vector<Hit>> expected;
+        for (auto& [origin, ray] : rays) {
+            expected.push_back(front_hits(parser.state, origin, ray));
+        }
+
+        for (int type = ACCEL_GRID; type < ACCEL_TYPE_COUNT; type++) {
+            build_accelerator(parser.state, static_cast<AccelType>(type));
+            int mismatches = 0;
+            for (size_t i = 0; i < rays.size(); i++) {
+                if (front_hits(parser.state, rays[i].first, rays[i].second) != expected[i]) {
+                    mismatches++;
+                }
+            }
+            std::cout << (mismatches == 0 ? "PASS: " : "FAIL: ") << accel_names[type] << (options.instanced ? " (instanced)" : "")
+                << ": " << mismatches << " of " << rays.size() << " rays differ from testing every object" << std::endl;
+            passed &= mismatches == 0;
+        }
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include "../src/definitions.h"
+#include "../src/scene.h"
+#include "../src/parser.h"
+#include "../src/render.h"
+
+/*
+    Lights a floor with a rectangle light partly hidden by a sphere and checks adaptive soft shadows:
+    points that see all of the light or none of it take only the first 2x2 shadow rays, points in the
+    penumbra take the full set, and the adaptive image is about as close to a many-sample reference as
+    the image with fixed samples while tracing fewer shadow rays. Rays are counted with the '--stats'
+    counters, so the counts are only checked in builds with RAYTRACER_STATS.
+
+    Usage:
+    SimpleRayTracerAreaLightTest
+*/
+
+const std::string scene =
+    "eye 0 6 14\n"
+    "viewdir 0 -0.4 -1\n"
+    "updir 0 1 0\n"
+    "hfov 60\n"
+    "imsize 64 48\n"
+    "bkgcolor 0.1 0.1 0.1\n"
+    "mtlcolor 0.8 0.8 0.8 1 1 1 0.1 0.8 0.1 10\n"
+    "rectlight 0 10 0 4 0 0 0 0 4 1 1 1\n"
+    "sphere 0 5 0 2\n"
+    "v -20 0 -20\n"
+    "v 20 0 -20\n"
+    "v 20 0 20\n"
+    "v -20 0 20\n"
+    "f 1 4 3\n"
+    "f 1 3 2\n";
+
+const bool counted = RAYTRACER_STATS;
+
+/*
+    Visibility of the light from a point, with the shadow rays it took in 'rays' and whether it refined them
+*/
+float visibility(SceneState& scene, Light& light, Vector3 point, uint64_t& rays, bool& refined)
+{
+    SceneObjectInfo nothing;
+    nothing.id = std::numeric_limits<unsigned int>::max();
+    RenderCounters before = render_stats.merged();
+    Color mask = area_light_visibility(scene, light, point, &nothing);
+    RenderCounters after = render_stats.merged();
+    rays = after.area_light_rays - before.area_light_rays;
+    refined = after.refined_area_light_evaluations > before.refined_area_light_evaluations;
+    return mask.r;
+}
+
+/*
+    Renders the scene, returning the image and the shadow rays it took in 'rays'
+*/
+Framebuffer render(SceneParser& parser, SoftShadowMode mode, int samples, uint64_t& rays)
+{
+    parser.state.settings.soft_shadows = mode;
+    parser.state.settings.shadow_samples = samples;
+    uint64_t before = render_stats.merged().rays[RAY_SHADOW];
+    Framebuffer image = create_view_window_and_ray_trace(parser.state, parser.view_origin, parser.view_direction.norm(), parser.view_up.norm(),
+        parser.fov_h, parser.height, parser.width, parser.background_color);
+    rays = render_stats.merged().rays[RAY_SHADOW] - before;
+    return image;
+}
+
+int main()
+{
+    bool passed = true;
+
+    SceneParser parser;
+    parser.state.settings.threads = 1;
+    std::istringstream lines(scene);
+    std::string line;
+    while (std::getline(lines, line)) {
+        parser.parse_line(line);
+    }
+    build_scene(parser.state);
+    Light rectangle = parser.state.scene_lights.front();
+    Light sphere = rectangle;
+    sphere.shape = LIGHT_SPHERE;
+    sphere.radius = 2.0f;
+
+    for (Light* light : { &rectangle, &sphere }) {
+        std::string name = light->shape == LIGHT_SPHERE ? "sphere light" : "rectangle light";
+        uint64_t rays;
+        bool refined;
+        float lit = visibility(parser.state, *light, { 15.0f, 0.5f, 0.0f }, rays, refined);
+        if (lit != 1.0f || (counted && rays != 4)) {
+            std::cout << "FAIL: " << name << ": a fully lit point has visibility " << lit << " from " << rays << " rays" << std::endl;
+            passed = false;
+        }
+        float umbra = visibility(parser.state, *light, { 0.0f, 0.5f, 0.0f }, rays, refined);
+        if (umbra != 0.0f || (counted && rays != 4)) {
+            std::cout << "FAIL: " << name << ": a point in the umbra has visibility " << umbra << " from " << rays << " rays" << std::endl;
+            passed = false;
+        }
+
+        // Walk out of the shadow until the fixed samples see half of the light, then check adaptive sampling refines there
+        bool found = false;
+        for (float x = 0.0f; x < 10.0f && !found; x += 0.05f) {
+            parser.state.settings.soft_shadows = SOFT_SHADOWS_FIXED;
+            float fixed = visibility(parser.state, *light, { x, 0.5f, 0.0f }, rays, refined);
+            if (fixed < 0.5f) {
+                continue;
+            }
+            parser.state.settings.soft_shadows = SOFT_SHADOWS_ADAPTIVE;
+            float adaptive = visibility(parser.state, *light, { x, 0.5f, 0.0f }, rays, refined);
+            found = true;
+            if ((counted && (!refined || rays != 4 + 16)) || adaptive <= 0.0f || adaptive >= 1.0f) {
+                std::cout << "FAIL: " << name << ": a point in the penumbra has visibility " << adaptive << " from " << rays
+                    << " rays, " << fixed << " with fixed samples" << std::endl;
+                passed = false;
+            }
+        }
+        if (!found) {
+            std::cout << "FAIL: " << name << ": no point in the penumbra" << std::endl;
+            passed = false;
+        }
+    }
+    parser.state.settings.soft_shadows = SOFT_SHADOWS_ADAPTIVE;
+
+    /*
+        Both modes are compared against a render with many more samples. Adaptive sampling may miss the
+        thin outer fringe of a penumbra, so it is allowed a little more error than fixed sampling.
+    */
+    uint64_t reference_rays, fixed_rays, adaptive_rays;
+    Framebuffer reference = render(parser, SOFT_SHADOWS_FIXED, 256, reference_rays);
+    Framebuffer fixed = render(parser, SOFT_SHADOWS_FIXED, SHADOW_SAMPLES_DEFAULT, fixed_rays);
+    Framebuffer adaptive = render(parser, SOFT_SHADOWS_ADAPTIVE, SHADOW_SAMPLES_DEFAULT, adaptive_rays);
+    double fixed_error = 0.0, adaptive_error = 0.0;
+    for (size_t i = 0; i < reference.rgb.size(); i++) {
+        fixed_error += std::fabs(fixed.rgb[i] - reference.rgb[i]) / reference.rgb.size();
+        adaptive_error += std::fabs(adaptive.rgb[i] - reference.rgb[i]) / reference.rgb.size();
+    }
+    if (adaptive_error > 2.0 * fixed_error + 0.002 || (counted && adaptive_rays >= fixed_rays)) {
+        passed = false;
+    }
+    std::cout << (passed ? "PASS: " : "FAIL: ") << "adaptive soft shadows traced " << adaptive_rays << " shadow rays against "
+        << fixed_rays << " fixed, mean error " << adaptive_error << " against " << fixed_error << " fixed" << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "raytracer.h"
+
+/*
+    Builds a scene with the renderer API from values in memory (spheres, a textured sphere with an
+    in-memory texture, smooth shaded faces, a mesh instance and lights) and checks that it renders
+    exactly like the same scene given as scene file text. Also checks that the scene file renders the
+    same from a second translation unit, that two Scenes can exist and render side by side, also from
+    two threads at once and with their own texture cache settings, and that objects added after a render
+    are in the next one.
+
+    Usage:
+    SimpleRayTracerEmbeddingTest
+*/
+
+const int texture_size = 4;
+
+// In embedding_unit.cpp
+Framebuffer render_in_second_unit(std::string text, RenderSettings settings);
+
+/*
+    The same scene as build_in_memory, with the texture read from 'texture_path'
+*/
+std::string scene_text(std::string texture_path)
+{
+    return
+        "eye 0 1 6\n"
+        "viewdir 0 -0.1 -1\n"
+        "updir 0 1 0\n"
+        "hfov 60\n"
+        "imsize 80 60\n"
+        "bkgcolor 0.1 0.2 0.3\n"
+        "light 3 5 4 1 1 1 1\n"
+        "light -1 -1 -1 0 0.3 0.3 0.3\n"
+        "mtlcolor 0.8 0.2 0.2 1 1 1 0.1 0.7 0.2 20\n"
+        "sphere -1.5 1 -1 1\n"
+        "texture " + texture_path + "\n"
+        "sphere 1.5 1 -1 1\n"
+        "mtlcolor 0.7 0.7 0.7 1 1 1 0.1 0.8 0.1 10\n"
+        "v -5 0 -5\n"
+        "v 5 0 -5\n"
+        "v 5 0 5\n"
+        "v -5 0 5\n"
+        "vn 0 1 0\n"
+        "vt 0 0\n"
+        "f 1/1/1 4/1/1 3/1/1\n"
+        "f 1/1/1 3/1/1 2/1/1\n"
+        "v 0 0 0\n"
+        "v 1 0 0\n"
+        "v 0 1 0\n"
+        "beginmesh tri\n"
+        "f 5 6 7\n"
+        "endmesh\n"
+        "mtlcolor 0.2 0.8 0.2 1 1 1 0.1 0.8 0.1 10\n"
+        "instance tri 1 0 0 -0.5 0 1 0 0.5 0 0 1 1\n";
+}
+
+Material make_material(Color diffuse, float ka, float kd, float ks, float n)
+{
+    return { diffuse, { 1.0f, 1.0f, 1.0f }, ka, kd, ks, n, 1.0f, 1.0f };
+}
+
+Light make_light(Vector3 position_or_direction, float w, Color color)
+{
+    Light light;
+    light.w = w;
+    light.position = position_or_direction;
+    light.direction = position_or_direction;
+    light.color = color;
+    return light;
+}
+
+void build_in_memory(Scene& scene, std::vector<byte>& texels)
+{
+    scene.set_background({ 0.1f, 0.2f, 0.3f });
+    scene.add_light(make_light({ 3.0f, 5.0f, 4.0f }, 1.0f, { 1.0f, 1.0f, 1.0f }));
+    scene.add_light(make_light({ -1.0f, -1.0f, -1.0f }, 0.0f, { 0.3f, 0.3f, 0.3f }));
+    scene.set_material(make_material({ 0.8f, 0.2f, 0.2f }, 0.1f, 0.7f, 0.2f, 20.0f));
+    scene.add_sphere({ -1.5f, 1.0f, -1.0f }, 1.0f);
+    scene.set_texture(scene.add_texture(texture_size, texture_size, texels.data()));
+    scene.add_sphere({ 1.5f, 1.0f, -1.0f }, 1.0f);
+
+    scene.set_material(make_material({ 0.7f, 0.7f, 0.7f }, 0.1f, 0.8f, 0.1f, 10.0f));
+    Vector3 corners[4] = { { -5.0f, 0.0f, -5.0f }, { 5.0f, 0.0f, -5.0f }, { 5.0f, 0.0f, 5.0f }, { -5.0f, 0.0f, 5.0f } };
+    Vector3 normals[3] = { { 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } };
+    Vector3 first[3] = { corners[0], corners[3], corners[2] };
+    Vector3 second[3] = { corners[0], corners[2], corners[1] };
+    scene.add_face(first, normals);
+    scene.add_face(second, normals);
+
+    Mesh* mesh = scene.add_mesh("tri", { { 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } }, { 0, 1, 2 });
+    Mat4 transform = Mat4::identity();
+    transform.m[0][3] = -0.5f;
+    transform.m[1][3] = 0.5f;
+    transform.m[2][3] = 1.0f;
+    scene.set_material(make_material({ 0.2f, 0.8f, 0.2f }, 0.1f, 0.8f, 0.1f, 10.0f));
+    scene.add_instance(mesh, transform);
+}
+
+int main()
+{
+    bool passed = true;
+    RenderSettings settings;
+    settings.threads = 2;
+
+    std::vector<byte> texels(texture_size * texture_size * 3);
+    for (size_t i = 0; i < texels.size(); i++) {
+        texels[i] = static_cast<byte>((i * 37) % 256);
+    }
+    std::filesystem::path texture_path = std::filesystem::temp_directory_path() / "simple_raytracer_embedding.ppm";
+    {
+        std::ofstream texture_file(texture_path);
+        texture_file << "P3\n" << texture_size << " " << texture_size << "\n255\n";
+        for (byte value : texels) {
+            texture_file << static_cast<int>(value) << "\n";
+        }
+    }
+
+    Framebuffer parsed(0, 0);
+    Camera camera;
+    {
+        Scene scene;
+        scene.parse_text(scene_text(texture_path.string()));
+        camera = scene.camera();
+        render(scene, camera, settings, parsed);
+    }
+    Framebuffer second_unit = render_in_second_unit(scene_text(texture_path.string()), settings);
+    std::filesystem::remove(texture_path);
+    bool same = second_unit.rgb == parsed.rgb;
+    std::cout << (same ? "PASS: " : "FAIL: ") << "a second translation unit renders the scene file " << (same ? "the same" : "differently") << std::endl;
+    passed &= same;
+
+    Framebuffer built(0, 0);
+    Scene scene;
+    build_in_memory(scene, texels);
+    render(scene, camera, settings, built);
+    bool identical = built.rgb == parsed.rgb && built.width == camera.width && built.height == camera.height;
+    std::cout << (identical ? "PASS: " : "FAIL: ") << "a scene built in memory renders " << (identical ? "the same as" : "differently from")
+        << " its scene file" << std::endl;
+    passed &= identical;
+
+    {
+        Scene second;
+        second.set_background({ 1.0f, 1.0f, 1.0f });
+        second.set_material(make_material({ 0.2f, 0.2f, 0.9f }, 0.1f, 0.8f, 0.1f, 10.0f));
+        second.add_sphere({ 0.0f, 1.0f, 0.0f }, 2.0f);
+        second.add_light(make_light({ 0.0f, 5.0f, 5.0f }, 1.0f, { 1.0f, 1.0f, 1.0f }));
+        Framebuffer other(0, 0);
+        render(second, camera, settings, other);
+        Framebuffer again(0, 0);
+        render(scene, camera, settings, again);
+        bool apart = other.rgb != built.rgb && again.rgb == built.rgb;
+        std::cout << (apart ? "PASS: " : "FAIL: ") << "a second Scene " << (apart ? "renders" : "does not render") << " apart from the first" << std::endl;
+        passed &= apart;
+
+        RenderSettings small_cache = settings;
+        small_cache.texture_cache_mb = 1.0f;
+        Framebuffer other_concurrent(0, 0);
+        Framebuffer concurrent(0, 0);
+        std::thread other_render([&]() { render(second, camera, small_cache, other_concurrent); });
+        render(scene, camera, settings, concurrent);
+        other_render.join();
+        bool side_by_side = other_concurrent.rgb == other.rgb && concurrent.rgb == built.rgb;
+        std::cout << (side_by_side ? "PASS: " : "FAIL: ") << "two Scenes rendered from two threads at once render "
+            << (side_by_side ? "the same as" : "differently from") << " one after the other" << std::endl;
+        passed &= side_by_side;
+        bool own_cache = scene.state.texture_cache.stats().budget_bytes == static_cast<size_t>(settings.texture_cache_mb * 1024.0f * 1024.0f)
+            && second.state.texture_cache.stats().budget_bytes == 1024 * 1024;
+        std::cout << (own_cache ? "PASS: " : "FAIL: ") << "each Scene " << (own_cache ? "keeps" : "does not keep") << " its own texture cache budget" << std::endl;
+        passed &= own_cache;
+    }
+
+    scene.set_material(make_material({ 0.9f, 0.9f, 0.1f }, 0.1f, 0.8f, 0.1f, 10.0f));
+    scene.add_sphere({ 0.0f, 1.0f, 2.0f }, 0.5f);
+    Framebuffer added(0, 0);
+    render(scene, camera, settings, added);
+    bool rebuilt = added.rgb != built.rgb;
+    std::cout << (rebuilt ? "PASS: " : "FAIL: ") << "a sphere added after a render " << (rebuilt ? "is" : "is not") << " in the next render" << std::endl;
+    passed &= rebuilt;
+    return passed ? 0 : 1;
+}
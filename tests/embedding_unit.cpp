@@ -0,0 +1,20 @@
+#include <string>
+#include "raytracer.h"
+
+/*
+    Second translation unit of SimpleRayTracerEmbeddingTest. The test only links if the renderer's headers
+    can be included from more than one.
+*/
+
+/*
+    Renders scene file text with a Scene of its own
+*/
+Framebuffer render_in_second_unit(std::string text, RenderSettings settings)
+{
+    Scene scene;
+    scene.parse_text(text);
+    Camera camera = scene.camera();
+    Framebuffer image(0, 0);
+    render(scene, camera, settings, image);
+    return image;
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include "../src/fast_math.h"
+
+/*
+    Checks the '--precision fast' approximations in src/fast_math.h against double precision <cmath>
+    over the inputs shading passes in, and fails if any exceeds its documented maximum error.
+
+    Usage:
+    SimpleRayTracerFastMathTest
+*/
+
+bool report(std::string name, double measured, double limit)
+{
+    bool passed = measured <= limit;
+    std::cout << (passed ? "PASS: " : "FAIL: ") << name << " max error " << measured << " (limit " << limit << ")" << std::endl;
+    return passed;
+}
+
+int main()
+{
+    const int samples = 1 << 20;
+    bool passed = true;
+
+    double acos_error = 0.0;
+    for (int i = 0; i <= samples; i++) {
+        float x = -1.0f + 2.0f * i / samples;
+        acos_error = std::max(acos_error, std::fabs(fast_acos(x) - std::acos(static_cast<double>(x))));
+    }
+    passed &= report("fast_acos", acos_error, FAST_ACOS_MAX_ERROR);
+
+    double atan2_error = 0.0;
+    for (int i = 0; i <= samples; i++) {
+        double angle = -M_PI + 2.0 * M_PI * i / samples;
+        for (float radius : { 1e-3f, 1.0f, 1e3f }) {
+            float x = static_cast<float>(radius * std::cos(angle));
+            float y = static_cast<float>(radius * std::sin(angle));
+            double error = std::fabs(fast_atan2(y, x) - std::atan2(static_cast<double>(y), static_cast<double>(x)));
+            atan2_error = std::max(atan2_error, std::min(error, 2.0 * M_PI - error)); // -pi and pi are the same direction
+        }
+    }
+    passed &= report("fast_atan2", atan2_error, FAST_ATAN2_MAX_ERROR);
+
+    double pow_error = 0.0;
+    for (int i = 1; i <= samples; i++) {
+        float x = static_cast<float>(i) / samples;
+        for (float y : { 0.0f, 1.0f, 2.0f, 5.0f, 10.0f, 20.0f, 64.0f, 0.5f, 2.5f, 12.75f, 100.0f, 333.3f, 1000.0f }) {
+            double exact = std::pow(static_cast<double>(x), static_cast<double>(y));
+            // Results below the normal float range have no meaningful relative error
+            if (exact > 1e-30) {
+                pow_error = std::max(pow_error, std::fabs(fast_pow(x, y) - exact) / exact);
+            }
+        }
+    }
+    passed &= report("fast_pow relative", pow_error, FAST_POW_MAX_RELATIVE_ERROR);
+
+    double schlick_error = 0.0;
+    for (int i = 0; i <= samples; i++) {
+        float cos_angle = static_cast<float>(i) / samples;
+        schlick_error = std::max(schlick_error, std::fabs(pow5(1.0f - cos_angle) - std::pow(1.0 - cos_angle, 5.0)));
+        schlick_error = std::max(schlick_error, std::fabs(pow2(cos_angle) - static_cast<double>(cos_angle) * cos_angle));
+    }
+    passed &= report("pow2 and pow5", schlick_error, 1e-6);
+
+    /*
+        Total internal reflection must agree with the angle comparison except where the angle of
+        incidence is within float rounding of the critical angle
+    */
+    int disagreements = 0;
+    for (float ratio : { 0.5f, 1.0f / 1.33f, 1.0f / 1.5f, 1.0f / 2.4f, 0.99f, 1.0f, 1.5f }) {
+        for (int i = -16; i <= samples + 16; i++) {
+            float cos_angle = static_cast<float>(i) / samples;
+            double critical_angle = std::asin(static_cast<double>(ratio));
+            double incidence_angle = std::acos(std::clamp(static_cast<double>(cos_angle), -1.0, 1.0));
+            bool exact = (critical_angle < incidence_angle) && (incidence_angle < M_PI / 2.0) && cos_angle <= 1.0f;
+            if (exact != total_internal_reflection_from_cosine(cos_angle, ratio) && std::fabs(incidence_angle - critical_angle) > 1e-6) {
+                disagreements++;
+            }
+        }
+    }
+    passed &= report("total_internal_reflection_from_cosine disagreements", disagreements, 0);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#include <iostream>
+#include <string>
+#include "test_helpers.h"
+#include "../bench/scene_generator.h"
+
+/*
+    Checks the '--mem-report' accounting against sizes known from the scene: the triangles' intersection
+    data and the spheres are counted under geometry, each object's material under materials, the
+    accelerator is counted, and a render and its tone mapped image are recorded as framebuffers.
+
+    Usage:
+    SimpleRayTracerMemoryReportTest
+*/
+
+int main()
+{
+    bool passed = true;
+    RenderSettings settings;
+    settings.threads = 2;
+    Scene scene;
+    scene.parse_text(generate_scene({ .spheres = 50, .triangles = 2000, .width = 64, .height = 48 }));
+    Camera camera = scene.camera();
+    scene.build(settings);
+
+    MemoryFootprint before = measure_memory(scene.state);
+    size_t triangles = scene.state.scene_mesh.triangles.size();
+    size_t objects = triangles + scene.state.spheres.size();
+    passed &= check(before.bytes[MEMORY_GEOMETRY] >= triangles * sizeof(TriangleIntersectionData) + scene.state.spheres.size() * sizeof(Sphere),
+        "geometry holds the triangles and spheres");
+    passed &= check(before.bytes[MEMORY_MATERIALS] >= objects * sizeof(Material), "materials hold one material per object");
+    passed &= check(before.bytes[MEMORY_METADATA] >= objects * (sizeof(SceneObjectInfo) - sizeof(Material)), "metadata holds one object info per object");
+    passed &= check(before.bytes[MEMORY_ACCELERATION] > 0, "the accelerator is counted");
+
+    /*
+        One more sphere adds exactly a sphere's bytes to geometry
+    */
+    scene.add_sphere({ 0.0f, 0.0f, -100.0f }, 1.0f);
+    MemoryFootprint added = measure_memory(scene.state);
+    passed &= check(added.bytes[MEMORY_GEOMETRY] == before.bytes[MEMORY_GEOMETRY] + sizeof(Sphere), "a sphere adds sizeof(Sphere) to geometry");
+
+    Framebuffer radiance(0, 0);
+    memory_ledger.reset_peaks();
+    render(scene, camera, settings, radiance);
+    size_t radiance_bytes = static_cast<size_t>(camera.width) * camera.height * 3 * sizeof(float);
+    passed &= check(measure_memory(scene.state).bytes[MEMORY_FRAMEBUFFERS] >= radiance_bytes, "the render's framebuffer is recorded");
+    Mat3D image = tone_map_to_image(radiance, TONEMAP_CLAMP, false);
+    MemoryFootprint after = measure_memory(scene.state);
+    passed &= check(after.bytes[MEMORY_FRAMEBUFFERS] == radiance_bytes + image.memory_usage(), "the tone mapped image is recorded next to the framebuffer");
+    passed &= check(after.bytes[MEMORY_TEMPORARY] >= radiance_bytes, "tone mapping's buffer is recorded as temporary");
+    passed &= check(memory_ledger.current[MEMORY_FRAMEBUFFERS] == 0 && memory_ledger.current[MEMORY_TEMPORARY] == 0, "nothing stays recorded after the render");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "test_helpers.h"
+
+/*
+    Checks that the parallel OBJ import assigns the same materials as reading the file in order when
+    a 'usemtl' is the last line of a chunk: one face under material A, then 'usemtl B' on the line
+    that ends the first chunk, then enough faces under B to fill the rest of the file.
+
+    Usage:
+    SimpleRayTracerObjImportTest
+*/
+
+int main()
+{
+    bool passed = true;
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::filesystem::path obj_path = directory / "simple_raytracer_obj_import.obj";
+    std::filesystem::path mtl_path = directory / "simple_raytracer_obj_import.mtl";
+    {
+        std::ofstream mtl_file(mtl_path);
+        mtl_file << "newmtl A\nKd 1 0 0\nnewmtl B\nKd 0 0 1\n";
+    }
+
+    /*
+        import_obj splits a file of 3 to 4 MB into 3 chunks (one per whole MB) and moves each boundary forward to
+        the next line start. The comment line puts the middle of the 'usemtl B' line at a third of the
+        file, so the line ends the first chunk.
+    */
+    const size_t b_faces = 300000;
+    std::string header = "mtllib " + mtl_path.filename().string() + "\nv 0 0 0\nv 1 0 0\nv 0 1 0\nusemtl A\nf 1 2 3\n";
+    std::string usemtl = "usemtl B\n";
+    std::string faces;
+    for (size_t i = 0; i < b_faces; i++) {
+        faces += "f 1 2 3\n";
+    }
+    size_t padding = (usemtl.size() + faces.size() - 12) / 2 - header.size();
+    std::string padding_line = std::string(padding - 1, '#') + "\n";
+    std::string text = header + padding_line + usemtl + faces;
+    size_t usemtl_start = header.size() + padding_line.size();
+    passed &= check(usemtl_start < text.size() / 3 && text.size() / 3 < usemtl_start + usemtl.size() && text.size() / (1 << 20) == 3,
+        "'usemtl B' is the last line of the first of 3 chunks");
+    {
+        std::ofstream obj_file(obj_path, std::ios::binary);
+        obj_file << text;
+    }
+
+    TextureCache cache;
+    SceneArena arena;
+    Mesh* mesh = import_obj(obj_path.string(), 4, false, arena, cache);
+    size_t a_count = 0;
+    size_t b_count = 0;
+    for (uint16_t material : mesh->triangle_materials) {
+        std::string name = material == Mesh::no_material ? "" : mesh->materials[material].name;
+        a_count += name == "A";
+        b_count += name == "B";
+    }
+    passed &= check(mesh->triangles.size() == b_faces + 1, "every face is imported");
+    passed &= check(a_count == 1, "one triangle has material A (" + std::to_string(a_count) + ")");
+    passed &= check(b_count == b_faces, "the triangles after the chunk boundary have material B (" + std::to_string(b_count) + ")");
+
+    std::filesystem::remove(obj_path);
+    std::filesystem::remove(mtl_path);
+    return passed ? 0 : 1;
+}
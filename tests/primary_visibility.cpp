@@ -0,0 +1,100 @@
+#include <string>
+#include <vector>
+#include "test_helpers.h"
+#include "../bench/scene_generator.h"
+
+/*
+    Renders scenes with camera rays ray traced and with '--primary raster', and checks that both give
+    exactly the same radiance: generated scenes of spheres, faces and a mesh instance, a floor that
+    passes behind the camera, a camera inside a glass sphere, and a rectangle of the image on its own.
+
+    Usage:
+    SimpleRayTracerPrimaryVisibilityTest
+*/
+
+const std::string floor_scene =
+    "eye 0 1 0\n"
+    "viewdir 0 -0.3 -1\n"
+    "updir 0 1 0\n"
+    "hfov 70\n"
+    "imsize 96 64\n"
+    "bkgcolor 0.1 0.1 0.1\n"
+    "light 2 5 -3 1 1 1 1\n"
+    "mtlcolor 0.8 0.8 0.8 1 1 1 0.1 0.8 0.1 10\n"
+    "v -20 0 20\n"
+    "v 20 0 20\n"
+    "v 20 0 -20\n"
+    "v -20 0 -20\n"
+    "f 1 2 3\n"
+    "f 1 3 4\n"
+    "mtlcolor 0.2 0.5 0.9 1 1 1 0.1 0.8 0.1 10\n"
+    "sphere 0 0.5 -4 0.5\n"
+    "sphere 0.9 0.5 -4 0.5\n";
+
+const std::string inside_sphere_scene =
+    "eye 0 0 0\n"
+    "viewdir 0 0 -1\n"
+    "updir 0 1 0\n"
+    "hfov 60\n"
+    "imsize 64 48\n"
+    "bkgcolor 0.1 0.1 0.1 1\n"
+    "light 0 4 -6 1 1 1 1\n"
+    "mtlcolor 0.9 0.9 1 1 1 1 0.05 0.2 0.5 60 0.2 1.3\n"
+    "sphere 0 0 -1 3\n"
+    "mtlcolor 0.8 0.2 0.2 1 1 1 0.1 0.7 0.2 20\n"
+    "sphere 0 0 -6 1\n";
+
+/**
+ * @brief Renders a scene, or a rectangle of it, in both modes
+ * @returns True if the radiance is identical
+ * @param text Scene file text
+ * @param name Reported name
+ * @param region Rectangle to render, or null for the whole image
+**/
+bool check_scene(std::string text, std::string name, int* region = nullptr)
+{
+    RenderSettings settings;
+    settings.threads = 2;
+    Scene scene;
+    scene.parse_text(text);
+    std::vector<float> images[2];
+    for (PrimaryVisibilityMode mode : { PRIMARY_RAYTRACE, PRIMARY_RASTER }) {
+        settings.primary_visibility = mode;
+        images[mode] = render_radiance(scene, settings, region);
+    }
+    bool identical = images[PRIMARY_RAYTRACE] == images[PRIMARY_RASTER];
+    return check(identical, name + ": rasterized primary visibility gives " + (identical ? "the same" : "a different") + " image");
+}
+
+int main()
+{
+    bool passed = true;
+
+    std::string spheres_and_faces = generate_scene({ .spheres = 200, .triangles = 2000, .width = 96, .height = 72 });
+    passed &= check_scene(spheres_and_faces, "spheres and faces");
+    int region[4] = { 13, 7, 81, 50 };
+    passed &= check_scene(spheres_and_faces, "rectangle of spheres and faces", region);
+
+    /*
+        Most camera rays of a scene of faces and spheres should need only the one intersection test
+    */
+    {
+        RenderSettings settings;
+        settings.threads = 2;
+        settings.primary_visibility = PRIMARY_RASTER;
+        Scene scene;
+        scene.parse_text(spheres_and_faces);
+        primary_visibility_stats.resolved = 0;
+        primary_visibility_stats.background = 0;
+        primary_visibility_stats.unresolved = 0;
+        render_radiance(scene, settings);
+        passed &= check(primary_visibility_stats.unresolved * 4 <= primary_visibility_stats.resolved + primary_visibility_stats.background,
+            std::to_string(primary_visibility_stats.unresolved) + " of " + std::to_string(scene.width * scene.height) + " camera rays were ray traced");
+    }
+
+    passed &= check_scene(generate_scene({ .spheres = 32, .triangles = 2000, .instanced = true, .glass_layers = 2, .width = 96, .height = 72 }), "mesh instance and glass");
+    passed &= check_scene(generate_scene({ .spheres = 16, .triangles = 500, .shapes = 100, .width = 96, .height = 72 }), "shapes over an infinite plane");
+    passed &= check_scene(floor_scene, "floor behind the camera");
+    passed &= check_scene(inside_sphere_scene, "camera inside a sphere");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,515 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/*
+    Golden image and render time regression check for one scene, run by CTest for every scene in Examples.
+
+    The scene is rendered by the SimpleRayTracer binary into the work directory and compared against
+    its reference in the reference directory: the image 'name.png' and the render time 'name.seconds',
+    both committed to the repository. A pixel passes when no channel differs by more than the tolerance.
+    A scene without a reference fails. --update-baseline records the render and its time as the new
+    reference instead of comparing. The scene's textures are replaced by generated stand-ins, so its
+    reference does not depend on the textures having been fetched from Git LFS.
+
+    Usage:
+    SimpleRayTracerRegression --renderer path --scene path --work-dir dir --reference-dir dir
+        [--tolerance N] [--max-failing-fraction F] [--min-psnr dB] [--time-threshold F] [--time-margin seconds]
+        [--update-baseline]
+
+    Exits with 0 on success and 1 on a regression or a missing reference.
+*/
+
+const int STAND_IN_TEXTURE_SIZE = 64;
+
+struct RegressionSettings
+{
+    std::filesystem::path renderer;
+    std::filesystem::path scene;
+    std::filesystem::path work_dir;
+    std::filesystem::path reference_dir;
+    int tolerance = 2; // Largest per channel difference a pixel may have and still match
+    double max_failing_fraction = 0.001; // Fraction of pixels allowed outside the tolerance, for silhouette edges
+    double min_psnr = 40.0;
+    double time_threshold = 1.5; // Fail when the render takes longer than this times the baseline
+    double time_margin = 1.0; // Seconds always allowed over the baseline, so noise cannot fail short renders
+    bool update_baseline = false;
+};
+
+struct Image
+{
+    int width = 0;
+    int height = 0;
+    std::vector<int> pixels; // Row-major RGB
+};
+
+struct ImageComparison
+{
+    int max_error = 0;
+    size_t failing_pixels = 0;
+    double psnr = INFINITY;
+};
+
+/*
+    Skips whitespace and '#' comments in a PPM header
+*/
+void skip_ppm_blank(std::istream& stream)
+{
+    while (stream) {
+        int c = stream.peek();
+        if (c == '#') {
+            std::string comment;
+            std::getline(stream, comment);
+        } else if (std::isspace(c)) {
+            stream.get();
+        } else {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Reads an ASCII (P3) or binary (P6) PPM image
+ * @returns False if the file is missing or malformed
+ * @param path File to read
+ * @param image Receives the pixels
+**/
+bool read_ppm(const std::filesystem::path& path, Image& image)
+{
+    std::ifstream stream(path, std::ios::binary);
+    std::string magic;
+    int max_value = 0;
+    stream >> magic;
+    skip_ppm_blank(stream);
+    stream >> image.width;
+    skip_ppm_blank(stream);
+    stream >> image.height;
+    skip_ppm_blank(stream);
+    stream >> max_value;
+    if (stream.fail() || (magic != "P3" && magic != "P6") || image.width <= 0 || image.height <= 0 || max_value <= 0 || max_value > 255) {
+        return false;
+    }
+
+    image.pixels.resize(static_cast<size_t>(image.width) * image.height * 3);
+    if (magic == "P3") {
+        // Out of range values (e.g. NaN pixels written as huge integers) are saturated like a viewer would
+        for (int& value : image.pixels) {
+            double raw;
+            stream >> raw;
+            value = static_cast<int>(std::clamp(raw, 0.0, static_cast<double>(max_value)));
+        }
+    } else {
+        stream.get();
+        std::vector<unsigned char> bytes(image.pixels.size());
+        stream.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+        std::copy(bytes.begin(), bytes.end(), image.pixels.begin());
+    }
+    return !stream.fail();
+}
+
+const unsigned char png_signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+
+uint32_t read_be32(const unsigned char* bytes)
+{
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) | (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+void append_be32(std::string& out, uint32_t value)
+{
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+/*
+    Paeth predictor of the PNG filters
+*/
+int paeth(int left, int up, int up_left)
+{
+    int estimate = left + up - up_left;
+    int to_left = std::abs(estimate - left), to_up = std::abs(estimate - up), to_up_left = std::abs(estimate - up_left);
+    if (to_left <= to_up && to_left <= to_up_left) {
+        return left;
+    }
+    return to_up <= to_up_left ? up : up_left;
+}
+
+/*
+    Prediction of byte i of a row by PNG filter 'filter', from the bytes already known
+*/
+int png_prediction(int filter, const unsigned char* row, const unsigned char* previous_row, size_t i, size_t pixel_bytes)
+{
+    int left = i >= pixel_bytes ? row[i - pixel_bytes] : 0;
+    int up = previous_row != nullptr ? previous_row[i] : 0;
+    int up_left = previous_row != nullptr && i >= pixel_bytes ? previous_row[i - pixel_bytes] : 0;
+    switch (filter)
+    {
+    case 1: return left;
+    case 2: return up;
+    case 3: return (left + up) / 2;
+    case 4: return paeth(left, up, up_left);
+    default: return 0;
+    }
+}
+
+/**
+ * @brief Reads an 8-bit RGB or RGBA, non-interlaced PNG image. Alpha is dropped.
+ * @returns False if the file is missing, malformed or in another PNG format
+ * @param path File to read
+ * @param image Receives the pixels
+**/
+bool read_png(const std::filesystem::path& path, Image& image)
+{
+    std::ifstream stream(path, std::ios::binary);
+    std::string file((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(file.data());
+    if (file.size() < 8 || !std::equal(png_signature, png_signature + 8, bytes)) {
+        return false;
+    }
+
+    int channels = 0;
+    std::string compressed;
+    for (size_t offset = 8; offset + 12 <= file.size();) {
+        uint32_t length = read_be32(bytes + offset);
+        std::string type = file.substr(offset + 4, 4);
+        const unsigned char* data = bytes + offset + 8;
+        if (offset + 12 + length > file.size()) {
+            return false;
+        }
+        if (type == "IHDR" && length >= 13) {
+            image.width = static_cast<int>(read_be32(data));
+            image.height = static_cast<int>(read_be32(data + 4));
+            channels = data[9] == 2 ? 3 : data[9] == 6 ? 4 : 0;
+            if (data[8] != 8 || channels == 0 || data[12] != 0) {
+                return false;
+            }
+        } else if (type == "IDAT") {
+            compressed.append(file, offset + 8, length);
+        } else if (type == "IEND") {
+            break;
+        }
+        offset += 12 + length;
+    }
+    if (channels == 0 || image.width <= 0 || image.height <= 0) {
+        return false;
+    }
+
+    size_t row_bytes = static_cast<size_t>(image.width) * channels;
+    std::vector<unsigned char> rows((row_bytes + 1) * image.height);
+    uLongf size = static_cast<uLongf>(rows.size());
+    if (uncompress(rows.data(), &size, reinterpret_cast<const Bytef*>(compressed.data()), static_cast<uLong>(compressed.size())) != Z_OK || size != rows.size()) {
+        return false;
+    }
+
+    image.pixels.resize(static_cast<size_t>(image.width) * image.height * 3);
+    unsigned char* previous_row = nullptr;
+    for (int y = 0; y < image.height; y++) {
+        unsigned char* row = &rows[y * (row_bytes + 1) + 1];
+        int filter = row[-1];
+        if (filter > 4) {
+            return false;
+        }
+        for (size_t i = 0; i < row_bytes; i++) {
+            row[i] = static_cast<unsigned char>(row[i] + png_prediction(filter, row, previous_row, i, channels));
+        }
+        for (int x = 0; x < image.width; x++) {
+            std::copy_n(row + x * channels, 3, &image.pixels[(static_cast<size_t>(y) * image.width + x) * 3]);
+        }
+        previous_row = row;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes an 8-bit RGB PNG image, each row with the filter that leaves the smallest residuals
+ * @returns False if the file could not be written
+ * @param path File to write
+ * @param image Pixels to write
+**/
+bool write_png(const std::filesystem::path& path, const Image& image)
+{
+    size_t row_bytes = static_cast<size_t>(image.width) * 3;
+    std::vector<unsigned char> source(image.pixels.begin(), image.pixels.end());
+    std::vector<unsigned char> rows;
+    rows.reserve((row_bytes + 1) * image.height);
+    std::vector<unsigned char> filtered(row_bytes), best(row_bytes);
+    for (int y = 0; y < image.height; y++) {
+        const unsigned char* row = &source[y * row_bytes];
+        const unsigned char* previous_row = y > 0 ? row - row_bytes : nullptr;
+        int best_filter = 0;
+        uint64_t best_cost = UINT64_MAX;
+        for (int filter = 0; filter <= 4; filter++) {
+            uint64_t cost = 0;
+            for (size_t i = 0; i < row_bytes; i++) {
+                filtered[i] = static_cast<unsigned char>(row[i] - png_prediction(filter, row, previous_row, i, 3));
+                cost += std::abs(static_cast<signed char>(filtered[i]));
+            }
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_filter = filter;
+                best.swap(filtered);
+            }
+        }
+        rows.push_back(static_cast<unsigned char>(best_filter));
+        rows.insert(rows.end(), best.begin(), best.end());
+    }
+
+    uLongf compressed_size = compressBound(static_cast<uLong>(rows.size()));
+    std::string compressed(compressed_size, '\0');
+    if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_size, rows.data(), static_cast<uLong>(rows.size()), Z_BEST_COMPRESSION) != Z_OK) {
+        return false;
+    }
+    compressed.resize(compressed_size);
+
+    std::string header;
+    append_be32(header, static_cast<uint32_t>(image.width));
+    append_be32(header, static_cast<uint32_t>(image.height));
+    header += std::string("\x08\x02\x00\x00\x00", 5); // 8 bits per channel, RGB, deflate, no interlacing
+
+    std::ofstream stream(path, std::ios::binary);
+    stream.write(reinterpret_cast<const char*>(png_signature), 8);
+    auto write_chunk = [&](const std::string& type, const std::string& data) {
+        std::string chunk;
+        append_be32(chunk, static_cast<uint32_t>(data.size()));
+        chunk += type + data;
+        append_be32(chunk, static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>(chunk.data() + 4), static_cast<uInt>(chunk.size() - 4))));
+        stream << chunk;
+    };
+    write_chunk("IHDR", header);
+    write_chunk("IDAT", compressed);
+    write_chunk("IEND", "");
+    return !stream.fail();
+}
+
+ImageComparison compare_images(const Image& rendered, const Image& reference, int tolerance)
+{
+    ImageComparison comparison;
+    double squared_error = 0.0;
+    for (size_t pixel = 0; pixel < rendered.pixels.size(); pixel += 3) {
+        int pixel_error = 0;
+        for (size_t channel = pixel; channel < pixel + 3; channel++) {
+            int error = std::abs(rendered.pixels[channel] - reference.pixels[channel]);
+            pixel_error = std::max(pixel_error, error);
+            squared_error += static_cast<double>(error) * error;
+        }
+        comparison.max_error = std::max(comparison.max_error, pixel_error);
+        if (pixel_error > tolerance) {
+            comparison.failing_pixels++;
+        }
+    }
+    double mse = squared_error / rendered.pixels.size();
+    if (mse > 0.0) {
+        comparison.psnr = 10.0 * std::log10(255.0 * 255.0 / mse);
+    }
+    return comparison;
+}
+
+bool read_baseline_time(const std::filesystem::path& path, double& seconds)
+{
+    std::ifstream stream(path);
+    return static_cast<bool>(stream >> seconds);
+}
+
+bool write_text(const std::filesystem::path& path, const std::string& text)
+{
+    std::ofstream stream(path);
+    stream << text;
+    return !stream.fail();
+}
+
+/*
+    Writes a 'P3' texture of STAND_IN_TEXTURE_SIZE texels square: a gradient under a checkerboard, tinted by
+    'tint' so different textures of a scene can be told apart
+*/
+bool write_stand_in_texture(const std::filesystem::path& path, int tint)
+{
+    std::ofstream stream(path);
+    stream << "P3\n" << STAND_IN_TEXTURE_SIZE << " " << STAND_IN_TEXTURE_SIZE << "\n255\n";
+    for (int y = 0; y < STAND_IN_TEXTURE_SIZE; y++) {
+        for (int x = 0; x < STAND_IN_TEXTURE_SIZE; x++) {
+            bool square = (x / 8 + y / 8) % 2 == 0;
+            stream << (x * 4 + tint) % 256 << " " << y * 4 << " " << (square ? 220 : 40) << "\n";
+        }
+    }
+    return !stream.fail();
+}
+
+/**
+ * @brief Copies the scene into the work directory with each 'texture' line pointing to a stand-in texture
+ * generated there, one per texture path
+ * @returns False if a file could not be written
+ * @param scene Scene to copy
+ * @param scene_copy Path of the copy
+ * @param work_dir Directory for the stand-in textures
+**/
+bool copy_scene_with_stand_in_textures(const std::filesystem::path& scene, const std::filesystem::path& scene_copy,
+    const std::filesystem::path& work_dir)
+{
+    std::ifstream input(scene);
+    std::ostringstream text;
+    std::vector<std::string> textures;
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream words(line);
+        std::string keyword, texture;
+        if (words >> keyword >> texture && keyword == "texture") {
+            size_t index = std::find(textures.begin(), textures.end(), texture) - textures.begin();
+            std::filesystem::path stand_in = work_dir / (scene.stem().string() + "_texture_" + std::to_string(index) + ".ppm");
+            if (index == textures.size()) {
+                textures.push_back(texture);
+                if (!write_stand_in_texture(stand_in, static_cast<int>(index) * 97)) {
+                    return false;
+                }
+            }
+            line = "texture " + stand_in.string();
+        }
+        text << line << "\n";
+    }
+    return write_text(scene_copy, text.str());
+}
+
+int run(RegressionSettings& settings)
+{
+    std::string name = settings.scene.stem().string();
+
+    /*
+        Render a copy of the scene, with stand-in textures, from inside its own directory, so the output
+        lands in the work directory instead of next to the reference
+    */
+    std::filesystem::create_directories(settings.work_dir);
+    std::filesystem::path scene_copy = std::filesystem::absolute(settings.work_dir / (name + ".txt"));
+    std::filesystem::path output = std::filesystem::absolute(settings.work_dir / (name + ".ppm"));
+    if (!copy_scene_with_stand_in_textures(settings.scene, scene_copy, settings.work_dir)) {
+        std::cout << "FAIL: could not copy '" << settings.scene.string() << "' to '" << settings.work_dir.string() << "'" << std::endl;
+        return 1;
+    }
+    std::filesystem::remove(output);
+
+    std::filesystem::path renderer = std::filesystem::absolute(settings.renderer);
+    std::filesystem::current_path(settings.scene.parent_path());
+    std::string command = "\"" + renderer.string() + "\" \"" + scene_copy.string() + "\"";
+    auto start = std::chrono::steady_clock::now();
+    int status = std::system(command.c_str());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Image rendered;
+    if (status != 0 || !read_ppm(output, rendered)) {
+        std::cout << "FAIL: '" << settings.scene.string() << "' did not render (exit status " << status << ")" << std::endl;
+        return 1;
+    }
+
+    bool passed = true;
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2) << name << ": " << rendered.width << "x" << rendered.height;
+
+    /*
+        Recording replaces the reference image and time, nothing is compared
+    */
+    std::filesystem::path reference_path = settings.reference_dir / (name + ".png");
+    std::filesystem::path time_path = settings.reference_dir / (name + ".seconds");
+    if (settings.update_baseline) {
+        std::filesystem::create_directories(settings.reference_dir);
+        if (!write_png(reference_path, rendered) || !write_text(time_path, std::to_string(seconds) + "\n")) {
+            std::cout << "FAIL: could not record reference '" << reference_path.string() << "'" << std::endl;
+            return 1;
+        }
+        std::cout << "PASS: " << report.str() << ", " << seconds << " s, recorded as reference in '" << settings.reference_dir.string() << "'" << std::endl;
+        return 0;
+    }
+
+    /*
+        Image check
+    */
+    Image reference;
+    if (!std::filesystem::exists(reference_path)) {
+        std::cout << "FAIL: no reference image '" << reference_path.string() << "'. Record it with --update-baseline." << std::endl;
+        return 1;
+    } else if (!read_png(reference_path, reference)) {
+        std::cout << "FAIL: could not read reference '" << reference_path.string() << "'" << std::endl;
+        return 1;
+    } else if (reference.width != rendered.width || reference.height != rendered.height) {
+        std::cout << "FAIL: rendered " << rendered.width << "x" << rendered.height << " but reference '"
+            << reference_path.string() << "' is " << reference.width << "x" << reference.height << std::endl;
+        return 1;
+    }
+    ImageComparison comparison = compare_images(rendered, reference, settings.tolerance);
+    double failing_fraction = static_cast<double>(comparison.failing_pixels) / (rendered.width * rendered.height);
+    report << ", PSNR " << comparison.psnr << " dB, max error " << comparison.max_error << ", "
+        << comparison.failing_pixels << " pixels over tolerance " << settings.tolerance;
+    if (comparison.psnr < settings.min_psnr || failing_fraction > settings.max_failing_fraction) {
+        report << " (limits: PSNR " << settings.min_psnr << " dB, " << settings.max_failing_fraction * 100.0 << "% of pixels)";
+        passed = false;
+    }
+
+    /*
+        Time check
+    */
+    double baseline_seconds = 0.0;
+    if (!read_baseline_time(time_path, baseline_seconds)) {
+        std::cout << "FAIL: no reference time '" << time_path.string() << "'. Record it with --update-baseline." << std::endl;
+        return 1;
+    }
+    double limit = std::max(baseline_seconds * settings.time_threshold, baseline_seconds + settings.time_margin);
+    report << ", " << seconds << " s (baseline " << baseline_seconds << " s, limit " << limit << " s)";
+    if (seconds > limit) {
+        passed = false;
+    }
+    write_text(settings.work_dir / (name + ".seconds"), std::to_string(seconds) + "\n");
+
+    std::cout << (passed ? "PASS: " : "FAIL: ") << report.str() << std::endl;
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    RegressionSettings settings;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string option{ argv[i] };
+            bool has_value = i + 1 < argc;
+            if (option == "--renderer" && has_value) {
+                settings.renderer = argv[++i];
+            } else if (option == "--scene" && has_value) {
+                settings.scene = std::filesystem::absolute(argv[++i]);
+            } else if (option == "--work-dir" && has_value) {
+                settings.work_dir = std::filesystem::absolute(argv[++i]);
+            } else if (option == "--reference-dir" && has_value) {
+                settings.reference_dir = std::filesystem::absolute(argv[++i]);
+            } else if (option == "--tolerance" && has_value) {
+                settings.tolerance = std::stoi(argv[++i]);
+            } else if (option == "--max-failing-fraction" && has_value) {
+                settings.max_failing_fraction = std::stod(argv[++i]);
+            } else if (option == "--min-psnr" && has_value) {
+                settings.min_psnr = std::stod(argv[++i]);
+            } else if (option == "--time-threshold" && has_value) {
+                settings.time_threshold = std::stod(argv[++i]);
+            } else if (option == "--time-margin" && has_value) {
+                settings.time_margin = std::stod(argv[++i]);
+            } else if (option == "--update-baseline") {
+                settings.update_baseline = true;
+            } else {
+                std::cout << "ERROR: unknown option '" << option << "'" << std::endl;
+                return 1;
+            }
+        }
+        if (settings.renderer.empty() || settings.scene.empty() || settings.work_dir.empty() || settings.reference_dir.empty()) {
+            std::cout << "ERROR: --renderer, --scene, --work-dir and --reference-dir are required" << std::endl;
+            return 1;
+        }
+        return run(settings);
+    } catch (std::exception& e) {
+        std::cout << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+}
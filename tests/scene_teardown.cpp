@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../src/definitions.h"
+#include "../src/scene.h"
+#include "../src/parser.h"
+#include "../src/render.h"
+#include "../bench/scene_generator.h"
+
+/*
+    Parses, builds and clears a scene with spheres, a mesh instance and a texture over and over, including
+    a line that fails to parse after its objects were created, and checks that clearing hands every object
+    back to the scene arena and that the parser's objects lie next to each other in parse order.
+    Configure with -DRAYTRACER_SANITIZE=address to have AddressSanitizer report anything left behind.
+
+    Usage:
+    SimpleRayTracerSceneTeardownTest
+*/
+
+const int rounds = 20;
+
+/*
+    Feeds a scene to the parser, the same way main() does. Returns false if a line was rejected.
+*/
+bool parse_scene(SceneParser& parser, std::string text)
+{
+    std::istringstream scene(text);
+    std::string line;
+    try
+    {
+        while (std::getline(scene, line)) {
+            parser.parse_line(line);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    bool passed = true;
+
+    std::string texture_path = "scene_teardown_texture.ppm";
+    {
+        std::ofstream texture(texture_path);
+        texture << "P3\n2 2\n255\n255 0 0 0 255 0 0 0 255 255 255 255\n";
+    }
+    std::string scene = generate_scene({ .spheres = 500, .triangles = 800, .instanced = true });
+    scene += "texture " + texture_path + "\nsphere 0 0 -8 0.5\n";
+
+    std::cerr.setstate(std::ios::failbit); // Silence the parser's error messages
+    for (int round = 0; round < rounds; round++) {
+        SceneParser parser;
+        if (!parse_scene(parser, scene)) {
+            std::cout << "FAIL: round " << round << ": the scene did not parse" << std::endl;
+            passed = false;
+            break;
+        }
+        parser.state.settings.accel = ACCEL_BVH;
+        build_scene(parser.state);
+        TraceRay(parser.state, { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f });
+
+        if (round == 0) {
+            /*
+                Spheres are created with their object info in between, so successive spheres should be
+                the same distance apart except where the arena starts a new block
+            */
+            std::map<ptrdiff_t, int> distances;
+            Sphere* previous = nullptr;
+            for (auto& [id, sphere] : parser.state.spheres) {
+                if (previous != nullptr) {
+                    distances[reinterpret_cast<char*>(sphere) - reinterpret_cast<char*>(previous)]++;
+                }
+                previous = sphere;
+            }
+            auto mode = std::max_element(distances.begin(), distances.end(), [](auto& a, auto& b) { return a.second < b.second; });
+            float fraction = static_cast<float>(mode->second) / (parser.state.spheres.size() - 1);
+            bool contiguous = mode->first > 0 && fraction >= 0.95f;
+            std::cout << (contiguous ? "PASS: " : "FAIL: ") << fraction * 100.0f << "% of spheres are " << mode->first
+                << " bytes after the previous one" << std::endl;
+            passed &= contiguous;
+        }
+        parser.state.clear();
+
+        // A sphere whose radius does not parse is rejected after the sphere was created
+        SceneParser rejecting;
+        if (parse_scene(rejecting, "mtlcolor 1 1 1 1 1 1 0.1 0.7 0.2 20\nsphere 0 0 -5 1\nsphere 0 0 -5 r\n")) {
+            std::cout << "FAIL: round " << round << ": a malformed sphere was accepted" << std::endl;
+            passed = false;
+        }
+        rejecting.state.clear();
+
+        for (SceneParser* cleared : { &parser, &rejecting }) {
+            if (cleared->state.arena.objects() != 0 || cleared->state.arena.bytes() != 0) {
+                std::cout << "FAIL: round " << round << ": " << cleared->state.arena.objects() << " objects ("
+                    << cleared->state.arena.bytes() << " bytes) remain after clear()" << std::endl;
+                passed = false;
+            }
+        }
+    }
+    std::cerr.clear();
+    std::remove(texture_path.c_str());
+
+    if (passed) {
+        std::cout << "PASS: " << rounds << " scenes parsed, built and cleared" << std::endl;
+    }
+    return passed ? 0 : 1;
+}
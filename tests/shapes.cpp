@@ -0,0 +1,151 @@
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "test_helpers.h"
+#include "../bench/scene_generator.h"
+
+/*
+    Checks the analytic 'plane', 'disk', 'box' and 'cylinder' primitives: distances, normals and texture
+    coordinates of known hits of each kind, that boxes and a floor plane give the same closest hits as the
+    same boxes written as faces, and that degenerate arguments are rejected by the parser.
+
+    Usage:
+    SimpleRayTracerShapesTest
+*/
+
+bool near(float a, float b, float tolerance = 1e-4f)
+{
+    return std::fabs(a - b) <= tolerance;
+}
+
+bool near(Vector3 a, Vector3 b, float tolerance = 1e-4f)
+{
+    return near(a.x, b.x, tolerance) && near(a.y, b.y, tolerance) && near(a.z, b.z, tolerance);
+}
+
+/*
+    Closest hit of each ray in the scene given as text
+*/
+std::vector<std::pair<bool, Intersection>> closest_hits(std::string text, Vector3 origin, std::vector<Vector3>& rays)
+{
+    RenderSettings settings;
+    Scene scene;
+    scene.parse_text(text);
+    scene.build(settings);
+    std::vector<std::pair<bool, Intersection>> hits;
+    for (Vector3& ray : rays) {
+        std::pair<bool, Intersection> closest = { false, {} };
+        for (auto& object_intersections : TraceRay(scene.state, origin, ray)) {
+            for (Intersection& intersection : object_intersections.intersections) {
+                if (intersection.distance > 0.0f && (!closest.first || intersection.distance < closest.second.distance)) {
+                    closest = { true, intersection };
+                }
+            }
+        }
+        hits.push_back(closest);
+    }
+    return hits;
+}
+
+/*
+    True if the line fails to parse with the given command's argument error
+*/
+bool rejected(std::string line, std::string command)
+{
+    SceneParser parser;
+    parser.parse_line("mtlcolor 1 0 0 1 1 1 0.1 0.7 0.2 20");
+    try
+    {
+        parser.parse_line(line);
+    }
+    catch(const std::exception& e)
+    {
+        return std::string(e.what()).find("'" + command + "'") != std::string::npos;
+    }
+    return false;
+}
+
+int main()
+{
+    bool passed = true;
+
+    /*
+        Known hits of each kind
+    */
+    Shape plane = make_plane({ 0.0f, -1.0f, 0.0f }, { 0.0f, 2.0f, 0.0f }, 4.0f);
+    std::vector<Intersection> hits = intersect_shape(&plane, { 0.5f, 3.0f, -2.0f }, { 0.0f, -2.0f, 0.0f });
+    passed &= check(hits.size() == 1 && near(hits[0].distance, 2.0f) && near(hits[0].normal, { 0.0f, 1.0f, 0.0f }), "a plane is hit once, in multiples of the ray");
+    passed &= check(hits.size() == 1 && hits[0].texture_coords.x >= 0.0f && hits[0].texture_coords.x < 1.0f
+        && hits[0].texture_coords.y >= 0.0f && hits[0].texture_coords.y < 1.0f, "a plane's texture repeats");
+    passed &= check(intersect_shape(&plane, { 0.0f, 3.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }).empty(), "a ray parallel to a plane misses it");
+
+    Shape disk = make_disk({ 0.0f, 0.0f, -5.0f }, { 0.0f, 0.0f, 1.0f }, 1.0f);
+    hits = intersect_shape(&disk, { 0.5f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f });
+    passed &= check(hits.size() == 1 && near(hits[0].distance, 5.0f) && near(hits[0].normal, { 0.0f, 0.0f, 1.0f }), "a disk is hit inside its radius");
+    passed &= check(intersect_shape(&disk, { 1.5f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f }).empty(), "a disk is missed outside its radius");
+
+    Shape box = make_box({ -1.0f, -1.0f, -6.0f }, { 1.0f, 1.0f, -4.0f });
+    hits = intersect_shape(&box, { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f });
+    passed &= check(hits.size() == 2 && near(hits[0].distance, 4.0f) && near(hits[0].normal, { 0.0f, 0.0f, 1.0f })
+        && near(hits[1].distance, 6.0f) && near(hits[1].normal, { 0.0f, 0.0f, -1.0f }), "a box is entered and left through opposite faces");
+    passed &= check(hits.size() == 2 && near(hits[0].texture_coords.x, 0.5f) && near(hits[0].texture_coords.y, 0.5f), "a face's center is its texture's center");
+    passed &= check(intersect_shape(&box, { 1.5f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f }).empty(), "a box is missed beside it");
+
+    // Turned 30 degrees about y, its front face is 1 from the center along (sin 30, 0, cos 30)
+    Shape turned = make_box({ -1.0f, -1.0f, -6.0f }, { 1.0f, 1.0f, -4.0f }, { 0.0f, 1.0f, 0.0f }, 30.0f);
+    hits = intersect_shape(&turned, { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f });
+    float cos30 = std::cos(static_cast<float>(M_PI) / 6.0f);
+    passed &= check(hits.size() == 2 && near(hits[0].distance, 5.0f - 1.0f / cos30) && near(hits[0].normal, { 0.5f, 0.0f, cos30 })
+        && near(hits[1].distance, 5.0f + 1.0f / cos30), "a rotated box is hit on its rotated faces");
+
+    Shape cylinder = make_cylinder({ 0.0f, -1.0f, -5.0f }, { 0.0f, 1.0f, -5.0f }, 1.0f);
+    hits = intersect_shape(&cylinder, { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f });
+    passed &= check(hits.size() == 2 && near(hits[0].distance, 4.0f) && near(hits[0].normal, { 0.0f, 0.0f, 1.0f })
+        && near(hits[1].distance, 6.0f) && near(hits[1].normal, { 0.0f, 0.0f, -1.0f }), "a cylinder's side is hit across its axis");
+    hits = intersect_shape(&cylinder, { 0.5f, 5.0f, -5.0f }, { 0.0f, -1.0f, 0.0f });
+    passed &= check(hits.size() == 2 && near(hits[0].distance, 4.0f) && near(hits[0].normal, { 0.0f, 1.0f, 0.0f })
+        && near(hits[1].distance, 6.0f) && near(hits[1].normal, { 0.0f, -1.0f, 0.0f }), "a cylinder's caps are hit along its axis");
+    passed &= check(intersect_shape(&cylinder, { 0.0f, 1.5f, 0.0f }, { 0.0f, 0.0f, -1.0f }).empty(), "a cylinder is missed above its top cap");
+
+    /*
+        Boxes and a floor plane against the same boxes and a floor as faces. Camera rays that would
+        reach the floor beyond the faces' edge are left out.
+    */
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> spread(-1.0f, 1.0f);
+    std::vector<Vector3> rays;
+    while (rays.size() < 4000) {
+        Vector3 ray = Vector3({ spread(random) * 0.6f, spread(random) * 0.45f, -1.0f }).norm();
+        if (ray.y > 0.0f || ray.y < -0.15f) {
+            rays.push_back(ray);
+        }
+    }
+    SceneGeneratorOptions options = { .shapes = 400 };
+    std::vector<std::pair<bool, Intersection>> analytic = closest_hits(generate_scene(options), { 0.0f, 0.0f, 0.0f }, rays);
+    options.shapes_as_faces = true;
+    std::vector<std::pair<bool, Intersection>> faces = closest_hits(generate_scene(options), { 0.0f, 0.0f, 0.0f }, rays);
+    size_t mismatches = 0, found = 0;
+    for (size_t i = 0; i < rays.size(); i++) {
+        found += analytic[i].first;
+        if (analytic[i].first != faces[i].first || (analytic[i].first && !(near(analytic[i].second.distance, faces[i].second.distance, 1e-3f)
+            && analytic[i].second.normal.dot(faces[i].second.normal.norm()) > 0.999f))) {
+            mismatches++;
+        }
+    }
+    std::cout << found << " of " << rays.size() << " rays hit, " << mismatches << " differ" << std::endl;
+    passed &= check(found > rays.size() / 2, "most rays hit a shape or the floor");
+    passed &= check(mismatches <= rays.size() / 500, "boxes and a plane hit like their faces");
+
+    /*
+        Arguments that describe no shape
+    */
+    passed &= check(rejected("plane 0 0 0 0 0 0", "plane"), "a plane needs a normal");
+    passed &= check(rejected("plane 0 0 0 0 1", "plane"), "a plane needs six numbers");
+    passed &= check(rejected("disk 0 0 0 0 1 0 -1", "disk"), "a disk needs a positive radius");
+    passed &= check(rejected("box 0 0 0 1 0 1", "box"), "a box needs a volume");
+    passed &= check(rejected("box 0 0 0 1 1 1 0 0 0 45", "box"), "a rotated box needs an axis");
+    passed &= check(rejected("cylinder 0 0 0 0 0 0 1", "cylinder"), "a cylinder needs distinct caps");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include "raytracer.h"
+
+/*
+    Helpers shared by the test programs that use the renderer API (simple_raytracer_core)
+*/
+
+/*
+    Prints the check's description after PASS or FAIL and returns the condition
+*/
+inline bool check(bool condition, std::string description)
+{
+    std::cout << (condition ? "PASS: " : "FAIL: ") << description << std::endl;
+    return condition;
+}
+
+/**
+ * @brief Renders the scene from its parsed camera, building it first if needed
+ * @returns The linear radiance of the rendered pixels, row-major RGB
+ * @param scene Scene to render
+ * @param settings Render options
+ * @param region Rectangle to render as in render_region, or null for the whole image
+**/
+inline std::vector<float> render_radiance(Scene& scene, RenderSettings& settings, int* region = nullptr)
+{
+    Camera camera = scene.camera();
+    Framebuffer image(0, 0);
+    if (region == nullptr) {
+        render(scene, camera, settings, image);
+    } else {
+        render_region(scene, camera, settings, region, image);
+    }
+    return image.rgb;
+}
@@ -0,0 +1,129 @@
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "test_helpers.h"
+
+/*
+    Checks '--texture-compression bc1': the BC1 encoder's error on smooth, flat, two colour and noisy
+    blocks, and, for a texture sampled through the cache, that compressed tiles take a sixth of the
+    bytes of their texels, that every fetched texel is within the reported largest error and that
+    the reported squared error is that of the fetched texels.
+
+    Usage:
+    SimpleRayTracerTextureCompressionTest
+*/
+
+/*
+    Largest difference of a channel between a block's texels and its encoding
+*/
+int block_max_error(const byte texels[16][3])
+{
+    BC1Block block = encode_bc1_block(texels);
+    int max_error = 0;
+    byte decoded[3];
+    for (int t = 0; t < 16; t++) {
+        decode_bc1_texel(block, t, decoded);
+        for (int k = 0; k < 3; k++) {
+            max_error = std::max(max_error, std::abs(decoded[k] - texels[t][k]));
+        }
+    }
+    return max_error;
+}
+
+int main()
+{
+    bool passed = true;
+
+    /*
+        Blocks: a flat colour only loses RGB565's precision, colours along a line lose little more,
+        two colours are both endpoints, and noise stays bounded
+    */
+    byte texels[16][3];
+    for (int t = 0; t < 16; t++) {
+        texels[t][0] = 200;
+        texels[t][1] = 117;
+        texels[t][2] = 33;
+    }
+    passed &= check(block_max_error(texels) <= 4, "a flat block is within RGB565 precision");
+    for (int t = 0; t < 16; t++) {
+        texels[t][0] = static_cast<byte>(40 + 8 * t);
+        texels[t][1] = static_cast<byte>(200 - 6 * t);
+        texels[t][2] = static_cast<byte>(90 + 2 * t);
+    }
+    passed &= check(block_max_error(texels) <= 16, "a gradient block is within 16 per channel");
+    for (int t = 0; t < 16; t++) {
+        bool first = (t % 4 + t / 4) % 2 == 0;
+        texels[t][0] = first ? 250 : 10;
+        texels[t][1] = first ? 20 : 180;
+        texels[t][2] = first ? 60 : 240;
+    }
+    passed &= check(block_max_error(texels) <= 4, "a two colour block keeps both colours");
+    for (int t = 0; t < 16; t++) {
+        texels[t][0] = static_cast<byte>((t * 97) % 256);
+        texels[t][1] = static_cast<byte>((t * 53 + 11) % 256);
+        texels[t][2] = static_cast<byte>((t * 29 + 101) % 256);
+    }
+    passed &= check(block_max_error(texels) < 192, "a noisy block is approximated");
+
+    /*
+        A texture whose size is not a multiple of the tile or the block size: smooth shading with hard edged squares
+    */
+    const size_t width = 200, height = 136;
+    std::string path = (std::filesystem::temp_directory_path() / "texture_compression_test.ppm").string();
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << "P6\n" << width << " " << height << "\n255\n";
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                bool square = (x / 10 + y / 10) % 3 == 0;
+                file.put(static_cast<char>(square ? 230 : x));
+                file.put(static_cast<char>(square ? 30 : y + 60));
+                file.put(static_cast<char>((x + y) % 256));
+            }
+        }
+    }
+
+    TextureCache cache;
+    SceneArena arena;
+    Texture* texture = read_texture(path, arena, cache);
+    std::vector<byte> source(width * height * 3);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            texture->fetch(x, y, &source[(y * width + x) * 3]);
+        }
+    }
+    size_t uncompressed_resident = cache.stats().bytes_resident;
+    cache.release(texture);
+
+    cache.set_compression(TEXTURE_COMPRESSION_BC1);
+    double squared_error = 0.0;
+    int max_error = 0;
+    byte texel[3];
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            texture->fetch(x, y, texel);
+            for (int k = 0; k < 3; k++) {
+                int difference = std::abs(texel[k] - source[(y * width + x) * 3 + k]);
+                squared_error += difference * difference;
+                max_error = std::max(max_error, difference);
+            }
+        }
+    }
+    TextureCacheStats stats = cache.stats();
+    std::filesystem::remove(path);
+
+    size_t tiles = texture->tiles_x * texture->tiles_y;
+    double rmse = std::sqrt(squared_error / (width * height * 3));
+    std::cout << "Compressed " << stats.compressed_tiles << " tiles: " << stats.compressed_bytes << " bytes instead of " << stats.uncompressed_bytes
+        << ", resident " << stats.bytes_resident << " instead of " << uncompressed_resident << ", RMSE " << rmse << ", max error " << max_error << std::endl;
+    passed &= check(stats.compressed_tiles == tiles, "every tile is compressed");
+    passed &= check(stats.uncompressed_bytes == width * height * 3, "the texels of every tile are counted");
+    passed &= check(stats.compressed_bytes == ((width + 3) / 4) * ((height + 3) / 4) * sizeof(BC1Block), "one 8 byte block per 4x4 texels");
+    passed &= check(stats.bytes_resident * 5 < uncompressed_resident, "compressed tiles take less than a fifth of the cache's bytes");
+    passed &= check(max_error == stats.max_error, "the reported largest error is that of the fetched texels");
+    passed &= check(std::fabs(squared_error - stats.squared_error) < 0.5, "the reported squared error is that of the fetched texels");
+    passed &= check(rmse < 6.0, "the texture's RMSE is below 6");
+    return passed ? 0 : 1;
+}
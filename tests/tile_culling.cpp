@@ -0,0 +1,105 @@
+#include <string>
+#include <vector>
+#include "test_helpers.h"
+#include "../bench/scene_generator.h"
+
+/*
+    Renders scenes with '--tile-culling' off and on, ray traced and rasterized, and checks that culling
+    gives exactly the same radiance while skipping the tiles that show only the background: generated
+    scenes of spheres, faces and shapes over an infinite plane, a rectangle of the image, a floor that
+    passes behind the camera, a camera looking away from everything and a camera above an infinite plane
+    looking up.
+
+    Usage:
+    SimpleRayTracerTileCullingTest
+*/
+
+const std::string floor_scene =
+    "eye 0 1 0\n"
+    "viewdir 0 -0.3 -1\n"
+    "updir 0 1 0\n"
+    "hfov 70\n"
+    "imsize 96 64\n"
+    "bkgcolor 0.1 0.1 0.1\n"
+    "light 2 5 -3 1 1 1 1\n"
+    "mtlcolor 0.8 0.8 0.8 1 1 1 0.1 0.8 0.1 10\n"
+    "v -20 0 20\n"
+    "v 20 0 20\n"
+    "v 20 0 -20\n"
+    "v -20 0 -20\n"
+    "f 1 2 3\n"
+    "f 1 3 4\n"
+    "mtlcolor 0.2 0.5 0.9 1 1 1 0.1 0.8 0.1 10\n"
+    "sphere 0 0.5 -4 0.5\n";
+
+const std::string behind_camera_scene =
+    "eye 0 0 0\n"
+    "viewdir 0 0 -1\n"
+    "updir 0 1 0\n"
+    "hfov 60\n"
+    "imsize 64 48\n"
+    "bkgcolor 0.3 0.4 0.5\n"
+    "light 0 4 6 1 1 1 1\n"
+    "mtlcolor 0.8 0.2 0.2 1 1 1 0.1 0.7 0.2 20\n"
+    "sphere 0 0 6 1\n"
+    "box -1 -1 3 1 1 4\n";
+
+const std::string sky_scene =
+    "eye 0 0 0\n"
+    "viewdir 0 0.6 -1\n"
+    "updir 0 1 0\n"
+    "hfov 60\n"
+    "imsize 64 48\n"
+    "bkgcolor 0.3 0.4 0.5\n"
+    "light 0 4 -6 1 1 1 1\n"
+    "mtlcolor 0.8 0.8 0.8 1 1 1 0.1 0.7 0.2 20\n"
+    "plane 0 -1 0 0 1 0\n";
+
+/**
+ * @brief Renders a scene, or a rectangle of it, without culling and with it in both '--primary' modes
+ * @returns True if the radiance is identical and at least 'min_skipped' tiles were skipped in each culled render
+ * @param text Scene file text
+ * @param name Reported name
+ * @param min_skipped Tiles that show only the background
+ * @param region Rectangle to render, or null for the whole image
+**/
+bool check_scene(std::string text, std::string name, uint64_t min_skipped, int* region = nullptr)
+{
+    RenderSettings settings;
+    settings.threads = 2;
+    settings.tile_culling = TILE_CULLING_OFF;
+    Scene scene;
+    scene.parse_text(text);
+    std::vector<float> expected = render_radiance(scene, settings, region);
+    bool passed = true;
+    settings.tile_culling = TILE_CULLING_ON;
+    for (PrimaryVisibilityMode mode : { PRIMARY_RAYTRACE, PRIMARY_RASTER }) {
+        settings.primary_visibility = mode;
+        uint64_t skipped = tile_culling_stats.empty;
+        bool identical = render_radiance(scene, settings, region) == expected;
+        skipped = tile_culling_stats.empty - skipped;
+        std::string mode_name = name + (mode == PRIMARY_RASTER ? " (raster)" : "");
+        passed &= check(identical, mode_name + ": culled tiles give " + (identical ? "the same" : "a different") + " image");
+        passed &= check(skipped >= min_skipped, mode_name + ": " + std::to_string(skipped) + " tiles skipped, expected at least " + std::to_string(min_skipped));
+    }
+    return passed;
+}
+
+int main()
+{
+    bool passed = true;
+
+    std::string sparse_spheres = generate_scene({ .spheres = 40, .width = 160, .height = 120 });
+    passed &= check_scene(sparse_spheres, "sparse spheres", 10);
+    int region[4] = { 13, 7, 141, 100 };
+    passed &= check_scene(sparse_spheres, "rectangle of sparse spheres", 5, region);
+
+    passed &= check_scene(generate_scene({ .spheres = 100, .triangles = 500, .shapes = 60, .width = 160, .height = 120 }),
+        "spheres, faces and shapes over an infinite plane", 0);
+    passed &= check_scene(floor_scene, "floor behind the camera", 0);
+
+    // Every tile of these shows only the background
+    passed &= check_scene(behind_camera_scene, "objects behind the camera", 4 * 3);
+    passed &= check_scene(sky_scene, "looking up from above an infinite plane", 4 * 3);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../bench/scene_generator.h"
+
+/*
+    Renders a generated scene once in a single process, then again split over concurrently running
+    processes, once with '--tile-index k/N' and once with '--region' rectangles that do not line up with
+    tiles, and checks that '--merge' assembles the partial images into exactly the same PPM and PFM files.
+
+    Usage:
+    SimpleRayTracerTileMergeTest --renderer path --work-dir dir [--processes N]
+*/
+
+/*
+    Contents of a file, or an empty string if it cannot be read
+*/
+std::string read_file(const std::filesystem::path& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    std::ostringstream contents;
+    contents << stream.rdbuf();
+    return contents.str();
+}
+
+/*
+    Runs every command in its own process at the same time. Returns false if any of them failed.
+*/
+bool run_concurrently(std::vector<std::string>& commands)
+{
+    std::vector<int> statuses(commands.size(), 0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < commands.size(); i++) {
+        threads.emplace_back([&, i]() { statuses[i] = std::system(commands[i].c_str()); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (int status : statuses) {
+        if (status != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Merges the partial images of one split render and compares them against the single process render
+ * @returns True if the merged files are identical
+ * @param renderer SimpleRayTracer binary
+ * @param work_dir Directory holding the renders
+ * @param name Scene name the partial images were rendered from
+ * @param commands Renderer invocations for the parts, run concurrently
+**/
+bool check_split(std::filesystem::path renderer, std::filesystem::path work_dir, std::string name, std::vector<std::string> commands)
+{
+    if (!run_concurrently(commands)) {
+        std::cout << "FAIL: " << name << ": a part did not render" << std::endl;
+        return false;
+    }
+    std::string merge = "\"" + renderer.string() + "\" --merge \"" + (work_dir / (name + ".ppm")).string() + "\" --hdr";
+    int parts = 0;
+    for (auto& entry : std::filesystem::directory_iterator(work_dir)) {
+        std::string file = entry.path().filename().string();
+        if (file.rfind(name + ".", 0) == 0 && entry.path().extension() == ".part") {
+            merge += " \"" + entry.path().string() + "\"";
+            parts++;
+        }
+    }
+    std::system(merge.c_str());
+
+    bool identical = read_file(work_dir / (name + ".ppm")) == read_file(work_dir / "single.ppm")
+        && read_file(work_dir / (name + ".pfm")) == read_file(work_dir / "single.pfm");
+    std::cout << (identical ? "PASS: " : "FAIL: ") << name << ": " << parts << " partial images from " << commands.size()
+        << " processes merge into " << (identical ? "the same" : "a different") << " image as one process" << std::endl;
+    return identical;
+}
+
+int main(int argc, char* argv[])
+{
+    std::filesystem::path renderer;
+    std::filesystem::path work_dir;
+    int processes = 4;
+    for (int i = 1; i < argc; i++) {
+        std::string option{argv[i]};
+        if (option == "--renderer" && i + 1 < argc) {
+            renderer = std::filesystem::absolute(argv[++i]);
+        } else if (option == "--work-dir" && i + 1 < argc) {
+            work_dir = std::filesystem::absolute(argv[++i]);
+        } else if (option == "--processes" && i + 1 < argc) {
+            processes = std::stoi(argv[++i]);
+        } else {
+            std::cout << "ERROR: Invalid option '" << option << "'. Please verify." << std::endl;
+            return 1;
+        }
+    }
+    if (renderer.empty() || work_dir.empty()) {
+        std::cout << "ERROR: Requires --renderer and --work-dir. Please verify." << std::endl;
+        return 1;
+    }
+
+    std::filesystem::remove_all(work_dir);
+    std::filesystem::create_directories(work_dir);
+    std::string scene = generate_scene({ .spheres = 60, .triangles = 400, .glass_layers = 2, .width = 101, .height = 75 });
+    for (std::string name : { "single", "tiles", "regions" }) {
+        std::ofstream(work_dir / (name + ".txt")) << scene;
+    }
+    std::string command = "\"" + renderer.string() + "\" \"";
+
+    if (std::system((command + (work_dir / "single.txt").string() + "\" --hdr --threads 1").c_str()) != 0) {
+        std::cout << "FAIL: the single process render failed" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> tile_commands;
+    for (int k = 0; k < processes; k++) {
+        tile_commands.push_back(command + (work_dir / "tiles.txt").string() + "\" --threads 1 --tile-index "
+            + std::to_string(k) + "/" + std::to_string(processes));
+    }
+
+    // Columns split at 37 and rows at 30, neither on a tile boundary
+    std::vector<std::string> region_commands;
+    for (std::string region : { "0 0 37 30", "37 0 101 30", "0 30 101 75" }) {
+        region_commands.push_back(command + (work_dir / "regions.txt").string() + "\" --threads 1 --region " + region);
+    }
+
+    bool passed = check_split(renderer, work_dir, "tiles", tile_commands);
+    passed &= check_split(renderer, work_dir, "regions", region_commands);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include <cmath>
+#include <iostream>
+#include <random>
+#include "../src/definitions.h"
+#include "../src/mesh.h"
+
+/*
+    Checks that intersect_face leaves no cracks between faces that share edges: rays aimed at the shared
+    vertices and edges of a triangle fan, and at random points of it, must all hit at least one face.
+
+    Usage:
+    SimpleRayTracerTriangleTest
+*/
+
+int main()
+{
+    /*
+        A fan of 12 triangles around the origin in the z = 0 plane, at an angle to the camera so that
+        the edges are not axis aligned
+    */
+    const int segments = 12;
+    Mesh mesh;
+    Vector3 center = { 0.0f, 0.0f, 0.0f };
+    std::vector<Vector3> rim;
+    for (int k = 0; k < segments; k++) {
+        float angle = 2.0f * static_cast<float>(M_PI) * k / segments + 0.1f;
+        rim.push_back({ std::cos(angle), 0.8f * std::sin(angle), 0.3f * std::cos(angle) });
+    }
+    uint32_t hub = mesh.add_vertex({ 0, 0, 0 }, center, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f });
+    for (int k = 0; k < segments; k++) {
+        uint32_t a = mesh.add_vertex({ k + 1, 0, 0 }, rim[k], { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f });
+        uint32_t b = mesh.add_vertex({ (k + 1) % segments + 1, 0, 0 }, rim[(k + 1) % segments], { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f });
+        mesh.add_triangle(hub, a, b, false);
+    }
+    mesh.finalize();
+
+    auto hits_any = [&](Vector3 origin, Vector3 target) {
+        WatertightRay ray(origin, (target - origin).norm());
+        Intersection info;
+        for (uint32_t t = 0; t < mesh.triangles.size(); t++) {
+            if (intersect_face(&mesh, t, ray, info)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> spread(-3.0f, 3.0f);
+    int rays = 0;
+    int misses = 0;
+    for (int n = 0; n < 2000; n++) {
+        Vector3 origin = { spread(random), spread(random), 5.0f };
+        int k = n % segments;
+        Vector3 edge_point = rim[k] * unit(random); // On the edge shared by faces k - 1 and k
+        Vector3 inner_point = (rim[k] * (0.5f * unit(random))) + (rim[(k + 1) % segments] * (0.5f * unit(random)));
+        for (Vector3 target : { center, edge_point, inner_point }) {
+            rays++;
+            if (!hits_any(origin, target)) {
+                misses++;
+            }
+        }
+    }
+
+    std::cout << (misses == 0 ? "PASS: " : "FAIL: ") << misses << " of " << rays << " rays through shared edges and faces missed" << std::endl;
+    return misses == 0 ? 0 : 1;
+}